@@ -1719,6 +1719,17 @@ function test_mon_osd_pool()
       expect_false ceph osd pool set ec_test allow_ec_overwrites false
   fi
   set -e
+  # compressing before striping excludes overwrites
+  expect_false ceph osd pool set replicated ec_compression_algorithm zstd
+  ceph osd pool create ec_compress 1 1 erasure
+  ceph osd pool application enable ec_compress rados
+  expect_false ceph osd pool set ec_compress ec_compression_algorithm foo
+  ceph osd pool set ec_compress ec_compression_algorithm zstd
+  ceph osd pool get ec_compress ec_compression_algorithm | grep 'zstd'
+  expect_false ceph osd pool set ec_compress ec_compression_algorithm unset
+  expect_false ceph osd pool set ec_compress allow_ec_overwrites true
+  ceph osd pool set ec_compress ec_compression_algorithm none
+  ceph osd pool delete ec_compress ec_compress --yes-i-really-really-mean-it
   ceph osd pool delete replicated replicated --yes-i-really-really-mean-it
   ceph osd pool delete ec_test ec_test --yes-i-really-really-mean-it
 
@@ -2058,6 +2069,33 @@ function test_mon_osd_pool_set()
   ceph osd pool set $TEST_POOL_GETSET compression_algorithm unset
   ceph osd pool get $TEST_POOL_GETSET compression_algorithm | expect_false grep '.'
 
+  ceph osd pool get $TEST_POOL_GETSET compression_level | expect_false grep '.'
+  expect_false ceph osd pool set $TEST_POOL_GETSET compression_level fast
+  ceph osd pool set $TEST_POOL_GETSET compression_algorithm zlib
+  expect_false ceph osd pool set $TEST_POOL_GETSET compression_level 10
+  expect_false ceph osd pool set $TEST_POOL_GETSET compression_level -1
+  ceph osd pool set $TEST_POOL_GETSET compression_level 3
+  ceph osd pool get $TEST_POOL_GETSET compression_level | grep '3'
+  ceph osd pool set $TEST_POOL_GETSET compression_level 0
+  ceph osd pool get $TEST_POOL_GETSET compression_level | expect_false grep '.'
+  ceph osd pool set $TEST_POOL_GETSET compression_algorithm snappy
+  expect_false ceph osd pool set $TEST_POOL_GETSET compression_level 3
+  ceph osd pool set $TEST_POOL_GETSET compression_algorithm unset
+
+  ceph osd pool get $TEST_POOL_GETSET recompression_algorithm | expect_false grep '.'
+  expect_false ceph osd pool set $TEST_POOL_GETSET recompression_algorithm foo
+  ceph osd pool set $TEST_POOL_GETSET recompression_algorithm zstd
+  ceph osd pool get $TEST_POOL_GETSET recompression_algorithm | grep 'zstd'
+  expect_false ceph osd pool set $TEST_POOL_GETSET recompression_level 23
+  ceph osd pool set $TEST_POOL_GETSET recompression_level 19
+  ceph osd pool get $TEST_POOL_GETSET recompression_level | grep '19'
+  expect_false ceph osd pool set $TEST_POOL_GETSET recompression_algorithm zlib
+  ceph osd pool get $TEST_POOL_GETSET recompression_algorithm | grep 'zstd'
+  ceph osd pool set $TEST_POOL_GETSET recompression_level 0
+  ceph osd pool get $TEST_POOL_GETSET recompression_level | expect_false grep '.'
+  ceph osd pool set $TEST_POOL_GETSET recompression_algorithm unset
+  ceph osd pool get $TEST_POOL_GETSET recompression_algorithm | expect_false grep '.'
+
   ceph osd pool get $TEST_POOL_GETSET compression_required_ratio | expect_false grep '.'
   expect_false ceph osd pool set $TEST_POOL_GETSET compression_required_ratio 1.1
   expect_false ceph osd pool set $TEST_POOL_GETSET compression_required_ratio -.2
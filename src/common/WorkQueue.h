@@ -370,6 +370,17 @@ public:
       std::lock_guard<Mutex> l(m_pool->_lock);
       return _empty();
     }
+    /// take item off the queue, unless a worker took it already
+    bool dequeue(T *item) {
+      std::lock_guard<Mutex> l(m_pool->_lock);
+      for (auto i = m_items.begin(); i != m_items.end(); ++i) {
+        if (*i == item) {
+          m_items.erase(i);
+          return true;
+        }
+      }
+      return false;
+    }
   protected:
     PointerWQ(string n, time_t ti, time_t sti, ThreadPool* p)
       : WorkQueue_(std::move(n), ti, sti), m_pool(p), m_processing(0) {
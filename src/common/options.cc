@@ -804,6 +804,12 @@ std::vector<Option> get_global_options() {
     .set_default(5)
     .set_description(""),
 
+    Option("compressor_zstdmt_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4)
+    .set_min_max(1, 128)
+    .set_description("Number of worker threads shared by all zstdmt compression and decompression calls")
+    .set_long_description("The zstdmt compressor keeps a pool of this many threads for the lifetime of the process and queues the work of each call to it, instead of starting one thread per core for every compressed blob."),
+
     Option("qat_compressor_enabled", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
     .set_description("enable qat acceleration support for compression"),
@@ -904,6 +910,25 @@ std::vector<Option> get_global_options() {
     .set_default(true)
     .set_description(""),
 
+    Option("ms_compress_mode", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("none")
+    .set_enum_allowed({"none", "osd", "all"})
+    .add_see_also({"ms_compress_algorithm", "ms_compress_min_size"})
+    .set_description("Which connections compress the data payload of the messages they send")
+    .set_long_description("'osd' compresses on connections between two OSDs, i.e. replication and recovery traffic, 'all' on any connection. The peer has to support it, and the choice is made when a session is opened. Only the async messenger compresses."),
+
+    Option("ms_compress_algorithm", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("snappy")
+    .set_enum_allowed({"snappy", "zlib", "zstd", "lz4"})
+    .add_see_also("ms_compress_mode")
+    .set_description("Compressor used for message data payloads")
+    .set_long_description("Receivers have to be able to load the same compressor plugin."),
+
+    Option("ms_compress_min_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(1024)
+    .add_see_also("ms_compress_mode")
+    .set_description("Do not compress message data payloads smaller than this"),
+
     Option("ms_die_on_bad_msg", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
     .set_description(""),
@@ -1993,6 +2018,32 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description(""),
 
+    Option("objecter_compression_algorithm", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("snappy")
+    .set_enum_allowed({"snappy", "zlib", "zstd", "lz4"})
+    .add_see_also("objecter_compression_segment_size")
+    .set_description("Compressor used for the data of writes the client asks to compress")
+    .set_long_description("Writes are only compressed when they carry LIBRADOS_OP_FLAG_COMPRESS. The OSDs have to be able to load the same compressor plugin."),
+
+    Option("objecter_compression_segment_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also({"objecter_compression_algorithm", "bluestore_compression_max_blob_size"})
+    .set_description("Compress the data of writes in pieces of this size, cut at its multiples within the object")
+    .set_long_description("BlueStore keeps the pieces compressed as they come only if they are aligned to its allocation unit and no larger than the blobs it would compress, so this should not be larger than bluestore_compression_max_blob_size."),
+
+    Option("objecter_compression_min_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(16_K)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("objecter_compression_algorithm")
+    .set_description("Do not compress writes smaller than this"),
+
+    Option("objecter_compression_required_ratio", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.875)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("objecter_compression_algorithm")
+    .set_description("Compressed size relative to the original size a piece of a write must reach to be sent compressed"),
+
     Option("filer_max_purge_ops", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(10)
     .set_description("Max in-flight operations for purging a striped range (e.g., MDS journal)"),
@@ -2105,6 +2156,20 @@ std::vector<Option> get_global_options() {
     .set_default(90)
     .set_description(""),
 
+    Option("osd_replicated_precompress", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Compress writes to replicated pools once, on the primary")
+    .set_long_description("The primary compresses the data of a write the way its objectstore would and sends it to the replicas compressed; replica BlueStores keep blobs that match their own allocation unit as they are instead of compressing them again. Takes effect once require_osd_release is nautilus.")
+    .add_see_also({"bluestore_compression_mode", "osd_compressed_write_algorithms"}),
+
+    Option("osd_compressed_write_algorithms", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("snappy zlib zstd")
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Compression algorithms every OSD of the cluster can decompress")
+    .set_long_description("Writes compressed with one of these, by a client or by osd_replicated_precompress, are sent to the replicas compressed, and so are pushes with osd_recovery_push_compressed; data compressed with any other algorithm is sent raw. List only algorithms whose plugins are installed on all OSDs.")
+    .add_see_also({"osd_replicated_precompress", "osd_recovery_push_compressed"}),
+
     Option("osd_max_pgls", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(1024)
     .set_description(""),
@@ -2150,6 +2215,21 @@ std::vector<Option> get_global_options() {
     .set_description("the amount of data (in bytes) in a data chunk, per stripe")
     .add_service("mon"),
 
+    Option("osd_ec_compression_extent_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_min_max(4_K, 4_M)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Logical bytes compressed together in erasure coded pools which compress before striping")
+    .set_long_description("Writes to the objects of erasure coded pools with an ec_compression_algorithm are cut into extents of this size, each compressed on its own. Reads decompress whole extents, so larger extents compress better and make small reads more expensive.")
+    .add_see_also("osd_ec_compression_required_ratio"),
+
+    Option("osd_ec_compression_required_ratio", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.875)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Compressed size relative to the original size an extent must reach to be stored compressed in erasure coded pools which compress before striping")
+    .set_long_description("The compression_required_ratio of the pool takes precedence.")
+    .add_see_also("osd_ec_compression_extent_size"),
+
     Option("osd_pool_default_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(3)
     .set_flag(Option::FLAG_RUNTIME)
@@ -3020,6 +3100,13 @@ std::vector<Option> get_global_options() {
     .set_default(8_M)
     .set_description(""),
 
+    Option("osd_recovery_push_compressed", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Push data the objectstore keeps compressed as it is stored during recovery and backfill of replicated pools")
+    .set_long_description("Compressed blobs are read from the source objectstore and written by the target without decompressing and compressing them again; BlueStore targets keep blobs that match their own allocation unit as they are. Takes effect once require_osd_release is nautilus.")
+    .add_see_also({"osd_replicated_precompress", "bluestore_compression_mode"}),
+
     Option("osd_recovery_max_omap_entries_per_chunk", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(8096)
     .set_description(""),
@@ -4010,10 +4097,10 @@ std::vector<Option> get_global_options() {
 
     Option("bluestore_compression_mode", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("none")
-    .set_enum_allowed({"none", "passive", "aggressive", "force"})
+    .set_enum_allowed({"none", "passive", "aggressive", "force", "adaptive"})
     .set_flag(Option::FLAG_RUNTIME)
     .set_description("Default policy for using compression when pool does not specify")
-    .set_long_description("'none' means never use compression.  'passive' means use compression when clients hint that data is compressible.  'aggressive' means use compression unless clients hint that data is not compressible.  This option is used when the per-pool property for the compression mode is not present."),
+    .set_long_description("'none' means never use compression.  'passive' means use compression when clients hint that data is compressible.  'aggressive' means use compression unless clients hint that data is not compressible.  'adaptive' is like 'aggressive', but stops trying to compress objects and collections whose data recently did not compress well.  This option is used when the per-pool property for the compression mode is not present."),
 
     Option("bluestore_compression_algorithm", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("snappy")
@@ -4079,12 +4166,92 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_RUNTIME)
     .set_description(""),
 
+    Option("bluestore_compression_level", Option::TYPE_INT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_min_max(0, 65537)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_compression_algorithm")
+    .set_description("Default compression level to use (if any)")
+    .set_long_description("The level is specific to the algorithm: the level of zlib and zstd, the quality of brotli and the acceleration of lz4 (higher is faster). 0 uses the default of the algorithm. The per-pool property compression_level overrides this value."),
+
     Option("bluestore_compression_required_ratio", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(.875)
     .set_flag(Option::FLAG_RUNTIME)
     .set_description("Compression ratio required to store compressed data")
     .set_long_description("If we compress data and get less than this we discard the result and store the original uncompressed data."),
 
+    Option("bluestore_compression_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_compression_mode")
+    .set_description("Number of threads compressing the blobs of a write, and decompressing those of a read, in parallel")
+    .set_long_description("A write which is split into several blobs has them compressed by these threads together with the submitting thread before space is allocated. A read of several compressed blobs has each of them decompressed by these threads as soon as it is read from disk. 0 compresses and decompresses all blobs on the submitting thread."),
+
+    Option("bluestore_compression_chunk_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_compression_max_blob_size")
+    .set_description("Compress blobs in independent chunks of this size")
+    .set_long_description("A compressed blob larger than this is split into chunks which are compressed on their own, so that a small read only fetches and decompresses the chunks it covers. Smaller chunks compress less. 0 compresses each blob as a whole. OSDs which wrote chunked blobs cannot be downgraded to a version without this option."),
+
+    Option("bluestore_compression_adaptive_max_rejects", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_compression_mode")
+    .set_description("Rejected blobs in a row after which adaptive compression skips an object")
+    .set_long_description("In 'adaptive' compression mode an object whose last writes were this many blobs in a row failing bluestore_compression_required_ratio is written uncompressed, except for every 16th blob which is compressed to see whether the data changed. 0 never skips an object."),
+
+    Option("bluestore_compression_adaptive_sample_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(4_K)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_compression_mode")
+    .set_description("Bytes of a blob sampled to estimate its compressibility")
+    .set_long_description("In 'adaptive' compression mode the blobs written to a collection where most recent blobs did not compress are sampled first, and are written uncompressed when the byte entropy of the sample suggests they will miss bluestore_compression_required_ratio. 0 disables the estimate."),
+
+    Option("bluestore_recompression_algorithm", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_enum_allowed({"", "snappy", "zlib", "zstd", "lz4", "brotli"})
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_recompression_level")
+    .set_description("Algorithm cold compressed data is rewritten with in the background")
+    .set_long_description("A background thread periodically walks the objects whose metadata is not in the cache and rewrites their compressed blobs which were compressed with another algorithm using this one. Empty disables it unless the per-pool property recompression_algorithm is set, which overrides this value."),
+
+    Option("bluestore_recompression_level", Option::TYPE_INT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_min_max(0, 65537)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_recompression_algorithm")
+    .set_description("Compression level cold data is rewritten with")
+    .set_long_description("0 uses the default of the algorithm. The per-pool property recompression_level overrides this value."),
+
+    Option("bluestore_recompression_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(3600)
+    .set_min(1)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_recompression_algorithm")
+    .set_description("Seconds between two background recompression passes"),
+
+    Option("bluestore_recompression_bytes_per_sec", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(8_M)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_recompression_algorithm")
+    .set_description("Bytes per second background recompression may read")
+    .set_long_description("The recompression thread sleeps after each object long enough to keep the data it read and rewrote under this rate. 0 does not throttle it."),
+
+    Option("bluestore_compression_readahead_blobs", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also({"bluestore_compression_readahead_trigger", "bluestore_compression_max_blob_size"})
+    .set_description("Compressed blobs to read ahead of a sequential reader")
+    .set_long_description("When an object whose data is compressed is read sequentially, up to this many blobs of the maximum compressed blob size past the read are read and decompressed into the buffer cache in the background, so that the following reads need not wait for them. 0 disables readahead."),
+
+    Option("bluestore_compression_readahead_trigger", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4)
+    .set_min(1)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_compression_readahead_blobs")
+    .set_description("Sequential reads of an object before it is read ahead"),
+
     Option("bluestore_extent_map_shard_max_size", Option::TYPE_SIZE, Option::LEVEL_DEV)
     .set_default(1200)
     .set_description("Max size (bytes) for a single extent map shard before splitting"),
@@ -4118,6 +4285,13 @@ std::vector<Option> get_global_options() {
     .set_enum_allowed({"2q", "lru"})
     .set_description("Cache replacement algorithm"),
 
+    Option("bluestore_cache_compressed", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_RUNTIME)
+    .add_see_also("bluestore_default_buffered_read")
+    .set_description("Cache compressed blobs in their compressed form")
+    .set_long_description("Buffered reads of a compressed blob keep what was read from disk in the buffer cache instead of the decompressed data, and a later read is decompressed from it. This stretches the cache by the compression ratio at the cost of decompressing on every cache hit."),
+
     Option("bluestore_2q_cache_kin_ratio", Option::TYPE_FLOAT, Option::LEVEL_DEV)
     .set_default(.5)
     .set_description("2Q paper suggests .5"),
@@ -5029,6 +5203,28 @@ std::vector<Option> get_rgw_options() {
     .set_long_description("The window size may be dynamically adjusted, but will not surpass this value.")
     .add_see_also({"rgw_put_obj_min_window_size", "rgw_max_chunk_size"}),
 
+    Option("rgw_compression_threads", Option::TYPE_INT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_min(0)
+    .set_description("Number of threads compressing uploaded data")
+    .set_long_description(
+        "If non-zero, the chunks of an upload to a bucket with compression "
+        "enabled are compressed by a pool of this many threads, so that a "
+        "single upload is not limited to the compression speed of one core, "
+        "and compression overlaps with the RADOS writes of earlier chunks. "
+        "If zero, each chunk is compressed by the thread handling the request "
+        "before it is written."),
+
+    Option("rgw_compression_max_inflight", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4)
+    .set_min(1)
+    .set_description("Number of chunks of an upload being compressed at once")
+    .set_long_description(
+        "When compression threads are used, at most this many chunks of "
+        "an upload are queued or being compressed, which bounds the memory "
+        "an upload holds.")
+    .add_see_also({"rgw_compression_threads", "rgw_max_chunk_size"}),
+
     Option("rgw_max_put_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
     .set_default(5_G)
     .set_description("Max size (in bytes) of regular (non multi-part) object upload.")
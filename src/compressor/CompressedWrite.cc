@@ -0,0 +1,203 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "CompressedWrite.h"
+#include "Compressor.h"
+#include "common/Formatter.h"
+
+void compressed_write_t::segment_t::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  encode(length, bl);
+  encode(alg, bl);
+  encode(compressed_length, bl);
+  ENCODE_FINISH(bl);
+}
+
+void compressed_write_t::segment_t::decode(bufferlist::const_iterator& p)
+{
+  DECODE_START(1, p);
+  decode(length, p);
+  decode(alg, p);
+  decode(compressed_length, p);
+  DECODE_FINISH(p);
+}
+
+void compressed_write_t::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  encode(segments, bl);
+  encode(data, bl);
+  ENCODE_FINISH(bl);
+}
+
+void compressed_write_t::decode(bufferlist::const_iterator& p)
+{
+  DECODE_START(1, p);
+  decode(segments, p);
+  decode(data, p);
+  DECODE_FINISH(p);
+}
+
+void compressed_write_t::dump(Formatter *f) const
+{
+  f->open_array_section("segments");
+  for (auto& s : segments) {
+    f->open_object_section("segment");
+    f->dump_unsigned("length", s.length);
+    f->dump_string("alg", Compressor::get_comp_alg_name(s.alg));
+    f->dump_unsigned("compressed_length", s.compressed_length);
+    f->close_section();
+  }
+  f->close_section();
+  f->dump_unsigned("data_length", data.length());
+}
+
+bool compressed_write_t::is_valid() const
+{
+  uint64_t len = 0;
+  for (auto& s : segments) {
+    if (s.alg >= Compressor::COMP_ALG_LAST) {
+      return false;
+    }
+    if (s.alg == Compressor::COMP_ALG_NONE &&
+	s.compressed_length != s.length) {
+      return false;
+    }
+    len += s.compressed_length;
+  }
+  return len == data.length();
+}
+
+bool compressed_write_t::uses_only(const std::set<int>& algs) const
+{
+  for (auto& s : segments) {
+    if (s.alg != Compressor::COMP_ALG_NONE && !algs.count(s.alg)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int compressed_write_t::decompress(CephContext *cct, bufferlist *out) const
+{
+  if (!is_valid()) {
+    return -EINVAL;
+  }
+  CompressorRef c;
+  auto p = data.cbegin();
+  for (auto& s : segments) {
+    if (s.alg == Compressor::COMP_ALG_NONE) {
+      p.copy(s.length, *out);
+      continue;
+    }
+    if (!c || c->get_type() != s.alg) {
+      c = Compressor::create(cct, s.alg);
+      if (!c) {
+	return -EOPNOTSUPP;
+      }
+    }
+    // no more than the segment claims, however the data decompresses
+    bufferptr raw = buffer::create(s.length);
+    int r = c->decompress_into(p, s.compressed_length, raw.c_str(), s.length);
+    if (r < 0) {
+      return r == -ENOSPC ? -EIO : r;
+    }
+    if ((uint32_t)r != s.length) {
+      return -EIO;
+    }
+    out->push_back(std::move(raw));
+  }
+  return 0;
+}
+
+int compressed_write_t::decode_payload(
+  CephContext *cct,
+  const bufferlist& payload,
+  uint64_t length,
+  uint64_t max_length,
+  bufferlist *out)
+{
+  try {
+    auto p = payload.cbegin();
+    decode(p);
+  } catch (buffer::error& e) {
+    return -EINVAL;
+  }
+  // bound what we decompress by what the write says it is
+  if (!is_valid() || get_length() != length) {
+    return -EINVAL;
+  }
+  if (max_length && length > max_length) {
+    return -E2BIG;
+  }
+  // every algorithm, before any of the data is decompressed
+  std::set<int> loaded;
+  for (auto& s : segments) {
+    if (s.alg == Compressor::COMP_ALG_NONE || loaded.count(s.alg)) {
+      continue;
+    }
+    if (!Compressor::create(cct, s.alg)) {
+      return -EOPNOTSUPP;
+    }
+    loaded.insert(s.alg);
+  }
+  int r = decompress(cct, out);
+  if (r < 0) {
+    out->clear();
+    return -EINVAL;
+  }
+  return 0;
+}
+
+unsigned compressed_write_t::compress(
+  Compressor *c,
+  uint64_t offset,
+  const bufferlist& bl,
+  uint64_t segment_size,
+  double required_ratio)
+{
+  ceph_assert(segment_size > 0);
+  std::vector<bufferlist> pieces;
+  for (uint64_t pos = 0; pos < bl.length(); ) {
+    uint64_t end = std::min<uint64_t>(
+      (offset + pos) / segment_size * segment_size + segment_size - offset,
+      bl.length());
+    pieces.emplace_back();
+    pieces.back().substr_of(bl, pos, end - pos);
+    pos = end;
+  }
+  std::vector<const bufferlist*> in;
+  for (auto& piece : pieces) {
+    in.push_back(&piece);
+  }
+  std::vector<bufferlist> out;
+  int r = c->compress_batch(in, out);
+
+  unsigned compressed = 0;
+  for (unsigned i = 0; i < pieces.size(); ++i) {
+    segment_t s;
+    s.length = pieces[i].length();
+    if (r == 0 && out[i].length() <= pieces[i].length() * required_ratio) {
+      s.alg = c->get_type();
+      s.compressed_length = out[i].length();
+      data.claim_append(out[i]);
+      ++compressed;
+    } else {
+      s.alg = Compressor::COMP_ALG_NONE;
+      s.compressed_length = s.length;
+      data.append(pieces[i]);
+    }
+    segments.push_back(s);
+  }
+  return compressed;
+}
@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMPRESSOR_COMPRESSEDWRITE_H
+#define CEPH_COMPRESSOR_COMPRESSEDWRITE_H
+
+#include <set>
+#include <vector>
+#include "include/buffer.h"
+#include "include/encoding.h"
+
+class CephContext;
+class Compressor;
+namespace ceph {
+  class Formatter;
+}
+
+/**
+ * The data of a write, compressed ahead of time: by
+ * ObjectStore::compress_write() for Transaction::write_compressed(), or
+ * by clients which compress the data of their writes.
+ *
+ * The write is cut into segments, each of which is either compressed on
+ * its own or carried as is.  A store that can keep a segment the way it
+ * comes does so; anything else is decompressed and written normally.
+ */
+struct compressed_write_t {
+  struct segment_t {
+    uint32_t length = 0;             ///< bytes of the write it covers
+    uint8_t alg = 0;                 ///< Compressor::CompressionAlgorithm
+    uint32_t compressed_length = 0;  ///< bytes of data it takes
+
+    void encode(ceph::bufferlist& bl) const;
+    void decode(ceph::bufferlist::const_iterator& p);
+  };
+  std::vector<segment_t> segments;
+  ceph::bufferlist data;             ///< the segments, back to back
+
+  uint64_t get_length() const {
+    uint64_t len = 0;
+    for (auto& s : segments) {
+      len += s.length;
+    }
+    return len;
+  }
+  /// do the segments add up to the data, and are the algorithms known?
+  bool is_valid() const;
+  /// is every segment raw or compressed with one of algs?
+  bool uses_only(const std::set<int>& algs) const;
+  /// the raw data of the whole write
+  int decompress(CephContext *cct, ceph::bufferlist *out) const;
+  /**
+   * Decode a write a client sent compressed, as an encoded
+   * compressed_write_t, and decompress it into *out.  It has to be of
+   * length bytes, no more than max_length unless that is 0.
+   *
+   * @return 0, -EINVAL if payload is not such a write, -E2BIG if it is
+   * too long, -EOPNOTSUPP if one of its algorithms can't be loaded
+   */
+  int decode_payload(CephContext *cct, const ceph::bufferlist& payload,
+		     uint64_t length, uint64_t max_length,
+		     ceph::bufferlist *out);
+  /**
+   * Cut bl, to be written at offset, at the multiples of segment_size and
+   * compress the pieces with c, keeping those which do not shrink to
+   * required_ratio of their length as they are.
+   *
+   * @return the number of compressed segments
+   */
+  unsigned compress(Compressor *c, uint64_t offset,
+		    const ceph::bufferlist& bl, uint64_t segment_size,
+		    double required_ratio);
+
+  void encode(ceph::bufferlist& bl) const;
+  void decode(ceph::bufferlist::const_iterator& p);
+  void dump(ceph::Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(compressed_write_t::segment_t)
+WRITE_CLASS_ENCODER(compressed_write_t)
+
+#endif
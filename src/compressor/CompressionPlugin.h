@@ -19,7 +19,10 @@
 #define COMPRESSION_PLUGIN_H
 
 #include <iosfwd>
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <mutex>
 
 #include "common/PluginRegistry.h"
 #include "Compressor.h"
@@ -28,7 +31,9 @@ namespace ceph {
 
   class CompressionPlugin :  public Plugin {
   public:
-    CompressorRef compressor;
+    CompressorRef compressor;                 ///< for the default level
+    std::map<int, CompressorRef> leveled;     ///< for explicit levels
+    std::mutex lock;                          ///< held around factory()
 
     explicit CompressionPlugin(CephContext *cct) : Plugin(cct),
                                           compressor(0) 
@@ -37,9 +42,21 @@ namespace ceph {
     ~CompressionPlugin() override {}
 
     virtual int factory(CompressorRef *cs,
-			                  std::ostream *ss) = 0;
+			std::ostream *ss,
+			boost::optional<int> level) = 0;
 
     virtual const char* name() {return "CompressionPlugin";}
+
+  protected:
+    /// bring an explicit level within what alg supports
+    static boost::optional<int> clamp_level(int alg,
+					    boost::optional<int> level) {
+      int min, max;
+      if (level && Compressor::get_level_range(alg, &min, &max)) {
+	level = std::min(std::max(*level, min), max);
+      }
+      return level;
+    }
   };
 
 }
@@ -12,6 +12,7 @@
  *
  */
 
+#include <cmath>
 #include <random>
 #include <sstream>
 #include <iterator>
@@ -20,6 +21,7 @@
 #include "CompressionPlugin.h"
 #include "Compressor.h"
 #include "include/random.h"
+#include "include/stringify.h"
 #include "common/ceph_context.h"
 #include "common/debug.h"
 #include "common/dout.h"
@@ -45,12 +47,38 @@ boost::optional<Compressor::CompressionAlgorithm> Compressor::get_comp_alg_type(
   return p->second;
 }
 
+bool Compressor::get_level_range(int alg, int *min, int *max)
+{
+  switch (alg) {
+  case COMP_ALG_ZLIB:
+    *min = 1;
+    *max = 9;
+    return true;
+  case COMP_ALG_ZSTD:
+  case COMP_ALG_ZSTDMT:
+    *min = 1;
+    *max = 22;          // ZSTD_maxCLevel()
+    return true;
+  case COMP_ALG_LZ4:
+    *min = 1;
+    *max = 65537;       // LZ4_ACCELERATION_MAX
+    return true;
+  case COMP_ALG_BROTLI:
+    *min = 0;
+    *max = 11;
+    return true;
+  default:
+    return false;
+  }
+}
+
 const char *Compressor::get_comp_mode_name(int m) {
   switch (m) {
     case COMP_NONE: return "none";
     case COMP_PASSIVE: return "passive";
     case COMP_AGGRESSIVE: return "aggressive";
     case COMP_FORCE: return "force";
+    case COMP_ADAPTIVE: return "adaptive";
     default: return "???";
   }
 }
@@ -63,10 +91,51 @@ boost::optional<Compressor::CompressionMode> Compressor::get_comp_mode_type(cons
     return COMP_PASSIVE;
   if (s == "none")
     return COMP_NONE;
+  if (s == "adaptive")
+    return COMP_ADAPTIVE;
   return boost::optional<CompressionMode>();
 }
 
-CompressorRef Compressor::create(CephContext *cct, const std::string &type)
+double Compressor::estimate_ratio(const bufferlist &bl, size_t sample_len)
+{
+  // order-0 entropy of a few slices spread over bl: random, encrypted or
+  // already compressed data is close to 8 bits per byte
+  static constexpr unsigned slices = 4;
+  size_t len = bl.length();
+  if (len == 0 || sample_len == 0)
+    return 1.0;
+  sample_len = std::min(sample_len, len);
+  size_t slice_len = std::max<size_t>(sample_len / slices, 1);
+  unsigned count[256] = {};
+  size_t total = 0;
+  for (unsigned s = 0; s < slices && total < sample_len; ++s) {
+    size_t off = (len - slice_len) * s / (slices - 1);
+    auto p = bl.begin();
+    p.advance(off);
+    size_t left = slice_len;
+    while (left) {
+      const char *data;
+      size_t l = p.get_ptr_and_advance(left, &data);
+      if (l == 0)
+	break;
+      for (size_t i = 0; i < l; ++i)
+	++count[(unsigned char)data[i]];
+      left -= l;
+      total += l;
+    }
+  }
+  double bits = 0;
+  for (auto c : count) {
+    if (c) {
+      double f = (double)c / total;
+      bits -= f * std::log2(f);
+    }
+  }
+  return bits / 8;
+}
+
+CompressorRef Compressor::create(CephContext *cct, const std::string &type,
+				 boost::optional<int> level)
 {
   // support "random" for teuthology testing
   if (type == "random") {
@@ -74,7 +143,7 @@ CompressorRef Compressor::create(CephContext *cct, const std::string &type)
     if (alg == COMP_ALG_NONE) {
       return nullptr;
     }
-    return create(cct, alg);
+    return create(cct, alg, level);
   }
 
   CompressorRef cs_impl = NULL;
@@ -85,18 +154,82 @@ CompressorRef Compressor::create(CephContext *cct, const std::string &type)
     lderr(cct) << __func__ << " cannot load compressor of type " << type << dendl;
     return NULL;
   }
-  int err = factory->factory(&cs_impl, &ss);
+  int err;
+  {
+    std::lock_guard<std::mutex> l(factory->lock);
+    err = factory->factory(&cs_impl, &ss, level);
+  }
   if (err)
     lderr(cct) << __func__ << " factory return error " << err << dendl;
+  if (cs_impl)
+    cs_impl->init_perf_counters(cct);
   return cs_impl;
 }
 
-CompressorRef Compressor::create(CephContext *cct, int alg)
+CompressorRef Compressor::create(CephContext *cct, int alg,
+				 boost::optional<int> level)
 {
   if (alg < 0 || alg >= COMP_ALG_LAST) {
     lderr(cct) << __func__ << " invalid algorithm value:" << alg << dendl;
     return CompressorRef();
   }
   std::string type_name = get_comp_alg_name(alg);
-  return create(cct, type_name);
+  return create(cct, type_name, level);
+}
+
+int Compressor::compress_batch(const std::vector<const bufferlist*> &in,
+			       std::vector<bufferlist> &out)
+{
+  int ret = 0;
+  out.resize(in.size());
+  for (size_t i = 0; i < in.size(); ++i) {
+    int r = compress(*in[i], out[i]);
+    if (r < 0 && ret == 0)
+      ret = r;
+  }
+  return ret;
+}
+
+int Compressor::decompress_batch(const std::vector<const bufferlist*> &in,
+				 std::vector<bufferlist> &out)
+{
+  int ret = 0;
+  out.resize(in.size());
+  for (size_t i = 0; i < in.size(); ++i) {
+    int r = decompress(*in[i], out[i]);
+    if (r < 0 && ret == 0)
+      ret = r;
+  }
+  return ret;
+}
+
+int Compressor::decompress_into(bufferlist::const_iterator &p,
+				size_t compressed_len,
+				char *dst, size_t dst_len)
+{
+  bufferlist out;
+  int r = decompress(p, compressed_len, out);
+  if (r < 0)
+    return r;
+  if (out.length() > dst_len)
+    return -ENOSPC;
+  out.copy(0, out.length(), dst);
+  return out.length();
+}
+
+void Compressor::init_perf_counters(CephContext *cct)
+{
+  // plugins hand out the same instance to every caller
+  std::call_once(perf_once, [this, cct] {
+    std::string name = std::string("compressor-") + type;
+    if (level)
+      name += "-" + stringify(*level);
+    PerfCountersBuilder b(cct, name, l_compressor_first, l_compressor_last);
+    b.add_u64_counter(l_compressor_ctx_hit, "ctx_hit",
+		      "Calls reusing a cached compression context");
+    b.add_u64_counter(l_compressor_ctx_miss, "ctx_miss",
+		      "Calls creating a new compression context");
+    logger = { b.create_perf_counters(), cct };
+    cct->get_perfcounters_collection()->add(logger.get());
+  });
 }
@@ -16,12 +16,16 @@
 #define CEPH_COMPRESSOR_H
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 #include <boost/optional.hpp>
 #include "include/ceph_assert.h"    // boost clobbers this
 #include "include/buffer.h"
 #include "include/int_types.h"
+#include "common/perf_counters.h"
 #ifdef HAVE_QATZIP
   #include "QatAccel.h"
 #endif
@@ -30,6 +34,43 @@ class Compressor;
 typedef std::shared_ptr<Compressor> CompressorRef;
 class CephContext;
 
+/* A stream compresses data which arrives in pieces as one whole, so that
+ * later pieces refer back to earlier ones instead of each of them being
+ * compressed on its own. feed() appends to out whatever output is ready,
+ * flush() all the output needed to decompress what was fed so far, and
+ * finish() ends the stream; the stream can't be fed after that. The
+ * memory held is bounded by the window of the algorithm, not by the
+ * length of the stream. A stream is used by one thread at a time.
+ */
+class CompressionStream {
+public:
+  virtual ~CompressionStream() {}
+  virtual int feed(const ceph::bufferlist &in, ceph::bufferlist &out) = 0;
+  virtual int flush(ceph::bufferlist &out) = 0;
+  virtual int finish(ceph::bufferlist &out) = 0;
+};
+
+/* Decompresses the output of a CompressionStream of the same algorithm,
+ * which may be fed cut at any byte. finish() fails with -EIO if the
+ * stream fed so far was not complete.
+ */
+class DecompressionStream {
+public:
+  virtual ~DecompressionStream() {}
+  virtual int feed(const ceph::bufferlist &in, ceph::bufferlist &out) = 0;
+  virtual int finish() = 0;
+};
+
+typedef std::unique_ptr<CompressionStream> CompressionStreamRef;
+typedef std::unique_ptr<DecompressionStream> DecompressionStreamRef;
+
+enum {
+  l_compressor_first = 96000,
+  l_compressor_ctx_hit,
+  l_compressor_ctx_miss,
+  l_compressor_last
+};
+
 class Compressor {
 public:
   enum CompressionAlgorithm {
@@ -77,7 +118,8 @@ public:
     COMP_NONE,                  ///< compress never
     COMP_PASSIVE,               ///< compress if hinted COMPRESSIBLE
     COMP_AGGRESSIVE,            ///< compress unless hinted INCOMPRESSIBLE
-    COMP_FORCE                  ///< compress always
+    COMP_FORCE,                 ///< compress always
+    COMP_ADAPTIVE               ///< aggressive, but skip data which does not compress
   };
 
 #ifdef HAVE_QATZIP
@@ -88,10 +130,18 @@ public:
   static const char* get_comp_alg_name(int a);
   static boost::optional<CompressionAlgorithm> get_comp_alg_type(const std::string &s);
 
+  /// the levels alg takes; false if it has none
+  static bool get_level_range(int alg, int *min, int *max);
+
   static const char *get_comp_mode_name(int m);
   static boost::optional<CompressionMode> get_comp_mode_type(const std::string &s);
 
-  Compressor(CompressionAlgorithm a, const char* t) : alg(a), type(t) {
+  /// estimated compressed/raw ratio of bl, from up to sample_len bytes of it
+  static double estimate_ratio(const ceph::bufferlist &bl, size_t sample_len);
+
+  Compressor(CompressionAlgorithm a, const char* t,
+	     boost::optional<int> l = boost::none)
+    : alg(a), type(t), level(l) {
   }
   virtual ~Compressor() {}
   const std::string& get_type_name() const {
@@ -100,19 +150,160 @@ public:
   CompressionAlgorithm get_type() const {
     return alg;
   }
+  /// the level asked for at creation, none means the algorithm's default
+  boost::optional<int> get_level() const {
+    return level;
+  }
   virtual int compress(const ceph::bufferlist &in, ceph::bufferlist &out) = 0;
   virtual int decompress(const ceph::bufferlist &in, ceph::bufferlist &out) = 0;
   // this is a bit weird but we need non-const iterator to be in
   // alignment with decode methods
   virtual int decompress(ceph::bufferlist::const_iterator &p, size_t compressed_len, ceph::bufferlist &out) = 0;
 
-  static CompressorRef create(CephContext *cct, const std::string &type);
-  static CompressorRef create(CephContext *cct, int alg);
+  /* Decompress compressed_len bytes at p straight into dst, which holds
+   * dst_len bytes. The default implementation decompresses into a
+   * bufferlist and copies it; plugins override it to skip that copy.
+   * Return the decompressed length, -ENOSPC if it does not fit in dst,
+   * or another negative error.
+   */
+  virtual int decompress_into(ceph::bufferlist::const_iterator &p,
+			      size_t compressed_len,
+			      char *dst, size_t dst_len);
+
+  /* Compress or decompress a set of independent buffers, out[i] is the
+   * result for *in[i]. The default implementation handles them one after
+   * another; plugins which can do better, e.g. by handing the whole set to
+   * hardware at once, override these.
+   * Return 0 if all of them succeeded, otherwise the first error.
+   */
+  virtual int compress_batch(const std::vector<const ceph::bufferlist*> &in,
+			     std::vector<ceph::bufferlist> &out);
+  virtual int decompress_batch(const std::vector<const ceph::bufferlist*> &in,
+			       std::vector<ceph::bufferlist> &out);
+
+  /* Trained dictionaries make small buffers which resemble the samples
+   * compress much better. train_dictionary() builds one of at most
+   * max_len bytes, with_dictionary() returns a compressor of the same
+   * algorithm and level which compresses with dict, and can decompress
+   * only what was compressed with it. Plugins without dictionaries
+   * return -EOPNOTSUPP and nullptr.
+   */
+  virtual int train_dictionary(const std::vector<ceph::bufferlist> &samples,
+			       size_t max_len, ceph::bufferlist *dict) {
+    return -EOPNOTSUPP;
+  }
+  virtual CompressorRef with_dictionary(const ceph::bufferlist &dict) {
+    return nullptr;
+  }
+
+  /* Start a compression or decompression stream at the level of this
+   * compressor. The stream format is that of the algorithm, and not
+   * necessarily what compress() produces. Plugins without streams
+   * return nullptr.
+   */
+  virtual CompressionStreamRef begin_compress() {
+    return nullptr;
+  }
+  virtual DecompressionStreamRef begin_decompress() {
+    return nullptr;
+  }
+
+  /* The meaning of level depends on the algorithm: the level of zlib and
+   * zstd, the quality of brotli and the acceleration of lz4; snappy and
+   * lzfse have none.
+   */
+  static CompressorRef create(CephContext *cct, const std::string &type,
+			      boost::optional<int> level = boost::none);
+  static CompressorRef create(CephContext *cct, int alg,
+			      boost::optional<int> level = boost::none);
+
+  PerfCounters *get_perf_counters() const {
+    return logger.get();
+  }
+
+  /* Setting up the native (de)compression state often costs as much as
+   * compressing a small blob, so plugins keep it in a thread_local cache
+   * instead of freeing it after each call. A context is cached under a
+   * key naming what it was created for (e.g. the level) and has to be
+   * reset by the plugin before it is used again. Free destroys one for
+   * good. DO NOT share a context with other threads.
+   */
+  template<typename T, void (*Free)(T*)>
+  class ContextCache {
+  public:
+    class Release {
+    public:
+      Release(int key = 0) : key(key) {}
+      void operator()(T *ctx) const {
+	if (!cache.destructed && cache.c.size() < max_elems) {
+	  cache.c.emplace_back(key, ctx);
+	} else {
+	  Free(ctx);
+	}
+      }
+    private:
+      int key;
+    };
+    using Ref = std::unique_ptr<T, Release>;
+
+    /// take an idle context of this thread cached under key, if any
+    static Ref get(int key) {
+      if (cache.destructed)
+	return Ref(nullptr, Release(key));
+      for (auto i = cache.c.rbegin(); i != cache.c.rend(); ++i) {
+	if (i->first == key) {
+	  T *ctx = i->second;
+	  cache.c.erase(std::next(i).base());
+	  return Ref(ctx, Release(key));
+	}
+      }
+      return Ref(nullptr, Release(key));
+    }
+
+  private:
+    static constexpr std::size_t max_elems = 8;
+
+    // see CachedStackStringStream
+    struct Cache {
+      Cache() {}
+      ~Cache() {
+	destructed = true;
+	for (auto& i : c)
+	  Free(i.second);
+      }
+
+      std::vector<std::pair<int, T*>> c;
+      bool destructed = false;
+    };
+
+    inline static thread_local Cache cache;
+  };
 
 protected:
+  /// get a cached context for key or, on a miss, one made by create()
+  template<typename T, void (*Free)(T*), typename Create>
+  typename ContextCache<T, Free>::Ref get_context(int key, Create&& create) {
+    auto ctx = ContextCache<T, Free>::get(key);
+    if (ctx) {
+      if (logger)
+	logger->inc(l_compressor_ctx_hit);
+      return ctx;
+    }
+    if (logger)
+      logger->inc(l_compressor_ctx_miss);
+    return typename ContextCache<T, Free>::Ref(
+      create(), typename ContextCache<T, Free>::Release(key));
+  }
+
   CompressionAlgorithm alg;
   std::string type;
+  boost::optional<int> level;
+
+private:
+  void init_perf_counters(CephContext *cct);
 
+  std::once_flag perf_once;
+  PerfCountersRef logger;
 };
 
 #endif
@@ -14,7 +14,7 @@ int BrotliCompressor::compress(const bufferlist &in, bufferlist &out)
     return -1;
   }
   auto sg = make_scope_guard([&s] { BrotliEncoderDestroyInstance(s); });
-  BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, (uint32_t)9);
+  BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, (uint32_t)quality);
   BrotliEncoderSetParameter(s, BROTLI_PARAM_LGWIN, 22);
   for (auto i = in.buffers().begin(); i != in.buffers().end();) {
     size_t available_in = i->length();
@@ -88,8 +88,175 @@ int BrotliCompressor::decompress(bufferlist::const_iterator &p,
   return 0;
 }
 
+int BrotliCompressor::decompress_into(bufferlist::const_iterator &p,
+                                      size_t compressed_size,
+                                      char *dst, size_t dst_len)
+{
+  BrotliDecoderState* s = BrotliDecoderCreateInstance(nullptr,
+                                                      nullptr,
+                                                      nullptr);
+  if (!s) {
+    return -1;
+  }
+  auto sg = make_scope_guard([&s] { BrotliDecoderDestroyInstance(s); });
+  size_t available_out = dst_len;
+  uint8_t* next_out = (uint8_t*)dst;
+  size_t remaining = std::min<size_t>(p.get_remaining(), compressed_size);
+  while (remaining) {
+    const uint8_t* next_in;
+    size_t len = p.get_ptr_and_advance(remaining, (const char**)&next_in);
+    remaining -= len;
+    size_t available_in = len;
+    BrotliDecoderResult result = BrotliDecoderDecompressStream(s,
+                                                               &available_in,
+                                                               &next_in,
+                                                               &available_out,
+                                                               &next_out,
+                                                               0);
+    if (!result) {
+      return -1;
+    }
+    if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+      return -ENOSPC;
+    }
+    if (BrotliDecoderIsFinished(s)) {
+      break;
+    }
+  }
+  return dst_len - available_out;
+}
+
 int BrotliCompressor::decompress(const bufferlist &in, bufferlist &out) 
 {
   auto i = std::cbegin(in);
   return decompress(i, in.length(), out);
 }
+
+// a stream is what compress() produces, so either decompresses the other
+class BrotliCompressionStream : public CompressionStream {
+ public:
+  BrotliCompressionStream()
+    : s(BrotliEncoderCreateInstance(nullptr, nullptr, nullptr)) {}
+  ~BrotliCompressionStream() override {
+    if (s) {
+      BrotliEncoderDestroyInstance(s);
+    }
+  }
+
+  int init(int quality) {
+    if (!s) {
+      return -1;
+    }
+    BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, (uint32_t)quality);
+    BrotliEncoderSetParameter(s, BROTLI_PARAM_LGWIN, 22);
+    return 0;
+  }
+
+  int feed(const bufferlist &in, bufferlist &out) override {
+    for (auto& p : in.buffers()) {
+      int r = compress_out((const uint8_t*)p.c_str(), p.length(),
+			   BROTLI_OPERATION_PROCESS, out);
+      if (r < 0) {
+	return r;
+      }
+    }
+    return 0;
+  }
+  int flush(bufferlist &out) override {
+    return compress_out(nullptr, 0, BROTLI_OPERATION_FLUSH, out);
+  }
+  int finish(bufferlist &out) override {
+    return compress_out(nullptr, 0, BROTLI_OPERATION_FINISH, out);
+  }
+
+ private:
+  BrotliEncoderState *s;
+
+  int compress_out(const uint8_t *next_in, size_t available_in,
+		   BrotliEncoderOperation op, bufferlist &out) {
+    if (BrotliEncoderIsFinished(s)) {
+      return -EINVAL;
+    }
+    do {
+      size_t available_out = MAX_LEN;
+      bufferptr ptr = buffer::create_page_aligned(MAX_LEN);
+      uint8_t* next_out = (uint8_t*)ptr.c_str();
+      if (!BrotliEncoderCompressStream(s, op, &available_in, &next_in,
+				       &available_out, &next_out, nullptr)) {
+	return -1;
+      }
+      unsigned have = MAX_LEN - available_out;
+      if (have) {
+	out.append(ptr, 0, have);
+      }
+    } while (available_in || BrotliEncoderHasMoreOutput(s) ||
+	     (op == BROTLI_OPERATION_FINISH && !BrotliEncoderIsFinished(s)));
+    return 0;
+  }
+};
+
+class BrotliDecompressionStream : public DecompressionStream {
+ public:
+  BrotliDecompressionStream()
+    : s(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr)) {}
+  ~BrotliDecompressionStream() override {
+    if (s) {
+      BrotliDecoderDestroyInstance(s);
+    }
+  }
+
+  int init() {
+    return s ? 0 : -1;
+  }
+
+  int feed(const bufferlist &in, bufferlist &out) override {
+    for (auto& p : in.buffers()) {
+      const uint8_t* next_in = (const uint8_t*)p.c_str();
+      size_t available_in = p.length();
+      BrotliDecoderResult result;
+      do {
+	if (BrotliDecoderIsFinished(s)) {
+	  return 0;
+	}
+	size_t available_out = MAX_LEN;
+	bufferptr ptr = buffer::create_page_aligned(MAX_LEN);
+	uint8_t* next_out = (uint8_t*)ptr.c_str();
+	result = BrotliDecoderDecompressStream(s, &available_in, &next_in,
+					       &available_out, &next_out, 0);
+	if (!result) {
+	  return -1;
+	}
+	unsigned have = MAX_LEN - available_out;
+	if (have) {
+	  out.append(ptr, 0, have);
+	}
+      } while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+    }
+    return 0;
+  }
+
+  int finish() override {
+    return BrotliDecoderIsFinished(s) ? 0 : -EIO;
+  }
+
+ private:
+  BrotliDecoderState *s;
+};
+
+CompressionStreamRef BrotliCompressor::begin_compress()
+{
+  auto s = std::make_unique<BrotliCompressionStream>();
+  if (s->init(quality) < 0) {
+    return nullptr;
+  }
+  return s;
+}
+
+DecompressionStreamRef BrotliCompressor::begin_decompress()
+{
+  auto s = std::make_unique<BrotliDecompressionStream>();
+  if (s->init() < 0) {
+    return nullptr;
+  }
+  return s;
+}
@@ -20,11 +20,21 @@
 class BrotliCompressor : public Compressor 
 {
   public:
-  BrotliCompressor() : Compressor(COMP_ALG_BROTLI, "brotli") {}
+  // the level is the quality
+  explicit BrotliCompressor(boost::optional<int> level)
+    : Compressor(COMP_ALG_BROTLI, "brotli", level),
+      quality(level.value_or(9)) {}
   
   int compress(const bufferlist &in, bufferlist &out) override;
   int decompress(const bufferlist &in, bufferlist &out) override;
   int decompress(bufferlist::const_iterator &p, size_t compressed_len, bufferlist &out) override;
+  int decompress_into(bufferlist::const_iterator &p, size_t compressed_len,
+                      char *dst, size_t dst_len) override;
+  CompressionStreamRef begin_compress() override;
+  DecompressionStreamRef begin_decompress() override;
+
+  private:
+  const int quality;
 };
 
 #endif //CEPH_BROTLICOMPRESSOR_H
@@ -22,13 +22,16 @@ public:
   explicit CompressionPluginBrotli(CephContext *cct) : CompressionPlugin(cct)
   {}
   
-  virtual int factory(CompressorRef *cs, std::ostream *ss)
+  virtual int factory(CompressorRef *cs, std::ostream *ss,
+		      boost::optional<int> level)
   {
-    if (compressor == nullptr) {
-      BrotliCompressor *interface = new BrotliCompressor();
-      compressor = CompressorRef(interface);
+    level = clamp_level(Compressor::COMP_ALG_BROTLI, level);
+    CompressorRef &c = level ? leveled[*level] : compressor;
+    if (c == nullptr) {
+      BrotliCompressor *interface = new BrotliCompressor(level);
+      c = CompressorRef(interface);
     }
-    *cs = compressor;
+    *cs = c;
     return 0;
   }
 };
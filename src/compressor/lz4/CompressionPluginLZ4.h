@@ -28,12 +28,15 @@ public:
   explicit CompressionPluginLZ4(CephContext* cct) : CompressionPlugin(cct)
   {}
 
-  int factory(CompressorRef *cs, std::ostream *ss) override {
-    if (compressor == 0) {
-      LZ4Compressor *interface = new LZ4Compressor(cct);
-      compressor = CompressorRef(interface);
+  int factory(CompressorRef *cs, std::ostream *ss,
+	      boost::optional<int> level) override {
+    level = clamp_level(Compressor::COMP_ALG_LZ4, level);
+    CompressorRef &c = level ? leveled[*level] : compressor;
+    if (c == 0) {
+      LZ4Compressor *interface = new LZ4Compressor(cct, level);
+      c = CompressorRef(interface);
     }
-    *cs = compressor;
+    *cs = c;
     return 0;
   }
 };
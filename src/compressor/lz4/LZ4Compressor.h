@@ -15,18 +15,168 @@
 #ifndef CEPH_LZ4COMPRESSOR_H
 #define CEPH_LZ4COMPRESSOR_H
 
+#include <memory>
 #include <lz4.h>
 
 #include "compressor/Compressor.h"
 #include "include/buffer.h"
 #include "include/encoding.h"
 #include "common/config.h"
-#include "common/Tub.h"
 
+/* A stream is a run of blocks of at most block_size bytes, each of them
+ * the original and the compressed length followed by the compressed
+ * data; a block of original length 0 ends it. A block refers back to
+ * the last block_size bytes before it, which both sides keep aside.
+ */
+namespace lz4_stream {
+  static constexpr size_t block_size = 64 << 10;
+  static constexpr size_t header_len = 2 * sizeof(uint32_t);
+}
+
+class LZ4CompressionStream : public CompressionStream {
+ public:
+  explicit LZ4CompressionStream(int acceleration)
+    : acceleration(acceleration),
+      block(new char[lz4_stream::block_size]),
+      dict(new char[lz4_stream::block_size]) {
+    LZ4_resetStream(&stream);
+  }
+
+  int feed(const bufferlist &in, bufferlist &out) override {
+    if (finished) {
+      return -EINVAL;
+    }
+    auto p = in.begin();
+    size_t left = in.length();
+    while (left) {
+      size_t len = std::min(left, lz4_stream::block_size - pending);
+      p.copy(len, block.get() + pending);
+      pending += len;
+      left -= len;
+      if (pending == lz4_stream::block_size) {
+	int r = compress_block(out);
+	if (r < 0) {
+	  return r;
+	}
+      }
+    }
+    return 0;
+  }
+  int flush(bufferlist &out) override {
+    if (finished) {
+      return -EINVAL;
+    }
+    return pending ? compress_block(out) : 0;
+  }
+  int finish(bufferlist &out) override {
+    int r = flush(out);
+    if (r < 0) {
+      return r;
+    }
+    encode((uint32_t)0, out);
+    encode((uint32_t)0, out);
+    finished = true;
+    return 0;
+  }
+
+ private:
+  const int acceleration;
+  LZ4_stream_t stream;
+  std::unique_ptr<char[]> block;  ///< input not compressed yet
+  size_t pending = 0;
+  std::unique_ptr<char[]> dict;   ///< what the next block may refer to
+  bool finished = false;
+
+  int compress_block(bufferlist &out) {
+    bufferptr outptr = buffer::create(LZ4_compressBound(pending));
+    int compressed_len = LZ4_compress_fast_continue(
+      &stream, block.get(), outptr.c_str(), pending, outptr.length(),
+      acceleration);
+    if (compressed_len <= 0) {
+      return -1;
+    }
+    encode((uint32_t)pending, out);
+    encode((uint32_t)compressed_len, out);
+    out.append(outptr, 0, compressed_len);
+    // block is about to be overwritten
+    LZ4_saveDict(&stream, dict.get(), lz4_stream::block_size);
+    pending = 0;
+    return 0;
+  }
+};
+
+class LZ4DecompressionStream : public DecompressionStream {
+ public:
+  LZ4DecompressionStream()
+    : dict(new char[lz4_stream::block_size]) {}
+
+  int feed(const bufferlist &in, bufferlist &out) override {
+    if (ended) {
+      return 0;
+    }
+    pending.append(in);
+    while (pending.length() >= lz4_stream::header_len) {
+      uint32_t origin_len, compressed_len;
+      auto p = pending.cbegin();
+      decode(origin_len, p);
+      decode(compressed_len, p);
+      if (origin_len == 0) {
+	ended = true;
+	pending.clear();
+	return 0;
+      }
+      if (origin_len > lz4_stream::block_size || compressed_len == 0 ||
+	  compressed_len > (uint32_t)LZ4_compressBound(lz4_stream::block_size)) {
+	return -1;
+      }
+      if (pending.length() < lz4_stream::header_len + compressed_len) {
+	break;
+      }
+      bufferlist compressed;
+      pending.splice(0, lz4_stream::header_len + compressed_len, &compressed);
+      bufferptr dstptr(origin_len);
+      int r = LZ4_decompress_safe_usingDict(
+	compressed.c_str() + lz4_stream::header_len, dstptr.c_str(),
+	compressed_len, origin_len, dict.get(), dict_len);
+      if (r != (int)origin_len) {
+	return -1;
+      }
+      save_dict(dstptr.c_str(), origin_len);
+      out.push_back(std::move(dstptr));
+    }
+    return 0;
+  }
+
+  int finish() override {
+    return ended ? 0 : -EIO;
+  }
+
+ private:
+  bufferlist pending;             ///< input short of a whole block
+  std::unique_ptr<char[]> dict;   ///< the output of the last blocks
+  size_t dict_len = 0;
+  bool ended = false;
+
+  void save_dict(const char *data, size_t len) {
+    if (len >= lz4_stream::block_size) {
+      memcpy(dict.get(), data + len - lz4_stream::block_size,
+	     lz4_stream::block_size);
+      dict_len = lz4_stream::block_size;
+      return;
+    }
+    size_t keep = std::min(dict_len, lz4_stream::block_size - len);
+    memmove(dict.get(), dict.get() + dict_len - keep, keep);
+    memcpy(dict.get() + keep, data, len);
+    dict_len = keep + len;
+  }
+};
 
 class LZ4Compressor : public Compressor {
  public:
-  LZ4Compressor(CephContext* cct) : Compressor(COMP_ALG_LZ4, "lz4") {
+  // the level is the acceleration, higher is faster but compresses less
+  LZ4Compressor(CephContext* cct, boost::optional<int> level)
+    : Compressor(COMP_ALG_LZ4, "lz4", level),
+      acceleration(level.value_or(1)) {
 #ifdef HAVE_QATZIP
     if (cct->_conf->qat_compressor_enabled && qat_accel.init("lz4"))
       qat_enabled = true;
@@ -55,7 +205,7 @@ class LZ4Compressor : public Compressor {
       uint32_t origin_len = p.get_ptr_and_advance(left, &data);
       int compressed_len = LZ4_compress_fast_continue(
         &lz4_stream, data, outptr.c_str()+pos, origin_len,
-        outptr.length()-pos, 1);
+        outptr.length()-pos, acceleration);
       if (compressed_len <= 0)
         return -1;
       pos += compressed_len;
@@ -85,48 +235,115 @@ class LZ4Compressor : public Compressor {
     if (qat_enabled)
       return qat_accel.decompress(p, compressed_len, dst);
 #endif
-    uint32_t count;
     std::vector<std::pair<uint32_t, uint32_t> > compressed_pairs;
+    uint32_t total_origin;
+    int r = decode_header(p, compressed_len, compressed_pairs, &total_origin);
+    if (r < 0)
+      return r;
+
+    bufferptr dstptr(total_origin);
+    r = decompress_chunks(p, compressed_len, compressed_pairs, dstptr.c_str());
+    if (r < 0)
+      return r;
+    dst.push_back(std::move(dstptr));
+    return 0;
+  }
+
+  int decompress_into(bufferlist::const_iterator &p,
+		      size_t compressed_len,
+		      char *dst, size_t dst_len) override {
+#ifdef HAVE_QATZIP
+    if (qat_enabled)
+      return Compressor::decompress_into(p, compressed_len, dst, dst_len);
+#endif
+    std::vector<std::pair<uint32_t, uint32_t> > compressed_pairs;
+    uint32_t total_origin;
+    int r = decode_header(p, compressed_len, compressed_pairs, &total_origin);
+    if (r < 0)
+      return r;
+    if (total_origin > dst_len)
+      return -ENOSPC;
+    r = decompress_chunks(p, compressed_len, compressed_pairs, dst);
+    if (r < 0)
+      return r;
+    return total_origin;
+  }
+
+  CompressionStreamRef begin_compress() override {
+    return std::make_unique<LZ4CompressionStream>(acceleration);
+  }
+
+  DecompressionStreamRef begin_decompress() override {
+    return std::make_unique<LZ4DecompressionStream>();
+  }
+
+ private:
+  // the chunk count and the (origin, compressed) length of each chunk
+  static int decode_header(
+    bufferlist::const_iterator &p,
+    size_t &compressed_len,
+    std::vector<std::pair<uint32_t, uint32_t> > &compressed_pairs,
+    uint32_t *total_origin) {
+    uint32_t count;
     decode(count, p);
+    size_t header_len = sizeof(uint32_t) + sizeof(uint32_t) * count * 2;
+    if (header_len > compressed_len)
+      return -1;
     compressed_pairs.resize(count);
-    uint32_t total_origin = 0;
+    *total_origin = 0;
     for (unsigned i = 0; i < count; ++i) {
       decode(compressed_pairs[i].first, p);
       decode(compressed_pairs[i].second, p);
-      total_origin += compressed_pairs[i].first;
+      *total_origin += compressed_pairs[i].first;
     }
-    compressed_len -= (sizeof(uint32_t) + sizeof(uint32_t) * count * 2);
+    compressed_len -= header_len;
+    return 0;
+  }
 
-    bufferptr dstptr(total_origin);
+  // a chunk is decoded in place when it lies within one buffer of the
+  // input, only a chunk straddling two buffers is copied to scratch
+  static int decompress_chunks(
+    bufferlist::const_iterator &p,
+    size_t compressed_len,
+    const std::vector<std::pair<uint32_t, uint32_t> > &compressed_pairs,
+    char *c_out) {
     LZ4_streamDecode_t lz4_stream_decode;
     LZ4_setStreamDecode(&lz4_stream_decode, nullptr, 0);
 
-    bufferptr cur_ptr = p.get_current_ptr();
-    bufferptr *ptr = &cur_ptr;
-    Tub<bufferptr> data_holder;
-    if (compressed_len != cur_ptr.length()) {
-      data_holder.construct(compressed_len);
-      p.copy_deep(compressed_len, *data_holder);
-      ptr = data_holder.get();
-    }
+    std::unique_ptr<char[]> scratch;
+    size_t scratch_len = 0;
+    for (auto& pair : compressed_pairs) {
+      uint32_t origin_len = pair.first;
+      uint32_t chunk_len = pair.second;
+      if (chunk_len == 0 || chunk_len > compressed_len)
+        return -1;
+      const char *c_in;
+      size_t len = p.get_ptr_and_advance(chunk_len, &c_in);
+      if (len < chunk_len) {
+        if (scratch_len < chunk_len) {
+          scratch.reset(new char[chunk_len]);
+          scratch_len = chunk_len;
+        }
+        memcpy(scratch.get(), c_in, len);
+        p.copy(chunk_len - len, scratch.get() + len);
+        c_in = scratch.get();
+      }
+      compressed_len -= chunk_len;
 
-    char *c_in = ptr->c_str();
-    char *c_out = dstptr.c_str();
-    for (unsigned i = 0; i < count; ++i) {
       int r = LZ4_decompress_safe_continue(
-          &lz4_stream_decode, c_in, c_out, compressed_pairs[i].second, compressed_pairs[i].first);
-      if (r == (int)compressed_pairs[i].first) {
-        c_in += compressed_pairs[i].second;
-        c_out += compressed_pairs[i].first;
+          &lz4_stream_decode, c_in, c_out, chunk_len, origin_len);
+      if (r == (int)origin_len) {
+        c_out += origin_len;
       } else if (r < 0) {
         return -1;
       } else {
         return -2;
       }
     }
-    dst.push_back(std::move(dstptr));
     return 0;
   }
+
+  const int acceleration;
 };
 
 #endif
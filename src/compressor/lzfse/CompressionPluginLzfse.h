@@ -23,13 +23,15 @@ public:
     explicit CompressionPluginLzfse(CephContext *cct) : CompressionPlugin(cct)
     {}
 
-    virtual int factory(CompressorRef *cs, std::ostream *ss)
+    virtual int factory(CompressorRef *cs, std::ostream *ss,
+			boost::optional<int> level)
     {
-      if (compressor == nullptr) {
-        LzfseCompressor *interface = new LzfseCompressor();
-        compressor = CompressorRef(interface);
+      CompressorRef &c = level ? leveled[*level] : compressor;
+      if (c == nullptr) {
+        LzfseCompressor *interface = new LzfseCompressor(level);
+        c = CompressorRef(interface);
       }
-      *cs = compressor;
+      *cs = c;
       return 0;
     }
 };
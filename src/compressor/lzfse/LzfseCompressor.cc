@@ -16,15 +16,20 @@ char* lzfse_init()
   return (char*) malloc(std::max<size_t>(lzfse_encode_scratch_size(), lzfse_decode_scratch_size()));
 }
 
+// the scratch space is large enough for both directions, so a single
+// cached one serves compress and decompress
+
 int LzfseCompressor::compress(const bufferlist &in, bufferlist &out)
 {
-  char *workmen = lzfse_init();
-  auto sg = make_scope_guard([&workmen] { lzfse_deinit(workmen); });
+  auto workmen = get_context<char, lzfse_deinit>(0, lzfse_init);
+  if (!workmen) {
+    return -1;
+  }
   for (auto &i : in.buffers()) {
     const uint8_t * c_in = (uint8_t*) i.c_str();
     size_t len = i.length();
     bufferptr ptr = buffer::create_small_page_aligned(MAX_LEN);
-    size_t out_len = lzfse_encode_buffer((uint8_t *)ptr.c_str(),ptr.length(),c_in,len, workmen);
+    size_t out_len = lzfse_encode_buffer((uint8_t *)ptr.c_str(),ptr.length(),c_in,len, workmen.get());
     if (out_len == 0 && len != 0) {
       return -1;
     }
@@ -37,8 +42,10 @@ int LzfseCompressor::decompress(bufferlist::const_iterator &p,
                                  size_t compressed_size,
                                  bufferlist &out)
 {
-  char *workmen = lzfse_init();
-  auto sg = make_scope_guard([&workmen] { lzfse_deinit(workmen); });
+  auto workmen = get_context<char, lzfse_deinit>(0, lzfse_init);
+  if (!workmen) {
+    return -1;
+  }
   size_t remaining = std::min<size_t>(p.get_remaining(), compressed_size);
   while (remaining) {
     bufferptr cur_ptr = p.get_current_ptr();
@@ -46,7 +53,7 @@ int LzfseCompressor::decompress(bufferlist::const_iterator &p,
     unsigned int len = cur_ptr.length();
     bufferptr ptr = buffer::create_small_page_aligned(MAX_LEN);
     uint8_t *next_out = (uint8_t *)ptr.c_str();
-    size_t out_size = lzfse_decode_buffer(next_out,ptr.length(),in,len, workmen);
+    size_t out_size = lzfse_decode_buffer(next_out,ptr.length(),in,len, workmen.get());
     if (out_size == 0 && len != 0) {
       return -1;
     }
@@ -20,7 +20,8 @@
 class LzfseCompressor : public Compressor
 {
 public:
-    LzfseCompressor() : Compressor(COMP_ALG_LZFSE, "lzfse") {}
+    explicit LzfseCompressor(boost::optional<int> level)
+      : Compressor(COMP_ALG_LZFSE, "lzfse", level) {}
 
     int compress(const bufferlist &in, bufferlist &out) override;
     int decompress(const bufferlist &in, bufferlist &out) override;
@@ -28,13 +28,15 @@ public:
   {}
 
   int factory(CompressorRef *cs,
-                      std::ostream *ss) override
+                      std::ostream *ss,
+                      boost::optional<int> level) override
   {
-    if (compressor == 0) {
-      SnappyCompressor *interface = new SnappyCompressor(cct);
-      compressor = CompressorRef(interface);
+    CompressorRef &c = level ? leveled[*level] : compressor;
+    if (c == 0) {
+      SnappyCompressor *interface = new SnappyCompressor(cct, level);
+      c = CompressorRef(interface);
     }
-    *cs = compressor;
+    *cs = c;
     return 0;
   }
 };
@@ -57,7 +57,8 @@ class CEPH_BUFFER_API BufferlistSource : public snappy::Source {
 
 class SnappyCompressor : public Compressor {
  public:
-  SnappyCompressor(CephContext* cct) : Compressor(COMP_ALG_SNAPPY, "snappy") {
+  SnappyCompressor(CephContext* cct, boost::optional<int> level)
+    : Compressor(COMP_ALG_SNAPPY, "snappy", level) {
 #ifdef HAVE_QATZIP
     if (cct->_conf->qat_compressor_enabled && qat_accel.init("snappy"))
       qat_enabled = true;
@@ -96,19 +97,53 @@ class SnappyCompressor : public Compressor {
     if (qat_enabled)
       return qat_accel.decompress(p, compressed_len, dst);
 #endif
-    snappy::uint32 res_len = 0;
-    BufferlistSource source_1(p, compressed_len);
-    if (!snappy::GetUncompressedLength(&source_1, &res_len)) {
+    size_t res_len = 0;
+    if (!get_uncompressed_length(p, compressed_len, &res_len)) {
       return -1;
     }
-    BufferlistSource source_2(p, compressed_len);
     bufferptr ptr(res_len);
-    if (snappy::RawUncompress(&source_2, ptr.c_str())) {
-      p = source_2.get_pos();
-      dst.append(ptr);
-      return 0;
+    int r = decompress_into(p, compressed_len, ptr.c_str(), res_len);
+    if (r < 0) {
+      return r;
     }
-    return -2;
+    dst.push_back(std::move(ptr));
+    return 0;
+  }
+
+  int decompress_into(bufferlist::const_iterator &p,
+		      size_t compressed_len,
+		      char *dst, size_t dst_len) override {
+#ifdef HAVE_QATZIP
+    if (qat_enabled)
+      return Compressor::decompress_into(p, compressed_len, dst, dst_len);
+#endif
+    size_t res_len = 0;
+    if (!get_uncompressed_length(p, compressed_len, &res_len)) {
+      return -1;
+    }
+    if (res_len > dst_len) {
+      return -ENOSPC;
+    }
+    // the source streams across the buffers of the input, so the data is
+    // decoded in a single pass
+    BufferlistSource source(p, compressed_len);
+    if (!snappy::RawUncompress(&source, dst)) {
+      return -2;
+    }
+    p = source.get_pos();
+    return res_len;
+  }
+
+ private:
+  // the uncompressed length is a varint of at most 5 bytes at the start
+  static bool get_uncompressed_length(bufferlist::const_iterator p,
+				      size_t compressed_len,
+				      size_t *len) {
+    char header[5];
+    size_t n = std::min<size_t>(
+      std::min<size_t>(sizeof(header), compressed_len), p.get_remaining());
+    p.copy(n, header);
+    return snappy::GetUncompressedLength(header, n, len);
   }
 };
 
@@ -32,7 +32,8 @@ public:
   {}
 
   int factory(CompressorRef *cs,
-                      std::ostream *ss) override
+                      std::ostream *ss,
+                      boost::optional<int> level) override
   {
     bool isal = false;
 #if defined(__i386__) || defined(__x86_64__)
@@ -42,11 +43,17 @@ public:
       isal = (ceph_arch_intel_pclmul && ceph_arch_intel_sse41);
     }
 #endif
-    if (compressor == 0 || has_isal != isal) {
-      compressor = std::make_shared<ZlibCompressor>(cct, isal);
+    if (has_isal != isal) {
+      compressor.reset();
+      leveled.clear();
       has_isal = isal;
     }
-    *cs = compressor;
+    level = clamp_level(Compressor::COMP_ALG_ZLIB, level);
+    CompressorRef &c = level ? leveled[*level] : compressor;
+    if (c == 0) {
+      c = std::make_shared<ZlibCompressor>(cct, isal, level);
+    }
+    *cs = c;
     return 0;
   }
 };
@@ -47,24 +47,65 @@ _prefix(std::ostream* _dout)
 // compression ratio.
 #define ZLIB_MEMORY_LEVEL 8
 
+static void free_deflate(z_stream *strm)
+{
+  deflateEnd(strm);
+  delete strm;
+}
+
+static void free_inflate(z_stream *strm)
+{
+  inflateEnd(strm);
+  delete strm;
+}
+
+static z_stream *new_inflate(CephContext *cct)
+{
+  z_stream *strm = new z_stream;
+  strm->zalloc = Z_NULL;
+  strm->zfree = Z_NULL;
+  strm->opaque = Z_NULL;
+  strm->avail_in = 0;
+  strm->next_in = Z_NULL;
+
+  // choose the variation of compressor
+  int ret = inflateInit2(strm, ZLIB_DEFAULT_WIN_SIZE);
+  if (ret != Z_OK) {
+    dout(1) << "Decompression init error: init return "
+         << ret << " instead of Z_OK" << dendl;
+    delete strm;
+    return nullptr;
+  }
+  return strm;
+}
+
 int ZlibCompressor::zlib_compress(const bufferlist &in, bufferlist &out)
 {
   int ret;
   unsigned have;
-  z_stream strm;
   unsigned char* c_in;
   int begin = 1;
 
-  /* allocate deflate state */
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
-  ret = deflateInit2(&strm, cct->_conf->compressor_zlib_level, Z_DEFLATED, ZLIB_DEFAULT_WIN_SIZE, ZLIB_MEMORY_LEVEL, Z_DEFAULT_STRATEGY);
-  if (ret != Z_OK) {
-    dout(1) << "Compression init error: init return "
-         << ret << " instead of Z_OK" << dendl;
+  /* get deflate state, a cached one is kept for each level */
+  int level = this->level.value_or(cct->_conf->compressor_zlib_level);
+  auto strm = get_context<z_stream, free_deflate>(level, [this, level] {
+    z_stream *strm = new z_stream;
+    strm->zalloc = Z_NULL;
+    strm->zfree = Z_NULL;
+    strm->opaque = Z_NULL;
+    int ret = deflateInit2(strm, level, Z_DEFLATED, ZLIB_DEFAULT_WIN_SIZE, ZLIB_MEMORY_LEVEL, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+      dout(1) << "Compression init error: init return "
+           << ret << " instead of Z_OK" << dendl;
+      delete strm;
+      return (z_stream*)nullptr;
+    }
+    return strm;
+  });
+  if (!strm) {
     return -1;
   }
+  deflateReset(strm.get());
 
   for (std::list<buffer::ptr>::const_iterator i = in.buffers().begin();
       i != in.buffers().end();) {
@@ -73,37 +114,34 @@ int ZlibCompressor::zlib_compress(const bufferlist &in, bufferlist &out)
     long unsigned int len = (*i).length();
     ++i;
 
-    strm.avail_in = len;
+    strm->avail_in = len;
     int flush = i != in.buffers().end() ? Z_NO_FLUSH : Z_FINISH;
 
-    strm.next_in = c_in;
+    strm->next_in = c_in;
     do {
       bufferptr ptr = buffer::create_page_aligned(MAX_LEN);
-      strm.next_out = (unsigned char*)ptr.c_str() + begin;
-      strm.avail_out = MAX_LEN - begin;
+      strm->next_out = (unsigned char*)ptr.c_str() + begin;
+      strm->avail_out = MAX_LEN - begin;
       if (begin) {
         // put a compressor variation mark in front of compressed stream, not used at the moment
         ptr.c_str()[0] = 0;
         begin = 0;
       }
-      ret = deflate(&strm, flush);    /* no bad return value */
+      ret = deflate(strm.get(), flush);    /* no bad return value */
       if (ret == Z_STREAM_ERROR) {
          dout(1) << "Compression error: compress return Z_STREAM_ERROR("
               << ret << ")" << dendl;
-         deflateEnd(&strm);
          return -1;
       }
-      have = MAX_LEN - strm.avail_out;
+      have = MAX_LEN - strm->avail_out;
       out.append(ptr, 0, have);
-    } while (strm.avail_out == 0);
-    if (strm.avail_in != 0) {
+    } while (strm->avail_out == 0);
+    if (strm->avail_in != 0) {
       dout(10) << "Compression error: unused input" << dendl;
-      deflateEnd(&strm);
       return -1;
     }
   }
 
-  deflateEnd(&strm);
   return 0;
 }
 
@@ -186,55 +224,92 @@ int ZlibCompressor::decompress(bufferlist::const_iterator &p, size_t compressed_
 
   int ret;
   unsigned have;
-  z_stream strm;
   const char* c_in;
   int begin = 1;
 
-  /* allocate inflate state */
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
-  strm.avail_in = 0;
-  strm.next_in = Z_NULL;
-
-  // choose the variation of compressor
-  ret = inflateInit2(&strm, ZLIB_DEFAULT_WIN_SIZE);
-  if (ret != Z_OK) {
-    dout(1) << "Decompression init error: init return "
-         << ret << " instead of Z_OK" << dendl;
+  /* get inflate state */
+  auto strm = get_context<z_stream, free_inflate>(0, [this] {
+    return new_inflate(cct);
+  });
+  if (!strm) {
     return -1;
   }
+  inflateReset(strm.get());
 
   size_t remaining = std::min<size_t>(p.get_remaining(), compressed_size);
 
   while(remaining) {
     long unsigned int len = p.get_ptr_and_advance(remaining, &c_in);
     remaining -= len;
-    strm.avail_in = len - begin;
-    strm.next_in = (unsigned char*)c_in + begin;
+    strm->avail_in = len - begin;
+    strm->next_in = (unsigned char*)c_in + begin;
     begin = 0;
 
     do {
-      strm.avail_out = MAX_LEN;
+      strm->avail_out = MAX_LEN;
       bufferptr ptr = buffer::create_page_aligned(MAX_LEN);
-      strm.next_out = (unsigned char*)ptr.c_str();
-      ret = inflate(&strm, Z_NO_FLUSH);
+      strm->next_out = (unsigned char*)ptr.c_str();
+      ret = inflate(strm.get(), Z_NO_FLUSH);
       if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
        dout(1) << "Decompression error: decompress return "
             << ret << dendl;
-       inflateEnd(&strm);
        return -1;
       }
-      have = MAX_LEN - strm.avail_out;
+      have = MAX_LEN - strm->avail_out;
       out.append(ptr, 0, have);
-    } while (strm.avail_out == 0);
+    } while (strm->avail_out == 0);
   }
 
-  /* clean up and return */
-  (void)inflateEnd(&strm);
   return 0;
 }
 
+int ZlibCompressor::decompress_into(bufferlist::const_iterator &p,
+				    size_t compressed_size,
+				    char *dst, size_t dst_len)
+{
+#ifdef HAVE_QATZIP
+  if (qat_enabled)
+    return Compressor::decompress_into(p, compressed_size, dst, dst_len);
+#endif
+
+  int ret = Z_OK;
+  const char* c_in;
+  int begin = 1;
+
+  auto strm = get_context<z_stream, free_inflate>(0, [this] {
+    return new_inflate(cct);
+  });
+  if (!strm) {
+    return -1;
+  }
+  inflateReset(strm.get());
+  strm->next_out = (unsigned char*)dst;
+  strm->avail_out = dst_len;
+
+  size_t remaining = std::min<size_t>(p.get_remaining(), compressed_size);
+
+  while (remaining && ret != Z_STREAM_END) {
+    long unsigned int len = p.get_ptr_and_advance(remaining, &c_in);
+    remaining -= len;
+    strm->avail_in = len - begin;
+    strm->next_in = (unsigned char*)c_in + begin;
+    begin = 0;
+
+    ret = inflate(strm.get(), Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+      dout(1) << "Decompression error: decompress return "
+	      << ret << dendl;
+      return -1;
+    }
+    if (strm->avail_in && ret != Z_STREAM_END) {
+      // dst is full but input is left
+      return -ENOSPC;
+    }
+  }
+
+  return dst_len - strm->avail_out;
+}
+
 int ZlibCompressor::decompress(const bufferlist &in, bufferlist &out)
 {
 #ifdef HAVE_QATZIP
@@ -244,3 +319,166 @@ int ZlibCompressor::decompress(const bufferlist &in, bufferlist &out)
   auto i = std::cbegin(in);
   return decompress(i, in.length(), out);
 }
+
+// a stream is a single deflate stream behind the variation mark, just
+// like what compress() produces, so either decompresses the other
+class ZlibCompressionStream : public CompressionStream {
+  CephContext *const cct;
+  z_stream strm;
+  bool inited = false;
+  bool begin = true;
+  bool finished = false;
+
+  int deflate_out(const char *in, size_t len, int flush, bufferlist &out) {
+    if (finished) {
+      return -EINVAL;
+    }
+    strm.next_in = (unsigned char*)in;
+    strm.avail_in = len;
+    do {
+      bufferptr ptr = buffer::create_page_aligned(MAX_LEN);
+      unsigned skip = 0;
+      if (begin) {
+	ptr.c_str()[0] = 0;
+	skip = 1;
+	begin = false;
+      }
+      strm.next_out = (unsigned char*)ptr.c_str() + skip;
+      strm.avail_out = MAX_LEN - skip;
+      int ret = deflate(&strm, flush);
+      if (ret == Z_STREAM_ERROR) {
+	dout(1) << "Compression error: compress return Z_STREAM_ERROR("
+		<< ret << ")" << dendl;
+	return -1;
+      }
+      unsigned have = MAX_LEN - strm.avail_out;
+      if (have) {
+	out.append(ptr, 0, have);
+      }
+    } while (strm.avail_out == 0);
+    if (strm.avail_in != 0) {
+      dout(10) << "Compression error: unused input" << dendl;
+      return -1;
+    }
+    finished = flush == Z_FINISH;
+    return 0;
+  }
+
+public:
+  explicit ZlibCompressionStream(CephContext *cct) : cct(cct) {}
+  ~ZlibCompressionStream() override {
+    if (inited) {
+      deflateEnd(&strm);
+    }
+  }
+
+  int init(int level) {
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    int ret = deflateInit2(&strm, level, Z_DEFLATED, ZLIB_DEFAULT_WIN_SIZE,
+			   ZLIB_MEMORY_LEVEL, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+      dout(1) << "Compression init error: init return "
+	      << ret << " instead of Z_OK" << dendl;
+      return -1;
+    }
+    inited = true;
+    return 0;
+  }
+
+  int feed(const bufferlist &in, bufferlist &out) override {
+    for (auto& p : in.buffers()) {
+      int r = deflate_out(p.c_str(), p.length(), Z_NO_FLUSH, out);
+      if (r < 0) {
+	return r;
+      }
+    }
+    return 0;
+  }
+  int flush(bufferlist &out) override {
+    return deflate_out(nullptr, 0, Z_SYNC_FLUSH, out);
+  }
+  int finish(bufferlist &out) override {
+    return deflate_out(nullptr, 0, Z_FINISH, out);
+  }
+};
+
+class ZlibDecompressionStream : public DecompressionStream {
+  CephContext *const cct;
+  z_stream *strm = nullptr;
+  bool begin = true;
+  bool ended = false;
+
+public:
+  explicit ZlibDecompressionStream(CephContext *cct) : cct(cct) {}
+  ~ZlibDecompressionStream() override {
+    if (strm) {
+      free_inflate(strm);
+    }
+  }
+
+  int init() {
+    strm = new_inflate(cct);
+    return strm ? 0 : -1;
+  }
+
+  int feed(const bufferlist &in, bufferlist &out) override {
+    for (auto& p : in.buffers()) {
+      if (ended) {
+	break;
+      }
+      unsigned skip = 0;
+      if (begin && p.length()) {
+	// the variation mark
+	skip = 1;
+	begin = false;
+      }
+      strm->next_in = (unsigned char*)p.c_str() + skip;
+      strm->avail_in = p.length() - skip;
+      do {
+	bufferptr ptr = buffer::create_page_aligned(MAX_LEN);
+	strm->next_out = (unsigned char*)ptr.c_str();
+	strm->avail_out = MAX_LEN;
+	int ret = inflate(strm, Z_NO_FLUSH);
+	if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+	  dout(1) << "Decompression error: decompress return "
+		  << ret << dendl;
+	  return -1;
+	}
+	unsigned have = MAX_LEN - strm->avail_out;
+	if (have) {
+	  out.append(ptr, 0, have);
+	}
+	if (ret == Z_STREAM_END) {
+	  ended = true;
+	  break;
+	}
+      } while (strm->avail_out == 0);
+    }
+    return 0;
+  }
+
+  int finish() override {
+    return ended ? 0 : -EIO;
+  }
+};
+
+CompressionStreamRef ZlibCompressor::begin_compress()
+{
+  int level = this->level.value_or(cct->_conf->compressor_zlib_level);
+  auto s = std::make_unique<ZlibCompressionStream>(cct);
+  if (s->init(level) < 0) {
+    return nullptr;
+  }
+  return s;
+}
+
+DecompressionStreamRef ZlibCompressor::begin_decompress()
+{
+  auto s = std::make_unique<ZlibDecompressionStream>(cct);
+  if (s->init() < 0) {
+    return nullptr;
+  }
+  return s;
+}
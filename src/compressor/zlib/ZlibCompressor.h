@@ -24,8 +24,8 @@ class ZlibCompressor : public Compressor {
   bool isal_enabled;
   CephContext *const cct;
 public:
-  ZlibCompressor(CephContext *cct, bool isal)
-    : Compressor(COMP_ALG_ZLIB, "zlib"), isal_enabled(isal), cct(cct) {
+  ZlibCompressor(CephContext *cct, bool isal, boost::optional<int> level)
+    : Compressor(COMP_ALG_ZLIB, "zlib", level), isal_enabled(isal), cct(cct) {
 #ifdef HAVE_QATZIP
     if (cct->_conf->qat_compressor_enabled && qat_accel.init("zlib"))
       qat_enabled = true;
@@ -37,6 +37,10 @@ public:
   int compress(const bufferlist &in, bufferlist &out) override;
   int decompress(const bufferlist &in, bufferlist &out) override;
   int decompress(bufferlist::const_iterator &p, size_t compressed_len, bufferlist &out) override;
+  int decompress_into(bufferlist::const_iterator &p, size_t compressed_len,
+		      char *dst, size_t dst_len) override;
+  CompressionStreamRef begin_compress() override;
+  DecompressionStreamRef begin_decompress() override;
 private:
   int zlib_compress(const bufferlist &in, bufferlist &out);
   int isal_compress(const bufferlist &in, bufferlist &out);
@@ -29,13 +29,16 @@ public:
   {}
 
   int factory(CompressorRef *cs,
-                      std::ostream *ss) override
+                      std::ostream *ss,
+                      boost::optional<int> level) override
   {
-    if (compressor == 0) {
-      ZstdCompressor *interface = new ZstdCompressor();
-      compressor = CompressorRef(interface);
+    level = clamp_level(Compressor::COMP_ALG_ZSTD, level);
+    CompressorRef &c = level ? leveled[*level] : compressor;
+    if (c == 0) {
+      ZstdCompressor *interface = new ZstdCompressor(level);
+      c = CompressorRef(interface);
     }
-    *cs = compressor;
+    *cs = c;
     return 0;
   }
 };
@@ -17,6 +17,7 @@
 
 #define ZSTD_STATIC_LINKING_ONLY
 #include "zstd/lib/zstd.h"
+#include "zstd/lib/dictBuilder/zdict.h"
 
 #include "include/buffer.h"
 #include "include/encoding.h"
@@ -24,13 +25,161 @@
 
 #define COMPRESSION_LEVEL 5
 
+// a stream is one zstd frame of unknown size, without the length prefix
+// compress() puts in front of it
+class ZstdCompressionStream : public CompressionStream {
+ public:
+  ZstdCompressionStream() : s(ZSTD_createCStream()) {}
+  ~ZstdCompressionStream() override {
+    ZSTD_freeCStream(s);
+  }
+
+  int init(int clevel, const ZSTD_CDict *cdict) {
+    if (!s) {
+      return -ENOMEM;
+    }
+    size_t r;
+    if (cdict) {
+      r = ZSTD_initCStream_usingCDict(s, cdict);
+    } else {
+      r = ZSTD_initCStream(s, clevel);
+    }
+    return ZSTD_isError(r) ? -EINVAL : 0;
+  }
+
+  int feed(const bufferlist &in, bufferlist &out) override {
+    for (auto& p : in.buffers()) {
+      ZSTD_inBuffer_s inbuf = {p.c_str(), p.length(), 0};
+      int r = compress_out(&inbuf, ZSTD_e_continue, out);
+      if (r < 0) {
+	return r;
+      }
+    }
+    return 0;
+  }
+  int flush(bufferlist &out) override {
+    ZSTD_inBuffer_s inbuf = {nullptr, 0, 0};
+    return compress_out(&inbuf, ZSTD_e_flush, out);
+  }
+  int finish(bufferlist &out) override {
+    ZSTD_inBuffer_s inbuf = {nullptr, 0, 0};
+    return compress_out(&inbuf, ZSTD_e_end, out);
+  }
+
+ private:
+  ZSTD_CStream *s;
+  bool finished = false;
+
+  // until all of inbuf is taken and, for a flush or the end, written out
+  int compress_out(ZSTD_inBuffer_s *inbuf, ZSTD_EndDirective zed,
+		   bufferlist &out) {
+    if (finished) {
+      return -EINVAL;
+    }
+    size_t r;
+    do {
+      bufferptr ptr = buffer::create_small_page_aligned(ZSTD_CStreamOutSize());
+      ZSTD_outBuffer_s outbuf = {ptr.c_str(), ptr.length(), 0};
+      r = ZSTD_compress_generic(s, &outbuf, inbuf, zed);
+      if (ZSTD_isError(r)) {
+	return -EINVAL;
+      }
+      if (outbuf.pos) {
+	out.append(ptr, 0, outbuf.pos);
+      }
+    } while (inbuf->pos < inbuf->size || (zed != ZSTD_e_continue && r != 0));
+    finished = zed == ZSTD_e_end;
+    return 0;
+  }
+};
+
+class ZstdDecompressionStream : public DecompressionStream {
+ public:
+  ZstdDecompressionStream() : s(ZSTD_createDStream()) {}
+  ~ZstdDecompressionStream() override {
+    ZSTD_freeDStream(s);
+  }
+
+  int init(const ZSTD_DDict *ddict) {
+    if (!s) {
+      return -ENOMEM;
+    }
+    size_t r;
+    if (ddict) {
+      r = ZSTD_initDStream_usingDDict(s, ddict);
+    } else {
+      r = ZSTD_initDStream(s);
+    }
+    return ZSTD_isError(r) ? -EINVAL : 0;
+  }
+
+  int feed(const bufferlist &in, bufferlist &out) override {
+    for (auto& p : in.buffers()) {
+      ZSTD_inBuffer_s inbuf = {p.c_str(), p.length(), 0};
+      size_t out_max = ZSTD_DStreamOutSize();
+      ZSTD_outBuffer_s outbuf;
+      do {
+	if (ended) {
+	  return 0;
+	}
+	bufferptr ptr = buffer::create_small_page_aligned(out_max);
+	outbuf = {ptr.c_str(), ptr.length(), 0};
+	size_t r = ZSTD_decompressStream(s, &outbuf, &inbuf);
+	if (ZSTD_isError(r)) {
+	  return -1;
+	}
+	if (outbuf.pos) {
+	  out.append(ptr, 0, outbuf.pos);
+	}
+	ended = r == 0;
+      } while (inbuf.pos < inbuf.size || outbuf.pos == outbuf.size);
+    }
+    return 0;
+  }
+
+  int finish() override {
+    return ended ? 0 : -EIO;
+  }
+
+ private:
+  ZSTD_DStream *s;
+  bool ended = false;
+};
+
 class ZstdCompressor : public Compressor {
  public:
-  ZstdCompressor() : Compressor(COMP_ALG_ZSTD, "zstd") {}
+  explicit ZstdCompressor(boost::optional<int> level)
+    : Compressor(COMP_ALG_ZSTD, "zstd", level),
+      clevel(level.value_or(COMPRESSION_LEVEL)) {}
+  ZstdCompressor(boost::optional<int> level, const bufferlist &dict)
+    : ZstdCompressor(level) {
+    // both copy what they need out of dict
+    bufferlist d(dict);
+    cdict = ZSTD_createCDict(d.c_str(), d.length(), clevel);
+    ddict = ZSTD_createDDict(d.c_str(), d.length());
+  }
+  ~ZstdCompressor() override {
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeDDict(ddict);
+  }
 
   int compress(const bufferlist &src, bufferlist &dst) override {
-    ZSTD_CStream *s = ZSTD_createCStream();
-    ZSTD_initCStream_srcSize(s, COMPRESSION_LEVEL, src.length());
+    auto s = get_context<ZSTD_CStream, free_cstream>(
+      clevel, ZSTD_createCStream);
+    if (!s) {
+      return -ENOMEM;
+    }
+    size_t r;
+    if (cdict) {
+      ZSTD_frameParameters fparams = {1, 0, 0};
+      r = ZSTD_initCStream_usingCDict_advanced(s.get(), cdict, fparams,
+					       src.length());
+    } else {
+      r = ZSTD_initCStream_srcSize(s.get(), clevel, src.length());
+    }
+    if (ZSTD_isError(r)) {
+      return -EINVAL;
+    }
     auto p = src.begin();
     size_t left = src.length();
 
@@ -48,15 +197,13 @@ class ZstdCompressor : public Compressor {
       inbuf.size = p.get_ptr_and_advance(left, (const char**)&inbuf.src);
       left -= inbuf.size;
       ZSTD_EndDirective const zed = (left==0) ? ZSTD_e_end : ZSTD_e_continue;
-      size_t r = ZSTD_compress_generic(s, &outbuf, &inbuf, zed);
+      r = ZSTD_compress_generic(s.get(), &outbuf, &inbuf, zed);
       if (ZSTD_isError(r)) {
 	return -EINVAL;
       }
     }
     ceph_assert(p.end());
 
-    ZSTD_freeCStream(s);
-
     // prefix with decompressed length
     encode((uint32_t)src.length(), dst);
     dst.append(outptr, 0, outbuf.pos);
@@ -74,17 +221,46 @@ class ZstdCompressor : public Compressor {
     if (compressed_len < 4) {
       return -1;
     }
-    compressed_len -= 4;
     uint32_t dst_len;
-    decode(dst_len, p);
-
+    {
+      auto q = p;
+      decode(dst_len, q);
+    }
     bufferptr dstptr(dst_len);
+    int r = decompress_into(p, compressed_len, dstptr.c_str(), dst_len);
+    if (r < 0) {
+      return r;
+    }
+    dst.append(dstptr, 0, r);
+    return 0;
+  }
+
+  int decompress_into(bufferlist::const_iterator &p,
+		      size_t compressed_len,
+		      char *dst, size_t dst_len) override {
+    if (compressed_len < 4) {
+      return -1;
+    }
+    compressed_len -= 4;
+    uint32_t len;
+    decode(len, p);
+    if (len > dst_len) {
+      return -ENOSPC;
+    }
+
     ZSTD_outBuffer_s outbuf;
-    outbuf.dst = dstptr.c_str();
-    outbuf.size = dstptr.length();
+    outbuf.dst = dst;
+    outbuf.size = len;
     outbuf.pos = 0;
-    ZSTD_DStream *s = ZSTD_createDStream();
-    ZSTD_initDStream(s);
+    auto s = get_context<ZSTD_DStream, free_dstream>(0, ZSTD_createDStream);
+    if (!s) {
+      return -ENOMEM;
+    }
+    if (ddict) {
+      ZSTD_initDStream_usingDDict(s.get(), ddict);
+    } else {
+      ZSTD_initDStream(s.get());
+    }
     while (compressed_len > 0) {
       if (p.end()) {
 	return -1;
@@ -93,14 +269,71 @@ class ZstdCompressor : public Compressor {
       inbuf.pos = 0;
       inbuf.size = p.get_ptr_and_advance(compressed_len,
 					 (const char**)&inbuf.src);
-      ZSTD_decompressStream(s, &outbuf, &inbuf);
+      size_t r = ZSTD_decompressStream(s.get(), &outbuf, &inbuf);
+      if (ZSTD_isError(r)) {
+	return -1;
+      }
       compressed_len -= inbuf.size;
     }
-    ZSTD_freeDStream(s);
+    return outbuf.pos;
+  }
 
-    dst.append(dstptr, 0, outbuf.pos);
+  int train_dictionary(const std::vector<bufferlist> &samples,
+		       size_t max_len, bufferlist *dict) override {
+    // the trainer wants the samples back to back
+    bufferlist all;
+    std::vector<size_t> sizes;
+    for (auto& i : samples) {
+      all.append(i);
+      sizes.push_back(i.length());
+    }
+    bufferptr d = buffer::create(max_len);
+    size_t r = ZDICT_trainFromBuffer(d.c_str(), d.length(), all.c_str(),
+				     sizes.data(), sizes.size());
+    if (ZDICT_isError(r)) {
+      return -EINVAL;
+    }
+    d.set_length(r);
+    dict->append(std::move(d));
     return 0;
   }
+
+  CompressorRef with_dictionary(const bufferlist &dict) override {
+    auto c = std::make_shared<ZstdCompressor>(level, dict);
+    if (!c->cdict || !c->ddict) {
+      return nullptr;
+    }
+    return c;
+  }
+
+  CompressionStreamRef begin_compress() override {
+    auto s = std::make_unique<ZstdCompressionStream>();
+    if (s->init(clevel, cdict) < 0) {
+      return nullptr;
+    }
+    return s;
+  }
+
+  DecompressionStreamRef begin_decompress() override {
+    auto s = std::make_unique<ZstdDecompressionStream>();
+    if (s->init(ddict) < 0) {
+      return nullptr;
+    }
+    return s;
+  }
+
+ private:
+  const int clevel;
+  // prepared from a trained dictionary, if any; shared by all threads
+  ZSTD_CDict *cdict = nullptr;
+  ZSTD_DDict *ddict = nullptr;
+
+  static void free_cstream(ZSTD_CStream *s) {
+    ZSTD_freeCStream(s);
+  }
+  static void free_dstream(ZSTD_DStream *s) {
+    ZSTD_freeDStream(s);
+  }
 };
 
 #endif
@@ -17,6 +17,7 @@
 
 // -----------------------------------------------------------------------------
 #include "ceph_ver.h"
+#include "common/ceph_context.h"
 #include "compressor/CompressionPlugin.h"
 #include "ZstdMtCompressor.h"
 // -----------------------------------------------------------------------------
@@ -24,18 +25,29 @@
 class CompressionPluginZstdMt : public CompressionPlugin {
 
  public:
+  uint64_t threads = 0;
 
   explicit CompressionPluginZstdMt(CephContext* cct) : CompressionPlugin(cct)
   {}
 
   int factory(CompressorRef *cs,
-              std::ostream *ss) override
+              std::ostream *ss,
+              boost::optional<int> level) override
   {
-    if (compressor == 0) {
-      ZstdMtCompressor *interface = new ZstdMtCompressor();
-      compressor = CompressorRef(interface);
+    auto wanted = cct->_conf.get_val<uint64_t>("compressor_zstdmt_threads");
+    if (threads != wanted) {
+      // previous compressors keep their pool until their last user is gone
+      compressor.reset();
+      leveled.clear();
+      threads = wanted;
     }
-    *cs = compressor;
+    level = clamp_level(Compressor::COMP_ALG_ZSTDMT, level);
+    CompressorRef &c = level ? leveled[*level] : compressor;
+    if (c == 0) {
+      ZstdMtCompressor *interface = new ZstdMtCompressor(wanted, level);
+      c = CompressorRef(interface);
+    }
+    *cs = c;
     return 0;
   }
 };
@@ -18,53 +18,37 @@
 #include "include/encoding.h"
 #include "compressor/Compressor.h"
 #include "lib/zstd-mt.h"
-#include <thread>
 #include "include/scope_guard.h"
 
 #define COMPRESSION_LEVEL 5
 class ZstdMtCompressor : public Compressor {
  public:
+  // input of the read/map callbacks, compressed_len bounds what they consume
   typedef struct {
     bufferlist::const_iterator *p;
     size_t compressed_len;
   } DeReadArg;
 
-  ZstdMtCompressor() : Compressor(COMP_ALG_ZSTDMT, "zstdmt") {}
+  ZstdMtCompressor(int threads, boost::optional<int> level)
+    : Compressor(COMP_ALG_ZSTDMT, "zstdmt", level),
+      clevel(level.value_or(COMPRESSION_LEVEL)),
+      pool(ZSTDMT_createPool(threads)) {}
+  ~ZstdMtCompressor() override {
+    ZSTDMT_freePool(pool);
+  }
+
   int compress(const bufferlist &src, bufferlist &dst) override {
-    ZSTDMT_CCtx *cctx = ZSTDMT_createCCtx(std::thread::hardware_concurrency(), COMPRESSION_LEVEL, 0);
+    ZSTDMT_CCtx *cctx = ZSTDMT_createCCtxPool(pool, clevel, 0);
     auto sg = make_scope_guard([&cctx] { ZSTDMT_freeCCtx(cctx); });
     if (cctx == nullptr) {
       return -1;
     }
-    ZSTDMT_RdWr_t rdwr;
-    rdwr.fn_read = [](void *arg, ZSTDMT_Buffer *in){
-      bufferlist::const_iterator* src = static_cast<bufferlist::const_iterator*>(arg);
-      size_t remain = std::min<size_t>(in->size,(size_t)src->get_remaining());
-      bufferptr new_ptr = buffer::create_small_page_aligned(remain);
-      unsigned int offset = 0;
-      do {
-        const void* tmp;
-        size_t size = src->get_ptr_and_advance(remain,(const char**)&tmp);
-        if (size == 0)
-          break;
-        new_ptr.copy_in(offset, size,(const char*)tmp);
-        offset += size;
-        remain -= size;
-      } while (remain != 0);
-      new_ptr.copy_out(0,new_ptr.length(),(char *)in->buf);
-      in->size = new_ptr.length();
-      return 0;
-    };
-    rdwr.fn_write = [](void *arg, ZSTDMT_Buffer * out){
-      bufferlist *dst = static_cast<bufferlist *>(arg);
-      bufferptr outptr = buffer::create_small_page_aligned(out->size);
-      outptr.copy_in(0,out->size,(const char *)out->buf);
-      dst->append(outptr, 0, out->size);
-      return 0;
-    };
     auto i = src.begin();
-    rdwr.arg_read = const_cast<bufferlist::const_iterator*>(&i);
-    rdwr.arg_write = &dst;
+    DeReadArg args;
+    args.p = &i;
+    args.compressed_len = src.length();
+    ZSTDMT_RdWr_t rdwr = {};
+    set_rdwr(rdwr, &args, &dst);
     auto ret = ZSTDMT_compressCCtx(cctx, &rdwr);
     if (ZSTDMT_isError(ret))
       return -1;
@@ -80,48 +64,91 @@ class ZstdMtCompressor : public Compressor {
                  size_t compressed_len,
                  bufferlist &dst) override {
 
-    auto dctx = ZSTDMT_createDCtx(std::thread::hardware_concurrency(), 0);
+    auto dctx = ZSTDMT_createDCtxPool(pool, 0);
     auto sg = make_scope_guard([&dctx] { ZSTDMT_freeDCtx(dctx); });
     if (!dctx)
       return -1;
-    ZSTDMT_RdWr_t rdwr;
     DeReadArg args;
-    args.p = const_cast<bufferlist::const_iterator*>(&p);
+    args.p = &p;
     args.compressed_len = compressed_len;
+    ZSTDMT_RdWr_t rdwr = {};
+    set_rdwr(rdwr, &args, &dst);
+    auto ret = ZSTDMT_decompressDCtx(dctx, &rdwr);
+    if (ZSTDMT_isError(ret))
+      return -1;
+    return 0;
+  }
+
+ private:
+  // frame headers are copied out by fn_read, frame data is handed to the
+  // library in place via fn_map, and output buffers are bufferptrs which
+  // end up in dst without another copy
+  static void set_rdwr(ZSTDMT_RdWr_t &rdwr, DeReadArg *args, bufferlist *dst) {
     rdwr.fn_read = [](void *arg, ZSTDMT_Buffer *in){
       DeReadArg *args = static_cast<DeReadArg*>(arg);
-      bufferlist::const_iterator* src = args->p;
-      size_t remain = std::min<size_t>(in->size,(size_t)args->compressed_len);
-      args->compressed_len -= remain;
-      bufferptr new_ptr = buffer::create_small_page_aligned(remain);
-      unsigned int offset = 0;
-      do {
-        const void* tmp;
-        size_t size = src->get_ptr_and_advance(remain,(const char**)&tmp);
+      size_t remain = std::min<size_t>(in->size, args->compressed_len);
+      size_t offset = 0;
+      while (remain != 0) {
+        const char* tmp;
+        size_t size = args->p->get_ptr_and_advance(remain, &tmp);
         if (size == 0)
           break;
-        new_ptr.copy_in(offset, size,(const char*)tmp);
+        memcpy((char *)in->buf + offset, tmp, size);
         offset += size;
         remain -= size;
-      } while (remain != 0);
-      new_ptr.copy_out(0,new_ptr.length(),(char *)in->buf);
-      in->size = new_ptr.length();
+      }
+      args->compressed_len -= offset;
+      in->size = offset;
       return 0;
     };
-    rdwr.fn_write =  [](void *arg, ZSTDMT_Buffer * out){
+    rdwr.fn_map = [](void *arg, ZSTDMT_Buffer *in){
+      DeReadArg *args = static_cast<DeReadArg*>(arg);
+      size_t want = std::min<size_t>(in->size, args->compressed_len);
+      const char* tmp = nullptr;
+      size_t size = want ? args->p->get_ptr_and_advance(want, &tmp) : 0;
+      args->compressed_len -= size;
+      in->buf = const_cast<char*>(tmp);
+      in->size = size;
+      return 0;
+    };
+    rdwr.fn_alloc = [](void *arg, ZSTDMT_Buffer *out){
+      bufferptr *ptr = new bufferptr(
+        buffer::create_small_page_aligned(out->size));
+      out->handle = ptr;
+      out->buf = ptr->c_str();
+      out->allocated = out->size;
+      return 0;
+    };
+    rdwr.fn_free = [](void *arg, ZSTDMT_Buffer *out){
+      delete static_cast<bufferptr*>(out->handle);
+      out->handle = nullptr;
+    };
+    rdwr.fn_write = [](void *arg, ZSTDMT_Buffer *out){
       bufferlist *dst = static_cast<bufferlist *>(arg);
-      bufferptr outptr = buffer::create_small_page_aligned(out->size);
-      outptr.copy_in(0,out->size,(const char *)out->buf);
-      dst->append(outptr, 0, out->size);
+      if (out->handle) {
+        bufferptr *ptr = static_cast<bufferptr*>(out->handle);
+        if (out->size == out->allocated) {
+          dst->push_back(std::move(*ptr));
+        } else {
+          // compressed frames fill a fraction of their ZSTD_compressBound()
+          // sized buffer; don't let the result pin all of it
+          dst->push_back(buffer::copy(static_cast<const char*>(out->buf),
+                                      out->size));
+        }
+        delete ptr;
+        out->handle = nullptr;
+        return 0;
+      }
+      dst->append(static_cast<const char*>(out->buf), out->size);
       return 0;
     };
-    rdwr.arg_read = &args;
-    rdwr.arg_write = &dst;
-    auto ret = ZSTDMT_decompressDCtx(dctx, &rdwr);
-    if (ZSTDMT_isError(ret))
-      return -1;
-    return 0;
+    rdwr.arg_read = args;
+    rdwr.arg_write = dst;
   }
+
+  const int clevel;
+  // worker threads shared by every context of this compressor
+  ZSTDMT_Pool *pool;
 };
 
 #endif
@@ -0,0 +1,60 @@
+
+/**
+ * Copyright (c) 2016 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include "threading.h"
+#include "list.h"
+#include "zstd-mt.h"
+
+/**
+ * internal interface of the shared worker pool
+ *
+ * - a context fills one job per wanted worker into a batch
+ * - the jobs are queued to the long lived pool threads
+ * - the caller waits for its batch, jobs which were not picked up
+ *   by any pool thread until then are dropped from the queue
+ */
+
+typedef void *(pool_fn) (void *arg);
+
+struct pool_batch;
+
+typedef struct {
+	pool_fn *fn;
+	void *arg;
+	struct pool_batch *batch;
+	struct list_head node;
+} pool_job_t;
+
+typedef struct pool_batch {
+	ZSTDMT_Pool *pool;
+	int pending;
+	void *retval;
+} pool_batch_t;
+
+void POOL_initBatch(pool_batch_t * batch, ZSTDMT_Pool * pool);
+void POOL_submit(pool_batch_t * batch, pool_job_t * job,
+		 pool_fn * fn, void *arg);
+void *POOL_wait(pool_batch_t * batch);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif				/* POOL_H */
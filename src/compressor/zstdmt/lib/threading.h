@@ -37,6 +37,14 @@ extern "C" {
 #define pthread_mutex_lock        EnterCriticalSection
 #define pthread_mutex_unlock      LeaveCriticalSection
 
+/* condition variables */
+#define pthread_cond_t CONDITION_VARIABLE
+#define pthread_cond_init(a,b)    InitializeConditionVariable((a))
+#define pthread_cond_destroy(a)   do { } while (0)
+#define pthread_cond_wait(a,b)    SleepConditionVariableCS((a),(b),INFINITE)
+#define pthread_cond_signal       WakeConditionVariable
+#define pthread_cond_broadcast    WakeAllConditionVariable
+
 /* pthread_create() and pthread_join() */
 typedef struct {
 	HANDLE handle;
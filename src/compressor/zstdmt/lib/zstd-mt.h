@@ -68,6 +68,7 @@ typedef struct {
 	void *buf;		/* ptr to data */
 	size_t size;		/* current filled in buf */
 	size_t allocated;	/* length of buf */
+	void *handle;		/* owner data of buffers from fn_alloc */
 } ZSTDMT_Buffer;
 
 /**
@@ -85,13 +86,71 @@ typedef struct {
 typedef int (fn_read) (void *args, ZSTDMT_Buffer * in);
 typedef int (fn_write) (void *args, ZSTDMT_Buffer * out);
 
+/**
+ * optional zero copy functions, set them to zero when not used
+ *
+ * fn_map:   called with arg_read instead of fn_read for frame data; it
+ *           does not copy, but points in->buf at the next at most
+ *           in->size bytes of the input and sets in->size to their
+ *           length (zero on eof). The memory must stay valid until the
+ *           (de)compression call returns. Frame headers are still read
+ *           with fn_read.
+ * fn_alloc: called with arg_write to get an output buffer for at least
+ *           out->size bytes, the caller may keep its own reference in
+ *           out->handle. A buffer from fn_alloc is handed over to
+ *           fn_write with out->size set to the used length, which may
+ *           take it over as is; or to fn_free, if it is not written.
+ *           out->handle is zero for all other buffers given to fn_write.
+ */
+typedef int (fn_map) (void *args, ZSTDMT_Buffer * in);
+typedef int (fn_alloc) (void *args, ZSTDMT_Buffer * out);
+typedef void (fn_free) (void *args, ZSTDMT_Buffer * out);
+
 typedef struct {
 	fn_read *fn_read;
 	void *arg_read;
 	fn_write *fn_write;
 	void *arg_write;
+	fn_map *fn_map;
+	fn_alloc *fn_alloc;
+	fn_free *fn_free;
 } ZSTDMT_RdWr_t;
 
+/* **************************************
+ * Worker pool
+ ****************************************/
+
+typedef struct ZSTDMT_Pool_s ZSTDMT_Pool;
+
+/**
+ * ZSTDMT_createPool() - allocate a pool of long lived worker threads
+ *
+ * Contexts, which are created with ZSTDMT_createCCtxPool() or
+ * ZSTDMT_createDCtxPool(), queue their work to the threads of the pool
+ * instead of creating and joining own threads on each call. The calling
+ * thread takes part in the work, so a context makes progress even when
+ * all pool threads are busy. One pool can be shared by any number of
+ * contexts, which may be used concurrently.
+ *
+ * @threads: number of worker threads (1..ZSTDMT_THREAD_MAX)
+ * @return: the pool on success, zero on error
+ */
+ZSTDMT_Pool *ZSTDMT_createPool(int threads);
+
+/**
+ * ZSTDMT_GetThreadsPool() - number of worker threads of the pool
+ */
+int ZSTDMT_GetThreadsPool(ZSTDMT_Pool * pool);
+
+/**
+ * ZSTDMT_freePool() - stop the worker threads and free the pool
+ *
+ * All contexts which use the pool must be finished before.
+ *
+ * @pool: pool, which should be freed
+ */
+void ZSTDMT_freePool(ZSTDMT_Pool * pool);
+
 /* **************************************
  * Compression
  ****************************************/
@@ -114,6 +173,18 @@ typedef struct ZSTDMT_CCtx_s ZSTDMT_CCtx;
  */
 ZSTDMT_CCtx *ZSTDMT_createCCtx(int threads, int level, int inputsize);
 
+/**
+ * ZSTDMT_createCCtxPool() - allocate new compression context on a pool
+ *
+ * Same as ZSTDMT_createCCtx(), but the work is done by the threads of
+ * the given pool, the number of threads is taken from the pool.
+ *
+ * @pool: worker pool, created with ZSTDMT_createPool()
+ * @return: the context on success, zero on error
+ */
+ZSTDMT_CCtx *ZSTDMT_createCCtxPool(ZSTDMT_Pool * pool, int level,
+				   int inputsize);
+
 /**
  * ZSTDMT_compressDCtx() - threaded compression for zstd
  *
@@ -168,6 +239,14 @@ typedef struct ZSTDMT_DCtx_s ZSTDMT_DCtx;
  */
 ZSTDMT_DCtx *ZSTDMT_createDCtx(int threads, int inputsize);
 
+/**
+ * ZSTDMT_createDCtxPool() - allocate new decompression context on a pool
+ *
+ * Same as ZSTDMT_createDCtx(), but the work is done by the threads of
+ * the given pool, the number of threads is taken from the pool.
+ */
+ZSTDMT_DCtx *ZSTDMT_createDCtxPool(ZSTDMT_Pool * pool, int inputsize);
+
 /**
  * ZSTDMT_decompressDCtx() - threaded decompression for zstd
  *
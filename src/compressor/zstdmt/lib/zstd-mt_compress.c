@@ -20,6 +20,7 @@
 #include "memmt.h"
 #include "threading.h"
 #include "list.h"
+#include "pool.h"
 #include "zstd-mt.h"
 
 /**
@@ -34,16 +35,21 @@
  *   4) begin with step 1 again, until no input
  */
 
+/* max. number of input pieces for one frame, when fn_map is used */
+#define ZSTDMT_SEGMENTS_MAX 64
+
 /* worker for compression */
 typedef struct {
 	ZSTDMT_CCtx *ctx;
 	pthread_t pthread;
+	pool_job_t job;
 } cwork_t;
 
 struct writelist;
 struct writelist {
 	size_t frame;
 	ZSTDMT_Buffer out;
+	int user;		/* out.buf is from fn_alloc */
 	struct list_head node;
 };
 
@@ -67,14 +73,20 @@ struct ZSTDMT_CCtx_s {
 	/* threading */
 	cwork_t *cwork;
 
+	/* shared worker pool, or zero for own threads */
+	ZSTDMT_Pool *pool;
+
 	/* reading input */
 	pthread_mutex_t read_mutex;
 	fn_read *fn_read;
+	fn_map *fn_map;
 	void *arg_read;
 
 	/* writing output */
 	pthread_mutex_t write_mutex;
 	fn_write *fn_write;
+	fn_alloc *fn_alloc;
+	fn_free *fn_free;
 	void *arg_write;
 
 	/* error handling */
@@ -129,6 +141,7 @@ ZSTDMT_CCtx *ZSTDMT_createCCtx(int threads, int level, int inputsize)
 	/* setup ctx */
 	ctx->level = level;
 	ctx->threads = threads;
+	ctx->pool = 0;
 
 	pthread_mutex_init(&ctx->read_mutex, NULL);
 	pthread_mutex_init(&ctx->write_mutex, NULL);
@@ -154,6 +167,21 @@ ZSTDMT_CCtx *ZSTDMT_createCCtx(int threads, int level, int inputsize)
 	return 0;
 }
 
+ZSTDMT_CCtx *ZSTDMT_createCCtxPool(ZSTDMT_Pool * pool, int level,
+				   int inputsize)
+{
+	ZSTDMT_CCtx *ctx;
+
+	if (!pool)
+		return 0;
+
+	ctx = ZSTDMT_createCCtx(ZSTDMT_GetThreadsPool(pool), level, inputsize);
+	if (ctx)
+		ctx->pool = pool;
+
+	return ctx;
+}
+
 /**
  * mt_error - return mt lib specific error code
  */
@@ -196,6 +224,12 @@ static size_t pt_write(ZSTDMT_CCtx * ctx, struct writelist *wl)
 				return mt_error(rv);
 			ctx->outsize += wl->out.size;
 			ctx->curframe++;
+			if (wl->user) {
+				/* fn_write took the buffer over */
+				wl->out.buf = 0;
+				wl->out.handle = 0;
+				wl->user = 0;
+			}
 			list_move(entry, &ctx->writelist_free);
 			goto again;
 		}
@@ -204,6 +238,86 @@ static size_t pt_write(ZSTDMT_CCtx * ctx, struct writelist *wl)
 	return 0;
 }
 
+/**
+ * pt_release - give back the output buffer of an unused list entry
+ */
+static void pt_release(ZSTDMT_CCtx * ctx, struct writelist *wl)
+{
+	if (!wl->user)
+		return;
+	ctx->fn_free(ctx->arg_write, &wl->out);
+	wl->out.buf = 0;
+	wl->out.handle = 0;
+	wl->user = 0;
+}
+
+/**
+ * pt_map - collect the input of the next frame without copying it
+ */
+static int pt_map(ZSTDMT_CCtx * ctx, ZSTDMT_Buffer * seg, int *nseg,
+		  size_t *total)
+{
+	int rv;
+
+	*nseg = 0;
+	*total = 0;
+	while (*total < (size_t)ctx->inputsize && *nseg < ZSTDMT_SEGMENTS_MAX) {
+		ZSTDMT_Buffer *in = &seg[*nseg];
+		in->size = ctx->inputsize - *total;
+		rv = ctx->fn_map(ctx->arg_read, in);
+		if (rv != 0)
+			return rv;
+		if (in->size == 0)
+			break;
+		*total += in->size;
+		(*nseg)++;
+	}
+
+	return 0;
+}
+
+/**
+ * pt_compress_segments - compress mapped input pieces as one frame
+ */
+static size_t pt_compress_segments(ZSTD_CStream * zcs, int level,
+				   ZSTDMT_Buffer * seg, int nseg,
+				   size_t total, ZSTDMT_Buffer * out)
+{
+	ZSTD_outBuffer zOut;
+	size_t result;
+	int i;
+
+	result = ZSTD_initCStream_srcSize(zcs, level, total);
+	if (ZSTD_isError(result))
+		return result;
+
+	zOut.dst = (unsigned char *)out->buf + 12;
+	zOut.size = out->size - 12;
+	zOut.pos = 0;
+	for (i = 0; i < nseg; i++) {
+		ZSTD_inBuffer zIn;
+		zIn.src = seg[i].buf;
+		zIn.size = seg[i].size;
+		zIn.pos = 0;
+		while (zIn.pos < zIn.size) {
+			result = ZSTD_compressStream(zcs, &zOut, &zIn);
+			if (ZSTD_isError(result))
+				return result;
+			/* can not happen, out has ZSTD_compressBound() */
+			if (zOut.pos == zOut.size)
+				return (size_t)-1;
+		}
+	}
+
+	result = ZSTD_endStream(zcs, &zOut);
+	if (ZSTD_isError(result))
+		return result;
+	if (result != 0)
+		return (size_t)-1;
+
+	return zOut.pos;
+}
+
 /* parallel compression worker */
 static void *pt_compress(void *arg)
 {
@@ -212,12 +326,23 @@ static void *pt_compress(void *arg)
 	struct writelist *wl;
 	size_t result;
 	ZSTDMT_Buffer in;
-
-	/* inbuf is constant */
-	in.size = ctx->inputsize;
-	in.buf = malloc(in.size);
-	if (!in.buf)
-		return (void *)ZSTDMT_ERROR(memory_allocation);
+	ZSTDMT_Buffer seg[ZSTDMT_SEGMENTS_MAX];
+	ZSTD_CStream *zcs = 0;
+	int nseg = 0;
+
+	if (ctx->fn_map) {
+		/* input is used in place, it needs no buffer */
+		in.buf = 0;
+		zcs = ZSTD_createCStream();
+		if (!zcs)
+			return (void *)ZSTDMT_ERROR(memory_allocation);
+	} else {
+		/* inbuf is constant */
+		in.size = ctx->inputsize;
+		in.buf = malloc(in.size);
+		if (!in.buf)
+			return (void *)ZSTDMT_ERROR(memory_allocation);
+	}
 
 	for (;;) {
 		struct list_head *entry;
@@ -238,15 +363,23 @@ static void *pt_compress(void *arg)
 							malloc(sizeof(struct writelist));
 			if (!wl) {
 				pthread_mutex_unlock(&ctx->write_mutex);
-				free(in.buf);
-				return (void *)ZSTDMT_ERROR(memory_allocation);
+				result = ZSTDMT_ERROR(memory_allocation);
+				goto error_nowl;
 			}
-			wl->out.size = ZSTD_compressBound(ctx->inputsize) + 12;;
-			wl->out.buf = malloc(wl->out.size);
-			if (!wl->out.buf) {
-				pthread_mutex_unlock(&ctx->write_mutex);
-				free(in.buf);
-				return (void *)ZSTDMT_ERROR(memory_allocation);
+			wl->user = 0;
+			wl->out.handle = 0;
+			wl->out.size = ZSTD_compressBound(ctx->inputsize) + 12;
+			if (ctx->fn_alloc) {
+				/* output buffers come from fn_alloc per frame */
+				wl->out.buf = 0;
+			} else {
+				wl->out.buf = malloc(wl->out.size);
+				if (!wl->out.buf) {
+					pthread_mutex_unlock(&ctx->write_mutex);
+					free(wl);
+					result = ZSTDMT_ERROR(memory_allocation);
+					goto error_nowl;
+				}
 			}
 			list_add(&wl->node, &ctx->writelist_busy);
 		}
@@ -255,8 +388,12 @@ static void *pt_compress(void *arg)
 
 		/* read new input */
 		pthread_mutex_lock(&ctx->read_mutex);
-		in.size = ctx->inputsize;
-		rv = ctx->fn_read(ctx->arg_read, &in);
+		if (ctx->fn_map) {
+			rv = pt_map(ctx, seg, &nseg, &in.size);
+		} else {
+			in.size = ctx->inputsize;
+			rv = ctx->fn_read(ctx->arg_read, &in);
+		}
 
 		if (rv != 0) {
 			pthread_mutex_unlock(&ctx->read_mutex);
@@ -266,7 +403,6 @@ static void *pt_compress(void *arg)
 
 		/* eof */
 		if (in.size == 0 && ctx->frames > 0) {
-			free(in.buf);
 			pthread_mutex_unlock(&ctx->read_mutex);
 
 			pthread_mutex_lock(&ctx->write_mutex);
@@ -279,10 +415,27 @@ static void *pt_compress(void *arg)
 		wl->frame = ctx->frames++;
 		pthread_mutex_unlock(&ctx->read_mutex);
 
+		/* exact sized output, directly from the caller */
+		if (ctx->fn_alloc) {
+			out->size = ZSTD_compressBound(in.size) + 12;
+			rv = ctx->fn_alloc(ctx->arg_write, out);
+			if (rv != 0) {
+				result = mt_error(rv);
+				goto error;
+			}
+			wl->user = 1;
+		}
+
 		/* compress whole frame */
 		{
 			unsigned char *outbuf = out->buf;
-			result =
+			if (ctx->fn_map)
+				result =
+					pt_compress_segments(zcs, ctx->level,
+							     seg, nseg, in.size,
+							     out);
+			else
+				result =
 							ZSTD_compress(outbuf + 12, out->size - 12, in.buf,
 														in.size, ctx->level);
 			if (ZSTD_isError(result)) {
@@ -307,15 +460,21 @@ static void *pt_compress(void *arg)
 		result = pt_write(ctx, wl);
 		pthread_mutex_unlock(&ctx->write_mutex);
 		if (ZSTDMT_isError(result))
-			goto error;
+			goto error_nowl;
 	}
 
 	okay:
+	free(in.buf);
+	ZSTD_freeCStream(zcs);
 	return 0;
 	error:
 	pthread_mutex_lock(&ctx->write_mutex);
+	pt_release(ctx, wl);
 	list_move(&wl->node, &ctx->writelist_free);
 	pthread_mutex_unlock(&ctx->write_mutex);
+	error_nowl:
+	free(in.buf);
+	ZSTD_freeCStream(zcs);
 	return (void *)result;
 }
 
@@ -333,6 +492,9 @@ size_t ZSTDMT_compressCCtx(ZSTDMT_CCtx * ctx, ZSTDMT_RdWr_t * rdwr)
 	ctx->fn_write = rdwr->fn_write;
 	ctx->arg_read = rdwr->arg_read;
 	ctx->arg_write = rdwr->arg_write;
+	ctx->fn_map = rdwr->fn_map;
+	ctx->fn_alloc = rdwr->fn_free ? rdwr->fn_alloc : 0;
+	ctx->fn_free = rdwr->fn_free;
 
 	/* init counter and error codes */
 	ctx->insize = 0;
@@ -341,19 +503,35 @@ size_t ZSTDMT_compressCCtx(ZSTDMT_CCtx * ctx, ZSTDMT_RdWr_t * rdwr)
 	ctx->curframe = 0;
 	ctx->zstdmt_errcode = 0;
 
-	/* start all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		pthread_create(&w->pthread, NULL, pt_compress, w);
-	}
+	if (ctx->pool) {
+		/* queue the other workers, the first one runs right here */
+		pool_batch_t batch;
+		void *p;
 
-	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(w->pthread, &p);
+		POOL_initBatch(&batch, ctx->pool);
+		for (t = 1; t < ctx->threads; t++) {
+			cwork_t *w = &ctx->cwork[t];
+			POOL_submit(&batch, &w->job, pt_compress, w);
+		}
+		retval_of_thread = pt_compress(&ctx->cwork[0]);
+		p = POOL_wait(&batch);
 		if (p)
 			retval_of_thread = p;
+	} else {
+		/* start all workers */
+		for (t = 0; t < ctx->threads; t++) {
+			cwork_t *w = &ctx->cwork[t];
+			pthread_create(&w->pthread, NULL, pt_compress, w);
+		}
+
+		/* wait for all workers */
+		for (t = 0; t < ctx->threads; t++) {
+			cwork_t *w = &ctx->cwork[t];
+			void *p = 0;
+			pthread_join(w->pthread, &p);
+			if (p)
+				retval_of_thread = p;
+		}
 	}
 
 	/* clean up the free list */
@@ -375,7 +553,10 @@ size_t ZSTDMT_compressCCtx(ZSTDMT_CCtx * ctx, ZSTDMT_RdWr_t * rdwr)
 		while (!list_empty(&ctx->writelist_busy)) {
 			entry = list_first(&ctx->writelist_busy);
 			wl = list_entry(entry, struct writelist, node);
-			free(wl->out.buf);
+			if (wl->user)
+				pt_release(ctx, wl);
+			else
+				free(wl->out.buf);
 			list_del(&wl->node);
 			free(wl);
 		}
@@ -383,7 +564,10 @@ size_t ZSTDMT_compressCCtx(ZSTDMT_CCtx * ctx, ZSTDMT_RdWr_t * rdwr)
 		while (!list_empty(&ctx->writelist_done)) {
 			entry = list_first(&ctx->writelist_done);
 			wl = list_entry(entry, struct writelist, node);
-			free(wl->out.buf);
+			if (wl->user)
+				pt_release(ctx, wl);
+			else
+				free(wl->out.buf);
 			list_del(&wl->node);
 			free(wl);
 		}
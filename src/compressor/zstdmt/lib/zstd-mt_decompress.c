@@ -20,6 +20,7 @@
 #include "memmt.h"
 #include "threading.h"
 #include "list.h"
+#include "pool.h"
 #include "zstd-mt.h"
 
 /**
@@ -47,14 +48,22 @@ extern size_t zstdmt_errcode;
 typedef struct {
 	ZSTDMT_DCtx *ctx;
 	pthread_t pthread;
+	pool_job_t job;
 	ZSTDMT_Buffer in;
 	ZSTD_DStream *dctx;
+
+	/* mapped frame input, when fn_map is used */
+	ZSTDMT_Buffer *seg;
+	int nseg;
+	int segs_allocated;
 } cwork_t;
 
 struct writelist;
 struct writelist {
 	size_t frame;
 	ZSTDMT_Buffer out;
+	ZSTDMT_Buffer own;	/* saved out, while out is from fn_alloc */
+	int user;
 	struct list_head node;
 };
 
@@ -79,14 +88,20 @@ struct ZSTDMT_DCtx_s {
 	/* threading */
 	cwork_t *cwork;
 
+	/* shared worker pool, or zero for own threads */
+	ZSTDMT_Pool *pool;
+
 	/* reading input */
 	pthread_mutex_t read_mutex;
 	fn_read *fn_read;
+	fn_map *fn_map;
 	void *arg_read;
 
 	/* writing output */
 	pthread_mutex_t write_mutex;
 	fn_write *fn_write;
+	fn_alloc *fn_alloc;
+	fn_free *fn_free;
 	void *arg_write;
 
 	/* error handling */
@@ -134,6 +149,21 @@ ZSTDMT_DCtx *ZSTDMT_createDCtx(int threads, int inputsize)
 
 	/* later */
 	ctx->cwork = 0;
+	ctx->pool = 0;
+
+	return ctx;
+}
+
+ZSTDMT_DCtx *ZSTDMT_createDCtxPool(ZSTDMT_Pool * pool, int inputsize)
+{
+	ZSTDMT_DCtx *ctx;
+
+	if (!pool)
+		return 0;
+
+	ctx = ZSTDMT_createDCtx(ZSTDMT_GetThreadsPool(pool), inputsize);
+	if (ctx)
+		ctx->pool = pool;
 
 	return ctx;
 }
@@ -195,6 +225,11 @@ static size_t pt_write(ZSTDMT_DCtx * ctx, struct writelist *wl)
 				return mt_error(rv);
 			ctx->outsize += wl->out.size;
 			ctx->curframe++;
+			if (wl->user) {
+				/* fn_write took the buffer over */
+				wl->out = wl->own;
+				wl->user = 0;
+			}
 			list_move(entry, &ctx->writelist_free);
 			goto again;
 		}
@@ -203,17 +238,68 @@ static size_t pt_write(ZSTDMT_DCtx * ctx, struct writelist *wl)
 	return 0;
 }
 
+/**
+ * pt_release - give back the output buffer from fn_alloc of an entry
+ */
+static void pt_release(ZSTDMT_DCtx * ctx, struct writelist *wl)
+{
+	if (!wl->user)
+		return;
+	ctx->fn_free(ctx->arg_write, &wl->out);
+	wl->out = wl->own;
+	wl->user = 0;
+}
+
+/**
+ * pt_map - map the next toRead bytes of input, without copying them
+ *
+ * returns the number of mapped bytes in w->in.size
+ */
+static int pt_map(ZSTDMT_DCtx * ctx, cwork_t * w, size_t toRead)
+{
+	w->in.size = 0;
+	while (toRead) {
+		ZSTDMT_Buffer *in;
+		int rv;
+
+		if (w->nseg == w->segs_allocated) {
+			int n = w->segs_allocated ? w->segs_allocated * 2 : 16;
+			ZSTDMT_Buffer *seg = (ZSTDMT_Buffer *)
+			    realloc(w->seg, sizeof(ZSTDMT_Buffer) * n);
+			if (!seg)
+				return -3;
+			w->seg = seg;
+			w->segs_allocated = n;
+		}
+
+		in = &w->seg[w->nseg];
+		in->size = toRead;
+		rv = ctx->fn_map(ctx->arg_read, in);
+		if (rv != 0)
+			return rv;
+		if (in->size == 0)
+			break;
+		toRead -= in->size;
+		w->in.size += in->size;
+		w->nseg++;
+	}
+
+	return 0;
+}
+
 /**
  * pt_read - read compressed input
  */
-static size_t pt_read(ZSTDMT_DCtx * ctx, ZSTDMT_Buffer * in, size_t * frame)
+static size_t pt_read(ZSTDMT_DCtx * ctx, cwork_t * w, size_t * frame)
 {
+	ZSTDMT_Buffer *in = &w->in;
 	unsigned char hdrbuf[12];
 	ZSTDMT_Buffer hdr;
 	size_t toRead;
 	int rv;
 
 	pthread_mutex_lock(&ctx->read_mutex);
+	w->nseg = 0;
 
 	/* special case, some bytes were read by magic check */
 	if (unlikely(ctx->frames == 0)) {
@@ -244,6 +330,19 @@ static size_t pt_read(ZSTDMT_DCtx * ctx, ZSTDMT_Buffer * in, size_t * frame)
 
 			/* read data */
 			toRead = MEM_readLE32((unsigned char *)hdr.buf + 8);
+			if (ctx->fn_map) {
+				rv = pt_map(ctx, w, toRead);
+				if (rv != 0) {
+					pthread_mutex_unlock(&ctx->read_mutex);
+					return mt_error(rv);
+				}
+				if (in->size != toRead)
+					goto error_data;
+				ctx->insize += in->size;
+				*frame = ctx->frames++;
+				pthread_mutex_unlock(&ctx->read_mutex);
+				return 0;	/* done! */
+			}
 			in->size = toRead;
 			in->buf = malloc(in->size);
 			if (!in->buf)
@@ -269,6 +368,31 @@ static size_t pt_read(ZSTDMT_DCtx * ctx, ZSTDMT_Buffer * in, size_t * frame)
 		if (IsZstd_Skippable(in->buf)) {
 			unsigned char *start = in->buf;	/* 16 bytes data */
 			toRead = MEM_readLE32((unsigned char *)start + 8);
+			if (ctx->fn_map && toRead >= 4) {
+				/* first 4 bytes stay in the magic buffer */
+				if (!w->segs_allocated) {
+					w->seg = (ZSTDMT_Buffer *)
+					    malloc(sizeof(ZSTDMT_Buffer) * 16);
+					if (!w->seg)
+						goto error_nomem;
+					w->segs_allocated = 16;
+				}
+				w->seg[0].buf = start + 12;
+				w->seg[0].size = 4;
+				w->nseg = 1;
+				rv = pt_map(ctx, w, toRead - 4);
+				if (rv != 0) {
+					pthread_mutex_unlock(&ctx->read_mutex);
+					return mt_error(rv);
+				}
+				if (in->size != toRead - 4)
+					goto error_data;
+				in->size += 4;
+				ctx->insize += in->size - 4;
+				*frame = ctx->frames++;
+				pthread_mutex_unlock(&ctx->read_mutex);
+				return 0;	/* done! */
+			}
 			in->size = toRead;
 			in->buf = malloc(in->size);
 			if (!in->buf)
@@ -327,7 +451,18 @@ static size_t pt_read(ZSTDMT_DCtx * ctx, ZSTDMT_Buffer * in, size_t * frame)
 
 	/* read new input (size should be _toRead_ bytes */
 	toRead = MEM_readLE32((unsigned char *)hdr.buf + 8);
-	{
+	if (ctx->fn_map) {
+		rv = pt_map(ctx, w, toRead);
+		if (rv != 0) {
+			pthread_mutex_unlock(&ctx->read_mutex);
+			return mt_error(rv);
+		}
+		/* needed more bytes! */
+		if (in->size != toRead)
+			goto error_data;
+
+		ctx->insize += in->size;
+	} else {
 		if (in->allocated < toRead) {
 			/* need bigger input buffer */
 			if (in->allocated)
@@ -368,6 +503,112 @@ static size_t pt_read(ZSTDMT_DCtx * ctx, ZSTDMT_Buffer * in, size_t * frame)
 	return ZSTDMT_ERROR(memory_allocation);
 }
 
+/**
+ * pt_linearize - copy the mapped input of a frame to the input buffer
+ */
+static size_t pt_linearize(cwork_t * w)
+{
+	ZSTDMT_Buffer *in = &w->in;
+	size_t pos = 0;
+	int i;
+
+	if (in->allocated < in->size) {
+		void *buf;
+		if (in->allocated)
+			buf = realloc(in->buf, in->size);
+		else
+			buf = malloc(in->size);
+		if (!buf)
+			return ZSTDMT_ERROR(memory_allocation);
+		in->buf = buf;
+		in->allocated = in->size;
+	}
+
+	for (i = 0; i < w->nseg; i++) {
+		memcpy((char *)in->buf + pos, w->seg[i].buf, w->seg[i].size);
+		pos += w->seg[i].size;
+	}
+	w->nseg = 0;
+
+	return 0;
+}
+
+/**
+ * pt_decompress_user - decompress a mapped frame into a buffer of fn_alloc
+ *
+ * This works only for frames which tell their content size, otherwise
+ * the input is copied to the input buffer and 1 is returned, so that the
+ * frame can be decompressed the usual way.
+ */
+static size_t pt_decompress_user(ZSTDMT_DCtx * ctx, cwork_t * w,
+				 struct writelist *wl)
+{
+	unsigned char fhdr[ZSTD_FRAMEHEADERSIZE_MAX];
+	unsigned long long content;
+	ZSTD_outBuffer zOut;
+	size_t n = 0, result = 1;
+	int i, rv;
+
+	/* the frame header may be spread over the first pieces */
+	for (i = 0; i < w->nseg && n < sizeof(fhdr); i++) {
+		size_t len = w->seg[i].size;
+		if (len > sizeof(fhdr) - n)
+			len = sizeof(fhdr) - n;
+		memcpy(fhdr + n, w->seg[i].buf, len);
+		n += len;
+	}
+	content = ZSTD_getFrameContentSize(fhdr, n);
+	if (!ctx->fn_alloc || content == ZSTD_CONTENTSIZE_UNKNOWN
+	    || content == ZSTD_CONTENTSIZE_ERROR || content == 0
+	    || content != (size_t)content) {
+		result = pt_linearize(w);
+		return ZSTDMT_isError(result) ? result : 1;
+	}
+
+	wl->own = wl->out;
+	wl->out.size = content;
+	rv = ctx->fn_alloc(ctx->arg_write, &wl->out);
+	if (rv != 0) {
+		wl->out = wl->own;
+		return mt_error(rv);
+	}
+	wl->user = 1;
+
+	zOut.dst = wl->out.buf;
+	zOut.size = content;
+	zOut.pos = 0;
+	for (i = 0; i < w->nseg && result != 0; i++) {
+		ZSTD_inBuffer zIn;
+		zIn.src = w->seg[i].buf;
+		zIn.size = w->seg[i].size;
+		zIn.pos = 0;
+		while (zIn.pos < zIn.size) {
+			size_t pos = zOut.pos;
+			result = ZSTD_decompressStream(w->dctx, &zOut, &zIn);
+			if (ZSTD_isError(result)) {
+				zstdmt_errcode = result;
+				return ZSTDMT_ERROR(compression_library);
+			}
+			/* end of frame */
+			if (result == 0)
+				break;
+			/* more output than the frame told us */
+			if (zOut.pos == zOut.size && zOut.pos == pos)
+				return ZSTDMT_ERROR(data_error);
+		}
+	}
+	if (result != 0 || zOut.pos != content)
+		return ZSTDMT_ERROR(data_error);
+	wl->out.size = zOut.pos;
+
+	/* write result */
+	pthread_mutex_lock(&ctx->write_mutex);
+	result = pt_write(ctx, wl);
+	pthread_mutex_unlock(&ctx->write_mutex);
+
+	return result;
+}
+
 static void *pt_decompress(void *arg)
 {
 	cwork_t *w = (cwork_t *) arg;
@@ -408,7 +649,9 @@ static void *pt_decompress(void *arg)
 				result = ZSTDMT_ERROR(memory_allocation);
 				goto error_unlock;
 			}
+			wl->user = 0;
 			out = &wl->out;
+			out->handle = 0;
 			out->size = ctx->outputsize;
 			out->buf = malloc(out->size);
 			if (!out->buf) {
@@ -432,14 +675,23 @@ static void *pt_decompress(void *arg)
 		}
 
 		/* zero should not happen here! */
-		result = pt_read(ctx, in, &wl->frame);
+		result = pt_read(ctx, w, &wl->frame);
 		if (in->size == 0)
 			break;
 		if (ZSTDMT_isError(result)) {
 			goto error_lock;
 		}
 
-		zIn.size = in->allocated;
+		/* mapped input, try to decompress it without copies */
+		if (w->nseg) {
+			result = pt_decompress_user(ctx, w, wl);
+			if (ZSTDMT_isError(result))
+				goto error_lock;
+			if (result == 0)
+				continue;
+		}
+
+		zIn.size = in->size;
 		zIn.src = in->buf;
 		zIn.pos = 0;
 
@@ -541,6 +793,7 @@ static void *pt_decompress(void *arg)
 	error_lock:
 	pthread_mutex_lock(&ctx->write_mutex);
 	error_unlock:
+	pt_release(ctx, wl);
 	list_move(&wl->node, &ctx->writelist_free);
 	pthread_mutex_unlock(&ctx->write_mutex);
 	if (in->allocated)
@@ -630,6 +883,7 @@ static size_t st_decompress(void *arg)
 				ZSTDMT_Buffer wb;
 				wb.size = zOut.pos;
 				wb.buf = zOut.dst;
+				wb.handle = 0;
 				rv = ctx->fn_write(ctx->arg_write, &wb);
 				if (rv != 0) {
 					result = mt_error(rv);
@@ -707,6 +961,9 @@ size_t ZSTDMT_decompressDCtx(ZSTDMT_DCtx * ctx, ZSTDMT_RdWr_t * rdwr)
 	ctx->fn_write = rdwr->fn_write;
 	ctx->arg_read = rdwr->arg_read;
 	ctx->arg_write = rdwr->arg_write;
+	ctx->fn_map = rdwr->fn_map;
+	ctx->fn_alloc = rdwr->fn_free ? rdwr->fn_alloc : 0;
+	ctx->fn_free = rdwr->fn_free;
 
 	/**
 	 * possible valid magic's for us, we need 16 bytes, for checking
@@ -773,6 +1030,9 @@ size_t ZSTDMT_decompressDCtx(ZSTDMT_DCtx * ctx, ZSTDMT_RdWr_t * rdwr)
 		w->in.buf = in->buf;
 		w->in.size = in->size;
 		w->in.allocated = 0;
+		w->seg = 0;
+		w->nseg = 0;
+		w->segs_allocated = 0;
 		w->ctx = ctx;
 		w->dctx = ZSTD_createDStream();
 		if (!w->dctx)
@@ -794,6 +1054,9 @@ size_t ZSTDMT_decompressDCtx(ZSTDMT_DCtx * ctx, ZSTDMT_RdWr_t * rdwr)
 		w->in.buf = in->buf;
 		w->in.size = in->size;
 		w->in.allocated = 0;
+		w->seg = 0;
+		w->nseg = 0;
+		w->segs_allocated = 0;
 		w->ctx = ctx;
 		w->dctx = ZSTD_createDStream();
 		if (!w->dctx)
@@ -809,19 +1072,35 @@ size_t ZSTDMT_decompressDCtx(ZSTDMT_DCtx * ctx, ZSTDMT_RdWr_t * rdwr)
 	INIT_LIST_HEAD(&ctx->writelist_busy);
 	INIT_LIST_HEAD(&ctx->writelist_done);
 
-	/* multi threaded */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		pthread_create(&wt->pthread, NULL, pt_decompress, wt);
-	}
+	if (ctx->pool) {
+		/* queue the other workers, the first one runs right here */
+		pool_batch_t batch;
+		void *p;
 
-	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(wt->pthread, &p);
+		POOL_initBatch(&batch, ctx->pool);
+		for (t = 1; t < ctx->threads; t++) {
+			cwork_t *wt = &ctx->cwork[t];
+			POOL_submit(&batch, &wt->job, pt_decompress, wt);
+		}
+		retval_of_thread = pt_decompress(&ctx->cwork[0]);
+		p = POOL_wait(&batch);
 		if (p)
 			retval_of_thread = p;
+	} else {
+		/* multi threaded */
+		for (t = 0; t < ctx->threads; t++) {
+			cwork_t *wt = &ctx->cwork[t];
+			pthread_create(&wt->pthread, NULL, pt_decompress, wt);
+		}
+
+		/* wait for all workers */
+		for (t = 0; t < ctx->threads; t++) {
+			cwork_t *wt = &ctx->cwork[t];
+			void *p = 0;
+			pthread_join(wt->pthread, &p);
+			if (p)
+				retval_of_thread = p;
+		}
 	}
 
 	/* clean up pthread stuff */
@@ -829,6 +1108,26 @@ size_t ZSTDMT_decompressDCtx(ZSTDMT_DCtx * ctx, ZSTDMT_RdWr_t * rdwr)
 	pthread_mutex_destroy(&ctx->write_mutex);
 	pthread_mutex_destroy(&ctx->error_mutex);
 
+	/* on error, these two lists may have some entries */
+	if (retval_of_thread) {
+		struct writelist *wl;
+		struct list_head *entry;
+
+		while (!list_empty(&ctx->writelist_busy)) {
+			entry = list_first(&ctx->writelist_busy);
+			wl = list_entry(entry, struct writelist, node);
+			list_move(entry, &ctx->writelist_free);
+			pt_release(ctx, wl);
+		}
+
+		while (!list_empty(&ctx->writelist_done)) {
+			entry = list_first(&ctx->writelist_done);
+			wl = list_entry(entry, struct writelist, node);
+			list_move(entry, &ctx->writelist_free);
+			pt_release(ctx, wl);
+		}
+	}
+
 	/* clean up the buffers */
 	while (!list_empty(&ctx->writelist_free)) {
 		struct writelist *wl;
@@ -880,6 +1179,7 @@ void ZSTDMT_freeDCtx(ZSTDMT_DCtx * ctx)
 	for (t = 0; t < ctx->threads; t++) {
 		cwork_t *w = &ctx->cwork[t];
 		ZSTD_freeDStream(w->dctx);
+		free(w->seg);
 	}
 
 	if (ctx->cwork)
@@ -0,0 +1,199 @@
+
+/**
+ * Copyright (c) 2016 - 2017 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+#include <stdlib.h>
+
+#include "pool.h"
+
+/**
+ * shared worker pool
+ *
+ * - the threads are started once and live until ZSTDMT_freePool()
+ * - each thread does this:
+ *   1) get pool mutex and take the first queued job
+ *   2) release pool mutex and run the job
+ *   3) get pool mutex, account the result to the batch of the job
+ *   4) begin with step 1 again, until the pool is stopped
+ */
+
+struct ZSTDMT_Pool_s {
+
+	/* threads: 1..ZSTDMT_THREAD_MAX */
+	int threads;
+	pthread_t *pthread;
+
+	/* queued jobs, protected by mutex */
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	struct list_head queue;
+	int shutdown;
+};
+
+static void *pt_pool(void *arg)
+{
+	ZSTDMT_Pool *pool = (ZSTDMT_Pool *) arg;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		pool_job_t *job;
+		void *rv;
+
+		while (list_empty(&pool->queue) && !pool->shutdown)
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		if (list_empty(&pool->queue))
+			break;
+
+		job = list_entry(list_first(&pool->queue), pool_job_t, node);
+		list_del(&job->node);
+		pthread_mutex_unlock(&pool->mutex);
+
+		rv = job->fn(job->arg);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (rv && !job->batch->retval)
+			job->batch->retval = rv;
+		if (--job->batch->pending == 0)
+			pthread_cond_broadcast(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return 0;
+}
+
+ZSTDMT_Pool *ZSTDMT_createPool(int threads)
+{
+	ZSTDMT_Pool *pool;
+	int t;
+
+	/* check threads value */
+	if (threads < 1 || threads > ZSTDMT_THREAD_MAX)
+		return 0;
+
+	/* allocate pool */
+	pool = (ZSTDMT_Pool *) malloc(sizeof(ZSTDMT_Pool));
+	if (!pool)
+		return 0;
+
+	pool->pthread = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+	if (!pool->pthread)
+		goto err_pool;
+
+	pool->threads = 0;
+	pool->shutdown = 0;
+	INIT_LIST_HEAD(&pool->queue);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (t = 0; t < threads; t++) {
+		if (pthread_create(&pool->pthread[t], NULL, pt_pool, pool))
+			break;
+		pool->threads++;
+	}
+
+	/* we could not start a single thread */
+	if (!pool->threads) {
+		ZSTDMT_freePool(pool);
+		return 0;
+	}
+
+	return pool;
+
+	err_pool:
+	free(pool);
+	return 0;
+}
+
+int ZSTDMT_GetThreadsPool(ZSTDMT_Pool * pool)
+{
+	if (!pool)
+		return 0;
+
+	return pool->threads;
+}
+
+void ZSTDMT_freePool(ZSTDMT_Pool * pool)
+{
+	int t;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (t = 0; t < pool->threads; t++)
+		pthread_join(pool->pthread[t], 0);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->pthread);
+	free(pool);
+
+	return;
+}
+
+void POOL_initBatch(pool_batch_t * batch, ZSTDMT_Pool * pool)
+{
+	batch->pool = pool;
+	batch->pending = 0;
+	batch->retval = 0;
+}
+
+void POOL_submit(pool_batch_t * batch, pool_job_t * job,
+		 pool_fn * fn, void *arg)
+{
+	ZSTDMT_Pool *pool = batch->pool;
+
+	job->fn = fn;
+	job->arg = arg;
+	job->batch = batch;
+
+	pthread_mutex_lock(&pool->mutex);
+	batch->pending++;
+	list_add_tail(&job->node, &pool->queue);
+	pthread_cond_signal(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * POOL_wait - wait for all jobs of a batch
+ *
+ * Jobs of the batch, which are still queued, are not needed anymore:
+ * the caller did the work on its own meanwhile, so they are dropped.
+ */
+void *POOL_wait(pool_batch_t * batch)
+{
+	ZSTDMT_Pool *pool = batch->pool;
+	struct list_head *entry, *next;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (entry = list_first(&pool->queue); entry != &pool->queue;
+	     entry = next) {
+		pool_job_t *job = list_entry(entry, pool_job_t, node);
+		next = list_next(entry);
+		if (job->batch == batch) {
+			list_del(entry);
+			batch->pending--;
+		}
+	}
+	while (batch->pending)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return batch->retval;
+}
@@ -94,6 +94,7 @@ DEFINE_CEPH_FEATURE_RETIRED(17, 1, INDEP_PG_MAP, JEWEL, LUMINOUS)
 DEFINE_CEPH_FEATURE(17, 3, OS_PERF_STAT_NS)
 DEFINE_CEPH_FEATURE(18, 1, CRUSH_TUNABLES)
 DEFINE_CEPH_FEATURE_RETIRED(19, 1, CHUNKY_SCRUB, JEWEL, LUMINOUS)
+DEFINE_CEPH_FEATURE(19, 3, MSG_COMPRESSION)
 
 DEFINE_CEPH_FEATURE_RETIRED(20, 1, MON_NULLROUTE, JEWEL, LUMINOUS)
 
@@ -233,6 +234,7 @@ DEFINE_CEPH_FEATURE_DEPRECATED(63, 1, RESERVED_BROKEN, LUMINOUS) // client-facin
 	 CEPH_FEATURE_RECOVERY_RESERVATION_2 |	\
 	 CEPH_FEATURE_SERVER_NAUTILUS |		\
 	 CEPH_FEATURE_CEPHX_V2 | \
+	 CEPH_FEATURE_MSG_COMPRESSION | \
 	 0ULL)
 
 #define CEPH_FEATURES_SUPPORTED_DEFAULT  CEPH_FEATURES_ALL
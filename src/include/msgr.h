@@ -161,10 +161,22 @@ struct ceph_msg_header {
 
 	/* oldest code we think can decode this.  unknown if zero. */
 	__le16 compat_version;
-	__le16 reserved;
+	__le16 reserved;  /* CEPH_MSG_HEADER_* with MSG_COMPRESSION */
 	__le32 crc;       /* header crc32c */
 } __attribute__ ((packed));
 
+#define CEPH_MSG_HEADER_COMPRESSED (1<<0) /* data payload is compressed */
+
+/*
+ * precedes the data payload of a message sent with
+ * CEPH_MSG_HEADER_COMPRESSED; data_len in the header is the length once
+ * decompressed.
+ */
+struct ceph_msg_data_compressed {
+	__u8 alg;         /* Compressor::CompressionAlgorithm */
+	__le32 len;       /* compressed bytes that follow */
+} __attribute__ ((packed));
+
 #define CEPH_MSG_PRIO_LOW     64
 #define CEPH_MSG_PRIO_DEFAULT 127
 #define CEPH_MSG_PRIO_HIGH    196
@@ -83,6 +83,8 @@ enum {
   LIBRADOS_OP_FLAG_FADVISE_NOCACHE    = 0x40,
   // optionally support FUA (force unit access) on write requests
   LIBRADOS_OP_FLAG_FADVISE_FUA        = 0x80,
+  // compress the data of a write/write_full op before sending it
+  LIBRADOS_OP_FLAG_COMPRESS           = 0x100,
 };
 
 #if __GNUC__ >= 4
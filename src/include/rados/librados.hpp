@@ -224,6 +224,7 @@ namespace librados
     OP_FADVISE_WILLNEED = LIBRADOS_OP_FLAG_FADVISE_WILLNEED,
     OP_FADVISE_DONTNEED = LIBRADOS_OP_FLAG_FADVISE_DONTNEED,
     OP_FADVISE_NOCACHE = LIBRADOS_OP_FLAG_FADVISE_NOCACHE,
+    OP_COMPRESS = LIBRADOS_OP_FLAG_COMPRESS,
   };
 
   class CEPH_RADOS_API ObjectOperationCompletion {
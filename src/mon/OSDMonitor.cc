@@ -4500,7 +4500,9 @@ namespace {
     RECOVERY_PRIORITY, RECOVERY_OP_PRIORITY, SCRUB_PRIORITY,
     COMPRESSION_MODE, COMPRESSION_ALGORITHM, COMPRESSION_REQUIRED_RATIO,
     COMPRESSION_MAX_BLOB_SIZE, COMPRESSION_MIN_BLOB_SIZE,
-    CSUM_TYPE, CSUM_MAX_BLOCK, CSUM_MIN_BLOCK, FINGERPRINT_ALGORITHM };
+    CSUM_TYPE, CSUM_MAX_BLOCK, CSUM_MIN_BLOCK, FINGERPRINT_ALGORITHM,
+    COMPRESSION_LEVEL, RECOMPRESSION_ALGORITHM, RECOMPRESSION_LEVEL,
+    EC_COMPRESSION_ALGORITHM };
 
   std::set<osd_pool_get_choices>
     subtract_second_from_first(const std::set<osd_pool_get_choices>& first,
@@ -5090,6 +5092,10 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
       {"csum_max_block", CSUM_MAX_BLOCK},
       {"csum_min_block", CSUM_MIN_BLOCK},
       {"fingerprint_algorithm", FINGERPRINT_ALGORITHM},
+      {"compression_level", COMPRESSION_LEVEL},
+      {"recompression_algorithm", RECOMPRESSION_ALGORITHM},
+      {"recompression_level", RECOMPRESSION_LEVEL},
+      {"ec_compression_algorithm", EC_COMPRESSION_ALGORITHM},
     };
 
     typedef std::set<osd_pool_get_choices> choices_set_t;
@@ -5297,6 +5303,10 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	  case CSUM_MAX_BLOCK:
 	  case CSUM_MIN_BLOCK:
 	  case FINGERPRINT_ALGORITHM:
+	  case COMPRESSION_LEVEL:
+	  case RECOMPRESSION_ALGORITHM:
+	  case RECOMPRESSION_LEVEL:
+	  case EC_COMPRESSION_ALGORITHM:
             pool_opts_t::key_t key = pool_opts_t::get_opt_desc(i->first).key;
             if (p->opts.is_set(key)) {
               if(*it == CSUM_TYPE) {
@@ -5446,6 +5456,10 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	  case CSUM_MAX_BLOCK:
 	  case CSUM_MIN_BLOCK:
 	  case FINGERPRINT_ALGORITHM:
+	  case COMPRESSION_LEVEL:
+	  case RECOMPRESSION_ALGORITHM:
+	  case RECOMPRESSION_LEVEL:
+	  case EC_COMPRESSION_ALGORITHM:
 	    for (i = ALL_CHOICES.begin(); i != ALL_CHOICES.end(); ++i) {
 	      if (i->second == *it)
 		break;
@@ -6796,6 +6810,33 @@ bool OSDMonitor::prepare_unset_flag(MonOpRequestRef op, int flag)
   return true;
 }
 
+// is level within the range of alg, or of the default algorithm of
+// bluestore (re)compression if alg is empty?
+static bool check_compression_level(bool recompression, string alg,
+                                    int64_t level, ostream& ss)
+{
+  const char *var = recompression ? "recompression_level" :
+                                    "compression_level";
+  if (alg.empty()) {
+    alg = recompression ?
+      g_conf().get_val<string>("bluestore_recompression_algorithm") :
+      g_conf()->bluestore_compression_algorithm;
+  }
+  auto a = Compressor::get_comp_alg_type(alg);
+  int min, max;
+  if (!a || !Compressor::get_level_range(*a, &min, &max)) {
+    ss << var << " " << level << " cannot be used, compression algorithm '"
+       << alg << "' has no levels";
+    return false;
+  }
+  if (level < min || level > max) {
+    ss << var << " " << level << " is out of range for " << alg << " ("
+       << min << "-" << max << ")";
+    return false;
+  }
+  return true;
+}
+
 int OSDMonitor::prepare_command_pool_set(const cmdmap_t& cmdmap,
                                          stringstream& ss)
 {
@@ -7142,6 +7183,11 @@ int OSDMonitor::prepare_command_pool_set(const cmdmap_t& cmdmap,
       return -EINVAL;
     }
     if (val == "true" || (interr.empty() && n == 1)) {
+      if (p.opts.is_set(pool_opts_t::EC_COMPRESSION_ALGORITHM)) {
+	ss << "ec overwrites cannot be enabled for a pool with an "
+	   << "ec_compression_algorithm";
+	return -EINVAL;
+      }
 	p.flags |= pg_pool_t::FLAG_EC_OVERWRITES;
     } else if (val == "false" || (interr.empty() && n == 0)) {
       ss << "ec overwrites cannot be disabled once enabled";
@@ -7259,14 +7305,51 @@ int OSDMonitor::prepare_command_pool_set(const cmdmap_t& cmdmap,
 	  return -EINVAL;
         }
       }
-    } else if (var == "compression_algorithm") {
+    } else if (var == "compression_algorithm" ||
+               var == "recompression_algorithm") {
       if (!unset) {
         auto alg = Compressor::get_comp_alg_type(val);
         if (!alg) {
-          ss << "unrecognized compression_algorithm '" << val << "'";
+          ss << "unrecognized " << var << " '" << val << "'";
 	  return -EINVAL;
         }
       }
+      // the pool's level has to suit the algorithm it ends up with
+      bool recomp = var == "recompression_algorithm";
+      int level = 0;
+      p.opts.get(recomp ? pool_opts_t::RECOMPRESSION_LEVEL :
+                          pool_opts_t::COMPRESSION_LEVEL, &level);
+      if (level != 0 &&
+          !check_compression_level(recomp, unset ? string() : val, level, ss)) {
+        return -EINVAL;
+      }
+    } else if (var == "ec_compression_algorithm") {
+      if (!p.is_erasure()) {
+	ss << "ec_compression_algorithm can only be set for an erasure coded pool";
+	return -EINVAL;
+      }
+      if (p.allows_ecoverwrites()) {
+	ss << "ec_compression_algorithm cannot be set for a pool with ec "
+	   << "overwrites enabled";
+	return -EINVAL;
+      }
+      if (osdmap.require_osd_release < CEPH_RELEASE_NAUTILUS) {
+	ss << "ec_compression_algorithm requires require_osd_release >= "
+	   << "nautilus";
+	return -EPERM;
+      }
+      if (unset) {
+	// objects compressed so far would turn unreadable once overwrites
+	// are enabled
+	ss << "ec_compression_algorithm cannot be unset, set it to none to "
+	   << "stop compressing new objects";
+	return -EINVAL;
+      }
+      auto alg = Compressor::get_comp_alg_type(val);
+      if (!alg) {
+	ss << "unrecognized ec_compression_algorithm '" << val << "'";
+	return -EINVAL;
+      }
     } else if (var == "compression_required_ratio") {
       if (floaterr.length()) {
         ss << "error parsing float value '" << val << "': " << floaterr;
@@ -7285,6 +7368,23 @@ int OSDMonitor::prepare_command_pool_set(const cmdmap_t& cmdmap,
       //preserve csum_type numeric value
       n = t;
       interr.clear(); 
+    } else if (var == "compression_level" ||
+               var == "recompression_level") {
+      if (interr.length()) {
+        ss << "error parsing int value '" << val << "': " << interr;
+        return -EINVAL;
+      }
+      if (!unset && n != 0) {
+        // the level is that of the algorithm the pool (or, failing that,
+        // the default configuration) selects
+        string alg;
+        bool recomp = var == "recompression_level";
+        p.opts.get(recomp ? pool_opts_t::RECOMPRESSION_ALGORITHM :
+                            pool_opts_t::COMPRESSION_ALGORITHM, &alg);
+        if (!check_compression_level(recomp, alg, n, ss)) {
+          return -EINVAL;
+        }
+      }
     } else if (var == "compression_max_blob_size" ||
                var == "compression_min_blob_size" ||
                var == "csum_max_block" ||
@@ -76,6 +76,8 @@ ProtocolV1::ProtocolV1(AsyncConnection *connection)
       peer_global_seq(0),
       msg_left(0),
       cur_msg_size(0),
+      tx_compress_min_size(0),
+      rx_compressed_alg(0),
       replacing(false),
       is_reset_from_peer(false),
       once_ready(false),
@@ -279,6 +281,67 @@ void ProtocolV1::prepare_send_message(uint64_t features, Message *m,
   bl.append(m->get_data());
 }
 
+void ProtocolV1::setup_compression() {
+  tx_compressor.reset();
+  if (!connection->has_features(CEPH_FEATUREMASK_MSG_COMPRESSION)) {
+    return;
+  }
+  const auto mode = cct->_conf.get_val<std::string>("ms_compress_mode");
+  if (mode == "all" ||
+      (mode == "osd" && messenger->get_mytype() == CEPH_ENTITY_TYPE_OSD &&
+       connection->peer_type == CEPH_ENTITY_TYPE_OSD)) {
+    const auto alg = cct->_conf.get_val<std::string>("ms_compress_algorithm");
+    tx_compressor = Compressor::create(cct, alg);
+    if (!tx_compressor) {
+      lderr(cct) << __func__ << " can't load compressor " << alg
+                 << ", sending data uncompressed" << dendl;
+      return;
+    }
+    tx_compress_min_size = cct->_conf.get_val<uint64_t>("ms_compress_min_size");
+    ldout(cct, 10) << __func__ << " compressing data of at least "
+                   << tx_compress_min_size << " bytes with " << alg << dendl;
+  }
+}
+
+// replace the data payload at the end of bl with its compressed form,
+// unless that does not make it any smaller
+bool ProtocolV1::compress_message_data(ceph_msg_header &header,
+                                       bufferlist &bl) {
+  unsigned data_len = le32_to_cpu(header.data_len);
+  unsigned data_off = bl.length() - data_len;
+  bufferlist raw, compressed;
+  raw.substr_of(bl, data_off, data_len);
+  int r = tx_compressor->compress(raw, compressed);
+  if (r < 0 ||
+      compressed.length() + sizeof(ceph_msg_data_compressed) >= data_len) {
+    ldout(cct, 20) << __func__ << " sending " << data_len
+                   << " bytes uncompressed, r=" << r << dendl;
+    return false;
+  }
+
+  ceph_msg_data_compressed c;
+  c.alg = tx_compressor->get_type();
+  c.len = init_le32(compressed.length());
+  bufferlist wire;
+  wire.substr_of(bl, 0, data_off);
+  wire.append((char *)&c, sizeof(c));
+  wire.claim_append(compressed);
+  bl.swap(wire);
+
+  header.reserved =
+      init_le16(le16_to_cpu(header.reserved) | CEPH_MSG_HEADER_COMPRESSED);
+  if (messenger->crcflags & MSG_CRC_HEADER) {
+    header.crc = ceph_crc32c(0, (unsigned char *)&header,
+                             sizeof(header) - sizeof(header.crc));
+  }
+  ldout(cct, 20) << __func__ << " compressed " << data_len << " bytes to "
+                 << le32_to_cpu(c.len) << dendl;
+  connection->logger->inc(l_msgr_send_compressed_raw_bytes, data_len);
+  connection->logger->inc(l_msgr_send_compressed_wire_bytes,
+                          le32_to_cpu(c.len));
+  return true;
+}
+
 void ProtocolV1::send_keepalive() {
   ldout(cct, 10) << __func__ << dendl;
   std::lock_guard<std::mutex> l(connection->write_lock);
@@ -416,6 +479,8 @@ bool ProtocolV1::is_queued() { return !out_q.empty(); }
 void ProtocolV1::ready() {
   ldout(cct, 25) << __func__ << dendl;
 
+  setup_compression();
+
   // make sure no pending tick timer
   if (connection->last_tick_id) {
     connection->center->delete_time_event(connection->last_tick_id);
@@ -777,6 +842,13 @@ void ProtocolV1::read_message_data_prepare() {
   unsigned data_len = le32_to_cpu(current_header.data_len);
   unsigned data_off = le32_to_cpu(current_header.data_off);
 
+  if (data_len &&
+      (le16_to_cpu(current_header.reserved) & CEPH_MSG_HEADER_COMPRESSED)) {
+    READ(sizeof(ceph_msg_data_compressed),
+         &ProtocolV1::handle_message_data_compressed);
+    return;
+  }
+
   if (data_len) {
     // get a buffer
     map<ceph_tid_t, pair<bufferlist, int> >::iterator p =
@@ -803,6 +875,36 @@ void ProtocolV1::read_message_data_prepare() {
   read_message_data();
 }
 
+void ProtocolV1::handle_message_data_compressed(char *buffer, int r) {
+  ldout(cct, 20) << __func__ << " r=" << r << dendl;
+
+  if (r < 0) {
+    ldout(cct, 1) << __func__ << " read compressed data header failed"
+                  << dendl;
+    fault();
+    return;
+  }
+
+  ceph_msg_data_compressed c = *((ceph_msg_data_compressed *)buffer);
+  unsigned len = le32_to_cpu(c.len);
+  if (!connection->has_features(CEPH_FEATUREMASK_MSG_COMPRESSION) ||
+      len == 0 || len >= le32_to_cpu(current_header.data_len)) {
+    ldout(cct, 0) << __func__ << " bad compressed data, " << len
+                  << " bytes for " << current_header.data_len << dendl;
+    fault();
+    return;
+  }
+
+  // read it into a buffer of its own, it is decompressed into one which
+  // matches the data alignment once it is all here
+  rx_compressed_alg = c.alg;
+  data_buf.push_back(buffer::create(len));
+  data_blp = data_buf.begin();
+  msg_left = len;
+
+  read_message_data();
+}
+
 void ProtocolV1::read_message_data() {
   ldout(cct, 20) << __func__ << " msg_left=" << msg_left << dendl;
 
@@ -831,9 +933,79 @@ void ProtocolV1::handle_message_data(char *buffer, int r) {
   data.append(bp, 0, read_len);
   msg_left -= read_len;
 
+  if (msg_left == 0 &&
+      (le16_to_cpu(current_header.reserved) & CEPH_MSG_HEADER_COMPRESSED)) {
+    if (decompress_message_data() < 0) {
+      fault();
+      return;
+    }
+  }
+
   read_message_data();
 }
 
+int ProtocolV1::decompress_message_data() {
+  if (!rx_compressor || rx_compressor->get_type() != rx_compressed_alg) {
+    rx_compressor = Compressor::create(cct, rx_compressed_alg);
+    if (!rx_compressor) {
+      ldout(cct, 0) << __func__ << " can't load decompressor "
+                    << (int)rx_compressed_alg << dendl;
+      return -EOPNOTSUPP;
+    }
+  }
+
+  unsigned data_len = le32_to_cpu(current_header.data_len);
+  unsigned data_off = le32_to_cpu(current_header.data_off);
+  bufferlist raw;
+  map<ceph_tid_t, pair<bufferlist, int> >::iterator rxb =
+      connection->rx_buffers.find(current_header.tid);
+  if (rxb != connection->rx_buffers.end()) {
+    ldout(cct, 10) << __func__ << " decompressing into rx buffer v "
+                   << rxb->second.second << " len "
+                   << rxb->second.first.length() << dendl;
+    raw = rxb->second.first;
+    if (raw.length() < data_len)
+      raw.push_back(buffer::create(data_len - raw.length()));
+  } else {
+    alloc_aligned_buffer(raw, data_len, data_off);
+  }
+
+  auto p = data.cbegin();
+  int r;
+  if (raw.get_num_buffers() == 1) {
+    r = rx_compressor->decompress_into(p, data.length(), raw.c_str(),
+                                       data_len);
+  } else {
+    // c_str() would rebuild raw away from the rx buffer
+    bufferptr tmp = buffer::create(data_len);
+    r = rx_compressor->decompress_into(p, data.length(), tmp.c_str(),
+                                       data_len);
+    if (r == (int)data_len) {
+      raw.copy_in(0, data_len, tmp.c_str());
+    }
+  }
+  if (r != (int)data_len) {
+    ldout(cct, 0) << __func__ << " decompressed " << data.length()
+                  << " bytes to " << r << ", expected " << data_len << dendl;
+    return -EIO;
+  }
+  connection->logger->inc(l_msgr_recv_compressed_raw_bytes, data_len);
+  connection->logger->inc(l_msgr_recv_compressed_wire_bytes, data.length());
+  data.clear();
+  data.substr_of(raw, 0, data_len);
+
+  // the crcs and the signature are those of the message as it was before
+  // its data got compressed
+  current_header.reserved = init_le16(
+      le16_to_cpu(current_header.reserved) & ~CEPH_MSG_HEADER_COMPRESSED);
+  if (messenger->crcflags & MSG_CRC_HEADER) {
+    current_header.crc =
+        ceph_crc32c(0, (unsigned char *)&current_header,
+                    sizeof(current_header) - sizeof(current_header.crc));
+  }
+  return 0;
+}
+
 void ProtocolV1::read_message_footer() {
   ldout(cct, 20) << __func__ << dendl;
 
@@ -1088,8 +1260,16 @@ ssize_t ProtocolV1::write_message(Message *m, bufferlist &bl, bool more) {
     }
   }
 
+  // what goes on the wire only differs from the message if its data is
+  // compressed
+  ceph_msg_header wire_header = header;
+  if (tx_compressor && header.data_len > 0 &&
+      le32_to_cpu(header.data_len) >= tx_compress_min_size) {
+    compress_message_data(wire_header, bl);
+  }
+
   connection->outcoming_bl.append(CEPH_MSGR_TAG_MSG);
-  connection->outcoming_bl.append((char *)&header, sizeof(header));
+  connection->outcoming_bl.append((char *)&wire_header, sizeof(wire_header));
 
   ldout(cct, 20) << __func__ << " sending message type=" << header.type
                  << " src " << entity_name_t(header.src)
@@ -5,6 +5,7 @@
 #include <map>
 
 #include "AsyncConnection.h"
+#include "compressor/Compressor.h"
 #include "include/buffer.h"
 #include "include/msgr.h"
 
@@ -118,6 +119,12 @@ protected:
   bufferlist::iterator data_blp;
   bufferlist front, middle, data;
 
+  // data payloads compressed on the wire, see CEPH_FEATURE_MSG_COMPRESSION
+  CompressorRef tx_compressor;  // null if we send them as they are
+  uint64_t tx_compress_min_size;
+  CompressorRef rx_compressor;  // the last one the peer compressed with
+  uint8_t rx_compressed_alg;    // of the message being read
+
   bool replacing;  // when replacing process happened, we will reply connect
                    // side with RETRY tag and accept side will clear replaced
                    // connection. So when connect side reissue connect_msg,
@@ -147,8 +154,10 @@ protected:
   void read_message_middle();
   void handle_message_middle(char *buffer, int r);
   void read_message_data_prepare();
+  void handle_message_data_compressed(char *buffer, int r);
   void read_message_data();
   void handle_message_data(char *buffer, int r);
+  int decompress_message_data();
   void read_message_footer();
   void handle_message_footer(char *buffer, int r);
 
@@ -158,6 +167,8 @@ protected:
   Message *_get_next_outgoing(bufferlist *bl);
 
   void prepare_send_message(uint64_t features, Message *m, bufferlist &bl);
+  void setup_compression();
+  bool compress_message_data(ceph_msg_header &header, bufferlist &bl);
   ssize_t write_message(Message *m, bufferlist &bl, bool more);
 
   void requeue_sent();
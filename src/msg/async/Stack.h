@@ -194,6 +194,10 @@ enum {
   l_msgr_send_bytes,
   l_msgr_created_connections,
   l_msgr_active_connections,
+  l_msgr_send_compressed_raw_bytes,
+  l_msgr_send_compressed_wire_bytes,
+  l_msgr_recv_compressed_raw_bytes,
+  l_msgr_recv_compressed_wire_bytes,
 
   l_msgr_running_total_time,
   l_msgr_running_send_time,
@@ -234,6 +238,10 @@ class Worker {
     plb.add_u64_counter(l_msgr_send_bytes, "msgr_send_bytes", "Network sent bytes", NULL, 0, unit_t(UNIT_BYTES));
     plb.add_u64_counter(l_msgr_active_connections, "msgr_active_connections", "Active connection number");
     plb.add_u64_counter(l_msgr_created_connections, "msgr_created_connections", "Created connection number");
+    plb.add_u64_counter(l_msgr_send_compressed_raw_bytes, "msgr_send_compressed_raw_bytes", "Data payload bytes compressed for sending", NULL, 0, unit_t(UNIT_BYTES));
+    plb.add_u64_counter(l_msgr_send_compressed_wire_bytes, "msgr_send_compressed_wire_bytes", "Compressed data payload bytes sent", NULL, 0, unit_t(UNIT_BYTES));
+    plb.add_u64_counter(l_msgr_recv_compressed_raw_bytes, "msgr_recv_compressed_raw_bytes", "Data payload bytes received compressed, once decompressed", NULL, 0, unit_t(UNIT_BYTES));
+    plb.add_u64_counter(l_msgr_recv_compressed_wire_bytes, "msgr_recv_compressed_wire_bytes", "Compressed data payload bytes received", NULL, 0, unit_t(UNIT_BYTES));
 
     plb.add_time(l_msgr_running_total_time, "msgr_running_total_time", "The total time of thread running");
     plb.add_time(l_msgr_running_send_time, "msgr_running_send_time", "The total time of message sending");
@@ -104,6 +104,18 @@ public:
   double get_dispatch_queue_max_age(utime_t now) override {
     return dispatch_queue.get_max_age(now);
   }
+
+  Policy get_policy(int t) override {
+    Policy p = SimplePolicyMessenger::get_policy(t);
+    // Pipe does not compress message data
+    p.features_supported &= ~CEPH_FEATURE_MSG_COMPRESSION;
+    return p;
+  }
+  Policy get_default_policy() override {
+    Policy p = SimplePolicyMessenger::get_default_policy();
+    p.features_supported &= ~CEPH_FEATURE_MSG_COMPRESSION;
+    return p;
+  }
   /** @} Accessors */
 
   /**
@@ -31,7 +31,8 @@ extern "C" {
 #include "msg/Messenger.h"
 #include "auth/AuthSessionHandler.h"
 
-#define XIO_ALL_FEATURES (CEPH_FEATURES_ALL)
+/* xio does not compress message data */
+#define XIO_ALL_FEATURES (CEPH_FEATURES_ALL & ~CEPH_FEATURE_MSG_COMPRESSION)
 
 
 #define XIO_NOP_TAG_MARKDOWN 0x0001
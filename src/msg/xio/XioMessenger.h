@@ -112,6 +112,12 @@ public:
   virtual void set_cluster_protocol(int p)
     { }
 
+  virtual Policy get_policy(int t) override {
+    Policy p = SimplePolicyMessenger::get_policy(t);
+    p.features_supported &= ~CEPH_FEATURE_MSG_COMPRESSION;
+    return p;
+  }
+
   virtual int bind(const entity_addr_t& addr);
 
   virtual int rebind(const set<int>& avoid_ports);
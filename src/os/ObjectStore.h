@@ -18,6 +18,7 @@
 #include "include/buffer.h"
 #include "include/types.h"
 #include "include/stringify.h"
+#include "compressor/CompressedWrite.h"
 #include "osd/osd_types.h"
 #include "common/TrackedOp.h"
 #include "common/WorkQueue.h"
@@ -351,6 +352,8 @@ public:
       OP_COLL_SET_BITS = 42, // cid, bits
 
       OP_MERGE_COLLECTION = 43, // cid, destination
+
+      OP_WRITE_COMPRESSED = 44, // cid, oid, offset, len, compressed_write_t
     };
 
     // Transaction hint type
@@ -618,6 +621,7 @@ public:
       case OP_OMAP_RMKEYRANGE:
       case OP_OMAP_SETHEADER:
       case OP_WRITE:
+      case OP_WRITE_COMPRESSED:
       case OP_ZERO:
       case OP_TRUNCATE:
       case OP_SETALLOCHINT:
@@ -915,6 +919,10 @@ public:
 	using ceph::decode;
         decode(bl, data_bl_p);
       }
+      void decode_compressed_write(compressed_write_t& cw) {
+	using ceph::decode;
+        decode(cw, data_bl_p);
+      }
       void decode_attrset(map<string,bufferptr>& aset) {
 	using ceph::decode;
         decode(aset, data_bl_p);
@@ -1047,6 +1055,28 @@ public:
       }
       data.ops++;
     }
+    /**
+     * Write data compressed by ObjectStore::compress_write()
+     *
+     * Same as write() with the raw data, except that a store which
+     * compresses the way the data was compressed can keep it as is.
+     */
+    void write_compressed(const coll_t& cid, const ghobject_t& oid,
+			  uint64_t off, uint64_t len,
+			  const compressed_write_t& cw, uint32_t flags = 0) {
+      using ceph::encode;
+      Op* _op = _get_next_op();
+      _op->op = OP_WRITE_COMPRESSED;
+      _op->cid = _get_coll_id(cid);
+      _op->oid = _get_object_id(oid);
+      _op->off = off;
+      _op->len = len;
+      encode(cw, data_bl);
+
+      ceph_assert(len == cw.get_length());
+      data.fadvise_flags = data.fadvise_flags | flags;
+      data.ops++;
+    }
     /**
      * zero out the indicated byte range within an object. Some
      * ObjectStore instances may optimize this to release the
@@ -1481,6 +1511,7 @@ public:
   virtual void generate_db_histogram(Formatter *f) { }
   virtual void flush_cache() { }
   virtual void dump_perf_counters(Formatter *f) {}
+  virtual void dump_recompression_status(Formatter *f) {}
 
   virtual string get_type() = 0;
 
@@ -1705,6 +1736,51 @@ public:
    virtual int fiemap(CollectionHandle& c, const ghobject_t& oid,
 		      uint64_t offset, size_t len, map<uint64_t, uint64_t>& destmap) = 0;
 
+  /**
+   * compress_write -- compress the data of a write the way this store would
+   *
+   * The result can be handed to Transaction::write_compressed(), on this
+   * or another store, in place of the raw data.
+   *
+   * @param c collection for object
+   * @param oid oid of object
+   * @param offset location offset of the write
+   * @param bl data of the write
+   * @param cw output compressed write
+   * @returns number of compressed segments (0 if compression did not
+   *          help), or negative error code (-EOPNOTSUPP if this store
+   *          does not compress the object).
+   */
+   virtual int compress_write(CollectionHandle& c, const ghobject_t& oid,
+			      uint64_t offset, const bufferlist& bl,
+			      compressed_write_t *cw) {
+     return -EOPNOTSUPP;
+   }
+
+  /**
+   * read_compressed -- read a byte range of an object the way it is stored
+   *
+   * Data this store keeps compressed, in pieces that can be handed on as
+   * they are, is returned compressed; the rest is read as usual.  The
+   * result can be handed to Transaction::write_compressed() on another
+   * store.
+   *
+   * @param c collection for object
+   * @param oid oid of object
+   * @param offset location offset of first byte to be read
+   * @param len number of bytes to be read
+   * @param cw output compressed write, as much as there is of the range
+   * @param op_flags is CEPH_OSD_OP_FLAG_*
+   * @returns number of compressed segments (0 if there are none, and cw
+   *          is left empty), or negative error code (-EOPNOTSUPP if this
+   *          store does not compress).
+   */
+   virtual int read_compressed(CollectionHandle& c, const ghobject_t& oid,
+			       uint64_t offset, size_t len,
+			       compressed_write_t *cw, uint32_t op_flags = 0) {
+     return -EOPNOTSUPP;
+   }
+
   /**
    * getattr -- get an xattr of an object
    *
@@ -45,7 +45,26 @@ void ObjectStore::Transaction::dump(ceph::Formatter *f)
         f->dump_unsigned("bufferlist length", bl.length());
       }
       break;
-      
+
+    case Transaction::OP_WRITE_COMPRESSED:
+      {
+        coll_t cid = i.get_cid(op->cid);
+        ghobject_t oid = i.get_oid(op->oid);
+        uint64_t off = op->off;
+        uint64_t len = op->len;
+	compressed_write_t cw;
+	i.decode_compressed_write(cw);
+	f->dump_string("op_name", "write_compressed");
+	f->dump_stream("collection") << cid;
+	f->dump_stream("oid") << oid;
+        f->dump_unsigned("length", len);
+        f->dump_unsigned("offset", off);
+	f->open_object_section("compressed_write");
+	cw.dump(f);
+	f->close_section();
+      }
+      break;
+
     case Transaction::OP_ZERO:
       {
         coll_t cid = i.get_cid(op->cid);
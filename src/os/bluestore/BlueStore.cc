@@ -72,6 +72,7 @@ const string PREFIX_DEFERRED = "L";  // id -> deferred_transaction_t
 const string PREFIX_ALLOC = "B";   // u64 offset -> u64 length (freelist)
 const string PREFIX_ALLOC_BITMAP = "b"; // (see BitmapFreelistManager)
 const string PREFIX_SHARED_BLOB = "X"; // u64 offset -> shared_blob_t
+const string PREFIX_COMPRESSION_DICT = "D"; // u32 id -> bluestore_compression_dict_t
 
 // write a label in the first block.  always use this size.  note that
 // bluefs makes a matching assumption about the location of its
@@ -574,8 +575,10 @@ ostream& operator<<(ostream& out, const BlueStore::Buffer& b)
   out << "buffer(" << &b << " space " << b.space << " 0x" << std::hex
       << b.offset << "~" << b.length << std::dec
       << " " << BlueStore::Buffer::get_state_name(b.state);
-  if (b.flags)
-    out << " " << BlueStore::Buffer::get_flag_name(b.flags);
+  for (unsigned f = 1; f <= b.flags; f <<= 1) {
+    if (b.flags & f)
+      out << " " << BlueStore::Buffer::get_flag_name(f);
+  }
   return out << ")";
 }
 
@@ -879,7 +882,7 @@ void BlueStore::LRUCache::_audit(const char *when)
   dout(10) << __func__ << " " << when << " start" << dendl;
   uint64_t s = 0;
   for (auto i = buffer_lru.begin(); i != buffer_lru.end(); ++i) {
-    s += i->length;
+    s += i->cache_length();
   }
   if (s != buffer_size) {
     derr << __func__ << " buffer_size " << buffer_size << " actual " << s
@@ -956,8 +959,8 @@ void BlueStore::TwoQCache::_add_buffer(Buffer *b, int level, Buffer *near)
     }
   }
   if (!b->is_empty()) {
-    buffer_bytes += b->length;
-    buffer_list_bytes[b->cache_private] += b->length;
+    buffer_bytes += b->cache_length();
+    buffer_list_bytes[b->cache_private] += b->cache_length();
   }
 }
 
@@ -965,10 +968,10 @@ void BlueStore::TwoQCache::_rm_buffer(Buffer *b)
 {
   dout(20) << __func__ << " " << *b << dendl;
  if (!b->is_empty()) {
-    ceph_assert(buffer_bytes >= b->length);
-    buffer_bytes -= b->length;
-    ceph_assert(buffer_list_bytes[b->cache_private] >= b->length);
-    buffer_list_bytes[b->cache_private] -= b->length;
+    ceph_assert(buffer_bytes >= b->cache_length());
+    buffer_bytes -= b->cache_length();
+    ceph_assert(buffer_list_bytes[b->cache_private] >= b->cache_length());
+    buffer_list_bytes[b->cache_private] -= b->cache_length();
   }
   switch (b->cache_private) {
   case BUFFER_WARM_IN:
@@ -1008,8 +1011,8 @@ void BlueStore::TwoQCache::_move_buffer(Cache *srcc, Buffer *b)
     ceph_abort_msg("bad cache_private");
   }
   if (!b->is_empty()) {
-    buffer_bytes += b->length;
-    buffer_list_bytes[b->cache_private] += b->length;
+    buffer_bytes += b->cache_length();
+    buffer_list_bytes[b->cache_private] += b->cache_length();
   }
 }
 
@@ -1070,12 +1073,13 @@ void BlueStore::TwoQCache::_trim(uint64_t onode_max, uint64_t buffer_max)
       Buffer *b = &*p;
       ceph_assert(b->is_clean());
       dout(20) << __func__ << " buffer_warm_in -> out " << *b << dendl;
-      ceph_assert(buffer_bytes >= b->length);
-      buffer_bytes -= b->length;
-      ceph_assert(buffer_list_bytes[BUFFER_WARM_IN] >= b->length);
-      buffer_list_bytes[BUFFER_WARM_IN] -= b->length;
-      to_evict_bytes -= b->length;
-      evicted += b->length;
+      uint32_t len = b->cache_length();
+      ceph_assert(buffer_bytes >= len);
+      buffer_bytes -= len;
+      ceph_assert(buffer_list_bytes[BUFFER_WARM_IN] >= len);
+      buffer_list_bytes[BUFFER_WARM_IN] -= len;
+      to_evict_bytes -= len;
+      evicted += len;
       b->state = Buffer::STATE_EMPTY;
       b->data.clear();
       buffer_warm_in.erase(buffer_warm_in.iterator_to(*b));
@@ -1104,8 +1108,8 @@ void BlueStore::TwoQCache::_trim(uint64_t onode_max, uint64_t buffer_max)
       dout(20) << __func__ << " buffer_hot rm " << *b << dendl;
       ceph_assert(b->is_clean());
       // adjust evict size before buffer goes invalid
-      to_evict_bytes -= b->length;
-      evicted += b->length;
+      to_evict_bytes -= b->cache_length();
+      evicted += b->cache_length();
       b->space->_rm_buffer(this, b);
     }
 
@@ -1177,7 +1181,7 @@ void BlueStore::TwoQCache::_audit(const char *when)
   dout(10) << __func__ << " " << when << " start" << dendl;
   uint64_t s = 0;
   for (auto i = buffer_hot.begin(); i != buffer_hot.end(); ++i) {
-    s += i->length;
+    s += i->cache_length();
   }
 
   uint64_t hot_bytes = s;
@@ -1190,7 +1194,7 @@ void BlueStore::TwoQCache::_audit(const char *when)
   }
 
   for (auto i = buffer_warm_in.begin(); i != buffer_warm_in.end(); ++i) {
-    s += i->length;
+    s += i->cache_length();
   }
 
   uint64_t warm_in_bytes = s - hot_bytes;
@@ -1245,6 +1249,11 @@ int BlueStore::BufferSpace::_discard(Cache* cache, uint32_t offset, uint32_t len
     if (b->cache_private > cache_private) {
       cache_private = b->cache_private;
     }
+    if (b->flags & Buffer::FLAG_COMPRESSED) {
+      // can't be cut, drop it as a whole
+      _rm_buffer(cache, i++);
+      continue;
+    }
     if (b->offset < offset) {
       int64_t front = offset - b->offset;
       if (b->end() > end) {
@@ -1312,7 +1321,9 @@ void BlueStore::BufferSpace::read(
   res.clear();
   res_intervals.clear();
   uint32_t want_bytes = length;
+  uint32_t want_off = offset;
   uint32_t end = offset + length;
+  interval_set<uint32_t> compressed;
 
   {
     std::lock_guard<std::recursive_mutex> l(cache->lock);
@@ -1321,6 +1332,15 @@ void BlueStore::BufferSpace::read(
          ++i) {
       Buffer *b = i->second.get();
       ceph_assert(b->end() > offset);
+      if (b->flags & Buffer::FLAG_COMPRESSED) {
+	// see read_compressed(), which counts these as hits
+	if (b->is_clean()) {
+	  uint32_t s = std::max(b->offset, want_off);
+	  uint32_t e = std::min(b->end(), end);
+	  compressed.union_insert(s, e - s);
+	}
+	continue;
+      }
 
       bool val = false;
       if (flags & BYPASS_CLEAN_CACHE)
@@ -1370,10 +1390,41 @@ void BlueStore::BufferSpace::read(
   uint64_t hit_bytes = res_intervals.size();
   ceph_assert(hit_bytes <= want_bytes);
   uint64_t miss_bytes = want_bytes - hit_bytes;
+  if (!compressed.empty()) {
+    interval_set<uint32_t> both;
+    both.intersection_of(compressed, res_intervals);
+    miss_bytes -= compressed.size() - both.size();
+  }
   cache->logger->inc(l_bluestore_buffer_hit_bytes, hit_bytes);
   cache->logger->inc(l_bluestore_buffer_miss_bytes, miss_bytes);
 }
 
+bool BlueStore::BufferSpace::read_compressed(
+  Cache* cache,
+  uint32_t offset,
+  uint32_t length,
+  uint32_t *b_off,
+  uint32_t *b_len,
+  bufferlist *bl)
+{
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  for (auto i = _data_lower_bound(offset);
+       i != buffer_map.end() && i->first <= offset;
+       ++i) {
+    Buffer *b = i->second.get();
+    if ((b->flags & Buffer::FLAG_COMPRESSED) && b->is_clean() &&
+	b->end() >= offset + length) {
+      cache->_touch_buffer(b);
+      *b_off = b->offset;
+      *b_len = b->length;
+      *bl = b->data;
+      cache->logger->inc(l_bluestore_buffer_compressed_hit_bytes, length);
+      return true;
+    }
+  }
+  return false;
+}
+
 void BlueStore::BufferSpace::_finish_write(Cache* cache, uint64_t seq)
 {
   auto i = writing.begin();
@@ -1515,6 +1566,19 @@ void BlueStore::OnodeSpace::clear()
   onode_map.clear();
 }
 
+bool BlueStore::OnodeSpace::evict(const ghobject_t& oid)
+{
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  auto p = onode_map.find(oid);
+  if (p == onode_map.end() || p->second->nref > 1) {
+    return false;
+  }
+  ldout(cache->cct, 30) << __func__ << " " << oid << dendl;
+  cache->_rm_onode(p->second);
+  onode_map.erase(p);
+  return true;
+}
+
 bool BlueStore::OnodeSpace::empty()
 {
   std::lock_guard<std::recursive_mutex> l(cache->lock);
@@ -3707,6 +3771,76 @@ void BlueStore::MempoolThread::_balance_cache_pri(int64_t *mem_avail,
 
 // =======================================================
 
+// RecompressThread
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.RecompressThread(" << this << ") "
+
+void *BlueStore::RecompressThread::entry()
+{
+  Mutex::Locker l(lock);
+  while (!stop) {
+    utime_t wait;
+    wait += store->cct->_conf.get_val<double>(
+      "bluestore_recompression_interval");
+    cond.WaitInterval(lock, wait);
+    if (stop) {
+      break;
+    }
+    lock.Unlock();
+    store->recompress_cold_data();
+    lock.Lock();
+  }
+  stop = false;
+  return NULL;
+}
+
+bool BlueStore::RecompressThread::throttle(uint64_t bytes)
+{
+  Mutex::Locker l(lock);
+  uint64_t rate = store->cct->_conf.get_val<Option::size_t>(
+    "bluestore_recompression_bytes_per_sec");
+  if (rate && bytes && !stop) {
+    utime_t wait;
+    wait.set_from_double((double)bytes / rate);
+    cond.WaitInterval(lock, wait);
+  }
+  return !stop;
+}
+
+void *BlueStore::ReadaheadThread::entry()
+{
+  Mutex::Locker l(lock);
+  while (!stop) {
+    if (queue.empty()) {
+      cond.Wait(lock);
+      continue;
+    }
+    Item i = std::move(queue.front());
+    queue.pop_front();
+    lock.Unlock();
+    store->_do_readahead(i.c.get(), i.oid, i.offset, i.length);
+    lock.Lock();
+  }
+  queue.clear();
+  stop = false;
+  return NULL;
+}
+
+bool BlueStore::ReadaheadThread::queue_read(
+  Collection *c, const ghobject_t& oid, uint64_t offset, uint64_t length)
+{
+  Mutex::Locker l(lock);
+  if (stop || queue.size() >= max_queue) {
+    return false;
+  }
+  queue.push_back(Item{c, oid, offset, length});
+  cond.Signal();
+  return true;
+}
+
+// =======================================================
+
 // OmapIteratorImpl
 
 #undef dout_prefix
@@ -3843,9 +3977,16 @@ BlueStore::BlueStore(CephContext *cct, const string& path)
 		       cct->_conf->bluestore_throttle_deferred_bytes),
     deferred_finisher(cct, "defered_finisher", "dfin"),
     finisher(cct, "commit_finisher", "cfin"),
+    compress_tp(cct, "BlueStore::compress_tp", "bstore_compress",
+		cct->_conf.get_val<uint64_t>("bluestore_compression_threads"),
+		"bluestore_compression_threads"),
+    compress_wq(&compress_tp),
+    decompress_wq(&compress_tp),
     kv_sync_thread(this),
     kv_finalize_thread(this),
-    mempool_thread(this)
+    mempool_thread(this),
+    recompress_thread(this),
+    readahead_thread(this)
 {
   _init_logger();
   cct->_conf.add_observer(this);
@@ -3863,11 +4004,18 @@ BlueStore::BlueStore(CephContext *cct,
 		       cct->_conf->bluestore_throttle_deferred_bytes),
     deferred_finisher(cct, "defered_finisher", "dfin"),
     finisher(cct, "commit_finisher", "cfin"),
+    compress_tp(cct, "BlueStore::compress_tp", "bstore_compress",
+		cct->_conf.get_val<uint64_t>("bluestore_compression_threads"),
+		"bluestore_compression_threads"),
+    compress_wq(&compress_tp),
+    decompress_wq(&compress_tp),
     kv_sync_thread(this),
     kv_finalize_thread(this),
     min_alloc_size(_min_alloc_size),
     min_alloc_size_order(ctz(_min_alloc_size)),
-    mempool_thread(this)
+    mempool_thread(this),
+    recompress_thread(this),
+    readahead_thread(this)
 {
   _init_logger();
   cct->_conf.add_observer(this);
@@ -3895,6 +4043,7 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_csum_type",
     "bluestore_compression_mode",
     "bluestore_compression_algorithm",
+    "bluestore_compression_level",
     "bluestore_compression_min_blob_size",
     "bluestore_compression_min_blob_size_ssd",
     "bluestore_compression_min_blob_size_hdd",
@@ -3930,6 +4079,7 @@ void BlueStore::handle_conf_change(const ConfigProxy& conf,
   }
   if (changed.count("bluestore_compression_mode") ||
       changed.count("bluestore_compression_algorithm") ||
+      changed.count("bluestore_compression_level") ||
       changed.count("bluestore_compression_min_blob_size") ||
       changed.count("bluestore_compression_max_blob_size")) {
     if (bdev) {
@@ -3974,6 +4124,15 @@ void BlueStore::handle_conf_change(const ConfigProxy& conf,
   }
 }
 
+boost::optional<int> BlueStore::_get_compression_level()
+{
+  auto level = cct->_conf.get_val<int64_t>("bluestore_compression_level");
+  if (level == 0) {
+    return boost::none;
+  }
+  return level;
+}
+
 void BlueStore::_set_compression()
 {
   auto m = Compressor::get_comp_mode_type(cct->_conf->bluestore_compression_mode);
@@ -4019,7 +4178,7 @@ void BlueStore::_set_compression()
 
   auto& alg_name = cct->_conf->bluestore_compression_algorithm;
   if (!alg_name.empty()) {
-    compressor = Compressor::create(cct, alg_name);
+    compressor = Compressor::create(cct, alg_name, _get_compression_level());
     if (!compressor) {
       derr << __func__ << " unable to initialize " << alg_name.c_str() << " compressor"
            << dendl;
@@ -4028,6 +4187,7 @@ void BlueStore::_set_compression()
  
   dout(10) << __func__ << " mode " << Compressor::get_comp_mode_name(comp_mode)
 	   << " alg " << (compressor ? compressor->get_type_name() : "(none)")
+	   << " level " << (compressor ? compressor->get_level() : boost::none)
 	   << " min_blob " << comp_min_blob_size
 	   << " max_blob " << comp_max_blob_size
 	   << dendl;
@@ -4227,6 +4387,8 @@ void BlueStore::_init_logger()
     "Average read latency");
   b.add_time_avg(l_bluestore_compress_lat, "compress_lat",
     "Average compress latency");
+  b.add_time_avg(l_bluestore_compress_txc_lat, "compress_txc_lat",
+    "Average time a transaction spent compressing its data");
   b.add_time_avg(l_bluestore_decompress_lat, "decompress_lat",
     "Average decompress latency");
   b.add_time_avg(l_bluestore_csum_lat, "csum_lat",
@@ -4235,6 +4397,17 @@ void BlueStore::_init_logger()
     "Sum for beneficial compress ops");
   b.add_u64_counter(l_bluestore_compress_rejected_count, "compress_rejected_count",
     "Sum for compress ops rejected due to low net gain of space");
+  b.add_u64_counter(l_bluestore_compress_skipped_count, "compress_skipped_count",
+    "Sum for compress ops skipped in adaptive mode as data looked incompressible");
+  b.add_u64_counter(l_bluestore_compress_precompressed_count,
+    "compress_precompressed_count",
+    "Sum for blobs written as they came compressed");
+  b.add_u64_counter(l_bluestore_compress_precompressed_rejected_count,
+    "compress_precompressed_rejected_count",
+    "Sum for compressed blobs that did not fit and were decompressed to be written");
+  b.add_u64_counter(l_bluestore_compress_dict_count,
+    "compress_dict_count",
+    "Sum for blobs compressed with a trained dictionary");
   b.add_u64_counter(l_bluestore_write_pad_bytes, "write_pad_bytes",
 		    "Sum for write-op padded bytes", NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_deferred_write_ops, "deferred_write_ops",
@@ -4277,6 +4450,10 @@ void BlueStore::_init_logger()
 	    "Sum for bytes of read hit in the cache", NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_buffer_miss_bytes, "bluestore_buffer_miss_bytes",
 	    "Sum for bytes of read missed in the cache", NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_buffer_compressed_hit_bytes,
+	    "bluestore_buffer_compressed_hit_bytes",
+	    "Sum for bytes of read missed in the cache but decompressed from a cached compressed blob",
+	    NULL, 0, unit_t(UNIT_BYTES));
 
   b.add_u64_counter(l_bluestore_write_big, "bluestore_write_big",
 		    "Large aligned writes into fresh blobs");
@@ -4311,6 +4488,35 @@ void BlueStore::_init_logger()
   b.add_u64_counter(l_bluestore_gc_merged, "bluestore_gc_merged",
 		    "Sum for extents that have been merged due to garbage "
 		    "collection");
+  b.add_u64_counter(l_bluestore_recompress_objects,
+		    "bluestore_recompress_objects",
+		    "Cold objects checked by background recompression");
+  b.add_u64_counter(l_bluestore_recompress_rewritten,
+		    "bluestore_recompress_rewritten",
+		    "Objects rewritten by background recompression");
+  b.add_u64_counter(l_bluestore_recompress_bytes,
+		    "bluestore_recompress_bytes",
+		    "Sum for bytes rewritten by background recompression",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_recompress_saved_bytes,
+		    "bluestore_recompress_saved_bytes",
+		    "Sum for bytes of allocations freed by background "
+		    "recompression",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_readahead_ops, "bluestore_readahead_ops",
+		    "Readaheads of compressed data queued");
+  b.add_u64_counter(l_bluestore_readahead_bytes, "bluestore_readahead_bytes",
+		    "Sum for bytes of compressed data read ahead into the "
+		    "cache",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_readahead_hit_bytes,
+		    "bluestore_readahead_hit_bytes",
+		    "Sum for bytes read after they were read ahead",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_readahead_wasted_bytes,
+		    "bluestore_readahead_wasted_bytes",
+		    "Sum for bytes read ahead which the reader skipped",
+		    NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_read_eio, "bluestore_read_eio",
                     "Read EIO errors propagated to high level callers");
   b.add_u64_counter(l_bluestore_reads_with_retries, "bluestore_reads_with_retries",
@@ -4340,6 +4546,129 @@ void BlueStore::_shutdown_logger()
 {
   cct->get_perfcounters_collection()->remove(logger);
   delete logger;
+  RWLock::WLocker l(comp_logger_lock);
+  for (auto& p : comp_alg_logger) {
+    if (p) {
+      cct->get_perfcounters_collection()->remove(p);
+      delete p;
+      p = nullptr;
+    }
+  }
+  for (auto& p : comp_pool_logger) {
+    cct->get_perfcounters_collection()->remove(p.second);
+    delete p.second;
+  }
+  comp_pool_logger.clear();
+}
+
+PerfCounters *BlueStore::_create_comp_logger(const string& name)
+{
+  // latency of (de)compressing blobs of a size, alike the osd op histograms
+  PerfHistogramCommon::axis_config_d lat_axis{
+    "Latency (usec)",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,
+    10000,     ///< 10usec
+    24,
+  };
+  PerfHistogramCommon::axis_config_d size_axis{
+    "Blob size (bytes)",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,
+    4096,
+    16,
+  };
+  PerfCountersBuilder b(cct, name,
+			l_bluestore_comp_first, l_bluestore_comp_last);
+  // for the mgr to see which pool or algorithm is worth its cpu
+  b.set_prio_default(PerfCountersBuilder::PRIO_USEFUL);
+  b.add_u64_counter(l_bluestore_comp_compress_bytes_in, "compress_bytes_in",
+		    "Bytes given to the compressor", NULL, 0,
+		    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_comp_compress_bytes_out, "compress_bytes_out",
+		    "Bytes the compressor produced, including rejected ones",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_comp_compress_success_count,
+		    "compress_success_count",
+		    "Blobs stored compressed");
+  b.add_u64_counter(l_bluestore_comp_compress_rejected_count,
+		    "compress_rejected_count",
+		    "Blobs stored uncompressed due to low net gain of space");
+  b.add_time_avg(l_bluestore_comp_compress_lat, "compress_lat",
+		 "Average time compressing the blobs of a write");
+  b.add_u64_counter_histogram(
+    l_bluestore_comp_compress_lat_bytes_hist, "compress_lat_bytes_histogram",
+    lat_axis, size_axis,
+    "Histogram of time compressing the blobs of a write + their size");
+  b.add_u64_counter(l_bluestore_comp_decompress_bytes_in,
+		    "decompress_bytes_in",
+		    "Compressed bytes given to the decompressor", NULL, 0,
+		    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_comp_decompress_bytes_out,
+		    "decompress_bytes_out",
+		    "Bytes the decompressor produced", NULL, 0,
+		    unit_t(UNIT_BYTES));
+  b.add_time_avg(l_bluestore_comp_decompress_lat, "decompress_lat",
+		 "Average time decompressing a blob");
+  b.add_u64_counter_histogram(
+    l_bluestore_comp_decompress_lat_bytes_hist,
+    "decompress_lat_bytes_histogram",
+    lat_axis, size_axis,
+    "Histogram of time decompressing a blob + its decompressed size");
+  PerfCounters *p = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(p);
+  return p;
+}
+
+bool BlueStore::_get_comp_loggers(int alg, Collection *c,
+				  PerfCounters **alg_logger,
+				  PerfCounters **pool_logger)
+{
+  *alg_logger = nullptr;
+  *pool_logger = nullptr;
+  if (alg > 0 && alg < Compressor::COMP_ALG_LAST) {
+    *alg_logger = comp_alg_logger[alg];
+    if (!*alg_logger) {
+      return false;
+    }
+  }
+  spg_t pgid;
+  if (c && c->cid.is_pg(&pgid)) {
+    auto p = comp_pool_logger.find(pgid.pool());
+    if (p == comp_pool_logger.end()) {
+      return false;
+    }
+    *pool_logger = p->second;
+  }
+  return true;
+}
+
+void BlueStore::_create_comp_loggers(int alg, Collection *c)
+{
+  RWLock::WLocker l(comp_logger_lock);
+  if (alg > 0 && alg < Compressor::COMP_ALG_LAST && !comp_alg_logger[alg]) {
+    comp_alg_logger[alg] = _create_comp_logger(
+      string("bluestore-compression-") + Compressor::get_comp_alg_name(alg));
+  }
+  spg_t pgid;
+  if (c && c->cid.is_pg(&pgid)) {
+    auto& p = comp_pool_logger[pgid.pool()];
+    if (!p) {
+      p = _create_comp_logger("bluestore-compression-pool-" +
+			      stringify(pgid.pool()));
+    }
+  }
+}
+
+void BlueStore::_remove_comp_pool_logger(int64_t pool)
+{
+  RWLock::WLocker l(comp_logger_lock);
+  auto p = comp_pool_logger.find(pool);
+  if (p != comp_pool_logger.end()) {
+    cct->get_perfcounters_collection()->remove(p->second);
+    delete p->second;
+    comp_pool_logger.erase(p);
+  }
 }
 
 int BlueStore::get_block_device_fsid(CephContext* cct, const string& path,
@@ -5695,6 +6024,7 @@ int BlueStore::mkfs()
     }
 
     ondisk_format = latest_ondisk_format;
+    compat_ondisk_format = min_compat_ondisk_format;
     _prepare_ondisk_format_super(t);
     db->submit_transaction_sync(t);
   }
@@ -5853,6 +6183,8 @@ int BlueStore::_mount(bool kv_only, bool open_db)
     goto out_stop;
 
   mempool_thread.init();
+  recompress_thread.init();
+  readahead_thread.init();
 
   mounted = true;
   return 0;
@@ -5881,6 +6213,10 @@ int BlueStore::umount()
   ceph_assert(_kv_only || mounted);
   dout(1) << __func__ << dendl;
 
+  if (!_kv_only) {
+    readahead_thread.shutdown();
+    recompress_thread.shutdown();
+  }
   _osr_drain_all();
 
   mounted = false;
@@ -7348,6 +7684,8 @@ int BlueStore::read(
     r = _do_read(c, o, offset, length, bl, op_flags);
     if (r == -EIO) {
       logger->inc(l_bluestore_read_eio);
+    } else if (r > 0) {
+      _maybe_readahead(c, o, offset, r);
     }
   }
 
@@ -7399,6 +7737,90 @@ struct region_t {
 typedef list<region_t> regions2read_t;
 typedef map<BlueStore::BlobRef, regions2read_t> blobs2read_t;
 
+// what is read of a compressed blob: all of it, or for a blob compressed
+// in chunks, the chunks covering the regions to read
+struct compressed_read_t {
+  bufferlist bl;
+  uint64_t r_off = 0;       ///< blob offset of bl
+  unsigned first_chunk = 0;
+  unsigned last_chunk = 0;
+  bool cached = false;      ///< bl came from the buffer cache
+
+  // set when bl is read with aio of its own and decompressed by compress_tp
+  std::unique_ptr<BlueStore::DecompressRead> dr;
+  bufferlist raw_bl;        ///< decompressed by dr
+  int r = 0;                ///< of the read and decompression by dr
+  bool csum_error = false;
+};
+
+// the compressed blobs of a read that compress_tp did not finish yet
+struct decompress_waiter_t {
+  std::mutex lock;
+  std::condition_variable cond;
+  unsigned pending = 0;     ///< not decompressed yet
+  unsigned queued = 0;      ///< ever queued to decompress_wq
+
+  void start(unsigned n) {
+    std::lock_guard<std::mutex> l(lock);
+    pending = n;
+  }
+  template <typename F>
+  void queue(F&& f) {
+    // under the lock: the reader may return as soon as the item finishes
+    std::lock_guard<std::mutex> l(lock);
+    f();
+    ++queued;
+    cond.notify_all();
+  }
+  void finish() {
+    std::lock_guard<std::mutex> l(lock);
+    if (--pending == 0) {
+      cond.notify_all();
+    }
+  }
+};
+
+struct BlueStore::DecompressRead : public BlueStore::AioContext {
+  BlueStore *store;
+  Collection *c;
+  OnodeRef o;
+  const bluestore_blob_t& blob;
+  uint64_t logical_offset;  ///< of the first region read, for csum errors
+  compressed_read_t& cr;
+  decompress_waiter_t& waiter;
+  IOContext ioc;
+
+  DecompressRead(BlueStore *store, Collection *c, OnodeRef o,
+		 const bluestore_blob_t& blob, uint64_t logical_offset,
+		 compressed_read_t& cr, decompress_waiter_t& waiter)
+    : store(store), c(c), o(o), blob(blob), logical_offset(logical_offset),
+      cr(cr), waiter(waiter), ioc(store->cct, this, true) {}
+
+  void aio_finish(BlueStore *store) override {
+    // called by the aio thread; keep it free for other completions
+    waiter.queue([this, store] { store->decompress_wq.queue(this); });
+  }
+
+  void run() {
+    cr.r = ioc.get_return_value();
+    if (cr.r == 0 &&
+	store->_verify_csum(o, &blob, cr.r_off, cr.bl, logical_offset) < 0) {
+      cr.csum_error = true;
+    }
+    if (cr.r == 0 && !cr.csum_error) {
+      cr.r = store->_decompress_blob(c, blob, cr.bl, cr.r_off,
+				     cr.first_chunk, cr.last_chunk,
+				     &cr.raw_bl);
+    }
+    waiter.finish();
+  }
+};
+
+void BlueStore::DecompressWQ::process(DecompressRead *d)
+{
+  d->run();
+}
+
 int BlueStore::_do_read(
   Collection *c,
   OnodeRef o,
@@ -7517,26 +7939,90 @@ int BlueStore::_do_read(
   start = mono_clock::now(); // for the sake of simplicity
                              // measure the whole block below.
                              // The error isn't that much...
-  vector<bufferlist> compressed_blob_bls;
+  vector<compressed_read_t> compressed_blobs;
   IOContext ioc(cct, NULL, true); // allow EIO
+  // with several compressed blobs to read, give each its own aio so that
+  // compress_tp decompresses them in parallel, each as soon as it is read
+  decompress_waiter_t decompress_waiter;
+  bool decompress_async = false;
+  if (compress_tp.get_num_threads() > 0) {
+    unsigned num_compressed = 0;
+    for (auto& p : blobs2read) {
+      if (p.first->get_blob().is_compressed()) {
+	++num_compressed;
+      }
+    }
+    decompress_async = num_compressed > 1;
+  }
   for (auto& p : blobs2read) {
     const BlobRef& bptr = p.first;
     dout(20) << __func__ << "  blob " << *bptr << std::hex
 	     << " need " << p.second << std::dec << dendl;
     if (bptr->get_blob().is_compressed()) {
-      // read the whole thing
-      if (compressed_blob_bls.empty()) {
+      if (compressed_blobs.empty()) {
 	// ensure we avoid any reallocation on subsequent blobs
-	compressed_blob_bls.reserve(blobs2read.size());
+	compressed_blobs.reserve(blobs2read.size());
+      }
+      compressed_blobs.push_back(compressed_read_t());
+      compressed_read_t& cr = compressed_blobs.back();
+      const bluestore_blob_t& blob = bptr->get_blob();
+      // read the whole thing, or only the chunks we need
+      uint64_t r_len = blob.get_ondisk_length();
+      if (blob.has_compressed_chunks()) {
+	cr.first_chunk = blob.get_compressed_chunk(p.second.front().blob_xoffset);
+	cr.last_chunk = cr.first_chunk;
+	for (auto& reg : p.second) {
+	  cr.first_chunk = std::min(cr.first_chunk,
+	    blob.get_compressed_chunk(reg.blob_xoffset));
+	  cr.last_chunk = std::max(cr.last_chunk,
+	    blob.get_compressed_chunk(reg.blob_xoffset + reg.length - 1));
+	}
+	uint64_t chunk_size = blob.get_chunk_size(block_size);
+	cr.r_off = p2align<uint64_t>(
+	  blob.get_compressed_chunk_offset(cr.first_chunk), chunk_size);
+	r_len = std::min<uint64_t>(
+	  p2roundup<uint64_t>(
+	    blob.get_compressed_chunk_offset(cr.last_chunk + 1), chunk_size),
+	  r_len) - cr.r_off;
+	dout(20) << __func__ << "    chunks " << cr.first_chunk << "-"
+		 << cr.last_chunk << " reading 0x" << std::hex << cr.r_off
+		 << "~" << r_len << std::dec << dendl;
+      }
+      if (read_cache_policy == 0) {
+	// is it cached in compressed form?
+	uint32_t want_off = 0;
+	uint32_t want_len = blob.get_logical_length();
+	if (blob.has_compressed_chunks()) {
+	  want_off = cr.first_chunk * blob.comp_chunk_length;
+	  want_len = std::min<uint32_t>(
+	    (cr.last_chunk + 1) * blob.comp_chunk_length, want_len) - want_off;
+	}
+	uint32_t c_off, c_len;
+	if (bptr->shared_blob->bc.read_compressed(
+	      bptr->shared_blob->get_cache(), want_off, want_len,
+	      &c_off, &c_len, &cr.bl)) {
+	  cr.cached = true;
+	  cr.r_off = blob.has_compressed_chunks() ?
+	    blob.get_compressed_chunk_offset(c_off / blob.comp_chunk_length) : 0;
+	  dout(20) << __func__ << "    cached compressed 0x" << std::hex
+		   << c_off << "~" << c_len << std::dec << dendl;
+	  continue;
+	}
       }
-      compressed_blob_bls.push_back(bufferlist());
-      bufferlist& bl = compressed_blob_bls.back();
-      r = bptr->get_blob().map(
-	0, bptr->get_blob().get_ondisk_length(),
+      bufferlist& bl = cr.bl;
+      if (decompress_async) {
+	cr.dr.reset(new DecompressRead(this, c, o, blob,
+				       p.second.front().logical_offset,
+				       cr, decompress_waiter));
+      }
+      r = blob.map(
+	cr.r_off, r_len,
 	[&](uint64_t offset, uint64_t length) {
 	  int r;
-	  // use aio if there are more regions to read than those in this blob
-	  if (num_regions > p.second.size()) {
+	  if (cr.dr) {
+	    r = bdev->aio_read(offset, length, &bl, &cr.dr->ioc);
+	  } else if (num_regions > p.second.size()) {
+	    // use aio if there are more regions to read than those in this blob
 	    r = bdev->aio_read(offset, length, &bl, &ioc);
 	  } else {
 	    r = bdev->read(offset, length, &bl, &ioc, false);
@@ -7603,30 +8089,72 @@ int BlueStore::_do_read(
       }
     }
   }
+  unsigned num_async = 0;
+  for (auto& cr : compressed_blobs) {
+    if (cr.dr) {
+      ++num_async;
+    }
+  }
+  decompress_waiter.start(num_async);
+  for (auto& cr : compressed_blobs) {
+    if (!cr.dr) {
+      continue;
+    }
+    if (cr.dr->ioc.has_pending_aios()) {
+      bdev->aio_submit(&cr.dr->ioc);
+    } else {
+      // the device read it synchronously
+      cr.dr->aio_finish(this);
+    }
+  }
   if (ioc.has_pending_aios()) {
     bdev->aio_submit(&ioc);
     dout(20) << __func__ << " waiting for aio" << dendl;
     ioc.aio_wait();
     r = ioc.get_return_value();
-    if (r < 0) {
-      ceph_assert(r == -EIO); // no other errors allowed
-      return -EIO;
+  }
+  {
+    std::unique_lock<std::mutex> l(decompress_waiter.lock);
+    unsigned seen = 0;
+    while (decompress_waiter.pending) {
+      if (decompress_waiter.queued != seen) {
+	// decompress what compress_tp has not taken yet ourselves; it may
+	// have lost its threads since we checked
+	seen = decompress_waiter.queued;
+	l.unlock();
+	for (auto& cr : compressed_blobs) {
+	  if (cr.dr && decompress_wq.dequeue(cr.dr.get())) {
+	    cr.dr->run();
+	  }
+	}
+	l.lock();
+	continue;
+      }
+      dout(20) << __func__ << " waiting for decompression" << dendl;
+      decompress_waiter.cond.wait(l);
     }
   }
+  if (r < 0) {
+    ceph_assert(r == -EIO); // no other errors allowed
+    return -EIO;
+  }
   logger->tinc(l_bluestore_read_wait_aio_lat, mono_clock::now() - start);
 
   // enumerate and decompress desired blobs
-  auto p = compressed_blob_bls.begin();
+  auto p = compressed_blobs.begin();
   blobs2read_t::iterator b2r_it = blobs2read.begin();
   while (b2r_it != blobs2read.end()) {
     const BlobRef& bptr = b2r_it->first;
     dout(20) << __func__ << "  blob " << *bptr << std::hex
 	     << " need 0x" << b2r_it->second << std::dec << dendl;
     if (bptr->get_blob().is_compressed()) {
-      ceph_assert(p != compressed_blob_bls.end());
-      bufferlist& compressed_bl = *p++;
-      if (_verify_csum(o, &bptr->get_blob(), 0, compressed_bl,
-		       b2r_it->second.front().logical_offset) < 0) {
+      ceph_assert(p != compressed_blobs.end());
+      compressed_read_t& cr = *p++;
+      const bluestore_blob_t& blob = bptr->get_blob();
+      if (cr.dr ? cr.csum_error :
+	  (!cr.cached &&
+	   _verify_csum(o, &blob, cr.r_off, cr.bl,
+			b2r_it->second.front().logical_offset) < 0)) {
         // Handles spurious read errors caused by a kernel bug.
         // We sometimes get all-zero pages as a result of the read under
         // high memory pressure. Retrying the failing read succeeds in most cases.
@@ -7637,16 +8165,41 @@ int BlueStore::_do_read(
         return _do_read(c, o, offset, length, bl, op_flags, retry_count + 1);
       }
       bufferlist raw_bl;
-      r = _decompress(compressed_bl, &raw_bl);
+      uint64_t raw_off = 0;
+      if (blob.has_compressed_chunks()) {
+	raw_off = (uint64_t)cr.first_chunk * blob.comp_chunk_length;
+      }
+      if (cr.dr) {
+	r = cr.r;
+	raw_bl.claim(cr.raw_bl);
+      } else {
+	r = _decompress_blob(c, blob, cr.bl, cr.r_off, cr.first_chunk,
+			     cr.last_chunk, &raw_bl);
+      }
       if (r < 0)
 	return r;
-      if (buffered) {
-	bptr->shared_blob->bc.did_read(bptr->shared_blob->get_cache(), 0,
-				       raw_bl);
+      if (buffered && !cr.cached) {
+	if (cct->_conf.get_val<bool>("bluestore_cache_compressed")) {
+	  // keep exactly the chunks decompressed, or all of the blob
+	  bufferlist cbl;
+	  if (blob.has_compressed_chunks()) {
+	    uint32_t c_off = blob.get_compressed_chunk_offset(cr.first_chunk);
+	    cbl.substr_of(
+	      cr.bl, c_off - cr.r_off,
+	      blob.get_compressed_chunk_offset(cr.last_chunk + 1) - c_off);
+	  } else {
+	    cbl = cr.bl;
+	  }
+	  bptr->shared_blob->bc.did_read_compressed(
+	    bptr->shared_blob->get_cache(), raw_off, raw_bl.length(), cbl);
+	} else {
+	  bptr->shared_blob->bc.did_read(bptr->shared_blob->get_cache(),
+					 raw_off, raw_bl);
+	}
       }
       for (auto& i : b2r_it->second) {
 	ready_regions[i.logical_offset].substr_of(
-	  raw_bl, i.blob_xoffset, i.length);
+	  raw_bl, i.blob_xoffset - raw_off, i.length);
       }
     } else {
       for (auto& reg : b2r_it->second) {
@@ -7711,6 +8264,116 @@ int BlueStore::_do_read(
   return r;
 }
 
+void BlueStore::_maybe_readahead(Collection *c, OnodeRef& o,
+				 uint64_t offset, size_t length)
+{
+  uint64_t blobs = cct->_conf.get_val<uint64_t>(
+    "bluestore_compression_readahead_blobs");
+  if (!blobs) {
+    return;
+  }
+  auto ra = o->readahead.load();
+  if (!ra) {
+    // only follow objects read from compressed data
+    auto ep = o->extent_map.seek_lextent(offset);
+    if (ep == o->extent_map.extent_map.end() ||
+	ep->logical_offset > offset ||
+	!ep->blob->get_blob().is_compressed()) {
+      return;
+    }
+    auto n = new Onode::ReadaheadState;
+    if (o->readahead.compare_exchange_strong(ra, n)) {
+      ra = n;
+    } else {
+      delete n;
+    }
+  }
+  ra->ra.set_trigger_requests(cct->_conf.get_val<uint64_t>(
+    "bluestore_compression_readahead_trigger"));
+  ra->ra.set_max_readahead_size(blobs * comp_max_blob_size);
+
+  interval_set<uint64_t> hit, skipped, ahead;
+  Readahead::extent_t e;
+  {
+    std::lock_guard<std::mutex> l(ra->lock);
+    interval_set<uint64_t> read;
+    read.insert(offset, length);
+    hit.intersection_of(ra->unread, read);
+    ra->unread.subtract(hit);
+    if (offset) {
+      // the reader went past these, they won't be read any more
+      interval_set<uint64_t> before;
+      before.insert(0, offset);
+      skipped.intersection_of(ra->unread, before);
+      ra->unread.subtract(skipped);
+    }
+    e = ra->ra.update(offset, length, o->onode.size);
+    if (e.second) {
+      ahead.insert(e.first, e.second);
+      interval_set<uint64_t> queued;
+      queued.intersection_of(ahead, ra->unread);
+      ahead.subtract(queued);
+      ra->unread.union_of(ahead);
+    }
+  }
+  if (hit.size()) {
+    logger->inc(l_bluestore_readahead_hit_bytes, hit.size());
+  }
+  if (skipped.size()) {
+    logger->inc(l_bluestore_readahead_wasted_bytes, skipped.size());
+  }
+  if (!e.second) {
+    return;
+  }
+  dout(20) << __func__ << " " << o->oid << " 0x" << std::hex << offset
+	   << "~" << length << " read ahead 0x" << e.first << "~" << e.second
+	   << std::dec << dendl;
+  if (readahead_thread.queue_read(c, o->oid, e.first, e.second)) {
+    logger->inc(l_bluestore_readahead_ops);
+  } else if (!ahead.empty()) {
+    std::lock_guard<std::mutex> l(ra->lock);
+    ra->unread.subtract(ahead);
+  }
+}
+
+void BlueStore::_do_readahead(Collection *c, const ghobject_t& oid,
+			      uint64_t offset, uint64_t length)
+{
+  if (!c->exists) {
+    return;
+  }
+  RWLock::RLocker l(c->lock);
+  OnodeRef o = c->get_onode(oid, false);
+  if (!o || !o->exists) {
+    return;
+  }
+  // read only the compressed extents, into the cache
+  o->extent_map.fault_range(db, offset, length);
+  interval_set<uint64_t> todo;
+  for (auto ep = o->extent_map.seek_lextent(offset);
+       ep != o->extent_map.extent_map.end() &&
+	 ep->logical_offset < offset + length;
+       ++ep) {
+    if (ep->blob->get_blob().is_compressed()) {
+      uint64_t start = std::max<uint64_t>(ep->logical_offset, offset);
+      uint64_t end = std::min<uint64_t>(ep->logical_end(), offset + length);
+      todo.union_insert(start, end - start);
+    }
+  }
+  for (auto p = todo.begin(); p != todo.end(); ++p) {
+    bufferlist bl;
+    int r = _do_read(c, o, p.get_start(), p.get_len(), bl,
+		     CEPH_OSD_OP_FLAG_FADVISE_WILLNEED);
+    if (r < 0) {
+      dout(10) << __func__ << " " << oid << " 0x" << std::hex
+	       << p.get_start() << "~" << p.get_len() << std::dec
+	       << " = " << r << dendl;
+      return;
+    }
+    logger->inc(l_bluestore_readahead_bytes, r);
+  }
+}
+
 int BlueStore::_verify_csum(OnodeRef& o,
 			    const bluestore_blob_t* blob, uint64_t blob_xoffset,
 			    const bufferlist& bl,
@@ -7757,7 +8420,44 @@ int BlueStore::_verify_csum(OnodeRef& o,
   return r;
 }
 
-int BlueStore::_decompress(bufferlist& source, bufferlist* result)
+CompressorRef BlueStore::_get_compression_dict(uint32_t id)
+{
+  std::lock_guard<std::mutex> l(comp_dict_lock);
+  auto p = comp_dicts.find(id);
+  if (p == comp_dicts.end()) {
+    return nullptr;
+  }
+  return p->second.compressor;
+}
+
+CompressorRef BlueStore::_get_pool_compression_dict(int64_t pool,
+						    const CompressorRef& c,
+						    uint32_t *id)
+{
+  std::lock_guard<std::mutex> l(comp_dict_lock);
+  auto p = pool_comp_dict.find(pool);
+  if (p == pool_comp_dict.end()) {
+    return nullptr;
+  }
+  auto& d = comp_dicts[p->second];
+  if (d.info.type != c->get_type() || !d.compressor) {
+    return nullptr;
+  }
+  *id = p->second;
+  // compress at the level of c, which honors the pool and config
+  auto level = c->get_level();
+  if (!level || level == d.compressor->get_level()) {
+    return d.compressor;
+  }
+  auto& lc = d.leveled[*level];
+  if (!lc) {
+    lc = c->with_dictionary(d.info.dict);
+  }
+  return lc;
+}
+
+int BlueStore::_decompress(Collection *c, bufferlist& source, size_t raw_len,
+			   bufferlist* result)
 {
   int r = 0;
   auto start = mono_clock::now();
@@ -7766,26 +8466,125 @@ int BlueStore::_decompress(bufferlist& source, bufferlist* result)
   decode(chdr, i);
   int alg = int(chdr.type);
   CompressorRef cp = compressor;
-  if (!cp || (int)cp->get_type() != alg) {
+  if (chdr.dict_id) {
+    cp = _get_compression_dict(chdr.dict_id);
+    if (cp && (int)cp->get_type() != alg) {
+      cp.reset();
+    }
+  } else if (!cp || (int)cp->get_type() != alg) {
     cp = Compressor::create(cct, alg);
   }
 
   if (!cp.get()) {
     // if compressor isn't available - error, because cannot return
     // decompressed data?
-    derr << __func__ << " can't load decompressor " << alg << dendl;
+    derr << __func__ << " can't load decompressor " << alg;
+    if (chdr.dict_id) {
+      *_dout << " with dictionary " << chdr.dict_id;
+    }
+    *_dout << dendl;
     r = -EIO;
   } else {
-    r = cp->decompress(i, chdr.length, *result);
+    // decompress straight into one buffer of the blob's logical size
+    bufferptr raw = buffer::create_small_page_aligned(raw_len);
+    r = cp->decompress_into(i, chdr.length, raw.c_str(), raw.length());
     if (r < 0) {
       derr << __func__ << " decompression failed with exit code " << r << dendl;
       r = -EIO;
+    } else if ((size_t)r != raw_len) {
+      derr << __func__ << " decompressed 0x" << std::hex << r
+	   << " bytes, expected 0x" << raw_len << std::dec << dendl;
+      r = -EIO;
+    } else {
+      result->push_back(std::move(raw));
+      r = 0;
+    }
+  }
+  auto lat = mono_clock::now() - start;
+  logger->tinc(l_bluestore_decompress_lat, lat);
+  if (r == 0) {
+    _update_comp_loggers(alg, c, [&](PerfCounters *l) {
+	l->inc(l_bluestore_comp_decompress_bytes_in, chdr.length);
+	l->inc(l_bluestore_comp_decompress_bytes_out, raw_len);
+	l->tinc(l_bluestore_comp_decompress_lat, lat);
+	l->hinc(l_bluestore_comp_decompress_lat_bytes_hist,
+		std::chrono::nanoseconds(lat).count(), raw_len);
+      });
+  }
+  return r;
+}
+
+int BlueStore::_decompress_chunks(Collection *c, const bluestore_blob_t& blob,
+				  bufferlist& source, uint64_t src_off,
+				  unsigned first, unsigned last,
+				  bufferlist* result)
+{
+  int r = 0;
+  auto start = mono_clock::now();
+  int alg = blob.comp_type;
+  CompressorRef cp = compressor;
+  if (!cp || (int)cp->get_type() != alg) {
+    cp = Compressor::create(cct, alg);
+  }
+  if (!cp.get()) {
+    derr << __func__ << " can't load decompressor " << alg << dendl;
+    return -EIO;
+  }
+
+  uint64_t chunk_len = blob.comp_chunk_length;
+  uint64_t raw_off = first * chunk_len;
+  uint64_t raw_end = std::min<uint64_t>((last + 1) * chunk_len,
+					blob.get_logical_length());
+  bufferptr raw = buffer::create_small_page_aligned(raw_end - raw_off);
+  for (unsigned i = first; i <= last; ++i) {
+    auto p = source.cbegin();
+    p.advance(blob.get_compressed_chunk_offset(i) - src_off);
+    uint64_t out_off = i * chunk_len - raw_off;
+    uint64_t out_len = std::min(chunk_len, raw_end - i * chunk_len);
+    r = cp->decompress_into(p, blob.get_compressed_chunk_length(i),
+			    raw.c_str() + out_off, out_len);
+    if (r < 0) {
+      derr << __func__ << " decompression of chunk " << i
+	   << " failed with exit code " << r << dendl;
+      r = -EIO;
+      break;
+    }
+    if ((uint64_t)r != out_len) {
+      derr << __func__ << " chunk " << i << " decompressed to 0x" << std::hex
+	   << r << " bytes, expected 0x" << out_len << std::dec << dendl;
+      r = -EIO;
+      break;
     }
+    r = 0;
+  }
+  auto lat = mono_clock::now() - start;
+  logger->tinc(l_bluestore_decompress_lat, lat);
+  if (r == 0) {
+    _update_comp_loggers(alg, c, [&](PerfCounters *l) {
+	l->inc(l_bluestore_comp_decompress_bytes_in,
+	       blob.get_compressed_chunk_offset(last + 1) -
+	       blob.get_compressed_chunk_offset(first));
+	l->inc(l_bluestore_comp_decompress_bytes_out, raw.length());
+	l->tinc(l_bluestore_comp_decompress_lat, lat);
+	l->hinc(l_bluestore_comp_decompress_lat_bytes_hist,
+		std::chrono::nanoseconds(lat).count(), raw.length());
+      });
+    result->push_back(std::move(raw));
   }
-  logger->tinc(l_bluestore_decompress_lat, mono_clock::now() - start);
   return r;
 }
 
+int BlueStore::_decompress_blob(Collection *c, const bluestore_blob_t& blob,
+				bufferlist& source, uint64_t src_off,
+				unsigned first, unsigned last,
+				bufferlist* result)
+{
+  if (blob.has_compressed_chunks()) {
+    return _decompress_chunks(c, blob, source, src_off, first, last, result);
+  }
+  return _decompress(c, source, blob.get_logical_length(), result);
+}
+
 // this stores fiemap into interval_set, other variations
 // use it internally
 int BlueStore::_fiemap(
@@ -7887,18 +8686,270 @@ int BlueStore::fiemap(
   return r;
 }
 
-int BlueStore::getattr(
+int BlueStore::compress_write(
   CollectionHandle &c_,
   const ghobject_t& oid,
-  const char *name,
-  bufferptr& value)
+  uint64_t offset,
+  const bufferlist& bl,
+  compressed_write_t *cw)
 {
-  Collection *c = static_cast<Collection *>(c_.get());
-  dout(15) << __func__ << " " << c->cid << " " << oid << " " << name << dendl;
+  CollectionRef c = static_cast<Collection *>(c_.get());
   if (!c->exists)
     return -ENOENT;
+  uint64_t length = bl.length();
+  uint64_t end = offset + length;
+  dout(15) << __func__ << " " << c->cid << " " << oid
+	   << " 0x" << std::hex << offset << "~" << length << std::dec
+	   << dendl;
 
-  int r;
+  // cut the write the way _do_write_data() does; only the blobs
+  // _do_write_big() would make of the middle are worth compressing
+  if (p2roundup(offset, min_alloc_size) + min_alloc_size >=
+      p2align(end, min_alloc_size)) {
+    return 0;
+  }
+
+  WriteContext wctx;
+  {
+    RWLock::RLocker l(c->lock);
+    OnodeRef o = c->get_onode(oid, false);
+    if (!o || !o->exists) {
+      // the write creates it, without any hints yet
+      o = new Onode(c.get(), oid, mempool::bluestore_cache_other::string());
+    }
+    _choose_write_options(c, o, 0, &wctx);
+  }
+  if (!wctx.compress) {
+    return -EOPNOTSUPP;
+  }
+  double crr;
+  CompressorRef cp = _select_compressor(c.get(), &wctx, &crr);
+  if (!cp) {
+    return -EOPNOTSUPP;
+  }
+
+  uint64_t middle_offset = p2roundup(offset, min_alloc_size);
+  uint64_t middle_end = p2align(end, min_alloc_size);
+  auto max_bsize = std::max(wctx.target_blob_size, min_alloc_size);
+  vector<compressed_write_t::segment_t> segments;
+  vector<bufferlist> raw;
+  auto add_segment = [&](uint64_t off, uint64_t len) {
+    segments.emplace_back();
+    segments.back().length = len;
+    raw.emplace_back();
+    raw.back().substr_of(bl, off - offset, len);
+  };
+  if (middle_offset > offset) {
+    add_segment(offset, middle_offset - offset);
+  }
+  for (uint64_t pos = middle_offset; pos < middle_end; ) {
+    uint64_t l = std::min(max_bsize, middle_end - pos);
+    add_segment(pos, l);
+    pos += l;
+  }
+  if (end > middle_end) {
+    add_segment(middle_end, end - middle_end);
+  }
+
+  vector<const bufferlist*> in;
+  vector<size_t> in_segments;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    if (segments[i].length > min_alloc_size) {
+      in.push_back(&raw[i]);
+      in_segments.push_back(i);
+    }
+  }
+  if (in.empty()) {
+    return 0;
+  }
+  auto start = mono_clock::now();
+  vector<bufferlist> out;
+  int r = _compress_batch(cp.get(), in, out);
+  if (r < 0) {
+    return r;
+  }
+  logger->tinc(l_bluestore_compress_lat, mono_clock::now() - start);
+
+  // the same test _do_alloc_write() makes, counting the header the
+  // store that keeps the blob puts in front of it
+  bluestore_compression_header_t chdr;
+  bufferlist hbl;
+  encode(chdr, hbl);
+  int num = 0;
+  for (size_t i = 0; i < in_segments.size(); ++i) {
+    auto& s = segments[in_segments[i]];
+    uint64_t newlen = p2roundup<uint64_t>(hbl.length() + out[i].length(),
+					  min_alloc_size);
+    uint64_t want_len = p2roundup<uint64_t>(s.length * crr, min_alloc_size);
+    if (newlen <= want_len && newlen < s.length) {
+      s.alg = cp->get_type();
+      raw[in_segments[i]].swap(out[i]);
+      ++num;
+    }
+  }
+  if (num == 0) {
+    return 0;
+  }
+  for (size_t i = 0; i < segments.size(); ++i) {
+    segments[i].compressed_length = raw[i].length();
+    cw->data.claim_append(raw[i]);
+  }
+  cw->segments.swap(segments);
+  dout(10) << __func__ << " " << c->cid << " " << oid
+	   << " 0x" << std::hex << offset << "~" << length
+	   << " -> 0x" << cw->data.length() << std::dec
+	   << " in " << num << " compressed segments" << dendl;
+  return num;
+}
+
+int BlueStore::read_compressed(
+  CollectionHandle &c_,
+  const ghobject_t& oid,
+  uint64_t offset,
+  size_t length,
+  compressed_write_t *cw,
+  uint32_t op_flags)
+{
+  Collection *c = static_cast<Collection *>(c_.get());
+  dout(15) << __func__ << " " << c->cid << " " << oid
+	   << " 0x" << std::hex << offset << "~" << length << std::dec
+	   << dendl;
+  if (!c->exists)
+    return -ENOENT;
+
+  RWLock::RLocker l(c->lock);
+  OnodeRef o = c->get_onode(oid, false);
+  if (!o || !o->exists) {
+    return -ENOENT;
+  }
+  if (offset >= o->onode.size) {
+    return 0;
+  }
+  if (offset + length > o->onode.size) {
+    length = o->onode.size - offset;
+  }
+  uint64_t end = offset + length;
+  o->extent_map.fault_range(db, offset, length);
+
+  // only blobs compressed as a whole, without a dictionary, and referenced
+  // whole by a single extent within the range go as they are.  blobs with
+  // writes in flight go through _do_read(), the device may not have them.
+  struct whole_blob_t {
+    uint64_t logical_offset;
+    uint32_t length;
+    BlobRef blob;
+  };
+  vector<whole_blob_t> whole;
+  for (auto ep = o->extent_map.seek_lextent(offset);
+       ep != o->extent_map.extent_map.end() && ep->logical_offset < end;
+       ++ep) {
+    const bluestore_blob_t& b = ep->blob->get_blob();
+    if (b.is_compressed() && !b.has_compressed_chunks() &&
+	ep->blob_offset == 0 && ep->length == b.get_logical_length() &&
+	ep->logical_offset >= offset && ep->logical_end() <= end &&
+	!ep->blob->shared_blob->bc.has_writing(
+	  ep->blob->shared_blob->get_cache())) {
+      whole.push_back({ep->logical_offset, ep->length, ep->blob});
+    }
+  }
+  if (whole.empty()) {
+    return 0;
+  }
+
+  compressed_write_t out;
+  uint64_t pos = offset;
+  auto read_raw = [&](uint64_t to) {
+    if (to <= pos) {
+      return 0;
+    }
+    bufferlist bl;
+    int r = _do_read(c, o, pos, to - pos, bl, op_flags);
+    if (r < 0) {
+      return r;
+    }
+    ceph_assert(bl.length() == to - pos);
+    compressed_write_t::segment_t s;
+    s.length = s.compressed_length = bl.length();
+    s.alg = Compressor::COMP_ALG_NONE;
+    out.segments.push_back(s);
+    out.data.claim_append(bl);
+    pos = to;
+    return 0;
+  };
+  int num = 0;
+  for (auto& w : whole) {
+    const bluestore_blob_t& b = w.blob->get_blob();
+    bufferlist cbl;
+    IOContext ioc(cct, NULL, true); // allow EIO
+    int r = b.map(
+      0, b.get_ondisk_length(),
+      [&](uint64_t off, uint64_t len) {
+	return bdev->read(off, len, &cbl, &ioc, false);
+      });
+    if (r < 0) {
+      derr << __func__ << " bdev-read failed: " << cpp_strerror(r) << dendl;
+      return r;
+    }
+    if (_verify_csum(o, &b, 0, cbl, w.logical_offset) < 0) {
+      logger->inc(l_bluestore_read_eio);
+      return -EIO;
+    }
+    bluestore_compression_header_t chdr;
+    auto p = cbl.cbegin();
+    try {
+      decode(chdr, p);
+    } catch (buffer::error& e) {
+      chdr.length = UINT32_MAX;
+    }
+    if (chdr.length > p.get_remaining()) {
+      derr << __func__ << " " << oid << " bad compression header at 0x"
+	   << std::hex << w.logical_offset << std::dec << dendl;
+      return -EIO;
+    }
+    if (chdr.dict_id) {
+      // the target would need our dictionary
+      continue;
+    }
+    r = read_raw(w.logical_offset);
+    if (r < 0) {
+      return r;
+    }
+    compressed_write_t::segment_t s;
+    s.length = w.length;
+    s.alg = chdr.type;
+    s.compressed_length = chdr.length;
+    out.segments.push_back(s);
+    p.copy(chdr.length, out.data);
+    pos += w.length;
+    ++num;
+  }
+  if (num == 0) {
+    return 0;
+  }
+  int r = read_raw(end);
+  if (r < 0) {
+    return r;
+  }
+  *cw = std::move(out);
+  dout(10) << __func__ << " " << c->cid << " " << oid
+	   << " 0x" << std::hex << offset << "~" << length
+	   << " -> 0x" << cw->data.length() << std::dec
+	   << " in " << num << " compressed segments" << dendl;
+  return num;
+}
+
+int BlueStore::getattr(
+  CollectionHandle &c_,
+  const ghobject_t& oid,
+  const char *name,
+  bufferptr& value)
+{
+  Collection *c = static_cast<Collection *>(c_.get());
+  dout(15) << __func__ << " " << c->cid << " " << oid << " " << name << dendl;
+  if (!c->exists)
+    return -ENOENT;
+
+  int r;
   {
     RWLock::RLocker l(c->lock);
     mempool::bluestore_cache_other::string k(name);
@@ -8397,9 +9448,10 @@ uint64_t BlueStore::_get_ondisk_reserved() const {
 void BlueStore::_prepare_ondisk_format_super(KeyValueDB::Transaction& t)
 {
   dout(10) << __func__ << " ondisk_format " << ondisk_format
-	   << " min_compat_ondisk_format " << min_compat_ondisk_format
+	   << " compat_ondisk_format " << compat_ondisk_format
 	   << dendl;
-  ceph_assert(ondisk_format == latest_ondisk_format);
+  ceph_assert(ondisk_format <= latest_ondisk_format);
+  ceph_assert(compat_ondisk_format >= min_compat_ondisk_format);
   {
     bufferlist bl;
     encode(ondisk_format, bl);
@@ -8407,11 +9459,33 @@ void BlueStore::_prepare_ondisk_format_super(KeyValueDB::Transaction& t)
   }
   {
     bufferlist bl;
-    encode(min_compat_ondisk_format, bl);
+    encode(compat_ondisk_format, bl);
     t->set(PREFIX_SUPER, "min_compat_ondisk_format", bl);
   }
 }
 
+int BlueStore::_require_compat_ondisk_format(int32_t v)
+{
+  std::lock_guard<std::mutex> l(compat_ondisk_format_lock);
+  if (compat_ondisk_format >= v) {
+    return 0;
+  }
+  dout(1) << __func__ << " compat_ondisk_format " << compat_ondisk_format
+	  << " -> " << v << dendl;
+  // persist before anything needing it is written
+  int32_t old = compat_ondisk_format;
+  compat_ondisk_format = v;
+  KeyValueDB::Transaction t = db->get_transaction();
+  _prepare_ondisk_format_super(t);
+  int r = db->submit_transaction_sync(t);
+  if (r < 0) {
+    derr << __func__ << " failed to update compat_ondisk_format: "
+	 << cpp_strerror(r) << dendl;
+    compat_ondisk_format = old;
+  }
+  return r;
+}
+
 int BlueStore::_open_super_meta()
 {
   // nid
@@ -8480,7 +9554,7 @@ int BlueStore::_open_super_meta()
   }
 
   // ondisk format
-  int32_t compat_ondisk_format = 0;
+  compat_ondisk_format = 0;
   {
     bufferlist bl;
     int r = db->get(PREFIX_SUPER, "ondisk_format", &bl);
@@ -8555,9 +9629,155 @@ int BlueStore::_open_super_meta()
   _set_blob_size();
 
   _validate_bdev();
+  return _open_compression_dicts();
+}
+
+int BlueStore::_open_compression_dicts()
+{
+  std::lock_guard<std::mutex> l(comp_dict_lock);
+  comp_dicts.clear();
+  pool_comp_dict.clear();
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_COMPRESSION_DICT);
+  for (it->lower_bound(string()); it->valid(); it->next()) {
+    uint32_t id;
+    _key_decode_u32(it->key().c_str(), &id);
+    bluestore_compression_dict_t d;
+    bufferlist bl = it->value();
+    auto p = bl.cbegin();
+    try {
+      decode(d, p);
+    } catch (buffer::error& e) {
+      derr << __func__ << " failed to decode compression dictionary " << id
+	   << dendl;
+      return -EIO;
+    }
+    _add_compression_dict(id, d);
+  }
   return 0;
 }
 
+void BlueStore::_add_compression_dict(uint32_t id,
+				      bluestore_compression_dict_t& d)
+{
+  compression_dict_t& cd = comp_dicts[id];
+  cd.info = d;
+  CompressorRef c = Compressor::create(cct, d.type);
+  if (c) {
+    cd.compressor = c->with_dictionary(d.dict);
+  }
+  if (!cd.compressor) {
+    derr << __func__ << " unable to load compression dictionary " << id
+	 << ", blobs compressed with it can't be read" << dendl;
+  }
+  // the newest dictionary of a pool is the one new blobs are compressed with
+  pool_comp_dict[d.pool] = id;
+  dout(10) << __func__ << " " << id << " pool " << d.pool << " "
+	   << Compressor::get_comp_alg_name(d.type) << " 0x" << std::hex
+	   << d.dict.length() << std::dec << dendl;
+}
+
+int BlueStore::train_compression_dict(
+  int64_t pool, const string& alg, unsigned max_samples, size_t sample_len,
+  size_t dict_len, uint32_t *id)
+{
+  dout(1) << __func__ << " pool " << pool << " " << alg << dendl;
+  CompressorRef c = Compressor::create(cct, alg);
+  if (!c) {
+    derr << __func__ << " unable to load compressor " << alg << dendl;
+    return -ENOENT;
+  }
+
+  vector<CollectionRef> colls;
+  {
+    RWLock::RLocker l(coll_lock);
+    for (auto& p : coll_map) {
+      spg_t pgid;
+      if (p.first.is_pg(&pgid) && pgid.pool() == pool) {
+	colls.push_back(p.second);
+      }
+    }
+  }
+  vector<bufferlist> samples;
+  for (auto& coll : colls) {
+    CollectionHandle ch = coll;
+    ghobject_t next;
+    while (samples.size() < max_samples && !next.is_max()) {
+      vector<ghobject_t> ls;
+      int r = collection_list(ch, next, ghobject_t::get_max(), 100, &ls,
+			      &next);
+      if (r < 0) {
+	return r;
+      }
+      for (auto& oid : ls) {
+	bufferlist bl;
+	r = read(ch, oid, 0, sample_len, bl,
+		 CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+	if (r > 0) {
+	  samples.push_back(std::move(bl));
+	  if (samples.size() >= max_samples) {
+	    break;
+	  }
+	}
+      }
+    }
+  }
+  if (samples.empty()) {
+    derr << __func__ << " no objects to train on in pool " << pool << dendl;
+    return -ENOENT;
+  }
+
+  bluestore_compression_dict_t d;
+  d.pool = pool;
+  d.type = c->get_type();
+  d.ctime = ceph_clock_now();
+  int r = c->train_dictionary(samples, dict_len, &d.dict);
+  if (r < 0) {
+    derr << __func__ << " training on " << samples.size() << " objects failed: "
+	 << cpp_strerror(r) << dendl;
+    return r;
+  }
+
+  // older releases would ignore the dictionary blobs are compressed with
+  r = _require_compat_ondisk_format(compression_dict_ondisk_format);
+  if (r < 0) {
+    return r;
+  }
+
+  std::lock_guard<std::mutex> l(comp_dict_lock);
+  *id = comp_dicts.empty() ? 1 : comp_dicts.rbegin()->first + 1;
+  string key;
+  _key_encode_u32(*id, &key);
+  bufferlist bl;
+  encode(d, bl);
+  KeyValueDB::Transaction t = db->get_transaction();
+  t->set(PREFIX_COMPRESSION_DICT, key, bl);
+  r = db->submit_transaction_sync(t);
+  if (r < 0) {
+    return r;
+  }
+  _add_compression_dict(*id, d);
+  dout(1) << __func__ << " trained dictionary " << *id << " of 0x" << std::hex
+	  << d.dict.length() << std::dec << " bytes on " << samples.size()
+	  << " objects" << dendl;
+  return 0;
+}
+
+void BlueStore::dump_compression_dicts(Formatter *f)
+{
+  std::lock_guard<std::mutex> l(comp_dict_lock);
+  f->open_array_section("compression_dicts");
+  for (auto& p : comp_dicts) {
+    f->open_object_section("dict");
+    f->dump_unsigned("id", p.first);
+    p.second.info.dump(f);
+    f->dump_bool("loaded", (bool)p.second.compressor);
+    auto q = pool_comp_dict.find(p.second.info.pool);
+    f->dump_bool("active", q != pool_comp_dict.end() && q->second == p.first);
+    f->close_section();
+  }
+  f->close_section();
+}
+
 int BlueStore::_upgrade_super()
 {
   dout(1) << __func__ << " from " << ondisk_format << ", latest "
@@ -8589,6 +9809,28 @@ int BlueStore::_upgrade_super()
       t->rmkey(PREFIX_SUPER, "min_min_alloc_size");
     }
     ondisk_format = 2;
+    compat_ondisk_format = min_compat_ondisk_format;
+    _prepare_ondisk_format_super(t);
+    int r = db->submit_transaction_sync(t);
+    ceph_assert(r == 0);
+  }
+  if (ondisk_format == 2) {
+    // changes:
+    // - blob: added FLAG_COMPRESSED_CHUNKS; compat_ondisk_format is
+    //   raised to compressed_chunks_ondisk_format on first use only
+    KeyValueDB::Transaction t = db->get_transaction();
+    ondisk_format = 3;
+    _prepare_ondisk_format_super(t);
+    int r = db->submit_transaction_sync(t);
+    ceph_assert(r == 0);
+  }
+  if (ondisk_format == 3) {
+    // changes:
+    // - compression header: dict_id of a trained compression dictionary;
+    //   compat_ondisk_format is raised to compression_dict_ondisk_format
+    //   when the first one is stored
+    KeyValueDB::Transaction t = db->get_transaction();
+    ondisk_format = 4;
     _prepare_ondisk_format_super(t);
     int r = db->submit_transaction_sync(t);
     ceph_assert(r == 0);
@@ -9202,6 +10444,7 @@ void BlueStore::_kv_start()
 
   deferred_finisher.start();
   finisher.start();
+  compress_tp.start();
   kv_sync_thread.create("bstore_kv_sync");
   kv_finalize_thread.create("bstore_kv_final");
 }
@@ -9241,6 +10484,7 @@ void BlueStore::_kv_stop()
   deferred_finisher.stop();
   finisher.wait_for_empty();
   finisher.stop();
+  compress_tp.stop();
   dout(10) << __func__ << " stopped" << dendl;
 }
 
@@ -9806,6 +11050,7 @@ int BlueStore::queue_transactions(
   dout(10) << __func__ << " ch " << c << " " << c->cid << dendl;
 
   // prepare
+  std::unique_lock<std::mutex> sl(osr->submit_lock);
   TransContext *txc = _txc_create(static_cast<Collection*>(ch.get()), osr,
 				  &on_commit);
 
@@ -9814,6 +11059,9 @@ int BlueStore::queue_transactions(
     _txc_add_transaction(txc, &(*p));
   }
   _txc_calc_cost(txc);
+  if (txc->compress_lat != ceph::timespan::zero()) {
+    logger->tinc(l_bluestore_compress_txc_lat, txc->compress_lat);
+  }
 
   _txc_write_nodes(txc, txc->t);
 
@@ -9828,6 +11076,7 @@ int BlueStore::queue_transactions(
   }
 
   _txc_finalize_kv(txc, txc->t);
+  sl.unlock();
   if (handle)
     handle->suspend_tp_timeout();
 
@@ -9995,6 +11244,7 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
     bool create = false;
     if (op->op == Transaction::OP_TOUCH ||
 	op->op == Transaction::OP_WRITE ||
+	op->op == Transaction::OP_WRITE_COMPRESSED ||
 	op->op == Transaction::OP_ZERO) {
       create = true;
     }
@@ -10029,6 +11279,17 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
       }
       break;
 
+    case Transaction::OP_WRITE_COMPRESSED:
+      {
+        uint64_t off = op->off;
+        uint64_t len = op->len;
+	uint32_t fadvise_flags = i.get_fadvise_flags();
+	compressed_write_t cw;
+	i.decode_compressed_write(cw);
+	r = _write_compressed(txc, c, o, off, len, cw, fadvise_flags);
+      }
+      break;
+
     case Transaction::OP_ZERO:
       {
         uint64_t off = op->off;
@@ -10787,6 +12048,159 @@ void BlueStore::_do_write_big(
   }
 }
 
+void BlueStore::CompressBatch::run()
+{
+  size_t i;
+  while ((i = next++) < in.size()) {
+    int rr = c->compress(*in[i], out[i]);
+    if (rr < 0) {
+      int expected = 0;
+      r.compare_exchange_strong(expected, rr);
+    }
+  }
+}
+
+void BlueStore::CompressWQ::process(CompressBatch *b)
+{
+  b->run();
+  std::lock_guard<std::mutex> l(b->lock);
+  if (--b->queued == 0) {
+    b->cond.notify_all();
+  }
+}
+
+// the compressor of the pool (or store) and the ratio it has to achieve
+CompressorRef BlueStore::_select_compressor(
+  Collection *coll,
+  const WriteContext *wctx,
+  double *crr)
+{
+  CompressorRef c = select_option(
+    "compression_algorithm",
+    compressor,
+    [&]() {
+      string val;
+      int level = 0;
+      bool has_alg = coll->pool_opts.get(pool_opts_t::COMPRESSION_ALGORITHM,
+                                         &val);
+      bool has_level = coll->pool_opts.get(pool_opts_t::COMPRESSION_LEVEL,
+                                           &level);
+      CompressorRef cp = compressor;
+      if (has_level && !has_alg && cp) {
+        val = cp->get_type_name();
+        has_alg = true;
+      }
+      if (has_alg) {
+        boost::optional<int> l = has_level ?
+          boost::optional<int>(level) : _get_compression_level();
+        if (!cp || cp->get_type_name() != val || cp->get_level() != l) {
+          cp = Compressor::create(cct, val, l);
+        }
+        return boost::optional<CompressorRef>(cp);
+      }
+      return boost::optional<CompressorRef>();
+    }
+  );
+
+  *crr = select_option(
+    "compression_required_ratio",
+    cct->_conf->bluestore_compression_required_ratio,
+    [&]() {
+      double val;
+      if (coll->pool_opts.get(pool_opts_t::COMPRESSION_REQUIRED_RATIO, &val)) {
+        return boost::optional<double>(val);
+      }
+      return boost::optional<double>();
+    }
+  );
+  if (wctx->compressor) {
+    c = wctx->compressor;
+  }
+  return c;
+}
+
+int BlueStore::_compress_batch(
+  Compressor *c,
+  const vector<const bufferlist*>& in,
+  vector<bufferlist>& out)
+{
+  // blobs are independent of each other; without helper threads let the
+  // compressor take them all at once
+  size_t helpers = std::min<size_t>(compress_tp.get_num_threads(),
+				    in.size() - 1);
+  if (helpers == 0) {
+    return c->compress_batch(in, out);
+  }
+
+  out.resize(in.size());
+  CompressBatch b(c, in, out);
+  b.queued = helpers;
+  for (size_t i = 0; i < helpers; ++i) {
+    compress_wq.queue(&b);
+  }
+  // do our share rather than idle, then wait for the helpers to be done
+  // with the batch before it goes away.  entries no worker took are taken
+  // back: bluestore_compression_threads may have dropped to 0 meanwhile
+  b.run();
+  unsigned unqueued = 0;
+  while (compress_wq.dequeue(&b)) {
+    ++unqueued;
+  }
+  std::unique_lock<std::mutex> l(b.lock);
+  b.queued -= unqueued;
+  b.cond.wait(l, [&b] { return b.queued == 0; });
+  return b.r;
+}
+
+bool BlueStore::_compress_skip(
+  Collection *c,
+  Onode *o,
+  const bufferlist& bl,
+  double crr)
+{
+  // an object which kept failing the ratio is written uncompressed, but
+  // every 16th blob is still tried in case its data changed
+  uint64_t max_rejects = cct->_conf.get_val<uint64_t>(
+    "bluestore_compression_adaptive_max_rejects");
+  if (max_rejects && o->comp_rejects >= max_rejects &&
+      ++o->comp_rejects % 16) {
+    dout(20) << __func__ << " " << o->oid << " rejected "
+	     << o->comp_rejects << " blobs in a row" << dendl;
+    return true;
+  }
+
+  // sampling is not free; only do it where compression mostly fails
+  if (c->comp_reject_rate < .5) {
+    return false;
+  }
+  uint64_t sample = cct->_conf.get_val<Option::size_t>(
+    "bluestore_compression_adaptive_sample_size");
+  if (!sample) {
+    return false;
+  }
+  double est = Compressor::estimate_ratio(bl, sample);
+  if (est <= crr) {
+    return false;
+  }
+  dout(20) << __func__ << " " << o->oid << " estimated ratio " << est
+	   << " > " << crr << dendl;
+  _compress_note(c, o, true);
+  return true;
+}
+
+void BlueStore::_compress_note(
+  Collection *c,
+  Onode *o,
+  bool rejected)
+{
+  if (rejected) {
+    ++o->comp_rejects;
+  } else {
+    o->comp_rejects = 0;
+  }
+  c->comp_reject_rate = c->comp_reject_rate * 7 / 8 + (rejected ? 1.0 / 8 : 0);
+}
+
 int BlueStore::_do_alloc_write(
   TransContext *txc,
   CollectionRef coll,
@@ -10803,33 +12217,7 @@ int BlueStore::_do_alloc_write(
   CompressorRef c;
   double crr = 0;
   if (wctx->compress) {
-    c = select_option(
-      "compression_algorithm",
-      compressor,
-      [&]() {
-        string val;
-        if (coll->pool_opts.get(pool_opts_t::COMPRESSION_ALGORITHM, &val)) {
-          CompressorRef cp = compressor;
-          if (!cp || cp->get_type_name() != val) {
-            cp = Compressor::create(cct, val);
-          }
-          return boost::optional<CompressorRef>(cp);
-        }
-        return boost::optional<CompressorRef>();
-      }
-    );
-
-    crr = select_option(
-      "compression_required_ratio",
-      cct->_conf->bluestore_compression_required_ratio,
-      [&]() {
-        double val;
-        if (coll->pool_opts.get(pool_opts_t::COMPRESSION_REQUIRED_RATIO, &val)) {
-          return boost::optional<double>(val);
-        }
-        return boost::optional<double>();
-      }
-    );
+    c = _select_compressor(coll.get(), wctx, &crr);
   }
 
   // checksum
@@ -10849,60 +12237,163 @@ int BlueStore::_do_alloc_write(
   // compress (as needed) and calc needed space
   uint64_t need = 0;
   auto max_bsize = std::max(wctx->target_blob_size, min_alloc_size);
-  for (auto& wi : wctx->writes) {
-    if (c && wi.blob_length > min_alloc_size) {
-      auto start = mono_clock::now();
-
-      // compress
-      ceph_assert(wi.b_off == 0);
-      ceph_assert(wi.blob_length == wi.bl.length());
-
-      // FIXME: memory alignment here is bad
-      bufferlist t;
-      int r = c->compress(wi.bl, t);
-      ceph_assert(r == 0);
+  vector<WriteContext::write_item*> to_compress;
+  uint64_t chunk_len = 0;
+  ceph::timespan compress_lat = ceph::timespan::zero();
+  if (c) {
+    for (auto& wi : wctx->writes) {
+      // compressed, or found not to compress, by _write_compressed()
+      if (wi.compressed || wi.incompressible) {
+	continue;
+      }
+      if (wi.blob_length > min_alloc_size) {
+	ceph_assert(wi.b_off == 0);
+	ceph_assert(wi.blob_length == wi.bl.length());
+	if (wctx->compress_adaptive &&
+	    _compress_skip(coll.get(), o.get(), wi.bl, crr)) {
+	  logger->inc(l_bluestore_compress_skipped_count);
+	  continue;
+	}
+	to_compress.push_back(&wi);
+      }
+    }
+  }
+  uint32_t dict_id = 0;
+  if (!to_compress.empty()) {
+    auto start = mono_clock::now();
+
+    // blobs larger than a chunk are compressed in independent chunks
+    chunk_len = cct->_conf.get_val<Option::size_t>(
+      "bluestore_compression_chunk_size");
+    size_t num_chunks = 0;
+    for (auto wip : to_compress) {
+      if (chunk_len && wip->blob_length > chunk_len) {
+	num_chunks += (wip->blob_length + chunk_len - 1) / chunk_len;
+      }
+    }
+    if (num_chunks &&
+	_require_compat_ondisk_format(compressed_chunks_ondisk_format) < 0) {
+      // older releases would misread chunked blobs; compress them whole
+      chunk_len = 0;
+      num_chunks = 0;
+    }
+    vector<bufferlist> chunks;
+    chunks.reserve(num_chunks);
+    vector<const bufferlist*> in;
+    for (auto wip : to_compress) {
+      if (chunk_len && wip->blob_length > chunk_len) {
+	for (uint64_t off = 0; off < wip->blob_length; off += chunk_len) {
+	  chunks.emplace_back();
+	  chunks.back().substr_of(
+	    wip->bl, off, std::min(chunk_len, wip->blob_length - off));
+	  in.push_back(&chunks.back());
+	}
+      } else {
+	in.push_back(&wip->bl);
+      }
+    }
 
-      bluestore_compression_header_t chdr;
-      chdr.type = c->get_type();
-      chdr.length = t.length();
-      encode(chdr, wi.compressed_bl);
-      wi.compressed_bl.claim_append(t);
+    // use the pool's trained dictionary, if it has one for this
+    // algorithm.  chunked blobs have no header to note it in.
+    CompressorRef cp;
+    spg_t pgid;
+    if (num_chunks == 0 && coll->cid.is_pg(&pgid)) {
+      cp = _get_pool_compression_dict(pgid.pool(), c, &dict_id);
+    }
+    if (!cp) {
+      cp = c;
+      dict_id = 0;
+    }
 
-      wi.compressed_len = wi.compressed_bl.length();
-      uint64_t newlen = p2roundup(wi.compressed_len, min_alloc_size);
-      uint64_t want_len_raw = wi.blob_length * crr;
-      uint64_t want_len = p2roundup(want_len_raw, min_alloc_size);
-      if (newlen <= want_len && newlen < wi.blob_length) {
-	// Cool. We compressed at least as much as we were hoping to.
-	// pad out to min_alloc_size
-	wi.compressed_bl.append_zero(newlen - wi.compressed_len);
-	logger->inc(l_bluestore_write_pad_bytes, newlen - wi.compressed_len);
-	dout(20) << __func__ << std::hex << "  compressed 0x" << wi.blob_length
-		 << " -> 0x" << wi.compressed_len << " => 0x" << newlen
-		 << " with " << c->get_type()
-		 << std::dec << dendl;
-	txc->statfs_delta.compressed() += wi.compressed_len;
-	txc->statfs_delta.compressed_original() += wi.blob_length;
-	txc->statfs_delta.compressed_allocated() += newlen;
-	logger->inc(l_bluestore_compress_success_count);
-	wi.compressed = true;
-	need += newlen;
+    // FIXME: memory alignment here is bad
+    vector<bufferlist> out;
+    int r = _compress_batch(cp.get(), in, out);
+    if (r < 0) {
+      // e.g. a level the algorithm does not take; store the data as is
+      derr << __func__ << " failed to compress " << to_compress.size()
+	   << " blobs with " << cp->get_type() << ": " << cpp_strerror(r)
+	   << ", writing them uncompressed" << dendl;
+      logger->inc(l_bluestore_compress_rejected_count, to_compress.size());
+      to_compress.clear();
+    }
+
+    auto po = out.begin();
+    for (auto wip : to_compress) {
+      auto& wi = *wip;
+      if (chunk_len && wi.blob_length > chunk_len) {
+	wi.chunk_offsets.push_back(0);
+	for (uint64_t off = 0; off < wi.blob_length; off += chunk_len) {
+	  wi.compressed_bl.claim_append(*po++);
+	  wi.chunk_offsets.push_back(wi.compressed_bl.length());
+	}
       } else {
-	dout(20) << __func__ << std::hex << "  0x" << wi.blob_length
-		 << " compressed to 0x" << wi.compressed_len << " -> 0x" << newlen
-		 << " with " << c->get_type()
-		 << ", which is more than required 0x" << want_len_raw
-		 << " -> 0x" << want_len
-		 << ", leaving uncompressed"
-		 << std::dec << dendl;
-	logger->inc(l_bluestore_compress_rejected_count);
-	need += wi.blob_length;
-      }
-      logger->tinc(l_bluestore_compress_lat,
-                  mono_clock::now() - start);
-    } else {
-      need += wi.blob_length;
+	bluestore_compression_header_t chdr;
+	chdr.type = c->get_type();
+	chdr.length = po->length();
+	chdr.dict_id = dict_id;
+	encode(chdr, wi.compressed_bl);
+	wi.compressed_bl.claim_append(*po++);
+      }
+      wi.compressed_len = wi.compressed_bl.length();
     }
+    compress_lat = mono_clock::now() - start;
+    logger->tinc(l_bluestore_compress_lat, compress_lat);
+    txc->compress_lat += compress_lat;
+  }
+  uint64_t bytes_in = 0, bytes_out = 0;
+  unsigned num_success = 0;
+  for (auto wip : to_compress) {
+    auto& wi = *wip;
+    uint64_t newlen = p2roundup(wi.compressed_len, min_alloc_size);
+    uint64_t want_len_raw = wi.blob_length * crr;
+    uint64_t want_len = p2roundup(want_len_raw, min_alloc_size);
+    if (newlen <= want_len && newlen < wi.blob_length) {
+      // Cool. We compressed at least as much as we were hoping to.
+      // pad out to min_alloc_size
+      wi.compressed_bl.append_zero(newlen - wi.compressed_len);
+      logger->inc(l_bluestore_write_pad_bytes, newlen - wi.compressed_len);
+      dout(20) << __func__ << std::hex << "  compressed 0x" << wi.blob_length
+	       << " -> 0x" << wi.compressed_len << " => 0x" << newlen
+	       << " with " << c->get_type()
+	       << std::dec << dendl;
+      txc->statfs_delta.compressed() += wi.compressed_len;
+      txc->statfs_delta.compressed_original() += wi.blob_length;
+      txc->statfs_delta.compressed_allocated() += newlen;
+      logger->inc(l_bluestore_compress_success_count);
+      if (dict_id) {
+	logger->inc(l_bluestore_compress_dict_count);
+      }
+      ++num_success;
+      wi.compressed = true;
+      _compress_note(coll.get(), o.get(), false);
+    } else {
+      dout(20) << __func__ << std::hex << "  0x" << wi.blob_length
+	       << " compressed to 0x" << wi.compressed_len << " -> 0x" << newlen
+	       << " with " << c->get_type()
+	       << ", which is more than required 0x" << want_len_raw
+	       << " -> 0x" << want_len
+	       << ", leaving uncompressed"
+	       << std::dec << dendl;
+      logger->inc(l_bluestore_compress_rejected_count);
+      _compress_note(coll.get(), o.get(), true);
+    }
+    bytes_in += wi.blob_length;
+    bytes_out += wi.compressed_len;
+  }
+  if (!to_compress.empty()) {
+    _update_comp_loggers(c->get_type(), coll.get(), [&](PerfCounters *l) {
+	l->inc(l_bluestore_comp_compress_bytes_in, bytes_in);
+	l->inc(l_bluestore_comp_compress_bytes_out, bytes_out);
+	l->inc(l_bluestore_comp_compress_success_count, num_success);
+	l->inc(l_bluestore_comp_compress_rejected_count,
+	       to_compress.size() - num_success);
+	l->tinc(l_bluestore_comp_compress_lat, compress_lat);
+	l->hinc(l_bluestore_comp_compress_lat_bytes_hist,
+		std::chrono::nanoseconds(compress_lat).count(), bytes_in);
+      });
+  }
+  for (auto& wi : wctx->writes) {
+    need += wi.compressed ? wi.compressed_bl.length() : wi.blob_length;
   }
   PExtentVector prealloc;
   prealloc.reserve(2 * wctx->writes.size());;
@@ -10932,6 +12423,10 @@ int BlueStore::_do_alloc_write(
       csum_length = final_length;
       l = &wi.compressed_bl;
       dblob.set_compressed(wi.blob_length, wi.compressed_len);
+      if (!wi.chunk_offsets.empty()) {
+	dblob.set_compressed_chunks(c->get_type(), chunk_len,
+				    wi.chunk_offsets);
+      }
     } else if (wi.new_blob) {
       // initialize newly created blob only
       ceph_assert(dblob.is_mutable());
@@ -11015,8 +12510,10 @@ int BlueStore::_do_alloc_write(
     wi.b->dirty_blob().mark_used(le->blob_offset, le->length);
     txc->statfs_delta.stored() += le->length;
     dout(20) << __func__ << "  lex " << *le << dendl;
-    _buffer_cache_write(txc, wi.b, b_off, wi.bl,
-                        wctx->buffered ? 0 : Buffer::FLAG_NOCACHE);
+    if (wi.bl.length()) {
+      _buffer_cache_write(txc, wi.b, b_off, wi.bl,
+			  wctx->buffered ? 0 : Buffer::FLAG_NOCACHE);
+    }
 
     // queue io
     if (!g_conf()->bluestore_debug_omit_block_device_write) {
@@ -11197,10 +12694,15 @@ void BlueStore::_choose_write_options(
 
   wctx->compress = (cm != Compressor::COMP_NONE) &&
     ((cm == Compressor::COMP_FORCE) ||
-     (cm == Compressor::COMP_AGGRESSIVE &&
+     ((cm == Compressor::COMP_AGGRESSIVE ||
+       cm == Compressor::COMP_ADAPTIVE) &&
       (alloc_hints & CEPH_OSD_ALLOC_HINT_FLAG_INCOMPRESSIBLE) == 0) ||
      (cm == Compressor::COMP_PASSIVE &&
       (alloc_hints & CEPH_OSD_ALLOC_HINT_FLAG_COMPRESSIBLE)));
+  // data hinted compressible is always tried
+  wctx->compress_adaptive = wctx->compress &&
+    cm == Compressor::COMP_ADAPTIVE &&
+    (alloc_hints & CEPH_OSD_ALLOC_HINT_FLAG_COMPRESSIBLE) == 0;
 
   if ((alloc_hints & CEPH_OSD_ALLOC_HINT_FLAG_SEQUENTIAL_READ) &&
       (alloc_hints & CEPH_OSD_ALLOC_HINT_FLAG_RANDOM_READ) == 0 &&
@@ -11396,6 +12898,343 @@ int BlueStore::_do_write(
   return r;
 }
 
+// -----------------
+// background recompression
+
+CompressorRef BlueStore::_get_recompressor(Collection *c)
+{
+  string alg = cct->_conf.get_val<string>(
+    "bluestore_recompression_algorithm");
+  int64_t level = cct->_conf.get_val<int64_t>("bluestore_recompression_level");
+  int val;
+  c->pool_opts.get(pool_opts_t::RECOMPRESSION_ALGORITHM, &alg);
+  if (c->pool_opts.get(pool_opts_t::RECOMPRESSION_LEVEL, &val)) {
+    level = val;
+  }
+  if (alg.empty()) {
+    return CompressorRef();
+  }
+  boost::optional<int> l;
+  if (level) {
+    l = level;
+  }
+  return Compressor::create(cct, alg, l);
+}
+
+int BlueStore::_get_blob_compression_type(const bluestore_blob_t& blob,
+					  int *type)
+{
+  if (blob.has_compressed_chunks()) {
+    *type = blob.comp_type;
+    return 0;
+  }
+  // the compression header is at the front of the blob
+  bufferlist bl;
+  IOContext ioc(cct, NULL, true); // allow EIO
+  int r = blob.map(
+    0, block_size,
+    [&](uint64_t offset, uint64_t length) {
+      return bdev->read(offset, length, &bl, &ioc, false);
+    });
+  if (r < 0) {
+    return r;
+  }
+  bluestore_compression_header_t chdr;
+  try {
+    auto p = bl.cbegin();
+    decode(chdr, p);
+  } catch (buffer::error& e) {
+    return -EIO;
+  }
+  *type = chdr.type;
+  return 0;
+}
+
+// find the extents of o in compressed blobs written with another
+// algorithm than alg, returns the bytes read to tell or an error
+int BlueStore::_find_recompress_extents(Collection *c, OnodeRef o, int alg,
+					interval_set<uint64_t> *extents)
+{
+  o->extent_map.fault_range(db, 0, o->onode.size);
+  map<Blob*,bool> blobs;  // blob -> to be recompressed
+  int bytes = 0;
+  for (auto& e : o->extent_map.extent_map) {
+    const bluestore_blob_t& b = e.blob->get_blob();
+    // rewriting a clone's share of a blob would only add to it
+    if (!b.is_compressed() || b.is_shared()) {
+      continue;
+    }
+    auto p = blobs.find(e.blob.get());
+    if (p == blobs.end()) {
+      int type;
+      int r = _get_blob_compression_type(b, &type);
+      if (r < 0) {
+	return r;
+      }
+      if (!b.has_compressed_chunks()) {
+	bytes += block_size;
+      }
+      p = blobs.emplace(e.blob.get(), type != alg).first;
+    }
+    if (p->second) {
+      extents->insert(e.logical_offset, e.length);
+    }
+  }
+  return bytes;
+}
+
+// rewrite the extents of a cold object in compressed blobs of another
+// algorithm with cp, returns the bytes read and written
+uint64_t BlueStore::_recompress_object(CollectionRef& c, CompressorRef cp,
+				       const ghobject_t& oid)
+{
+  int alg = cp->get_type();
+  uint64_t bytes = 0;
+  interval_set<uint64_t> extents;
+  {
+    RWLock::RLocker l(c->lock);
+    // onodes in the cache belong to objects used recently
+    if (c->onode_map.lookup(oid)) {
+      return 0;
+    }
+    logger->inc(l_bluestore_recompress_objects);
+    OnodeRef o = c->get_onode(oid, false);
+    int r = 0;
+    if (o && o->exists) {
+      r = _find_recompress_extents(c.get(), o, alg, &extents);
+    }
+    // drop what we loaded, or the object would look hot to the next pass
+    o.reset();
+    c->onode_map.evict(oid);
+    if (r < 0) {
+      derr << __func__ << " " << c->cid << " " << oid
+	   << " failed to read compression headers: " << cpp_strerror(r)
+	   << dendl;
+      return 0;
+    }
+    bytes = r;
+  }
+  if (extents.empty()) {
+    return bytes;
+  }
+  if (alloc->get_free() < extents.size()) {
+    dout(10) << __func__ << " " << c->cid << " " << oid
+	     << " not enough free space to rewrite 0x" << std::hex
+	     << extents.size() << std::dec << " bytes" << dendl;
+    return bytes;
+  }
+
+  // prepare the rewrite under the lock queue_transactions() prepares
+  // under, so that no txc of the OSD is prepared at the same time
+  OpSequencer *osr = c->osr.get();
+  std::unique_lock<std::mutex> sl(osr->submit_lock);
+  RWLock::WLocker wl(c->lock);
+  // the object may have changed since, or be about to
+  OnodeRef o = c->get_onode(oid, false);
+  if (!o || !o->exists || o->flushing_count.load()) {
+    return bytes;
+  }
+  extents.clear();
+  if (_find_recompress_extents(c.get(), o, alg, &extents) < 0) {
+    return bytes;
+  }
+  // whole allocation units only: those go to new blobs, so that nothing
+  // is written, and the rewrite can be dropped, until all are allocated
+  interval_set<uint64_t> aligned;
+  for (auto p = extents.begin(); p != extents.end(); ++p) {
+    uint64_t start = p2roundup<uint64_t>(p.get_start(), min_alloc_size);
+    uint64_t end = p2align<uint64_t>(p.get_end(), min_alloc_size);
+    if (start < end) {
+      aligned.insert(start, end - start);
+    }
+  }
+  if (aligned.empty()) {
+    return bytes;
+  }
+  vector<bufferlist> data;
+  for (auto p = aligned.begin(); p != aligned.end(); ++p) {
+    data.emplace_back();
+    int r = _do_read(c.get(), o, p.get_start(), p.get_len(), data.back(), 0);
+    bytes += p.get_len();
+    if (r != (int)p.get_len()) {
+      derr << __func__ << " " << c->cid << " " << oid << " read 0x"
+	   << std::hex << p.get_start() << "~" << p.get_len() << std::dec
+	   << " failed: " << (r < 0 ? cpp_strerror(r) : "short read")
+	   << dendl;
+      return bytes;
+    }
+  }
+  dout(20) << __func__ << " " << c->cid << " " << oid << " 0x"
+	   << std::hex << aligned << std::dec << " to "
+	   << cp->get_type_name() << dendl;
+
+  TransContext *txc = _txc_create(c.get(), osr, nullptr);
+  WriteContext wctx;
+  _choose_write_options(c, o, CEPH_OSD_OP_FLAG_FADVISE_DONTNEED, &wctx);
+  wctx.compress = true;
+  wctx.compress_adaptive = false;
+  wctx.compressor = cp;
+  wctx.target_blob_size = comp_max_blob_size.load();
+  auto d = data.begin();
+  for (auto p = aligned.begin(); p != aligned.end(); ++p, ++d) {
+    _do_write_data(txc, c, o, p.get_start(), p.get_len(), *d, &wctx);
+    txc->bytes += p.get_len();
+  }
+  int r = _do_alloc_write(txc, c, o, &wctx);
+  if (r < 0) {
+    derr << __func__ << " " << c->cid << " " << oid
+	 << " _do_alloc_write failed with " << cpp_strerror(r) << dendl;
+    // nothing is written; forget the extents we punched in the onode,
+    // and finish the txc, which is queued already, empty
+    txc->statfs_delta.reset();
+    o.reset();
+    c->onode_map.evict(oid);
+  } else {
+    _wctx_finish(txc, c, o, &wctx);
+    o->extent_map.compress_extent_map(aligned.range_start(),
+				      aligned.range_end() -
+				      aligned.range_start());
+    o->extent_map.dirty_range(aligned.range_start(),
+			      aligned.range_end() - aligned.range_start());
+    txc->write_onode(o);
+    bytes += txc->bytes;
+    logger->inc(l_bluestore_recompress_bytes, txc->bytes);
+    logger->inc(l_bluestore_recompress_rewritten);
+    if (txc->statfs_delta.allocated() < 0) {
+      logger->inc(l_bluestore_recompress_saved_bytes,
+		  -txc->statfs_delta.allocated());
+    }
+  }
+
+  // submit like queue_transactions() does
+  _txc_calc_cost(txc);
+  _txc_write_nodes(txc, txc->t);
+  if (txc->deferred_txn) {
+    txc->deferred_txn->seq = ++deferred_seq;
+    bufferlist bl;
+    encode(*txc->deferred_txn, bl);
+    string key;
+    get_deferred_key(txc->deferred_txn->seq, &key);
+    txc->t->set(PREFIX_DEFERRED, key, bl);
+  }
+  _txc_finalize_kv(txc, txc->t);
+  wl.unlock();
+  sl.unlock();
+  throttle_bytes.get(txc->cost);
+  if (txc->deferred_txn) {
+    if (!throttle_deferred_bytes.get_or_fail(txc->cost)) {
+      ++deferred_aggressive;
+      deferred_try_submit();
+      {
+	std::lock_guard<std::mutex> l(kv_lock);
+	kv_cond.notify_one();
+      }
+      throttle_deferred_bytes.get(txc->cost);
+      --deferred_aggressive;
+    }
+  }
+  logger->inc(l_bluestore_txc);
+  _txc_state_proc(txc);
+  return bytes;
+}
+
+void BlueStore::recompress_cold_data()
+{
+  vector<CollectionRef> colls;
+  {
+    RWLock::RLocker l(coll_lock);
+    for (auto& p : coll_map) {
+      spg_t pgid;
+      if (p.first.is_pg(&pgid)) {
+	colls.push_back(p.second);
+      }
+    }
+  }
+  dout(10) << __func__ << " " << colls.size() << " collections" << dendl;
+  {
+    Mutex::Locker l(recompress_thread.lock);
+    recompress_thread.running = true;
+    recompress_thread.pass_start = ceph_clock_now();
+    recompress_thread.colls_done = 0;
+    recompress_thread.colls_total = colls.size();
+  }
+
+  bool stopped = false;
+  for (auto& c : colls) {
+    {
+      Mutex::Locker l(recompress_thread.lock);
+      recompress_thread.cur_cid = c->cid;
+    }
+    ghobject_t pos;
+    while (!stopped) {
+      CompressorRef cp;
+      vector<ghobject_t> ls;
+      {
+	RWLock::RLocker l(c->lock);
+	cp = _get_recompressor(c.get());
+	if (!cp) {
+	  break;
+	}
+	int r = _collection_list(c.get(), pos, ghobject_t::get_max(), 64,
+				 &ls, &pos);
+	if (r < 0) {
+	  break;
+	}
+      }
+      for (auto& oid : ls) {
+	uint64_t bytes = _recompress_object(c, cp, oid);
+	if (!recompress_thread.throttle(bytes)) {
+	  stopped = true;
+	  break;
+	}
+      }
+      if (pos.is_max()) {
+	break;
+      }
+    }
+    if (stopped) {
+      break;
+    }
+    Mutex::Locker l(recompress_thread.lock);
+    ++recompress_thread.colls_done;
+  }
+
+  dout(10) << __func__ << (stopped ? " stopped" : " done") << dendl;
+  Mutex::Locker l(recompress_thread.lock);
+  recompress_thread.running = false;
+  recompress_thread.cur_cid = coll_t();
+  recompress_thread.pass_end = ceph_clock_now();
+  if (!stopped) {
+    ++recompress_thread.passes;
+  }
+}
+
+void BlueStore::dump_recompression_status(Formatter *f)
+{
+  f->open_object_section("recompression");
+  {
+    Mutex::Locker l(recompress_thread.lock);
+    f->dump_bool("running", recompress_thread.running);
+    f->dump_unsigned("passes", recompress_thread.passes);
+    f->dump_stream("pass_start") << recompress_thread.pass_start;
+    f->dump_stream("pass_end") << recompress_thread.pass_end;
+    if (recompress_thread.running) {
+      f->dump_stream("collection") << recompress_thread.cur_cid;
+      f->dump_unsigned("collections_done", recompress_thread.colls_done);
+      f->dump_unsigned("collections_total", recompress_thread.colls_total);
+    }
+  }
+  f->dump_unsigned("objects_checked",
+		   logger->get(l_bluestore_recompress_objects));
+  f->dump_unsigned("objects_rewritten",
+		   logger->get(l_bluestore_recompress_rewritten));
+  f->dump_unsigned("bytes_rewritten",
+		   logger->get(l_bluestore_recompress_bytes));
+  f->dump_unsigned("bytes_saved",
+		   logger->get(l_bluestore_recompress_saved_bytes));
+  f->close_section();
+}
+
 int BlueStore::_write(TransContext *txc,
 		      CollectionRef& c,
 		      OnodeRef& o,
@@ -11420,6 +13259,155 @@ int BlueStore::_write(TransContext *txc,
   return r;
 }
 
+int BlueStore::_write_compressed(TransContext *txc,
+				 CollectionRef& c,
+				 OnodeRef& o,
+				 uint64_t offset, size_t length,
+				 const compressed_write_t& cw,
+				 uint32_t fadvise_flags)
+{
+  dout(15) << __func__ << " " << c->cid << " " << o->oid
+	   << " 0x" << std::hex << offset << "~" << length << std::dec
+	   << " " << cw.segments.size() << " segments" << dendl;
+  if (offset + length >= OBJECT_MAX_SIZE) {
+    return -E2BIG;
+  }
+  if (!cw.is_valid() || cw.get_length() != length) {
+    derr << __func__ << " " << o->oid << " bad compressed write 0x"
+	 << std::hex << offset << "~" << length << std::dec << dendl;
+    return -EIO;
+  }
+  if (length == 0) {
+    return 0;
+  }
+
+  // decompress every segment before touching the object: a segment we
+  // cannot decompress to its length leaves no data to write, and the
+  // raw data of those kept compressed goes to the buffer cache
+  vector<bufferlist> raws(cw.segments.size());
+  {
+    CompressorRef cp;
+    auto p = cw.data.cbegin();
+    uint64_t pos = offset;
+    for (size_t i = 0; i < cw.segments.size(); ++i) {
+      auto& s = cw.segments[i];
+      if (s.alg == Compressor::COMP_ALG_NONE) {
+	p.copy(s.length, raws[i]);
+	pos += s.length;
+	continue;
+      }
+      if (!cp || cp->get_type() != s.alg) {
+	cp = Compressor::create(cct, s.alg);
+	if (!cp) {
+	  derr << __func__ << " " << o->oid << " no compressor "
+	       << Compressor::get_comp_alg_name(s.alg) << dendl;
+	  return -EIO;
+	}
+      }
+      bufferptr raw = buffer::create(s.length);
+      auto start = mono_clock::now();
+      int r = cp->decompress_into(p, s.compressed_length, raw.c_str(),
+				  s.length);
+      logger->tinc(l_bluestore_decompress_lat, mono_clock::now() - start);
+      if (r != (int)s.length) {
+	derr << __func__ << " " << o->oid << " failed to decompress 0x"
+	     << std::hex << pos << "~" << s.length << std::dec
+	     << ": " << r << dendl;
+	return -EIO;
+      }
+      raws[i].push_back(std::move(raw));
+      pos += s.length;
+    }
+  }
+
+  _assign_nid(txc, o);
+  _dump_onode(o);
+
+  // segments are kept compressed if they make the blob a write of ours
+  // would: aligned, no larger than we would make it, and saving space.
+  // anything else is written raw as usual, where segments the writer did
+  // not compress are not tried again.
+  WriteContext wctx;
+  _choose_write_options(c, o, fadvise_flags, &wctx);
+  auto max_bsize = std::max(wctx.target_blob_size, min_alloc_size);
+  o->extent_map.fault_range(db, offset, length);
+
+  int r = 0;
+  uint64_t pos = offset;
+  auto p = cw.data.cbegin();
+  for (size_t i = 0; i < cw.segments.size(); ++i) {
+    auto& s = cw.segments[i];
+    bufferlist sbl;
+    p.copy(s.compressed_length, sbl);
+    if (s.alg == Compressor::COMP_ALG_NONE) {
+      size_t n = wctx.writes.size();
+      _do_write_data(txc, c, o, pos, s.length, raws[i], &wctx);
+      for (; n < wctx.writes.size(); ++n) {
+	wctx.writes[n].incompressible = true;
+      }
+      pos += s.length;
+      continue;
+    }
+    bluestore_compression_header_t chdr(s.alg);
+    chdr.length = s.compressed_length;
+    bufferlist cbl;
+    encode(chdr, cbl);
+    uint64_t newlen = p2roundup<uint64_t>(cbl.length() + s.compressed_length,
+					  min_alloc_size);
+    if (wctx.compress &&
+	p2phase<uint64_t>(pos, min_alloc_size) == 0 &&
+	p2phase<uint64_t>(s.length, min_alloc_size) == 0 &&
+	s.length > min_alloc_size &&
+	s.length <= max_bsize &&
+	newlen < s.length) {
+      o->extent_map.punch_hole(c, pos, s.length, &wctx.old_extents);
+      BlobRef b = c->new_blob();
+      // the raw data becomes the writing buffer, so that reads before
+      // the write is on disk are served from the cache
+      wctx.write(pos, b, s.length, 0, raws[i], 0, s.length, false, true);
+      auto& wi = wctx.writes.back();
+      cbl.claim_append(sbl);
+      wi.compressed_len = cbl.length();
+      cbl.append_zero(newlen - wi.compressed_len);
+      wi.compressed_bl.swap(cbl);
+      wi.compressed = true;
+      txc->statfs_delta.compressed() += wi.compressed_len;
+      txc->statfs_delta.compressed_original() += s.length;
+      txc->statfs_delta.compressed_allocated() += newlen;
+      logger->inc(l_bluestore_write_pad_bytes, newlen - wi.compressed_len);
+      logger->inc(l_bluestore_compress_precompressed_count);
+      dout(20) << __func__ << std::hex << "  keep compressed 0x" << pos
+	       << "~" << s.length << " -> 0x" << wi.compressed_len
+	       << std::dec << dendl;
+    } else {
+      logger->inc(l_bluestore_compress_precompressed_rejected_count);
+      _do_write_data(txc, c, o, pos, s.length, raws[i], &wctx);
+    }
+    pos += s.length;
+  }
+
+  r = _do_alloc_write(txc, c, o, &wctx);
+  if (r < 0) {
+    derr << __func__ << " _do_alloc_write failed with " << cpp_strerror(r)
+	 << dendl;
+    return r;
+  }
+  _wctx_finish(txc, c, o, &wctx);
+  uint64_t end = offset + length;
+  if (end > o->onode.size) {
+    dout(20) << __func__ << " extending size to 0x" << std::hex << end
+	     << std::dec << dendl;
+    o->onode.size = end;
+  }
+  o->extent_map.compress_extent_map(offset, length);
+  o->extent_map.dirty_range(offset, length);
+  txc->write_onode(o);
+  dout(10) << __func__ << " " << c->cid << " " << o->oid
+	   << " 0x" << std::hex << offset << "~" << length << std::dec
+	   << " = 0" << dendl;
+  return 0;
+}
+
 int BlueStore::_zero(TransContext *txc,
 		     CollectionRef& c,
 		     OnodeRef& o,
@@ -12236,6 +14224,17 @@ void BlueStore::_do_remove_collection(TransContext *txc,
 				      CollectionRef *c)
 {
   coll_map.erase((*c)->cid);
+  spg_t pgid;
+  if ((*c)->cid.is_pg(&pgid) &&
+      std::none_of(coll_map.begin(), coll_map.end(),
+		   [&](const pair<const coll_t,CollectionRef>& p) {
+		     spg_t other;
+		     return p.first.is_pg(&other) &&
+		       other.pool() == pgid.pool();
+		   })) {
+    // the pool is gone from this osd
+    _remove_comp_pool_logger(pgid.pool());
+  }
   txc->removed_collections.push_back(*c);
   (*c)->exists = false;
   _osr_register_zombie((*c)->osr.get());
@@ -37,6 +37,7 @@
 #include "common/Throttle.h"
 #include "common/perf_counters.h"
 #include "common/PriorityCache.h"
+#include "common/Readahead.h"
 #include "compressor/Compressor.h"
 #include "os/ObjectStore.h"
 
@@ -82,10 +83,15 @@ enum {
   l_bluestore_read_onode_meta_lat,
   l_bluestore_read_wait_aio_lat,
   l_bluestore_compress_lat,
+  l_bluestore_compress_txc_lat,
   l_bluestore_decompress_lat,
   l_bluestore_csum_lat,
   l_bluestore_compress_success_count,
   l_bluestore_compress_rejected_count,
+  l_bluestore_compress_skipped_count,
+  l_bluestore_compress_precompressed_count,
+  l_bluestore_compress_precompressed_rejected_count,
+  l_bluestore_compress_dict_count,
   l_bluestore_write_pad_bytes,
   l_bluestore_deferred_write_ops,
   l_bluestore_deferred_write_bytes,
@@ -106,6 +112,7 @@ enum {
   l_bluestore_buffer_bytes,
   l_bluestore_buffer_hit_bytes,
   l_bluestore_buffer_miss_bytes,
+  l_bluestore_buffer_compressed_hit_bytes,
   l_bluestore_write_big,
   l_bluestore_write_big_bytes,
   l_bluestore_write_big_blobs,
@@ -120,12 +127,36 @@ enum {
   l_bluestore_blob_split,
   l_bluestore_extent_compress,
   l_bluestore_gc_merged,
+  l_bluestore_recompress_objects,
+  l_bluestore_recompress_rewritten,
+  l_bluestore_recompress_bytes,
+  l_bluestore_recompress_saved_bytes,
+  l_bluestore_readahead_ops,
+  l_bluestore_readahead_bytes,
+  l_bluestore_readahead_hit_bytes,
+  l_bluestore_readahead_wasted_bytes,
   l_bluestore_read_eio,
   l_bluestore_reads_with_retries,
   l_bluestore_fragmentation,
   l_bluestore_last
 };
 
+// compression counters, kept per algorithm and per pool
+enum {
+  l_bluestore_comp_first = 732800,
+  l_bluestore_comp_compress_bytes_in,
+  l_bluestore_comp_compress_bytes_out,
+  l_bluestore_comp_compress_success_count,
+  l_bluestore_comp_compress_rejected_count,
+  l_bluestore_comp_compress_lat,
+  l_bluestore_comp_compress_lat_bytes_hist,
+  l_bluestore_comp_decompress_bytes_in,
+  l_bluestore_comp_decompress_bytes_out,
+  l_bluestore_comp_decompress_lat,
+  l_bluestore_comp_decompress_lat_bytes_hist,
+  l_bluestore_comp_last
+};
+
 class BlueStore : public ObjectStore,
 		  public md_config_obs_t {
   // -----------------------------------------------------
@@ -140,6 +171,7 @@ public:
   void handle_discard(interval_set<uint64_t>& to_release);
 
   void _set_csum();
+  boost::optional<int> _get_compression_level();
   void _set_compression();
   void _set_throttle_params();
   int _set_cache_sizes();
@@ -157,6 +189,10 @@ public:
     virtual ~AioContext() {}
   };
 
+  /// a compressed blob of a read, verified and decompressed by compress_tp
+  /// as soon as its own aio completes
+  struct DecompressRead;
+
   /// cached buffer
   struct Buffer {
     MEMPOOL_CLASS_HELPERS();
@@ -176,11 +212,12 @@ public:
     }
     enum {
       FLAG_NOCACHE = 1,  ///< trim when done WRITING (do not become CLEAN)
-      // NOTE: fix operator<< when you define a second flag
+      FLAG_COMPRESSED = 2, ///< data is the compressed form of offset~length
     };
     static const char *get_flag_name(int s) {
       switch (s) {
       case FLAG_NOCACHE: return "nocache";
+      case FLAG_COMPRESSED: return "compressed";
       default: return "???";
       }
     }
@@ -218,6 +255,11 @@ public:
       return offset + length;
     }
 
+    /// bytes charged against the cache for this buffer
+    uint32_t cache_length() const {
+      return (flags & FLAG_COMPRESSED) ? data.length() : length;
+    }
+
     void truncate(uint32_t newlen) {
       ceph_assert(newlen < length);
       if (data.length()) {
@@ -237,6 +279,7 @@ public:
 
     void dump(Formatter *f) const {
       f->dump_string("state", get_state_name(state));
+      f->dump_unsigned("flags", flags);
       f->dump_unsigned("seq", seq);
       f->dump_unsigned("offset", offset);
       f->dump_unsigned("length", length);
@@ -348,11 +391,31 @@ public:
       b->cache_private = _discard(cache, offset, bl.length());
       _add_buffer(cache, b, 1, nullptr);
     }
+    /// cache bl, the compressed form of the blob range offset~length
+    void did_read_compressed(Cache* cache, uint32_t offset, uint32_t length,
+			     bufferlist& bl) {
+      std::lock_guard<std::recursive_mutex> l(cache->lock);
+      Buffer *b = new Buffer(this, Buffer::STATE_CLEAN, 0, offset, length,
+			     Buffer::FLAG_COMPRESSED);
+      b->data = bl;
+      b->cache_private = _discard(cache, offset, length);
+      _add_buffer(cache, b, 1, nullptr);
+    }
 
     void read(Cache* cache, uint32_t offset, uint32_t length,
 	      BlueStore::ready_regions_t& res,
 	      interval_set<uint32_t>& res_intervals,
 	      int flags = 0);
+    /// find a compressed buffer covering offset~length; on a hit its range
+    /// is returned in *b_off~*b_len and its data in *bl
+    bool read_compressed(Cache* cache, uint32_t offset, uint32_t length,
+			 uint32_t *b_off, uint32_t *b_len, bufferlist *bl);
+
+    /// is anything written to the blob not on disk yet (deferred or not)?
+    bool has_writing(Cache* cache) const {
+      std::lock_guard<std::recursive_mutex> l(cache->lock);
+      return !writing.empty();
+    }
 
     void truncate(Cache* cache, uint32_t offset) {
       discard(cache, offset, (uint32_t)-1 - offset);
@@ -1042,6 +1105,17 @@ public:
     std::mutex flush_lock;  ///< protect flush_txns
     std::condition_variable flush_cond;   ///< wait here for uncommitted txns
 
+    /// blobs in a row which failed the compression ratio (adaptive mode)
+    uint32_t comp_rejects = 0;
+
+    /// sequential reads of compressed data, made by the first of them
+    struct ReadaheadState {
+      Readahead ra;
+      std::mutex lock;
+      interval_set<uint64_t> unread;  ///< read ahead, not read since
+    };
+    std::atomic<ReadaheadState*> readahead = {nullptr};
+
     Onode(Collection *c, const ghobject_t& o,
 	  const mempool::bluestore_cache_other::string& k)
       : nref(0),
@@ -1051,6 +1125,9 @@ public:
 	exists(false),
 	extent_map(this) {
     }
+    ~Onode() {
+      delete readahead.load();
+    }
 
     void flush();
     void get() {
@@ -1178,11 +1255,11 @@ public:
       } else {
 	buffer_lru.push_back(*b);
       }
-      buffer_size += b->length;
+      buffer_size += b->cache_length();
     }
     void _rm_buffer(Buffer *b) override {
-      ceph_assert(buffer_size >= b->length);
-      buffer_size -= b->length;
+      ceph_assert(buffer_size >= b->cache_length());
+      buffer_size -= b->cache_length();
       auto q = buffer_lru.iterator_to(*b);
       buffer_lru.erase(q);
     }
@@ -1335,6 +1412,8 @@ public:
     void remove(const ghobject_t& oid) {
       onode_map.erase(oid);
     }
+    /// drop oid from the cache unless it is in use, true if dropped
+    bool evict(const ghobject_t& oid);
     void rename(OnodeRef& o, const ghobject_t& old_oid,
 		const ghobject_t& new_oid,
 		const mempool::bluestore_cache_other::string& new_okey);
@@ -1370,6 +1449,9 @@ public:
     pool_opts_t pool_opts;
     ContextQueue *commit_queue;
 
+    /// decaying share of blobs which failed the compression ratio
+    float comp_reject_rate = 0;
+
     OnodeRef get_onode(const ghobject_t& oid, bool create);
 
     // the terminology is confusing here, sorry!
@@ -1594,6 +1676,7 @@ public:
     uint64_t seq = 0;
     utime_t start;
     utime_t last_stamp;
+    ceph::timespan compress_lat = ceph::timespan::zero(); ///< time compressing
 
     uint64_t last_nid = 0;     ///< if non-zero, highest new nid we allocated
     uint64_t last_blobid = 0;  ///< if non-zero, highest new blobid we allocated
@@ -1675,6 +1758,9 @@ public:
 
   class OpSequencer : public RefCountedObject {
   public:
+    /// held while a txc is prepared, by queue_transactions() and the
+    /// recompressor, which are not otherwise serialized
+    std::mutex submit_lock;
     std::mutex qlock;
     std::condition_variable qcond;
     typedef boost::intrusive::list<
@@ -1885,6 +1971,46 @@ private:
   atomic_int deferred_aggressive = {0}; ///< aggressive wakeup of kv thread
   Finisher deferred_finisher, finisher;
 
+  /// blobs of a write, compressed by compress_tp and the submitting thread
+  struct CompressBatch {
+    Compressor *c;
+    const vector<const bufferlist*> &in;
+    vector<bufferlist> &out;
+    std::atomic<size_t> next = {0};  ///< first blob nobody took yet
+    std::atomic<int> r = {0};
+
+    std::mutex lock;
+    std::condition_variable cond;
+    unsigned queued = 0;   ///< entries in compress_wq not processed yet
+
+    CompressBatch(Compressor *c,
+		  const vector<const bufferlist*> &in,
+		  vector<bufferlist> &out)
+      : c(c), in(in), out(out) {}
+
+    /// compress blobs until there are no more left
+    void run();
+  };
+  struct CompressWQ : public ThreadPool::PointerWQ<CompressBatch> {
+    explicit CompressWQ(ThreadPool *tp)
+      : ThreadPool::PointerWQ<CompressBatch>("BlueStore::CompressWQ",
+					     0, 0, tp) {
+      register_work_queue();
+    }
+    void process(CompressBatch *b) override;
+  };
+  struct DecompressWQ : public ThreadPool::PointerWQ<DecompressRead> {
+    explicit DecompressWQ(ThreadPool *tp)
+      : ThreadPool::PointerWQ<DecompressRead>("BlueStore::DecompressWQ",
+					      0, 0, tp) {
+      register_work_queue();
+    }
+    void process(DecompressRead *d) override;
+  };
+  ThreadPool compress_tp;
+  CompressWQ compress_wq;
+  DecompressWQ decompress_wq;
+
   KVSyncThread kv_sync_thread;
   std::mutex kv_lock;
   std::condition_variable kv_cond;
@@ -1906,6 +2032,11 @@ private:
 
   PerfCounters *logger = nullptr;
 
+  /// compression counters, created on first use
+  RWLock comp_logger_lock = {"BlueStore::comp_logger_lock"};
+  PerfCounters *comp_alg_logger[Compressor::COMP_ALG_LAST] = {};
+  map<int64_t,PerfCounters*> comp_pool_logger;
+
   list<CollectionRef> removed_collections;
 
   RWLock debug_read_error_lock = {"BlueStore::debug_read_error_lock"};
@@ -1943,6 +2074,16 @@ private:
   std::atomic<uint64_t> comp_min_blob_size = {0};
   std::atomic<uint64_t> comp_max_blob_size = {0};
 
+  /// trained compression dictionaries; never removed, blobs refer to them
+  struct compression_dict_t {
+    bluestore_compression_dict_t info;
+    CompressorRef compressor;     ///< null if the plugin can't load it
+    map<int, CompressorRef> leveled;  ///< to compress at other levels
+  };
+  std::mutex comp_dict_lock;
+  map<uint32_t, compression_dict_t> comp_dicts;  ///< by id
+  map<int64_t, uint32_t> pool_comp_dict;         ///< pool -> latest id
+
   std::atomic<uint64_t> max_blob_size = {0};  ///< maximum blob size
 
   uint64_t kv_ios = 0;
@@ -2098,11 +2239,109 @@ private:
                             PriorityCache::Priority pri);
   } mempool_thread;
 
+  struct RecompressThread : public Thread {
+    BlueStore *store;
+
+    Cond cond;
+    Mutex lock;
+    bool stop = false;
+
+    // progress, for dump_recompression_status()
+    bool running = false;           ///< a pass is in progress
+    uint64_t passes = 0;            ///< passes completed
+    utime_t pass_start;             ///< start of the current or last pass
+    utime_t pass_end;               ///< end of the last pass
+    coll_t cur_cid;                 ///< collection being walked
+    unsigned colls_done = 0;        ///< collections walked this pass
+    unsigned colls_total = 0;       ///< collections to walk this pass
+
+    explicit RecompressThread(BlueStore *s)
+      : store(s),
+	lock("BlueStore::RecompressThread::lock") {}
+
+    void *entry() override;
+    void init() {
+      ceph_assert(stop == false);
+      create("bstore_recomp");
+    }
+    void shutdown() {
+      lock.Lock();
+      stop = true;
+      cond.Signal();
+      lock.Unlock();
+      join();
+    }
+    /// sleep for the time bytes take under the IO budget, false if stopping
+    bool throttle(uint64_t bytes);
+  } recompress_thread;
+
+  struct ReadaheadThread : public Thread {
+    BlueStore *store;
+
+    Cond cond;
+    Mutex lock;
+    bool stop = false;
+
+    struct Item {
+      CollectionRef c;
+      ghobject_t oid;
+      uint64_t offset, length;
+    };
+    std::deque<Item> queue;
+    static constexpr size_t max_queue = 64;
+
+    explicit ReadaheadThread(BlueStore *s)
+      : store(s),
+	lock("BlueStore::ReadaheadThread::lock") {}
+
+    void *entry() override;
+    void init() {
+      ceph_assert(stop == false);
+      create("bstore_readahead");
+    }
+    void shutdown() {
+      lock.Lock();
+      stop = true;
+      cond.Signal();
+      lock.Unlock();
+      join();
+    }
+    /// false if too much is queued already
+    bool queue_read(Collection *c, const ghobject_t& oid,
+		    uint64_t offset, uint64_t length);
+  } readahead_thread;
+
   // --------------------------------------------------------
   // private methods
 
   void _init_logger();
   void _shutdown_logger();
+  PerfCounters *_create_comp_logger(const string& name);
+  /// look up the loggers of alg and of the pool of c, false if one is
+  /// yet to be created; caller holds comp_logger_lock
+  bool _get_comp_loggers(int alg, Collection *c, PerfCounters **alg_logger,
+			 PerfCounters **pool_logger);
+  void _create_comp_loggers(int alg, Collection *c);
+  /// update the compression counters of alg and of the pool of c with f
+  template <typename F>
+  void _update_comp_loggers(int alg, Collection *c, F f) {
+    PerfCounters *alg_logger, *pool_logger;
+    while (true) {
+      {
+	RWLock::RLocker l(comp_logger_lock);
+	if (_get_comp_loggers(alg, c, &alg_logger, &pool_logger)) {
+	  for (auto p : { alg_logger, pool_logger }) {
+	    if (p) {
+	      f(p);
+	    }
+	  }
+	  return;
+	}
+      }
+      _create_comp_loggers(alg, c);
+    }
+  }
+  void _remove_comp_pool_logger(int64_t pool);
   int _reload_logger();
 
   int _open_path();
@@ -2149,6 +2388,8 @@ private:
 			       bool create);
 
   int _open_super_meta();
+  int _open_compression_dicts();
+  void _add_compression_dict(uint32_t id, bluestore_compression_dict_t& d);
 
   void _open_statfs();
 
@@ -2258,14 +2499,21 @@ private:
 
   // -- ondisk version ---
 public:
-  const int32_t latest_ondisk_format = 2;        ///< our version
+  const int32_t latest_ondisk_format = 4;        ///< our version
   const int32_t min_readable_ondisk_format = 1;  ///< what we can read
   const int32_t min_compat_ondisk_format = 2;    ///< who can read us
+  /// who can read us once blobs have FLAG_COMPRESSED_CHUNKS
+  const int32_t compressed_chunks_ondisk_format = 3;
+  /// who can read us once there are trained compression dictionaries
+  const int32_t compression_dict_ondisk_format = 4;
 
 private:
   int32_t ondisk_format = 0;  ///< value detected on mount
+  int32_t compat_ondisk_format = 0;  ///< who can read us, as recorded
+  std::mutex compat_ondisk_format_lock;  ///< serialize compat bumps
 
   int _upgrade_super();  ///< upgrade (called during open_super)
+  int _require_compat_ondisk_format(int32_t v);  ///< raise compat to >= v
   uint64_t _get_ondisk_reserved() const;
   void _prepare_ondisk_format_super(KeyValueDB::Transaction& t);
 
@@ -2332,6 +2580,16 @@ public:
   }
   int _fsck(bool deep, bool repair);
 
+  /// train a dictionary for pool on up to max_samples of its objects
+  int train_compression_dict(int64_t pool, const string& alg,
+			     unsigned max_samples, size_t sample_len,
+			     size_t dict_len, uint32_t *id);
+  void dump_compression_dicts(Formatter *f);
+
+  /// recompress the cold data of the pools which ask for it, once
+  void recompress_cold_data();
+  void dump_recompression_status(Formatter *f) override;
+
   void set_cache_shards(unsigned num) override;
 
   int validate_hobject_key(const hobject_t &obj) const override {
@@ -2387,6 +2645,11 @@ public:
     uint64_t retry_count = 0);
 
 private:
+  /// note a read of o, and queue what to read ahead of it
+  void _maybe_readahead(Collection *c, OnodeRef& o,
+			uint64_t offset, size_t length);
+  void _do_readahead(Collection *c, const ghobject_t& oid,
+		     uint64_t offset, uint64_t length);
   int _fiemap(CollectionHandle &c_, const ghobject_t& oid,
  	     uint64_t offset, size_t len, interval_set<uint64_t>& destset);
 public:
@@ -2394,7 +2657,12 @@ public:
 	     uint64_t offset, size_t len, bufferlist& bl) override;
   int fiemap(CollectionHandle &c, const ghobject_t& oid,
 	     uint64_t offset, size_t len, map<uint64_t, uint64_t>& destmap) override;
-
+  int compress_write(CollectionHandle &c, const ghobject_t& oid,
+		     uint64_t offset, const bufferlist& bl,
+		     compressed_write_t *cw) override;
+  int read_compressed(CollectionHandle &c, const ghobject_t& oid,
+		      uint64_t offset, size_t len,
+		      compressed_write_t *cw, uint32_t op_flags = 0) override;
 
   int getattr(CollectionHandle &c, const ghobject_t& oid, const char *name,
 	      bufferptr& value) override;
@@ -2562,7 +2830,23 @@ private:
     uint64_t blob_xoffset,
     const bufferlist& bl,
     uint64_t logical_offset) const;
-  int _decompress(bufferlist& source, bufferlist* result);
+  CompressorRef _get_compression_dict(uint32_t id);
+  CompressorRef _get_pool_compression_dict(int64_t pool,
+					   const CompressorRef& c,
+					   uint32_t *id);
+  int _decompress(Collection *c, bufferlist& source, size_t raw_len,
+		  bufferlist* result);
+  int _get_blob_compression_type(const bluestore_blob_t& blob, int *type);
+  int _decompress_chunks(Collection *c, const bluestore_blob_t& blob,
+			 bufferlist& source, uint64_t src_off,
+			 unsigned first, unsigned last,
+			 bufferlist* result);
+  /// decompress what was read of a compressed blob: chunks first..last of
+  /// it, or all of it when it is not compressed in chunks
+  int _decompress_blob(Collection *c, const bluestore_blob_t& blob,
+		       bufferlist& source, uint64_t src_off,
+		       unsigned first, unsigned last,
+		       bufferlist* result);
 
 
   // --------------------------------------------------------
@@ -2571,6 +2855,8 @@ private:
   struct WriteContext {
     bool buffered = false;          ///< buffered write
     bool compress = false;          ///< compressed write
+    bool compress_adaptive = false; ///< may skip compression (adaptive mode)
+    CompressorRef compressor;       ///< if set, overrides the pool's compressor
     uint64_t target_blob_size = 0;  ///< target (max) blob size
     unsigned csum_order = 0;        ///< target checksum chunk order
 
@@ -2589,8 +2875,10 @@ private:
       bool new_blob; ///< whether new blob was created
 
       bool compressed = false;
+      bool incompressible = false;  ///< the writer failed to compress it
       bufferlist compressed_bl;
       size_t compressed_len = 0;
+      vector<uint32_t> chunk_offsets;  ///< if compressed in chunks
 
       write_item(
 	uint64_t logical_offs,
@@ -2619,6 +2907,8 @@ private:
     void fork(const WriteContext& other) {
       buffered = other.buffered;
       compress = other.compress;
+      compress_adaptive = other.compress_adaptive;
+      compressor = other.compressor;
       target_blob_size = other.target_blob_size;
       csum_order = other.csum_order;
     }
@@ -2664,6 +2954,23 @@ private:
     uint64_t offset, uint64_t length,
     bufferlist::iterator& blp,
     WriteContext *wctx);
+  CompressorRef _select_compressor(
+    Collection *coll,
+    const WriteContext *wctx,
+    double *crr);
+  int _compress_batch(
+    Compressor *c,
+    const vector<const bufferlist*>& in,
+    vector<bufferlist>& out);
+  bool _compress_skip(
+    Collection *c,
+    Onode *o,
+    const bufferlist& bl,
+    double crr);
+  void _compress_note(
+    Collection *c,
+    Onode *o,
+    bool rejected);
   int _do_alloc_write(
     TransContext *txc,
     CollectionRef c,
@@ -2682,6 +2989,12 @@ private:
 	     uint64_t offset, size_t len,
 	     bufferlist& bl,
 	     uint32_t fadvise_flags);
+  int _write_compressed(TransContext *txc,
+			CollectionRef& c,
+			OnodeRef& o,
+			uint64_t offset, size_t len,
+			const compressed_write_t& cw,
+			uint32_t fadvise_flags);
   void _pad_zeros(bufferlist *bl, uint64_t *offset,
 		  uint64_t chunk_size);
 
@@ -2704,6 +3017,12 @@ private:
 		uint64_t offset, uint64_t length,
 		bufferlist& bl,
 		uint32_t fadvise_flags);
+
+  CompressorRef _get_recompressor(Collection *c);
+  int _find_recompress_extents(Collection *c, OnodeRef o, int alg,
+			       interval_set<uint64_t> *extents);
+  uint64_t _recompress_object(CollectionRef& c, CompressorRef cp,
+			      const ghobject_t& oid);
   void _do_write_data(TransContext *txc,
                       CollectionRef& c,
                       OnodeRef o,
@@ -191,6 +191,11 @@ int main(int argc, char **argv)
   string key, value;
   int log_level = 30;
   bool fsck_deep = false;
+  int64_t pool = -1;
+  string algorithm = "zstd";
+  unsigned samples = 1000;
+  size_t sample_size = 16384;
+  size_t dict_size = 112640;
   po::options_description po_options("Options");
   po_options.add_options()
     ("help,h", "produce help message")
@@ -202,10 +207,15 @@ int main(int argc, char **argv)
     ("deep", po::value<bool>(&fsck_deep), "deep fsck (read all data)")
     ("key,k", po::value<string>(&key), "label metadata key name")
     ("value,v", po::value<string>(&value), "label metadata value")
+    ("pool", po::value<int64_t>(&pool), "pool id to train a compression dictionary for")
+    ("algorithm", po::value<string>(&algorithm), "compression algorithm of the dictionary (default: zstd)")
+    ("samples", po::value<unsigned>(&samples), "max objects to train the dictionary on (default: 1000)")
+    ("sample-size", po::value<size_t>(&sample_size), "bytes read from the start of each object (default: 16384)")
+    ("dict-size", po::value<size_t>(&dict_size), "max size of the dictionary (default: 112640)")
     ;
   po::options_description po_positional("Positional options");
   po_positional.add_options()
-    ("command", po::value<string>(&action), "fsck, repair, bluefs-export, bluefs-bdev-sizes, bluefs-bdev-expand, show-label, set-label-key, rm-label-key, prime-osd-dir, bluefs-log-dump")
+    ("command", po::value<string>(&action), "fsck, repair, bluefs-export, bluefs-bdev-sizes, bluefs-bdev-expand, show-label, set-label-key, rm-label-key, prime-osd-dir, bluefs-log-dump, train-compression-dict, list-compression-dicts")
     ;
   po::options_description po_all("All options");
   po_all.add(po_options).add(po_positional);
@@ -241,6 +251,17 @@ int main(int argc, char **argv)
       exit(EXIT_FAILURE);
     }
   }
+  if (action == "train-compression-dict" ||
+      action == "list-compression-dicts") {
+    if (path.empty()) {
+      cerr << "must specify bluestore path" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (action == "train-compression-dict" && pool < 0) {
+      cerr << "must specify a pool id with --pool" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
   if (action == "prime-osd-dir") {
     if (devs.size() != 1) {
       cerr << "must specify the main bluestore device" << std::endl;
@@ -592,6 +613,34 @@ int main(int argc, char **argv)
     delete fs;
   } else if (action == "bluefs-log-dump") {
     log_dump(cct.get(), path, devs);
+  } else if (action == "train-compression-dict" ||
+	     action == "list-compression-dicts") {
+    validate_path(cct.get(), path, false);
+    BlueStore bluestore(cct.get(), path);
+    int r = bluestore.mount();
+    if (r < 0) {
+      cerr << "failed to mount bluestore: " << cpp_strerror(r) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (action == "train-compression-dict") {
+      uint32_t id;
+      r = bluestore.train_compression_dict(pool, algorithm, samples,
+					   sample_size, dict_size, &id);
+      if (r < 0) {
+	cerr << "failed to train a dictionary: " << cpp_strerror(r)
+	     << std::endl;
+	bluestore.umount();
+	exit(EXIT_FAILURE);
+      }
+      cout << "trained dictionary " << id << " for pool " << pool
+	   << std::endl;
+    } else {
+      JSONFormatter f(true);
+      bluestore.dump_compression_dicts(&f);
+      f.flush(cout);
+      cout << std::endl;
+    }
+    bluestore.umount();
   } else {
     cerr << "unrecognized action " << action << std::endl;
     return 1;
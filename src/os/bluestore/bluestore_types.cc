@@ -608,6 +608,11 @@ string bluestore_blob_t::get_flags_string(unsigned flags)
       s += '+';
     s += "shared";
   }
+  if (flags & FLAG_COMPRESSED_CHUNKS) {
+    if (s.length())
+      s += '+';
+    s += "compressed_chunks";
+  }
 
   return s;
 }
@@ -627,6 +632,14 @@ void bluestore_blob_t::dump(Formatter *f) const
   f->dump_unsigned("logical_length", logical_length);
   f->dump_unsigned("compressed_length", compressed_length);
   f->dump_unsigned("flags", flags);
+  if (has_compressed_chunks()) {
+    f->dump_unsigned("comp_type", comp_type);
+    f->dump_unsigned("comp_chunk_length", comp_chunk_length);
+    f->open_array_section("comp_chunk_offsets");
+    for (auto off : comp_chunk_offsets)
+      f->dump_unsigned("offset", off);
+    f->close_section();
+  }
   f->dump_unsigned("csum_type", csum_type);
   f->dump_unsigned("csum_chunk_order", csum_chunk_order);
   f->open_array_section("csum_data");
@@ -652,6 +665,11 @@ void bluestore_blob_t::generate_test_instances(list<bluestore_blob_t*>& ls)
   ls.back()->allocated_test(
     bluestore_pextent_t(bluestore_pextent_t::INVALID_OFFSET, 0x1000));
   ls.back()->allocated_test(bluestore_pextent_t(0x40120000, 0x10000));
+  ls.push_back(new bluestore_blob_t);
+  ls.back()->allocated_test(bluestore_pextent_t(0x40140000, 0x10000));
+  ls.back()->set_compressed(0x40000, 0x9000);
+  ls.back()->set_compressed_chunks(Compressor::COMP_ALG_SNAPPY, 0x10000,
+				   {0, 0x2000, 0x5000, 0x7000, 0x9000});
 }
 
 ostream& operator<<(ostream& out, const bluestore_blob_t& o)
@@ -663,6 +681,9 @@ ostream& operator<<(ostream& out, const bluestore_blob_t& o)
 	<< " -> 0x"
 	<< o.get_compressed_payload_length()
 	<< std::dec;
+    if (o.has_compressed_chunks()) {
+      out << " in " << (o.comp_chunk_offsets.size() - 1) << " chunks";
+    }
   }
   if (o.flags) {
     out << " " << o.get_flags_string();
@@ -1121,6 +1142,7 @@ void bluestore_compression_header_t::dump(Formatter *f) const
 {
   f->dump_unsigned("type", type);
   f->dump_unsigned("length", length);
+  f->dump_unsigned("dict_id", dict_id);
 }
 
 void bluestore_compression_header_t::generate_test_instances(
@@ -1129,4 +1151,28 @@ void bluestore_compression_header_t::generate_test_instances(
   o.push_back(new bluestore_compression_header_t);
   o.push_back(new bluestore_compression_header_t(1));
   o.back()->length = 1234;
+  o.push_back(new bluestore_compression_header_t(3));
+  o.back()->length = 1234;
+  o.back()->dict_id = 2;
+}
+
+// bluestore_compression_dict_t
+
+void bluestore_compression_dict_t::dump(Formatter *f) const
+{
+  f->dump_int("pool", pool);
+  f->dump_string("type", Compressor::get_comp_alg_name(type));
+  f->dump_stream("ctime") << ctime;
+  f->dump_unsigned("length", dict.length());
+}
+
+void bluestore_compression_dict_t::generate_test_instances(
+  list<bluestore_compression_dict_t*>& o)
+{
+  o.push_back(new bluestore_compression_dict_t);
+  o.push_back(new bluestore_compression_dict_t);
+  o.back()->pool = 3;
+  o.back()->type = 3;
+  o.back()->ctime = utime_t(12, 34);
+  o.back()->dict.append("dictionary");
 }
@@ -427,6 +427,7 @@ public:
     FLAG_CSUM = 4,            ///< blob has checksums
     FLAG_HAS_UNUSED = 8,      ///< blob has unused map
     FLAG_SHARED = 16,         ///< blob is shared; see external SharedBlob
+    FLAG_COMPRESSED_CHUNKS = 32, ///< compressed in independent chunks
   };
   static string get_flags_string(unsigned flags);
 
@@ -440,6 +441,13 @@ public:
 
   bufferptr csum_data;                ///< opaque vector of csum data
 
+  /// with FLAG_COMPRESSED_CHUNKS, every comp_chunk_length logical bytes are
+  /// compressed on their own with comp_type, without a compression header;
+  /// chunk i is stored at [comp_chunk_offsets[i], comp_chunk_offsets[i+1])
+  uint8_t comp_type = 0;
+  uint32_t comp_chunk_length = 0;
+  mempool::bluestore_cache_other::vector<uint32_t> comp_chunk_offsets;
+
   bluestore_blob_t(uint32_t f = 0) : flags(f) {}
 
   const PExtentVector& get_extents() const {
@@ -456,6 +464,12 @@ public:
     denc_varint(flags, p);
     denc_varint_lowz(logical_length, p);
     denc_varint_lowz(compressed_length, p);
+    denc(comp_type, p);
+    denc_varint(comp_chunk_length, p);
+    denc_varint(comp_chunk_offsets.size(), p);
+    for (auto off : comp_chunk_offsets) {
+      denc_varint_lowz(off, p);
+    }
     denc(csum_type, p);
     denc(csum_chunk_order, p);
     denc_varint(csum_data.length(), p);
@@ -471,6 +485,15 @@ public:
       denc_varint_lowz(logical_length, p);
       denc_varint_lowz(compressed_length, p);
     }
+    if (has_compressed_chunks()) {
+      // chunk lengths rather than offsets, they encode shorter
+      denc(comp_type, p);
+      denc_varint(comp_chunk_length, p);
+      denc_varint(comp_chunk_offsets.size() - 1, p);
+      for (size_t i = 1; i < comp_chunk_offsets.size(); ++i) {
+	denc_varint_lowz(comp_chunk_offsets[i] - comp_chunk_offsets[i - 1], p);
+      }
+    }
     if (has_csum()) {
       denc(csum_type, p);
       denc(csum_chunk_order, p);
@@ -493,6 +516,19 @@ public:
     } else {
       logical_length = get_ondisk_length();
     }
+    if (has_compressed_chunks()) {
+      denc(comp_type, p);
+      denc_varint(comp_chunk_length, p);
+      uint32_t n;
+      denc_varint(n, p);
+      comp_chunk_offsets.resize(n + 1);
+      comp_chunk_offsets[0] = 0;
+      for (uint32_t i = 1; i <= n; ++i) {
+	uint32_t len;
+	denc_varint_lowz(len, p);
+	comp_chunk_offsets[i] = comp_chunk_offsets[i - 1] + len;
+      }
+    }
     if (has_csum()) {
       denc(csum_type, p);
       denc(csum_chunk_order, p);
@@ -543,6 +579,28 @@ public:
   bool is_compressed() const {
     return has_flag(FLAG_COMPRESSED);
   }
+  bool has_compressed_chunks() const {
+    return has_flag(FLAG_COMPRESSED_CHUNKS);
+  }
+  /// offsets are where each chunk begins, plus where the last one ends
+  void set_compressed_chunks(uint8_t type, uint32_t chunk_length,
+			     const vector<uint32_t>& offsets) {
+    ceph_assert(is_compressed());
+    ceph_assert(offsets.size() >= 2 && offsets[0] == 0);
+    set_flag(FLAG_COMPRESSED_CHUNKS);
+    comp_type = type;
+    comp_chunk_length = chunk_length;
+    comp_chunk_offsets.assign(offsets.begin(), offsets.end());
+  }
+  unsigned get_compressed_chunk(uint32_t logical_offset) const {
+    return logical_offset / comp_chunk_length;
+  }
+  uint32_t get_compressed_chunk_offset(unsigned chunk) const {
+    return comp_chunk_offsets[chunk];
+  }
+  uint32_t get_compressed_chunk_length(unsigned chunk) const {
+    return comp_chunk_offsets[chunk + 1] - comp_chunk_offsets[chunk];
+  }
   bool has_csum() const {
     return has_flag(FLAG_CSUM);
   }
@@ -1007,15 +1065,19 @@ WRITE_CLASS_DENC(bluestore_deferred_transaction_t)
 struct bluestore_compression_header_t {
   uint8_t type = Compressor::COMP_ALG_NONE;
   uint32_t length = 0;
+  uint32_t dict_id = 0;  ///< trained dictionary compressed with, if not 0
 
   bluestore_compression_header_t() {}
   bluestore_compression_header_t(uint8_t _type)
     : type(_type) {}
 
   DENC(bluestore_compression_header_t, v, p) {
-    DENC_START(1, 1, p);
+    DENC_START(2, 1, p);
     denc(v.type, p);
     denc(v.length, p);
+    if (struct_v >= 2) {
+      denc(v.dict_id, p);
+    }
     DENC_FINISH(p);
   }
   void dump(Formatter *f) const;
@@ -1023,5 +1085,25 @@ struct bluestore_compression_header_t {
 };
 WRITE_CLASS_DENC(bluestore_compression_header_t)
 
+/// a trained compression dictionary, see bluestore_compression_header_t
+struct bluestore_compression_dict_t {
+  int64_t pool = -1;     ///< pool whose objects it was trained on
+  uint8_t type = Compressor::COMP_ALG_NONE;
+  utime_t ctime;
+  bufferlist dict;
+
+  DENC(bluestore_compression_dict_t, v, p) {
+    DENC_START(1, 1, p);
+    denc(v.pool, p);
+    denc(v.type, p);
+    denc(v.ctime, p);
+    denc(v.dict, p);
+    DENC_FINISH(p);
+  }
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<bluestore_compression_dict_t*>& o);
+};
+WRITE_CLASS_DENC(bluestore_compression_dict_t)
+
 
 #endif
@@ -2760,6 +2760,24 @@ void FileStore::_do_transaction(
       }
       break;
 
+    case Transaction::OP_WRITE_COMPRESSED:
+      {
+        const coll_t &_cid = i.get_cid(op->cid);
+        const ghobject_t &oid = i.get_oid(op->oid);
+        const coll_t &cid = !_need_temp_object_collection(_cid, oid) ?
+          _cid : _cid.get_temp();
+        uint64_t off = op->off;
+        uint64_t len = op->len;
+        uint32_t fadvise_flags = i.get_fadvise_flags();
+        compressed_write_t cw;
+        i.decode_compressed_write(cw);
+        bufferlist bl;
+        r = cw.decompress(cct, &bl);
+        if (r >= 0 && _check_replay_guard(cid, oid, spos) > 0)
+          r = _write(cid, oid, off, len, bl, fadvise_flags);
+      }
+      break;
+
     case Transaction::OP_ZERO:
       {
         const coll_t &_cid = i.get_cid(op->cid);
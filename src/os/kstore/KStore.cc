@@ -2309,6 +2309,7 @@ void KStore::_txc_add_transaction(TransContext *txc, Transaction *t)
       bool create = false;
       if (op->op == Transaction::OP_TOUCH ||
 	  op->op == Transaction::OP_WRITE ||
+	  op->op == Transaction::OP_WRITE_COMPRESSED ||
 	  op->op == Transaction::OP_ZERO) {
 	create = true;
       }
@@ -2340,6 +2341,21 @@ void KStore::_txc_add_transaction(TransContext *txc, Transaction *t)
       }
       break;
 
+    case Transaction::OP_WRITE_COMPRESSED:
+      {
+        uint64_t off = op->off;
+        uint64_t len = op->len;
+	uint32_t fadvise_flags = i.get_fadvise_flags();
+	compressed_write_t cw;
+	i.decode_compressed_write(cw);
+        bufferlist bl;
+	r = cw.decompress(cct, &bl);
+	if (r >= 0) {
+	  r = _write(txc, c, o, off, len, bl, fadvise_flags);
+	}
+      }
+      break;
+
     case Transaction::OP_ZERO:
       {
         uint64_t off = op->off;
@@ -683,6 +683,23 @@ void MemStore::_do_transaction(Transaction& t)
       }
       break;
 
+    case Transaction::OP_WRITE_COMPRESSED:
+      {
+        coll_t cid = i.get_cid(op->cid);
+        ghobject_t oid = i.get_oid(op->oid);
+        uint64_t off = op->off;
+        uint64_t len = op->len;
+	uint32_t fadvise_flags = i.get_fadvise_flags();
+	compressed_write_t cw;
+	i.decode_compressed_write(cw);
+        bufferlist bl;
+	r = cw.decompress(cct, &bl);
+	if (r >= 0) {
+	  r = _write(cid, oid, off, len, bl, fadvise_flags);
+	}
+      }
+      break;
+
     case Transaction::OP_ZERO:
       {
         coll_t cid = i.get_cid(op->cid);
@@ -591,10 +591,13 @@ void ECBackend::continue_recovery_op(
       ObjectRecoveryProgress after_progress = op.recovery_progress;
       after_progress.data_recovered_to += op.extent_requested.second;
       after_progress.first = false;
-      if (after_progress.data_recovered_to >= op.obc->obs.oi.size) {
+      // the stripes of objects compressed before striping hold less than
+      // their logical size
+      uint64_t size = op.hinfo->is_compressed() ?
+	op.hinfo->get_total_logical_size(sinfo) : op.obc->obs.oi.size;
+      if (after_progress.data_recovered_to >= size) {
 	after_progress.data_recovered_to =
-	  sinfo.logical_to_next_stripe_offset(
-	    op.obc->obs.oi.size);
+	  sinfo.logical_to_next_stripe_offset(size);
 	after_progress.data_complete = true;
       }
       for (set<pg_shard_t>::iterator mi = op.missing_on.begin();
@@ -1797,10 +1800,51 @@ ECUtil::HashInfoRef ECBackend::get_hash_info(
   return ref;
 }
 
+void ECBackend::get_compression_opts(ECTransaction::CompressionOpts *opts)
+{
+  const pg_pool_t &pool = get_parent()->get_pool();
+  string alg;
+  if (pool.allows_ecoverwrites() ||
+      !pool.opts.get(pool_opts_t::EC_COMPRESSION_ALGORITHM, &alg) ||
+      get_osdmap()->require_osd_release < CEPH_RELEASE_NAUTILUS) {
+    ec_compressor.reset();
+  } else {
+    int level = 0;
+    boost::optional<int> l;
+    if (pool.opts.get(pool_opts_t::COMPRESSION_LEVEL, &level)) {
+      l = level;
+    }
+    if (!ec_compressor ||
+	ec_compressor->get_type_name() != alg ||
+	ec_compressor->get_level() != l) {
+      ec_compressor = Compressor::create(cct, alg, l);
+      if (!ec_compressor && alg != "none") {
+	derr << __func__ << " unable to load " << alg << " compressor"
+	     << dendl;
+      }
+    }
+  }
+  opts->compressor = ec_compressor;
+  opts->extent_size =
+    cct->_conf.get_val<Option::size_t>("osd_ec_compression_extent_size");
+  double ratio = 0;
+  if (pool.opts.get(pool_opts_t::COMPRESSION_REQUIRED_RATIO, &ratio)) {
+    opts->required_ratio = ratio;
+  } else {
+    opts->required_ratio =
+      cct->_conf.get_val<double>("osd_ec_compression_required_ratio");
+  }
+}
+
 void ECBackend::start_rmw(Op *op, PGTransactionUPtr &&t)
 {
   ceph_assert(op);
 
+  // objects compressed before striping keep being compressed, even once
+  // the pool stops compressing new objects
+  ECTransaction::CompressionOpts copts;
+  get_compression_opts(&copts);
+
   op->plan = ECTransaction::get_write_plan(
     sinfo,
     std::move(t),
@@ -1815,7 +1859,8 @@ void ECBackend::start_rmw(Op *op, PGTransactionUPtr &&t)
       }
       return ref;
     },
-    get_parent()->get_dpp());
+    get_parent()->get_dpp(),
+    get_parent()->get_pool().allows_ecoverwrites() ? nullptr : &copts);
 
   dout(10) << __func__ << ": " << *op << dendl;
 
@@ -2127,6 +2172,26 @@ void ECBackend::objects_read_async(
              pair<bufferlist*, Context*> > > &to_read,
   Context *on_complete,
   bool fast_read)
+{
+  // only pools which compress before striping have compressed objects,
+  // don't look the others' hinfo up
+  if (get_parent()->get_pool().opts.is_set(
+	pool_opts_t::EC_COMPRESSION_ALGORITHM)) {
+    ECUtil::HashInfoRef hinfo = get_hash_info(hoid, false);
+    if (hinfo && hinfo->is_compressed()) {
+      objects_read_compressed(hoid, *hinfo, to_read, on_complete, fast_read);
+      return;
+    }
+  }
+  objects_read_stripes_async(hoid, to_read, on_complete, fast_read);
+}
+
+void ECBackend::objects_read_stripes_async(
+  const hobject_t &hoid,
+  const list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
+             pair<bufferlist*, Context*> > > &to_read,
+  Context *on_complete,
+  bool fast_read)
 {
   map<hobject_t,std::list<boost::tuple<uint64_t, uint64_t, uint32_t> > >
     reads;
@@ -2236,6 +2301,143 @@ void ECBackend::objects_read_async(
 	   on_complete)));
 }
 
+void ECBackend::objects_read_compressed(
+  const hobject_t &hoid,
+  const ECUtil::HashInfo &hinfo,
+  const list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
+             pair<bufferlist*, Context*> > > &to_read,
+  Context *on_complete,
+  bool fast_read)
+{
+  struct C_DecompressReads : public Context {
+    ECBackend *ec;
+    hobject_t hoid;
+    list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
+	      pair<bufferlist*, Context*> > > to_read;
+    unique_ptr<Context> on_complete;
+    // the extents overlapping to_read, by logical offset, and their data
+    // as read from the stripes
+    map<uint64_t, pair<ECUtil::compressed_extent_t, bufferlist> > extents;
+
+    C_DecompressReads(
+      ECBackend *ec,
+      const hobject_t &hoid,
+      const list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
+                 pair<bufferlist*, Context*> > > &to_read,
+      Context *on_complete)
+      : ec(ec), hoid(hoid), to_read(to_read), on_complete(on_complete) {}
+    ~C_DecompressReads() override {
+      for (auto &&i : to_read) {
+	delete i.second.second;
+      }
+    }
+
+    int decompress(const ECUtil::compressed_extent_t &e, bufferlist &in,
+		   map<int, CompressorRef> *compressors, bufferlist *out) {
+      if (e.alg == Compressor::COMP_ALG_NONE) {
+	*out = in;
+      } else {
+	auto &c = (*compressors)[e.alg];
+	if (!c) {
+	  c = Compressor::create(ec->cct, e.alg);
+	  if (!c) {
+	    return -EOPNOTSUPP;
+	  }
+	}
+	int r = c->decompress(in, *out);
+	if (r < 0) {
+	  return r;
+	}
+      }
+      return out->length() >= e.logical_length ? 0 : -EIO;
+    }
+
+    void finish(int r) override {
+      auto dpp = ec->get_parent()->get_dpp();
+      map<int, CompressorRef> compressors;
+      map<uint64_t, bufferlist> decompressed;
+      for (auto &&read : to_read) {
+	uint64_t offset = read.first.get<0>();
+	uint64_t length = read.first.get<1>();
+	bufferlist bl;
+	if (r >= 0) {
+	  // what the map does not cover is a hole
+	  uint64_t pos = offset;
+	  for (auto p = extents.begin(); p != extents.end() && r >= 0; ++p) {
+	    auto &e = p->second.first;
+	    if (e.logical_end() <= pos || e.logical_offset >= offset + length) {
+	      continue;
+	    }
+	    auto d = decompressed.find(p->first);
+	    if (d == decompressed.end()) {
+	      d = decompressed.emplace(p->first, bufferlist()).first;
+	      r = decompress(e, p->second.second, &compressors, &d->second);
+	      if (r < 0) {
+		ldpp_dout(dpp, 0) << "objects_read_compressed: " << hoid
+				  << " failed to decompress " << e
+				  << ": " << cpp_strerror(r) << dendl;
+		break;
+	      }
+	    }
+	    if (e.logical_offset > pos) {
+	      bl.append_zero(e.logical_offset - pos);
+	      pos = e.logical_offset;
+	    }
+	    uint64_t end = std::min(e.logical_end(), offset + length);
+	    bufferlist piece;
+	    piece.substr_of(d->second, pos - e.logical_offset, end - pos);
+	    bl.claim_append(piece);
+	    pos = end;
+	  }
+	  if (r >= 0 && pos < offset + length) {
+	    bl.append_zero(offset + length - pos);
+	  }
+	}
+	if (r >= 0) {
+	  read.second.first->claim(bl);
+	}
+	if (read.second.second) {
+	  read.second.second->complete(r < 0 ? r : length);
+	  read.second.second = nullptr;
+	}
+      }
+      to_read.clear();
+      if (on_complete) {
+	on_complete.release()->complete(r < 0 ? r : 0);
+      }
+    }
+  };
+
+  C_DecompressReads *c = new C_DecompressReads(this, hoid, to_read,
+					       on_complete);
+  for (auto &&read : to_read) {
+    vector<ECUtil::compressed_extent_t> overlapping;
+    hinfo.map_compressed(read.first.get<0>(), read.first.get<1>(),
+			 &overlapping);
+    for (auto &e : overlapping) {
+      c->extents.emplace(e.logical_offset, make_pair(e, bufferlist()));
+    }
+  }
+  dout(20) << __func__ << ": " << hoid << " reading " << c->extents.size()
+	   << " compressed extents" << dendl;
+
+  if (c->extents.empty()) {
+    // nothing but holes
+    c->complete(0);
+    return;
+  }
+  list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
+	    pair<bufferlist*, Context*> > > physical;
+  for (auto &&i : c->extents) {
+    physical.push_back(
+      make_pair(
+	boost::make_tuple(i.second.first.offset, i.second.first.length,
+			  to_read.front().first.get<2>()),
+	make_pair(&i.second.second, nullptr)));
+  }
+  objects_read_stripes_async(hoid, physical, c, fast_read);
+}
+
 struct CallClientContexts :
   public GenContext<pair<RecoveryMessages*, ECBackend::read_result_t& > &> {
   hobject_t hoid;
@@ -2424,6 +2626,29 @@ void ECBackend::rollback_append(
       old_size));
 }
 
+uint64_t ECBackend::be_get_ondisk_size(
+  uint64_t logical_size,
+  const map<string,bufferptr> &attrs)
+{
+  // objects compressed before striping are as large as their stripes
+  auto p = attrs.find(ECUtil::get_hinfo_key());
+  if (p != attrs.end()) {
+    ECUtil::HashInfo hinfo;
+    bufferlist bl;
+    bl.push_back(p->second);
+    try {
+      auto bp = bl.cbegin();
+      decode(hinfo, bp);
+      if (hinfo.is_compressed()) {
+	return hinfo.get_total_chunk_size();
+      }
+    } catch (buffer::error&) {
+      // reported as a corrupt hinfo
+    }
+  }
+  return sinfo.logical_to_next_chunk_offset(logical_size);
+}
+
 int ECBackend::be_deep_scrub(
   const hobject_t &poid,
   ScrubMap &map,
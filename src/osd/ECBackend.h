@@ -174,6 +174,21 @@ public:
 		    pair<bufferlist*, Context*> > > &to_read,
     Context *on_complete,
     bool fast_read = false) override;
+  /// read [offset, length) of the stripes as is
+  void objects_read_stripes_async(
+    const hobject_t &hoid,
+    const list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
+		    pair<bufferlist*, Context*> > > &to_read,
+    Context *on_complete,
+    bool fast_read);
+  /// read an object compressed before striping through its extent map
+  void objects_read_compressed(
+    const hobject_t &hoid,
+    const ECUtil::HashInfo &hinfo,
+    const list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
+		    pair<bufferlist*, Context*> > > &to_read,
+    Context *on_complete,
+    bool fast_read);
 
   template <typename Func>
   void objects_read_async_no_cache(
@@ -564,6 +579,8 @@ public:
   eversion_t completed_to;
   eversion_t committed_to;
   void start_rmw(Op *op, PGTransactionUPtr &&t);
+  CompressorRef ec_compressor; ///< of the pool, if it compresses before striping
+  void get_compression_opts(ECTransaction::CompressionOpts *opts);
   bool try_state_to_reads();
   bool try_reads_to_commit();
   bool try_finish_rmw();
@@ -671,9 +688,9 @@ public:
     ScrubMap &map,
     ScrubMapBuilder &pos,
     ScrubMap::object &o) override;
-  uint64_t be_get_ondisk_size(uint64_t logical_size) override {
-    return sinfo.logical_to_next_chunk_offset(logical_size);
-  }
+  uint64_t be_get_ondisk_size(
+    uint64_t logical_size,
+    const map<string,bufferptr> &attrs) override;
   void _failed_push(const hobject_t &hoid,
     pair<RecoveryMessages *, ECBackend::read_result_t &> &in);
 };
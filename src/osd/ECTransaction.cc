@@ -81,6 +81,85 @@ void encode_and_write(
   }
 }
 
+void ECTransaction::compress_object_op(
+  const ECUtil::stripe_info_t &sinfo,
+  const CompressionOpts &opts,
+  uint64_t projected_size,
+  PGTransaction::ObjectOperation &op,
+  CompressedUpdate *update,
+  DoutPrefixProvider *dpp)
+{
+  using BufferUpdate = PGTransaction::ObjectOperation::BufferUpdate;
+  ceph_assert(sinfo.logical_offset_is_stripe_aligned(projected_size));
+  ceph_assert(opts.extent_size > 0);
+
+  if (op.truncate) {
+    if (op.truncate->first == 0) {
+      // the object is recreated, extending it only leaves a hole
+      op.truncate = make_pair(0, 0);
+    } else {
+      update->truncate = op.truncate->first;
+      op.truncate = boost::none;
+    }
+  }
+
+  PGTransaction::ObjectOperation::buffer_update_type appends;
+  uint64_t offset = projected_size;
+  for (auto &&extent : op.buffer_updates) {
+    if (boost::get<BufferUpdate::CloneRange>(&(extent.get_val()))) {
+      ceph_assert(
+	0 ==
+	"CloneRange is not allowed, do_op should have returned ENOTSUPP");
+    }
+    auto w = boost::get<BufferUpdate::Write>(&(extent.get_val()));
+    if (!w) {
+      // zeroes past the end of the map are holes already
+      continue;
+    }
+
+    vector<bufferlist> pieces;
+    for (uint64_t pos = 0; pos < extent.get_len(); pos += opts.extent_size) {
+      pieces.emplace_back();
+      pieces.back().substr_of(
+	w->buffer, pos, std::min(opts.extent_size, extent.get_len() - pos));
+    }
+    vector<const bufferlist*> in;
+    for (auto &piece : pieces) {
+      in.push_back(&piece);
+    }
+    vector<bufferlist> out;
+    int r = -EOPNOTSUPP;
+    if (opts.compressor) {
+      r = opts.compressor->compress_batch(in, out);
+    }
+
+    bufferlist bl;
+    uint64_t logical_offset = extent.get_off();
+    for (unsigned j = 0; j < pieces.size(); ++j) {
+      // keep what does not compress well enough as is
+      bool raw = r < 0 ||
+	out[j].length() > pieces[j].length() * opts.required_ratio;
+      const bufferlist &data = raw ? pieces[j] : out[j];
+      update->extents.emplace_back(
+	logical_offset, pieces[j].length(),
+	offset + bl.length(), data.length(),
+	raw ? Compressor::COMP_ALG_NONE : opts.compressor->get_type());
+      logical_offset += pieces[j].length();
+      bl.append(data);
+    }
+    ldpp_dout(dpp, 20) << __func__ << ": " << extent.get_off() << "~"
+		       << extent.get_len() << " compressed to " << offset
+		       << "~" << bl.length() << dendl;
+    if (bl.length() == 0) {
+      continue;
+    }
+    auto len = bl.length();
+    appends.insert(offset, len, BufferUpdate::Write{bl, w->fadvise_flags});
+    offset = sinfo.logical_to_next_stripe_offset(offset + len);
+  }
+  op.buffer_updates = std::move(appends);
+}
+
 bool ECTransaction::requires_overwrite(
   uint64_t prev_size,
   const PGTransaction::ObjectOperation &op) {
@@ -306,6 +385,17 @@ void ECTransaction::generate_transactions(
 	  }
 	});
 
+      auto citer = plan.compressed.find(oid);
+      if (citer != plan.compressed.end()) {
+	hinfo->set_compressed();
+	if (citer->second.truncate) {
+	  hinfo->truncate_compressed(*citer->second.truncate);
+	}
+	for (auto &e : citer->second.extents) {
+	  hinfo->append_compressed(e);
+	}
+      }
+
       // omap not supported (except 0, handled above)
       ceph_assert(!(op.clear_omap));
       ceph_assert(!(op.omap_header));
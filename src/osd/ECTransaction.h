@@ -21,8 +21,22 @@
 #include "erasure-code/ErasureCodeInterface.h"
 #include "PGTransaction.h"
 #include "ExtentCache.h"
+#include "compressor/Compressor.h"
 
 namespace ECTransaction {
+  /// how the pool compresses objects before striping them
+  struct CompressionOpts {
+    CompressorRef compressor;  ///< for new objects, none if they are not
+    uint64_t extent_size = 0;  ///< logical bytes compressed on their own
+    double required_ratio = 1.0;
+  };
+
+  /// changes to the extent map of an object compressed before striping
+  struct CompressedUpdate {
+    boost::optional<uint64_t> truncate; ///< clip the map to this size first
+    vector<ECUtil::compressed_extent_t> extents; ///< then map these
+  };
+
   struct WritePlan {
     PGTransactionUPtr t;
     bool invalidates_cache = false; // Yes, both are possible
@@ -30,18 +44,34 @@ namespace ECTransaction {
     map<hobject_t,extent_set> will_write; // superset of to_read
 
     map<hobject_t,ECUtil::HashInfoRef> hash_infos;
+    map<hobject_t,CompressedUpdate> compressed;
   };
 
   bool requires_overwrite(
     uint64_t prev_size,
     const PGTransaction::ObjectOperation &op);
 
+  /* Turn the writes to an object compressed before striping into appends
+   * of compressed data at projected_size, the end of its stripes, and
+   * record where they went in *update. Truncates only clip the extent map
+   * and what lies past the end of the map reads as zeros, so op is left
+   * with neither truncates (except to 0) nor zeroes.
+   */
+  void compress_object_op(
+    const ECUtil::stripe_info_t &sinfo,
+    const CompressionOpts &opts,
+    uint64_t projected_size,
+    PGTransaction::ObjectOperation &op,
+    CompressedUpdate *update,
+    DoutPrefixProvider *dpp);
+
   template <typename F>
   WritePlan get_write_plan(
     const ECUtil::stripe_info_t &sinfo,
     PGTransactionUPtr &&t,
     F &&get_hinfo,
-    DoutPrefixProvider *dpp) {
+    DoutPrefixProvider *dpp,
+    const CompressionOpts *copts = nullptr) {
     WritePlan plan;
     t->safe_create_traverse(
       [&](pair<const hobject_t, PGTransaction::ObjectOperation> &i) {
@@ -58,14 +88,37 @@ namespace ECTransaction {
 	}
 
 	hobject_t source;
+	ECUtil::HashInfoRef shinfo;
 	if (i.second.has_source(&source)) {
 	  plan.invalidates_cache = true;
 
-	  ECUtil::HashInfoRef shinfo = get_hinfo(source);
+	  shinfo = get_hinfo(source);
 	  projected_size = shinfo->get_projected_total_logical_size(sinfo);
 	  plan.hash_infos[source] = shinfo;
 	}
 
+	if (copts) {
+	  // objects are compressed or not from their creation on
+	  bool recreated = i.second.deletes_first() ||
+	    (i.second.truncate && i.second.truncate->first == 0);
+	  bool compress;
+	  if (shinfo) {
+	    compress = shinfo->is_projected_compressed();
+	  } else if (recreated) {
+	    compress = !!copts->compressor;
+	  } else if (projected_size == 0) {
+	    compress = hinfo->is_projected_compressed() || copts->compressor;
+	  } else {
+	    compress = hinfo->is_projected_compressed();
+	  }
+	  hinfo->set_projected_compressed(compress);
+	  if (compress) {
+	    compress_object_op(
+	      sinfo, *copts, recreated && !shinfo ? 0 : projected_size,
+	      i.second, &plan.compressed[i.first], dpp);
+	  }
+	}
+
 	auto &will_write = plan.will_write[i.first];
 	if (i.second.truncate &&
 	    i.second.truncate->first < projected_size) {
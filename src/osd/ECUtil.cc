@@ -1,6 +1,7 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 
 #include <errno.h>
+#include <algorithm>
 #include "include/encoding.h"
 #include "ECUtil.h"
 
@@ -176,19 +177,97 @@ void ECUtil::HashInfo::append(uint64_t old_size,
   total_chunk_size += size_to_append;
 }
 
-void ECUtil::HashInfo::encode(bufferlist &bl) const
+void ECUtil::compressed_extent_t::encode(bufferlist &bl) const
 {
   ENCODE_START(1, 1, bl);
+  encode(logical_offset, bl);
+  encode(logical_length, bl);
+  encode(offset, bl);
+  encode(length, bl);
+  encode(alg, bl);
+  ENCODE_FINISH(bl);
+}
+
+void ECUtil::compressed_extent_t::decode(bufferlist::const_iterator &bl)
+{
+  DECODE_START(1, bl);
+  decode(logical_offset, bl);
+  decode(logical_length, bl);
+  decode(offset, bl);
+  decode(length, bl);
+  decode(alg, bl);
+  DECODE_FINISH(bl);
+}
+
+void ECUtil::compressed_extent_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("logical_offset", logical_offset);
+  f->dump_unsigned("logical_length", logical_length);
+  f->dump_unsigned("offset", offset);
+  f->dump_unsigned("length", length);
+  f->dump_unsigned("alg", alg);
+}
+
+void ECUtil::HashInfo::append_compressed(const compressed_extent_t &e)
+{
+  ceph_assert(compressed);
+  ceph_assert(compressed_extents.empty() ||
+	      compressed_extents.back().logical_end() <= e.logical_offset);
+  compressed_extents.push_back(e);
+}
+
+void ECUtil::HashInfo::truncate_compressed(uint64_t logical_size)
+{
+  while (!compressed_extents.empty()) {
+    auto &e = compressed_extents.back();
+    if (e.logical_offset >= logical_size) {
+      compressed_extents.pop_back();
+    } else {
+      if (e.logical_end() > logical_size) {
+	e.logical_length = logical_size - e.logical_offset;
+      }
+      break;
+    }
+  }
+}
+
+void ECUtil::HashInfo::map_compressed(
+  uint64_t off, uint64_t len,
+  vector<compressed_extent_t> *out) const
+{
+  auto p = std::upper_bound(
+    compressed_extents.begin(), compressed_extents.end(), off,
+    [](uint64_t o, const compressed_extent_t &e) {
+      return o < e.logical_end();
+    });
+  for (; p != compressed_extents.end() && p->logical_offset < off + len; ++p) {
+    out->push_back(*p);
+  }
+}
+
+void ECUtil::HashInfo::encode(bufferlist &bl) const
+{
+  // only compressed objects need the new encoding, keep the others
+  // readable by older OSDs
+  ENCODE_START(compressed ? 2 : 1, compressed ? 2 : 1, bl);
   encode(total_chunk_size, bl);
   encode(cumulative_shard_hashes, bl);
+  if (compressed) {
+    encode(compressed_extents, bl);
+  }
   ENCODE_FINISH(bl);
 }
 
 void ECUtil::HashInfo::decode(bufferlist::const_iterator &bl)
 {
-  DECODE_START(1, bl);
+  DECODE_START(2, bl);
   decode(total_chunk_size, bl);
   decode(cumulative_shard_hashes, bl);
+  compressed = struct_v >= 2;
+  compressed_extents.clear();
+  if (compressed) {
+    decode(compressed_extents, bl);
+  }
   projected_total_chunk_size = total_chunk_size;
   DECODE_FINISH(bl);
 }
@@ -204,15 +283,35 @@ void ECUtil::HashInfo::dump(Formatter *f) const
     f->close_section();
   }
   f->close_section();
+  if (compressed) {
+    f->open_array_section("compressed_extents");
+    for (auto &e : compressed_extents) {
+      f->open_object_section("extent");
+      e.dump(f);
+      f->close_section();
+    }
+    f->close_section();
+  }
 }
 
 namespace ECUtil {
+std::ostream& operator<<(std::ostream& out, const compressed_extent_t& e)
+{
+  return out << "0x" << hex << e.logical_offset << "~" << e.logical_length
+	     << "->0x" << e.offset << "~" << e.length << dec
+	     << " alg " << (int)e.alg;
+}
+
 std::ostream& operator<<(std::ostream& out, const HashInfo& hi)
 {
   ostringstream hashes;
   for (auto hash: hi.cumulative_shard_hashes)
     hashes << " " << hex << hash;
-  return out << "tcs=" << hi.total_chunk_size << hashes.str();
+  out << "tcs=" << hi.total_chunk_size << hashes.str();
+  if (hi.compressed) {
+    out << " compressed " << hi.compressed_extents.size() << " extents";
+  }
+  return out;
 }
 }
 
@@ -230,6 +329,18 @@ void ECUtil::HashInfo::generate_test_instances(list<HashInfo*>& o)
     o.back()->append(20, buffers);
   }
   o.push_back(new HashInfo(4));
+  o.push_back(new HashInfo(3));
+  {
+    bufferlist bl;
+    bl.append_zero(20);
+    map<int, bufferlist> buffers;
+    buffers[0] = bl;
+    buffers[1] = bl;
+    buffers[2] = bl;
+    o.back()->append(0, buffers);
+    o.back()->set_compressed();
+    o.back()->append_compressed(compressed_extent_t(0, 100, 0, 40, 5));
+  }
 }
 
 const string HINFO_KEY = "hinfo_key";
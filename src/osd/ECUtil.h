@@ -16,6 +16,7 @@
 #define ECUTIL_H
 
 #include <ostream>
+#include <boost/optional.hpp>
 #include "erasure-code/ErasureCodeInterface.h"
 #include "include/buffer_fwd.h"
 #include "include/ceph_assert.h"
@@ -98,12 +99,44 @@ int encode(
   const std::set<int> &want,
   std::map<int, bufferlist> *out);
 
+/// where a logical extent of an object compressed before striping lives
+struct compressed_extent_t {
+  uint64_t logical_offset = 0;
+  uint32_t logical_length = 0;  ///< may be less than the decompressed length
+  uint64_t offset = 0;          ///< of the compressed data, in the stripes
+  uint32_t length = 0;          ///< of the compressed data
+  uint8_t alg = 0;              ///< Compressor::COMP_ALG_NONE if stored raw
+
+  compressed_extent_t() {}
+  compressed_extent_t(uint64_t lo, uint32_t ll, uint64_t o, uint32_t l,
+		      uint8_t a)
+    : logical_offset(lo), logical_length(ll), offset(o), length(l), alg(a) {}
+
+  uint64_t logical_end() const {
+    return logical_offset + logical_length;
+  }
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::const_iterator &bl);
+  void dump(Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(compressed_extent_t)
+
+std::ostream& operator<<(std::ostream& out, const compressed_extent_t& e);
+
 class HashInfo {
   uint64_t total_chunk_size = 0;
   std::vector<uint32_t> cumulative_shard_hashes;
 
+  // objects compressed before striping map their logical extents to the
+  // compressed data in the stripes, sorted by logical offset
+  bool compressed = false;
+  std::vector<compressed_extent_t> compressed_extents;
+
   // purely ephemeral, represents the size once all in-flight ops commit
   uint64_t projected_total_chunk_size = 0;
+  // purely ephemeral, whether the object is compressed once all in-flight
+  // ops commit, if any of them decided it
+  boost::optional<bool> projected_compressed;
 public:
   HashInfo() {}
   explicit HashInfo(unsigned num_chunks) :
@@ -114,6 +147,8 @@ public:
     cumulative_shard_hashes = std::vector<uint32_t>(
       cumulative_shard_hashes.size(),
       -1);
+    compressed = false;
+    compressed_extents.clear();
   }
   void encode(bufferlist &bl) const;
   void decode(bufferlist::const_iterator &bl);
@@ -153,9 +188,34 @@ public:
   }
   void update_to(const HashInfo &rhs) {
     auto ptcs = projected_total_chunk_size;
+    auto pc = projected_compressed;
     *this = rhs;
     projected_total_chunk_size = ptcs;
+    projected_compressed = pc;
+  }
+
+  bool is_compressed() const {
+    return compressed;
+  }
+  bool is_projected_compressed() const {
+    return projected_compressed ? *projected_compressed : compressed;
+  }
+  void set_projected_compressed(bool c) {
+    projected_compressed = c;
+  }
+  const std::vector<compressed_extent_t> &get_compressed_extents() const {
+    return compressed_extents;
+  }
+  void set_compressed() {
+    compressed = true;
   }
+  /// map e, which must start at or past the end of the mapped data
+  void append_compressed(const compressed_extent_t &e);
+  /// forget what lies past logical_size
+  void truncate_compressed(uint64_t logical_size);
+  /// the extents overlapping [off, off + len)
+  void map_compressed(uint64_t off, uint64_t len,
+		      std::vector<compressed_extent_t> *out) const;
   friend std::ostream& operator<<(std::ostream& out, const HashInfo& hi);
 };
 
@@ -2392,6 +2392,8 @@ will start to track new ops received afterwards.";
     f->close_section();
   } else if (admin_command == "dump_objectstore_kv_stats") {
     store->get_db_statistics(f);
+  } else if (admin_command == "dump_objectstore_recompression") {
+    store->dump_recompression_status(f);
   } else if (admin_command == "dump_scrubs") {
     service.dumps_scrub(f);
   } else if (admin_command == "calc_objectstore_db_histogram") {
@@ -3013,6 +3015,13 @@ void OSD::final_init()
 				     "print statistics of kvdb which used by bluestore");
   ceph_assert(r == 0);
 
+  r = admin_socket->register_command("dump_objectstore_recompression",
+				     "dump_objectstore_recompression",
+				     asok_hook,
+				     "print progress of bluestore background "
+				     "recompression");
+  ceph_assert(r == 0);
+
   r = admin_socket->register_command("dump_scrubs",
 				     "dump_scrubs",
 				     asok_hook,
@@ -3300,6 +3309,16 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_pull, "pull", "Pull requests sent");
   osd_plb.add_u64_counter(l_osd_push, "push", "Push messages sent");
   osd_plb.add_u64_counter(l_osd_push_outb, "push_out_bytes", "Pushed size", NULL, 0, unit_t(UNIT_BYTES));
+  osd_plb.add_u64_counter(
+    l_osd_push_compressed, "push_compressed",
+    "Pushed extents sent as stored compressed");
+  osd_plb.add_u64_counter(
+    l_osd_push_compressed_bytes, "push_compressed_bytes",
+    "Pushed data sent as stored compressed", NULL, 0, unit_t(UNIT_BYTES));
+  osd_plb.add_u64_counter(
+    l_osd_push_compressed_saved_bytes, "push_compressed_saved_bytes",
+    "Pushed data not sent thanks to sending it compressed", NULL, 0,
+    unit_t(UNIT_BYTES));
 
   osd_plb.add_u64_counter(
     l_osd_rop, "recovery_ops",
@@ -119,6 +119,9 @@ enum {
   l_osd_pull,
   l_osd_push,
   l_osd_push_outb,
+  l_osd_push_compressed,
+  l_osd_push_compressed_bytes,
+  l_osd_push_compressed_saved_bytes,
 
   l_osd_rop,
   l_osd_rbytes,
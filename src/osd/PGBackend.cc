@@ -737,7 +737,7 @@ bool PGBackend::be_compare_scrub_objects(
       }
     }
   }
-  uint64_t oi_size = be_get_ondisk_size(auth_oi.size);
+  uint64_t oi_size = be_get_ondisk_size(auth_oi.size, auth.attrs);
   if (oi_size != candidate.size) {
     if (error != CLEAN)
       errorstream << ", ";
@@ -958,7 +958,7 @@ map<pg_shard_t, ScrubMap *>::const_iterator
     // This is automatically corrected in PG::_repair_oinfo_oid()
     ceph_assert(oi.soid == obj);
 
-    if (i->second.size != be_get_ondisk_size(oi.size)) {
+    if (i->second.size != be_get_ondisk_size(oi.size, i->second.attrs)) {
       shard_info.set_obj_size_info_mismatch();
       if (error)
         shard_errorstream << ", ";
@@ -595,7 +595,8 @@ typedef std::shared_ptr<const OSDMap> OSDMapRef;
      const vector<int> &acting,
      ostream &errorstream);
    virtual uint64_t be_get_ondisk_size(
-     uint64_t logical_size) = 0;
+     uint64_t logical_size,
+     const map<string,bufferptr> &attrs) = 0;
    virtual int be_deep_scrub(
      const hobject_t &oid,
      ScrubMap &map,
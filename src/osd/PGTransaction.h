@@ -23,6 +23,7 @@
 #include "osd/osd_internal_types.h"
 #include "common/interval_map.h"
 #include "common/inline_variant.h"
+#include "compressor/CompressedWrite.h"
 
 /**
  * This class represents transactions which can be submitted to
@@ -150,6 +151,8 @@ public:
       struct Write {
 	bufferlist buffer;
 	uint32_t fadvise_flags;
+	/// buffer as the client compressed it, if it did
+	std::shared_ptr<const compressed_write_t> compressed;
       };
       struct Zero {
 	uint64_t len;
@@ -176,7 +179,10 @@ public:
 	  [&](const BufferUpdate::Write &w) -> BufferUpdateType {
 	    bufferlist bl;
 	    bl.substr_of(w.buffer, offset, len);
-	    return BufferUpdate::Write{bl, w.fadvise_flags};
+	    if (offset == 0 && len == w.buffer.length()) {
+	      return BufferUpdate::Write{bl, w.fadvise_flags, w.compressed};
+	    }
+	    return BufferUpdate::Write{bl, w.fadvise_flags, nullptr};
 	  },
 	  [&](const BufferUpdate::Zero &) -> BufferUpdateType {
 	    return BufferUpdate::Zero{len};
@@ -206,7 +212,8 @@ public:
 	  left,
 	  [&](const BufferUpdate::Write &w) -> bool {
 	    auto r = boost::get<BufferUpdate::Write>(&right);
-	    return r != nullptr && (w.fadvise_flags == r->fadvise_flags);
+	    return r != nullptr && (w.fadvise_flags == r->fadvise_flags) &&
+	      !w.compressed && !r->compressed;
 	  },
 	  [&](const BufferUpdate::Zero &) -> bool {
 	    auto r = boost::get<BufferUpdate::Zero>(&right);
@@ -226,7 +233,7 @@ public:
 	    ceph_assert(r && w.fadvise_flags == r->fadvise_flags);
 	    bufferlist bl = w.buffer;
 	    bl.append(r->buffer);
-	    return BufferUpdate::Write{bl, w.fadvise_flags};
+	    return BufferUpdate::Write{bl, w.fadvise_flags, nullptr};
 	  },
 	  [&](const BufferUpdate::Zero &z) -> BufferUpdateType {
 	    auto r = boost::get<BufferUpdate::Zero>(&right);
@@ -404,16 +411,19 @@ public:
     uint64_t off,                  ///< [in] off at which to write
     uint64_t len,                  ///< [in] len to write from bl
     bufferlist &bl,                ///< [in] bl to write will be claimed to len
-    uint32_t fadvise_flags = 0     ///< [in] fadvise hint
+    uint32_t fadvise_flags = 0,    ///< [in] fadvise hint
+    std::shared_ptr<const compressed_write_t> compressed = nullptr
+                                   ///< [in] bl as the client compressed it
     ) {
     auto &op = get_object_op_for_modify(hoid);
     ceph_assert(!op.updated_snaps);
     ceph_assert(len > 0);
     ceph_assert(len == bl.length());
+    ceph_assert(!compressed || compressed->get_length() == len);
     op.buffer_updates.insert(
       off,
       len,
-      ObjectOperation::BufferUpdate::Write{bl, fadvise_flags});
+      ObjectOperation::BufferUpdate::Write{bl, fadvise_flags, compressed});
   }
   void clone_range(
     const hobject_t &from,         ///< [in] from
@@ -4649,6 +4649,40 @@ int PrimaryLogPG::do_xattr_cmp_str(int op, string& v1s, bufferlist& xattr)
   }
 }
 
+/*
+ * Replace the data of a write the client sent compressed
+ * (CEPH_OSD_OP_FLAG_COMPRESSED) with the raw data, so that the op goes on
+ * as if it had been sent that way.  The compressed form is handed back
+ * for the backend to pass on to the ObjectStore.
+ */
+int PrimaryLogPG::decompress_client_write(
+  OSDOp& osd_op,
+  std::shared_ptr<const compressed_write_t> *cw)
+{
+  ceph_osd_op& op = osd_op.op;
+  if (!(op.flags & CEPH_OSD_OP_FLAG_COMPRESSED)) {
+    return 0;
+  }
+  // before the op goes anywhere: nothing we can't decompress is passed
+  // on to the replicas
+  auto c = std::make_shared<compressed_write_t>();
+  bufferlist raw;
+  int r = c->decode_payload(cct, osd_op.indata, op.extent.length,
+			    cct->_conf->osd_max_write_size << 20, &raw);
+  if (r < 0) {
+    dout(10) << __func__ << " bad compressed data of "
+	     << osd_op.indata.length() << " bytes for " << op.extent.length
+	     << ": " << cpp_strerror(r) << dendl;
+    return r == -E2BIG ? -OSD_WRITETOOBIG : r;
+  }
+  dout(20) << __func__ << " " << osd_op.indata.length() << " -> "
+	   << raw.length() << dendl;
+  osd_op.indata.swap(raw);
+  op.flags = op.flags & ~CEPH_OSD_OP_FLAG_COMPRESSED;
+  *cw = std::move(c);
+  return 0;
+}
+
 int PrimaryLogPG::do_writesame(OpContext *ctx, OSDOp& osd_op)
 {
   ceph_osd_op& op = osd_op.op;
@@ -6362,6 +6396,10 @@ int PrimaryLogPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
       { // write
         __u32 seq = oi.truncate_seq;
 	tracepoint(osd, do_osd_op_pre_write, soid.oid.name.c_str(), soid.snap.val, oi.size, seq, op.extent.offset, op.extent.length, op.extent.truncate_size, op.extent.truncate_seq);
+	std::shared_ptr<const compressed_write_t> cw;
+	result = decompress_client_write(osd_op, &cw);
+	if (result < 0)
+	  break;
 	if (op.extent.length != osd_op.indata.length()) {
 	  result = -EINVAL;
 	  break;
@@ -6439,8 +6477,12 @@ int PrimaryLogPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	    t->nop(soid);
 	  }
 	} else {
+	  if (cw && cw->get_length() != op.extent.length) {
+	    cw.reset();  // trimmed above
+	  }
 	  t->write(
-	    soid, op.extent.offset, op.extent.length, osd_op.indata, op.flags);
+	    soid, op.extent.offset, op.extent.length, osd_op.indata, op.flags,
+	    cw);
 	}
 
 	if (op.extent.offset == 0 && op.extent.length >= oi.size
@@ -6466,6 +6508,10 @@ int PrimaryLogPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
       { // write full object
 	tracepoint(osd, do_osd_op_pre_writefull, soid.oid.name.c_str(), soid.snap.val, oi.size, 0, op.extent.length);
 
+	std::shared_ptr<const compressed_write_t> cw;
+	result = decompress_client_write(osd_op, &cw);
+	if (result < 0)
+	  break;
 	if (op.extent.length != osd_op.indata.length()) {
 	  result = -EINVAL;
 	  break;
@@ -6486,7 +6532,7 @@ int PrimaryLogPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  t->truncate(soid, op.extent.length);
 	}
 	if (op.extent.length) {
-	  t->write(soid, 0, op.extent.length, osd_op.indata, op.flags);
+	  t->write(soid, 0, op.extent.length, osd_op.indata, op.flags, cw);
 	}
         if (!skip_data_digest) {
 	  obs.oi.set_data_digest(osd_op.indata.crc32c(-1));
@@ -14712,12 +14758,12 @@ void PrimaryLogPG::scrub_snapshot_metadata(
     }
 
     if (oi) {
-      if (pgbackend->be_get_ondisk_size(oi->size) != p->second.size) {
+      if (pgbackend->be_get_ondisk_size(oi->size, p->second.attrs) != p->second.size) {
 	osd->clog->error() << mode << " " << info.pgid << " " << soid
 			   << " : on disk size (" << p->second.size
 			   << ") does not match object info size ("
 			   << oi->size << ") adjusted for ondisk to ("
-			   << pgbackend->be_get_ondisk_size(oi->size)
+			   << pgbackend->be_get_ondisk_size(oi->size, p->second.attrs)
 			   << ")";
 	soid_error.set_size_mismatch();
 	++scrubber.shallow_errors;
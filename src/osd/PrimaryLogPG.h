@@ -1366,6 +1366,9 @@ protected:
   int do_read(OpContext *ctx, OSDOp& osd_op);
   int do_sparse_read(OpContext *ctx, OSDOp& osd_op);
   int do_writesame(OpContext *ctx, OSDOp& osd_op);
+  int decompress_client_write(
+    OSDOp& osd_op,
+    std::shared_ptr<const compressed_write_t> *cw);
 
   bool pgls_filter(PGLSFilter *filter, hobject_t& sobj, bufferlist& outdata);
   int get_pgls_filter(bufferlist::const_iterator& iter, PGLSFilter **pfilter);
@@ -21,6 +21,7 @@
 #include "messages/MOSDPGPushReply.h"
 #include "common/EventTrace.h"
 #include "include/random.h"
+#include "include/str_list.h"
 #include "OSD.h"
 
 #define dout_context cct
@@ -275,9 +276,15 @@ public:
   }
 };
 
+// writes the client compressed with write_compressed_algs are passed on
+// as they came; with store, other writes are compressed by it once here
+// rather than by the store of every replica, and passed on the same way
 void generate_transaction(
   PGTransactionUPtr &pgt,
   const coll_t &coll,
+  const set<int> &write_compressed_algs,
+  ObjectStore *store,
+  ObjectStore::CollectionHandle &ch,
   vector<pg_log_entry_t> &log_entries,
   ObjectStore::Transaction *t,
   set<hobject_t> *added,
@@ -392,6 +399,31 @@ void generate_transaction(
 	match(
 	  extent.get_val(),
 	  [&](const BufferUpdate::Write &op) {
+	    if (op.compressed &&
+		op.compressed->uses_only(write_compressed_algs)) {
+	      t->write_compressed(
+		coll,
+		goid,
+		extent.get_off(),
+		extent.get_len(),
+		*op.compressed,
+		op.fadvise_flags);
+	      return;
+	    }
+	    compressed_write_t cw;
+	    if (store &&
+		store->compress_write(
+		  ch, goid, extent.get_off(), op.buffer, &cw) > 0 &&
+		cw.uses_only(write_compressed_algs)) {
+	      t->write_compressed(
+		coll,
+		goid,
+		extent.get_off(),
+		extent.get_len(),
+		cw,
+		op.fadvise_flags);
+	      return;
+	    }
 	    t->write(
 	      coll,
 	      goid,
@@ -442,9 +474,20 @@ void ReplicatedBackend::submit_transaction(
   ObjectStore::Transaction op_t;
   PGTransactionUPtr t(std::move(_t));
   set<hobject_t> added, removed;
+  // replicas which predate OP_WRITE_COMPRESSED can't apply it, and none
+  // can decompress what it has no plugin for
+  set<int> write_compressed_algs;
+  if (get_osdmap()->require_osd_release >= CEPH_RELEASE_NAUTILUS) {
+    write_compressed_algs = get_compressed_write_algs();
+  }
+  bool precompress = !write_compressed_algs.empty() &&
+    cct->_conf.get_val<bool>("osd_replicated_precompress");
   generate_transaction(
     t,
     coll,
+    write_compressed_algs,
+    precompress ? store : nullptr,
+    ch,
     log_entries,
     &op_t,
     &added,
@@ -1503,6 +1546,7 @@ void ReplicatedBackend::submit_push_data(
   bool cache_dont_need,
   const interval_set<uint64_t> &intervals_included,
   bufferlist data_included,
+  const map<uint64_t, compressed_write_t> &compressed_included,
   bufferlist omap_header,
   const map<string, bufferlist> &attrs,
   const map<string, bufferlist> &omap_entries,
@@ -1548,6 +1592,11 @@ void ReplicatedBackend::submit_push_data(
 	     p.get_start(), p.get_len(), bit, fadvise_flags);
     off += p.get_len();
   }
+  for (auto& p : compressed_included) {
+    t->write_compressed(coll, ghobject_t(target_oid),
+			p.first, p.second.get_length(), p.second,
+			fadvise_flags);
+  }
 
   if (!omap_entries.empty())
     t->omap_setkeys(coll, ghobject_t(target_oid), omap_entries);
@@ -1668,6 +1717,31 @@ bool ReplicatedBackend::handle_pull_response(
   }
 
 
+  // extents sent compressed can only be written whole; decompress
+  // those which have to be trimmed along with the rest.  the others are
+  // decompressed once, by the store as it writes them.
+  map<uint64_t, compressed_write_t> compressed;
+  for (auto& p : pop.compressed_data) {
+    int r = check_pushed_data(hoid, p.first, p.second);
+    if (r < 0) {
+      _failed_pull(from, pop.soid);
+      return false;
+    }
+    interval_set<uint64_t> x;
+    x.insert(p.first, p.second.get_length());
+    if (x.subset_of(pi.recovery_info.copy_subset)) {
+      compressed.insert(p);
+      continue;
+    }
+    bufferlist raw;
+    r = decompress_pushed_data(hoid, p.first, p.second, &raw);
+    if (r < 0) {
+      _failed_pull(from, pop.soid);
+      return false;
+    }
+    insert_pushed_data(p.first, raw, &data_included, &data);
+  }
+
   interval_set<uint64_t> usable_intervals;
   bufferlist usable_data;
   trim_pushed_data(pi.recovery_info.copy_subset,
@@ -1690,14 +1764,19 @@ bool ReplicatedBackend::handle_pull_response(
   submit_push_data(pi.recovery_info, first,
 		   complete, pi.cache_dont_need,
 		   data_included, data,
+		   compressed,
 		   pop.omap_header,
 		   pop.attrset,
 		   pop.omap_entries,
 		   t);
 
+  uint64_t compressed_len = 0;
+  for (auto& p : compressed) {
+    compressed_len += p.second.get_length();
+  }
   pi.stat.num_keys_recovered += pop.omap_entries.size();
-  pi.stat.num_bytes_recovered += data.length();
-  get_parent()->get_logger()->inc(l_osd_rop, pop.omap_entries.size() + data.length());
+  pi.stat.num_bytes_recovered += data.length() + compressed_len;
+  get_parent()->get_logger()->inc(l_osd_rop, pop.omap_entries.size() + data.length() + compressed_len);
 
   if (complete) {
     pi.stat.num_objects_recovered++;
@@ -1729,12 +1808,22 @@ void ReplicatedBackend::handle_push(
     pop.after_progress.omap_complete;
 
   response->soid = pop.recovery_info.soid;
+  for (auto& p : pop.compressed_data) {
+    int r = check_pushed_data(pop.recovery_info.soid, p.first, p.second);
+    if (r < 0) {
+      // apply none of it, and have the primary fail the push
+      response->error = r;
+      return;
+    }
+  }
+
   submit_push_data(pop.recovery_info,
 		   first,
 		   complete,
 		   true, // must be replicate
 		   pop.data_included,
 		   data,
+		   pop.compressed_data,
 		   pop.omap_header,
 		   pop.attrset,
 		   pop.omap_entries,
@@ -1923,9 +2012,33 @@ int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
     out_op->data_included.clear();
   }
 
+  // with push_compressed, extents the store keeps compressed are sent as
+  // they are stored, for the target to write without recompressing them.
+  // targets which predate PushOp::compressed_data would drop them.
+  bool push_compressed =
+    cct->_conf.get_val<bool>("osd_recovery_push_compressed") &&
+    get_osdmap()->require_osd_release >= CEPH_RELEASE_NAUTILUS;
+  set<int> push_compressed_algs;
+  if (push_compressed) {
+    push_compressed_algs = get_compressed_write_algs();
+  }
+  interval_set<uint64_t> compressed_included;
   for (interval_set<uint64_t>::iterator p = out_op->data_included.begin();
        p != out_op->data_included.end();
        ++p) {
+    if (push_compressed) {
+      compressed_write_t cw;
+      int r = store->read_compressed(
+	ch, ghobject_t(recovery_info.soid), p.get_start(), p.get_len(), &cw,
+	cache_dont_need ? CEPH_OSD_OP_FLAG_FADVISE_DONTNEED: 0);
+      if (r > 0 && cw.get_length() == p.get_len() &&
+	  cw.uses_only(push_compressed_algs)) {
+	compressed_included.insert(p.get_start(), p.get_len());
+	out_op->compressed_data[p.get_start()] = std::move(cw);
+	continue;
+      }
+      // read it as usual otherwise, which also deals with errors
+    }
     bufferlist bit;
     int r = store->read(ch, ghobject_t(recovery_info.soid),
 		p.get_start(), p.get_len(), bit,
@@ -1958,15 +2071,30 @@ int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
     }
     out_op->data.claim_append(bit);
   }
-  if (progress.first && out_op->data_included.begin().get_start() == 0 &&
-      out_op->data.length() == oi.size && oi.is_data_digest()) {
-    uint32_t crc = out_op->data.crc32c(-1);
-    if (oi.data_digest != crc) {
-      dout(0) << __func__ << " " << coll << std::hex
-                         << " full-object read crc 0x" << crc
-                         << " != expected 0x" << oi.data_digest
-                         << std::dec << " on " << recovery_info.soid << dendl;
-      return -EIO;
+  out_op->data_included.subtract(compressed_included);
+  // the digest is of the raw data, so what is sent compressed is
+  // decompressed to check it along with the rest
+  if (progress.first && oi.is_data_digest() &&
+      out_op->data.length() + out_op->get_compressed_length() == oi.size) {
+    interval_set<uint64_t> included = out_op->data_included;
+    bufferlist data = out_op->data;
+    for (auto& p : out_op->compressed_data) {
+      bufferlist raw;
+      if (decompress_pushed_data(recovery_info.soid, p.first, p.second,
+				 &raw) < 0) {
+	return -EIO;
+      }
+      insert_pushed_data(p.first, raw, &included, &data);
+    }
+    if (!included.empty() && included.range_start() == 0) {
+      uint32_t crc = data.crc32c(-1);
+      if (oi.data_digest != crc) {
+        dout(0) << __func__ << " " << coll << std::hex
+                           << " full-object read crc 0x" << crc
+                           << " != expected 0x" << oi.data_digest
+                           << std::dec << " on " << recovery_info.soid << dendl;
+        return -EIO;
+      }
     }
   }
 
@@ -1976,14 +2104,24 @@ int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
       stat->num_objects_recovered++;
   }
 
+  uint64_t compressed_len = out_op->get_compressed_length();
+  uint64_t compressed_data_len = out_op->get_compressed_data_length();
   if (stat) {
     stat->num_keys_recovered += out_op->omap_entries.size();
-    stat->num_bytes_recovered += out_op->data.length();
-    get_parent()->get_logger()->inc(l_osd_rbytes, out_op->omap_entries.size() + out_op->data.length());
+    stat->num_bytes_recovered += out_op->data.length() + compressed_len;
+    get_parent()->get_logger()->inc(l_osd_rbytes, out_op->omap_entries.size() + out_op->data.length() + compressed_len);
   }
 
   get_parent()->get_logger()->inc(l_osd_push);
-  get_parent()->get_logger()->inc(l_osd_push_outb, out_op->data.length());
+  get_parent()->get_logger()->inc(l_osd_push_outb, out_op->data.length() + compressed_data_len);
+  if (!out_op->compressed_data.empty()) {
+    get_parent()->get_logger()->inc(l_osd_push_compressed,
+				    out_op->compressed_data.size());
+    get_parent()->get_logger()->inc(l_osd_push_compressed_bytes,
+				    compressed_len);
+    get_parent()->get_logger()->inc(l_osd_push_compressed_saved_bytes,
+				    compressed_len - compressed_data_len);
+  }
 
   // send
   out_op->version = v;
@@ -2017,6 +2155,11 @@ bool ReplicatedBackend::handle_push_reply(
   } else {
     PushInfo *pi = &pushing[soid][peer];
     bool error = pushing[soid].begin()->second.recovery_progress.error;
+    if (op.error < 0) {
+      dout(5) << __func__ << ": oid " << soid << " osd." << peer
+	      << " failed the push: " << cpp_strerror(op.error) << dendl;
+      error = true;
+    }
 
     if (!pi->recovery_progress.data_complete && !error) {
       dout(10) << " pushing more from, "
@@ -2140,6 +2283,73 @@ void ReplicatedBackend::trim_pushed_data(
   }
 }
 
+set<int> ReplicatedBackend::get_compressed_write_algs() const
+{
+  set<int> algs;
+  for (auto& name : get_str_set(
+	 cct->_conf.get_val<string>("osd_compressed_write_algorithms"))) {
+    auto alg = Compressor::get_comp_alg_type(name);
+    if (alg) {
+      algs.insert(*alg);
+    }
+  }
+  return algs;
+}
+
+int ReplicatedBackend::check_pushed_data(
+  const hobject_t &soid,
+  uint64_t off,
+  const compressed_write_t &cw)
+{
+  if (!cw.is_valid() || !cw.uses_only(get_compressed_write_algs())) {
+    derr << __func__ << " " << soid << " pushed 0x" << std::hex << off
+	 << "~" << cw.get_length() << std::dec
+	 << " compressed in a way the store cannot write" << dendl;
+    return -EINVAL;
+  }
+  return 0;
+}
+
+int ReplicatedBackend::decompress_pushed_data(
+  const hobject_t &soid,
+  uint64_t off,
+  const compressed_write_t &cw,
+  bufferlist *raw)
+{
+  int r = cw.decompress(cct, raw);
+  if (r < 0) {
+    derr << __func__ << " " << soid << " unable to decompress pushed 0x"
+	 << std::hex << off << "~" << cw.get_length() << std::dec
+	 << ": " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ceph_assert(raw->length() == cw.get_length());
+  return 0;
+}
+
+void ReplicatedBackend::insert_pushed_data(
+  uint64_t off,
+  bufferlist bl,
+  interval_set<uint64_t> *intervals,
+  bufferlist *data)
+{
+  ceph_assert(!intervals->intersects(off, bl.length()));
+  uint64_t data_off = 0;
+  for (auto p = intervals->begin();
+       p != intervals->end() && p.get_start() < off;
+       ++p) {
+    data_off += p.get_len();
+  }
+  bufferlist before, after;
+  before.substr_of(*data, 0, data_off);
+  after.substr_of(*data, data_off, data->length() - data_off);
+  intervals->insert(off, bl.length());
+  data->clear();
+  data->claim_append(before);
+  data->claim_append(bl);
+  data->claim_append(after);
+}
+
 void ReplicatedBackend::_failed_pull(pg_shard_t from, const hobject_t &soid)
 {
   dout(20) << __func__ << ": " << soid << " from " << from << dendl;
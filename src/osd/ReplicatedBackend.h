@@ -251,6 +251,25 @@ private:
 			       bufferlist data_received,
 			       interval_set<uint64_t> *intervals_usable,
 			       bufferlist *data_usable);
+  /// the compression algorithms every OSD can decompress
+  set<int> get_compressed_write_algs() const;
+  /**
+   * check that what a peer pushed compressed is whole, and compressed
+   * with algorithms every OSD can load; the store decompresses it as it
+   * writes it
+   */
+  int check_pushed_data(const hobject_t &soid,
+			uint64_t off,
+			const compressed_write_t &cw);
+  /// decompress what is pushed compressed into *raw
+  int decompress_pushed_data(const hobject_t &soid,
+			     uint64_t off,
+			     const compressed_write_t &cw,
+			     bufferlist *raw);
+  static void insert_pushed_data(uint64_t off,
+				 bufferlist bl,
+				 interval_set<uint64_t> *intervals,
+				 bufferlist *data);
   void _failed_pull(pg_shard_t from, const hobject_t &soid);
 
   void send_pushes(int prio, map<pg_shard_t, vector<PushOp> > &pushes);
@@ -271,6 +290,7 @@ private:
 			bool cache_dont_need,
 			const interval_set<uint64_t> &intervals_included,
 			bufferlist data_included,
+			const map<uint64_t, compressed_write_t> &compressed_included,
 			bufferlist omap_header,
 			const map<string, bufferlist> &attrs,
 			const map<string, bufferlist> &omap_entries,
@@ -424,7 +444,9 @@ private:
     ScrubMap &map,
     ScrubMapBuilder &pos,
     ScrubMap::object &o) override;
-  uint64_t be_get_ondisk_size(uint64_t logical_size) override { return logical_size; }
+  uint64_t be_get_ondisk_size(
+    uint64_t logical_size,
+    const map<string,bufferptr> &attrs) override { return logical_size; }
 };
 
 #endif
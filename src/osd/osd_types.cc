@@ -104,6 +104,12 @@ const char * ceph_osd_op_flag_name(unsigned flag)
     case CEPH_OSD_OP_FLAG_BYPASS_CLEAN_CACHE:
       name = "bypass_clean_cache";
       break;
+    case CEPH_OSD_OP_FLAG_COMPRESS:
+      name = "compress";
+      break;
+    case CEPH_OSD_OP_FLAG_COMPRESSED:
+      name = "compressed";
+      break;
     default:
       name = "???";
   };
@@ -1063,7 +1069,15 @@ static opt_mapping_t opt_mapping = boost::assign::map_list_of
            ("csum_min_block", pool_opts_t::opt_desc_t(
 	     pool_opts_t::CSUM_MIN_BLOCK, pool_opts_t::INT))
            ("fingerprint_algorithm", pool_opts_t::opt_desc_t(
-	     pool_opts_t::FINGERPRINT_ALGORITHM, pool_opts_t::STR));
+	     pool_opts_t::FINGERPRINT_ALGORITHM, pool_opts_t::STR))
+           ("compression_level", pool_opts_t::opt_desc_t(
+	     pool_opts_t::COMPRESSION_LEVEL, pool_opts_t::INT))
+           ("recompression_algorithm", pool_opts_t::opt_desc_t(
+	     pool_opts_t::RECOMPRESSION_ALGORITHM, pool_opts_t::STR))
+           ("recompression_level", pool_opts_t::opt_desc_t(
+	     pool_opts_t::RECOMPRESSION_LEVEL, pool_opts_t::INT))
+           ("ec_compression_algorithm", pool_opts_t::opt_desc_t(
+	     pool_opts_t::EC_COMPRESSION_ALGORITHM, pool_opts_t::STR));
 
 bool pool_opts_t::is_opt_name(const std::string& name) {
     return opt_mapping.count(name);
@@ -5572,32 +5586,42 @@ void PushReplyOp::generate_test_instances(list<PushReplyOp*> &o)
   o.back()->soid = hobject_t(sobject_t("asdf", 2));
   o.push_back(new PushReplyOp);
   o.back()->soid = hobject_t(sobject_t("asdf", CEPH_NOSNAP));
+  o.back()->error = -EINVAL;
 }
 
 void PushReplyOp::encode(bufferlist &bl) const
 {
-  ENCODE_START(1, 1, bl);
+  ENCODE_START(2, 1, bl);
   encode(soid, bl);
+  encode(error, bl);
   ENCODE_FINISH(bl);
 }
 
 void PushReplyOp::decode(bufferlist::const_iterator &bl)
 {
-  DECODE_START(1, bl);
+  DECODE_START(2, bl);
   decode(soid, bl);
+  if (struct_v >= 2) {
+    decode(error, bl);
+  } else {
+    error = 0;
+  }
   DECODE_FINISH(bl);
 }
 
 void PushReplyOp::dump(Formatter *f) const
 {
   f->dump_stream("soid") << soid;
+  f->dump_int("error", error);
 }
 
 ostream &PushReplyOp::print(ostream &out) const
 {
-  return out
-    << "PushReplyOp(" << soid
-    << ")";
+  out << "PushReplyOp(" << soid;
+  if (error < 0) {
+    out << " error " << error;
+  }
+  return out << ")";
 }
 
 ostream& operator<<(ostream& out, const PushReplyOp &op)
@@ -5687,11 +5711,20 @@ void PushOp::generate_test_instances(list<PushOp*> &o)
   o.push_back(new PushOp);
   o.back()->soid = hobject_t(sobject_t("asdf", CEPH_NOSNAP));
   o.back()->version = eversion_t(0, 0);
+  o.push_back(new PushOp);
+  o.back()->soid = hobject_t(sobject_t("asdf", CEPH_NOSNAP));
+  o.back()->version = eversion_t(3, 10);
+  {
+    compressed_write_t& cw = o.back()->compressed_data[4096];
+    cw.segments.resize(1);
+    cw.segments[0].length = cw.segments[0].compressed_length = 4;
+    cw.data.append("abcd");
+  }
 }
 
 void PushOp::encode(bufferlist &bl, uint64_t features) const
 {
-  ENCODE_START(1, 1, bl);
+  ENCODE_START(2, 1, bl);
   encode(soid, bl);
   encode(version, bl);
   encode(data, bl);
@@ -5702,12 +5735,13 @@ void PushOp::encode(bufferlist &bl, uint64_t features) const
   encode(recovery_info, bl, features);
   encode(after_progress, bl);
   encode(before_progress, bl);
+  encode(compressed_data, bl);
   ENCODE_FINISH(bl);
 }
 
 void PushOp::decode(bufferlist::const_iterator &bl)
 {
-  DECODE_START(1, bl);
+  DECODE_START(2, bl);
   decode(soid, bl);
   decode(version, bl);
   decode(data, bl);
@@ -5718,6 +5752,9 @@ void PushOp::decode(bufferlist::const_iterator &bl)
   decode(recovery_info, bl);
   decode(after_progress, bl);
   decode(before_progress, bl);
+  if (struct_v >= 2) {
+    decode(compressed_data, bl);
+  }
   DECODE_FINISH(bl);
 }
 
@@ -5727,6 +5764,8 @@ void PushOp::dump(Formatter *f) const
   f->dump_stream("version") << version;
   f->dump_int("data_len", data.length());
   f->dump_stream("data_included") << data_included;
+  f->dump_int("compressed_data_len", get_compressed_data_length());
+  f->dump_int("compressed_len", get_compressed_length());
   f->dump_int("omap_header_len", omap_header.length());
   f->dump_int("omap_entries_len", omap_entries.size());
   f->dump_int("attrset_len", attrset.size());
@@ -5754,6 +5793,8 @@ ostream &PushOp::print(ostream &out) const
     << ", version: " << version
     << ", data_included: " << data_included
     << ", data_size: " << data.length()
+    << ", compressed_extents: " << compressed_data.size()
+    << ", compressed_data_size: " << get_compressed_data_length()
     << ", omap_header_size: " << omap_header.length()
     << ", omap_entries_size: " << omap_entries.size()
     << ", attrset_size: " << attrset.size()
@@ -5770,7 +5811,7 @@ ostream& operator<<(ostream& out, const PushOp &op)
 
 uint64_t PushOp::cost(CephContext *cct) const
 {
-  uint64_t cost = data_included.size();
+  uint64_t cost = data_included.size() + get_compressed_data_length();
   for (map<string, bufferlist>::const_iterator i =
 	 omap_entries.begin();
        i != omap_entries.end();
@@ -5781,6 +5822,24 @@ uint64_t PushOp::cost(CephContext *cct) const
   return cost;
 }
 
+uint64_t PushOp::get_compressed_length() const
+{
+  uint64_t len = 0;
+  for (auto& p : compressed_data) {
+    len += p.second.get_length();
+  }
+  return len;
+}
+
+uint64_t PushOp::get_compressed_data_length() const
+{
+  uint64_t len = 0;
+  for (auto& p : compressed_data) {
+    len += p.second.data.length();
+  }
+  return len;
+}
+
 // -- ScrubMap --
 
 void ScrubMap::merge_incr(const ScrubMap &l)
@@ -43,6 +43,7 @@
 #include "Watch.h"
 #include "include/cmp.h"
 #include "librados/ListObjectImpl.h"
+#include "compressor/CompressedWrite.h"
 #include "compressor/Compressor.h"
 #include <atomic>
 
@@ -1100,6 +1101,10 @@ public:
     CSUM_MAX_BLOCK,
     CSUM_MIN_BLOCK,
     FINGERPRINT_ALGORITHM,
+    COMPRESSION_LEVEL,
+    RECOMPRESSION_ALGORITHM,
+    RECOMPRESSION_LEVEL,
+    EC_COMPRESSION_ALGORITHM,
   };
 
   enum type_t {
@@ -5041,6 +5046,7 @@ ostream& operator<<(ostream& out, const ObjectRecoveryProgress &prog);
 
 struct PushReplyOp {
   hobject_t soid;
+  int32_t error = 0;  ///< < 0 if the push could not be applied
 
   static void generate_test_instances(list<PushReplyOp*>& o);
   void encode(bufferlist &bl) const;
@@ -5075,6 +5081,8 @@ struct PushOp {
   eversion_t version;
   bufferlist data;
   interval_set<uint64_t> data_included;
+  /// extents, not in data_included, sent as the source stores them
+  map<uint64_t, compressed_write_t> compressed_data;
   bufferlist omap_header;
   map<string, bufferlist> omap_entries;
   map<string, bufferlist> attrset;
@@ -5090,6 +5098,10 @@ struct PushOp {
   void dump(Formatter *f) const;
 
   uint64_t cost(CephContext *cct) const;
+  /// bytes of the object in compressed_data
+  uint64_t get_compressed_length() const;
+  /// bytes compressed_data takes
+  uint64_t get_compressed_data_length() const;
 };
 WRITE_CLASS_ENCODER_FEATURES(PushOp)
 ostream& operator<<(ostream& out, const PushOp &op);
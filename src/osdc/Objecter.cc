@@ -50,6 +50,8 @@
 #include "include/str_list.h"
 #include "common/errno.h"
 #include "common/EventTrace.h"
+#include "compressor/CompressedWrite.h"
+#include "compressor/Compressor.h"
 
 using ceph::real_time;
 using ceph::real_clock;
@@ -143,6 +145,10 @@ enum {
   l_osdc_osdop_omap_rd,
   l_osdc_osdop_omap_del,
 
+  l_osdc_osdop_compressed,
+  l_osdc_osdop_compressed_bytes,
+  l_osdc_osdop_compressed_saved_bytes,
+
   l_osdc_last,
 };
 
@@ -365,10 +371,30 @@ void Objecter::init()
     pcb.add_u64_counter(l_osdc_osdop_omap_del, "omap_del",
 			"OSD OMAP delete operations");
 
+    pcb.add_u64_counter(l_osdc_osdop_compressed, "osdop_compressed",
+			"Write operations sent compressed");
+    pcb.add_u64_counter(l_osdc_osdop_compressed_bytes,
+			"osdop_compressed_bytes",
+			"Data of write operations sent compressed", NULL, 0,
+			unit_t(UNIT_BYTES));
+    pcb.add_u64_counter(l_osdc_osdop_compressed_saved_bytes,
+			"osdop_compressed_saved_bytes",
+			"Data not sent thanks to compressing writes", NULL, 0,
+			unit_t(UNIT_BYTES));
+
     logger = pcb.create_perf_counters();
     cct->get_perfcounters_collection()->add(logger);
   }
 
+  {
+    auto alg = cct->_conf.get_val<std::string>("objecter_compression_algorithm");
+    compressor = Compressor::create(cct, alg);
+    if (!compressor) {
+      lderr(cct) << __func__ << " unable to load compressor '" << alg
+		 << "', writes will be sent uncompressed" << dendl;
+    }
+  }
+
   m_request_state_hook = new RequestStateHook(this);
   AdminSocket* admin_socket = cct->get_admin_socket();
   int ret = admin_socket->register_command("objecter_requests",
@@ -2264,6 +2290,8 @@ void Objecter::resend_mon_ops()
 
 void Objecter::op_submit(Op *op, ceph_tid_t *ptid, int *ctx_budget)
 {
+  if (op->target.flags & CEPH_OSD_FLAG_WRITE)
+    _compress_ops(op);
   shunique_lock rl(rwlock, ceph::acquire_shared);
   ceph_tid_t tid = 0;
   if (!ptid)
@@ -2272,6 +2300,68 @@ void Objecter::op_submit(Op *op, ceph_tid_t *ptid, int *ctx_budget)
   _op_submit_with_budget(op, rl, ptid, ctx_budget);
 }
 
+/*
+ * Compress the data of the WRITE and WRITEFULL ops which asked for it
+ * with CEPH_OSD_OP_FLAG_COMPRESS, in the form the OSD can hand on to its
+ * ObjectStore (see compressed_write_t).  Ops which do not compress, or
+ * which go to a cluster that cannot take them, are sent as they are.
+ * Done before taking rwlock; compressing may take a while.
+ */
+void Objecter::_compress_ops(Op *op)
+{
+  bool wanted = false;
+  for (auto& o : op->ops) {
+    if (o.op.flags & CEPH_OSD_OP_FLAG_COMPRESS) {
+      wanted = true;
+      break;
+    }
+  }
+  if (!wanted)
+    return;
+
+  bool supported;
+  {
+    shared_lock rl(rwlock);
+    supported = osdmap->require_osd_release >= CEPH_RELEASE_NAUTILUS;
+  }
+  const auto& conf = cct->_conf;
+  uint64_t min_size =
+    conf.get_val<Option::size_t>("objecter_compression_min_size");
+  uint64_t segment_size =
+    conf.get_val<Option::size_t>("objecter_compression_segment_size");
+  double required_ratio =
+    conf.get_val<double>("objecter_compression_required_ratio");
+
+  for (auto& o : op->ops) {
+    if (!(o.op.flags & CEPH_OSD_OP_FLAG_COMPRESS))
+      continue;
+    o.op.flags = o.op.flags & ~CEPH_OSD_OP_FLAG_COMPRESS;
+    if (!supported || !compressor || segment_size == 0 ||
+	(o.op.op != CEPH_OSD_OP_WRITE && o.op.op != CEPH_OSD_OP_WRITEFULL) ||
+	o.indata.length() < min_size ||
+	o.indata.length() != o.op.extent.length)
+      continue;
+
+    compressed_write_t cw;
+    if (cw.compress(compressor.get(), o.op.extent.offset, o.indata,
+		    segment_size, required_ratio) == 0)
+      continue;
+    bufferlist bl;
+    encode(cw, bl);
+    if (bl.length() >= o.indata.length())
+      continue;
+    ldout(cct, 20) << __func__ << " " << op->target.base_oid << " "
+		   << ceph_osd_op_name(o.op.op) << " " << o.indata.length()
+		   << " -> " << bl.length() << dendl;
+    logger->inc(l_osdc_osdop_compressed);
+    logger->inc(l_osdc_osdop_compressed_bytes, o.indata.length());
+    logger->inc(l_osdc_osdop_compressed_saved_bytes,
+		o.indata.length() - bl.length());
+    o.indata.swap(bl);
+    o.op.flags = o.op.flags | CEPH_OSD_OP_FLAG_COMPRESSED;
+  }
+}
+
 void Objecter::_op_submit_with_budget(Op *op, shunique_lock& sul,
 				      ceph_tid_t *ptid,
 				      int *ctx_budget)
@@ -50,6 +50,7 @@ class OSDMap;
 class MonClient;
 class Message;
 class Finisher;
+class Compressor;
 
 class MPoolOpReply;
 
@@ -1908,6 +1909,9 @@ public:
   ceph::timespan mon_timeout;
   ceph::timespan osd_timeout;
 
+  /// for writes which ask for CEPH_OSD_OP_FLAG_COMPRESS
+  std::shared_ptr<Compressor> compressor;
+
   MOSDOp *_prepare_osd_op(Op *op);
   void _send_op(Op *op);
   void _send_op_account(Op *op);
@@ -2151,6 +2155,7 @@ private:
                              const OSDMap &new_osd_map);
 
   // low-level
+  void _compress_ops(Op *op);
   void _op_submit(Op *op, shunique_lock& lc, ceph_tid_t *ptid);
   void _op_submit_with_budget(Op *op, shunique_lock& lc,
 			      ceph_tid_t *ptid,
@@ -70,6 +70,7 @@ cdef extern from "rados/librados.h" nogil:
         _LIBRADOS_OP_FLAG_FADVISE_WILLNEED "LIBRADOS_OP_FLAG_FADVISE_WILLNEED"
         _LIBRADOS_OP_FLAG_FADVISE_DONTNEED "LIBRADOS_OP_FLAG_FADVISE_DONTNEED"
         _LIBRADOS_OP_FLAG_FADVISE_NOCACHE "LIBRADOS_OP_FLAG_FADVISE_NOCACHE"
+        _LIBRADOS_OP_FLAG_COMPRESS "LIBRADOS_OP_FLAG_COMPRESS"
 
 
     enum:
@@ -314,6 +315,7 @@ LIBRADOS_OP_FLAG_FADVISE_SEQUENTIAL = _LIBRADOS_OP_FLAG_FADVISE_SEQUENTIAL
 LIBRADOS_OP_FLAG_FADVISE_WILLNEED = _LIBRADOS_OP_FLAG_FADVISE_WILLNEED
 LIBRADOS_OP_FLAG_FADVISE_DONTNEED = _LIBRADOS_OP_FLAG_FADVISE_DONTNEED
 LIBRADOS_OP_FLAG_FADVISE_NOCACHE = _LIBRADOS_OP_FLAG_FADVISE_NOCACHE
+LIBRADOS_OP_FLAG_COMPRESS = _LIBRADOS_OP_FLAG_COMPRESS
 
 LIBRADOS_SNAP_HEAD = _LIBRADOS_SNAP_HEAD
 
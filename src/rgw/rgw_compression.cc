@@ -3,11 +3,123 @@
 // vim: ts=8 sw=2 smarttab
 
 #include "rgw_compression.h"
+#include "common/WorkQueue.h"
 
 #define dout_subsys ceph_subsys_rgw
 
+namespace {
+
+class CompressionThreadPool : public ThreadPool {
+public:
+  ContextWQ *work_queue;
+
+  explicit CompressionThreadPool(CephContext *cct)
+    : ThreadPool(cct, "rgw::compression_thread_pool", "tp_rgw_comp",
+                 cct->_conf.get_val<int64_t>("rgw_compression_threads"),
+                 "rgw_compression_threads"),
+      work_queue(new ContextWQ("rgw::compression_work_queue",
+                               cct->_conf->rgw_op_thread_timeout, this)) {
+    start();
+  }
+  ~CompressionThreadPool() override {
+    work_queue->drain();
+    delete work_queue;
+
+    stop();
+  }
+};
+
+} // anonymous namespace
+
+// the compression threads, none to (de)compress in the request thread
+static ContextWQ *get_compression_work_queue(CephContext *cct)
+{
+  if (cct->_conf.get_val<int64_t>("rgw_compression_threads") <= 0) {
+    return nullptr;
+  }
+  return cct->lookup_or_create_singleton_object<CompressionThreadPool>(
+    "rgw::compression_thread_pool", false, cct).work_queue;
+}
+
 //------------RGWPutObj_Compress---------------
 
+RGWPutObj_Compress::RGWPutObj_Compress(CephContext* cct_,
+                                       CompressorRef compressor,
+                                       RGWPutObjDataProcessor* next)
+  : RGWPutObj_Filter(next), cct(cct_), compressor(compressor),
+    max_inflight(cct->_conf.get_val<uint64_t>("rgw_compression_max_inflight"))
+{
+  work_queue = get_compression_work_queue(cct);
+}
+
+RGWPutObj_Compress::~RGWPutObj_Compress()
+{
+  // a failed upload may leave parts behind which are still compressed
+  Mutex::Locker l(lock);
+  while (!jobs.empty()) {
+    if (jobs.front()->done) {
+      jobs.pop_front();
+    } else {
+      cond.Wait(lock);
+    }
+  }
+}
+
+void RGWPutObj_Compress::add_block(off_t ofs, size_t len)
+{
+  compression_block newbl;
+  size_t bs = blocks.size();
+  newbl.old_ofs = ofs;
+  newbl.new_ofs = bs > 0 ? blocks[bs-1].len + blocks[bs-1].new_ofs : 0;
+  newbl.len = len;
+  blocks.push_back(newbl);
+}
+
+void RGWPutObj_Compress::queue_compress(bufferlist& bl, off_t ofs)
+{
+  auto job = std::make_shared<Job>();
+  job->ofs = ofs;
+  job->in.claim(bl);
+  {
+    Mutex::Locker l(lock);
+    jobs.push_back(job);
+  }
+  work_queue->queue(new FunctionContext([this, job](int) {
+    int r = compressor->compress(job->in, job->out);
+    job->in.clear();
+    Mutex::Locker l(lock);
+    job->r = r;
+    job->done = true;
+    cond.Signal();
+  }));
+}
+
+// take the compressed parts which are done, in order, waiting for the
+// oldest ones while more than max_inflight are queued, or for all of them
+int RGWPutObj_Compress::collect(bool wait_all, bufferlist *out)
+{
+  Mutex::Locker l(lock);
+  while (!jobs.empty()) {
+    auto& job = jobs.front();
+    if (!job->done) {
+      if (!wait_all && jobs.size() <= max_inflight) {
+        break;
+      }
+      cond.Wait(lock);
+      continue;
+    }
+    if (job->r < 0) {
+      lderr(cct) << "Compression failed with exit code " << job->r
+          << " for part at " << job->ofs << ", compression process failed" << dendl;
+      return -EIO;
+    }
+    add_block(job->ofs, job->out.length());
+    out->claim_append(job->out);
+    jobs.pop_front();
+  }
+  return 0;
+}
+
 int RGWPutObj_Compress::handle_data(bufferlist& bl, off_t ofs, void **phandle, rgw_raw_obj *pobj, bool *again)
 {
   bufferlist in_bl;
@@ -15,9 +127,19 @@ int RGWPutObj_Compress::handle_data(bufferlist& bl, off_t ofs, void **phandle, r
     return next->handle_data(in_bl, ofs, phandle, pobj, again);
   }
   if (bl.length() > 0) {
+    end_ofs = ofs + bl.length();
     // compression stuff
-    if ((ofs > 0 && compressed) ||                                // if previous part was compressed
-        (ofs == 0)) {                                             // or it's the first part
+    if (ofs > 0 && compressed && work_queue) {
+      // the first part decided that the object is compressed, the
+      // following ones are compressed while earlier ones are written
+      ldout(cct, 10) << "Compression for rgw is enabled, queue part " << bl.length() << dendl;
+      queue_compress(bl, ofs);
+      int r = collect(false, &in_bl);
+      if (r < 0) {
+        return r;
+      }
+    } else if ((ofs > 0 && compressed) ||                         // if previous part was compressed
+               (ofs == 0)) {                                      // or it's the first part
       ldout(cct, 10) << "Compression for rgw is enabled, compress part " << bl.length() << dendl;
       int cr = compressor->compress(bl, in_bl);
       if (cr < 0) {
@@ -32,19 +154,20 @@ int RGWPutObj_Compress::handle_data(bufferlist& bl, off_t ofs, void **phandle, r
         in_bl.claim(bl);
       } else {
         compressed = true;
-    
-        compression_block newbl;
-        size_t bs = blocks.size();
-        newbl.old_ofs = ofs;
-        newbl.new_ofs = bs > 0 ? blocks[bs-1].len + blocks[bs-1].new_ofs : 0;
-        newbl.len = in_bl.length();
-        blocks.push_back(newbl);
+        add_block(ofs, in_bl.length());
       }
     } else {
       compressed = false;
       in_bl.claim(bl);
     }
     // end of compression stuff
+  } else {
+    // only the flush at the end of the object, past the last part, waits
+    // for all of it to be passed on
+    int r = collect(ofs == end_ofs, &in_bl);
+    if (r < 0) {
+      return r;
+    }
   }
   return next->handle_data(in_bl, ofs, phandle, pobj, again);
 }
@@ -61,6 +184,7 @@ RGWGetObj_Decompress::RGWGetObj_Decompress(CephContext* cct_,
                                                                 q_len(0),
                                                                 cur_ofs(0)
 {
+  work_queue = get_compression_work_queue(cct);
   compressor = Compressor::create(cct, cs_info->compression_type);
   if (!compressor.get())
     lderr(cct) << "Cannot load compressor of type " << cs_info->compression_type << dendl;
@@ -76,36 +200,41 @@ int RGWGetObj_Decompress::handle_data(bufferlist& bl, off_t bl_ofs, off_t bl_len
     lderr(cct) << "Cannot load compressor of type " << cs_info->compression_type << dendl;
     return -EIO;
   }
-  bufferlist out_bl, in_bl, temp_in_bl;
-  bl.copy(bl_ofs, bl_len, temp_in_bl); 
+  // the blocks are cut out of the input by reference, nothing is copied
+  // before it is decompressed
+  bufferlist out_bl, in_bl;
+  in_bl.claim(waiting);
+  {
+    bufferlist tmp;
+    tmp.substr_of(bl, bl_ofs, bl_len);
+    in_bl.claim_append(tmp);
+  }
   bl_ofs = 0;
   int r = 0;
-  if (waiting.length() != 0) {
-    in_bl.append(waiting);
-    in_bl.append(temp_in_bl);        
-    waiting.clear();
-  } else {
-    in_bl.claim(temp_in_bl);
-  }
   bl_len = in_bl.length();
-  
-  while (first_block <= last_block) {
-    bufferlist tmp;
+
+  std::vector<bufferlist> compressed;
+  for (; first_block <= last_block; ++first_block) {
     off_t ofs_in_bl = first_block->new_ofs - cur_ofs;
     if (ofs_in_bl + (off_t)first_block->len > bl_len) {
       // not complete block, put it to waiting
       unsigned tail = bl_len - ofs_in_bl;
-      in_bl.copy(ofs_in_bl, tail, waiting);
+      waiting.substr_of(in_bl, ofs_in_bl, tail);
       cur_ofs -= tail;
       break;
     }
-    in_bl.copy(ofs_in_bl, first_block->len, tmp);
-    int cr = compressor->decompress(tmp, out_bl);
-    if (cr < 0) {
-      lderr(cct) << "Compression failed with exit code " << cr << dendl;
-      return cr;
-    }
-    ++first_block;
+    compressed.emplace_back();
+    compressed.back().substr_of(in_bl, ofs_in_bl, first_block->len);
+  }
+
+  std::vector<bufferlist> decompressed;
+  int cr = decompress_blocks(compressed, decompressed);
+  if (cr < 0) {
+    lderr(cct) << "Compression failed with exit code " << cr << dendl;
+    return cr;
+  }
+  for (auto& block : decompressed) {
+    out_bl.claim_append(block);
     while (out_bl.length() - q_ofs >= cct->_conf->rgw_max_chunk_size)
     {
       off_t ch_len = std::min<off_t>(cct->_conf->rgw_max_chunk_size, q_len);
@@ -135,6 +264,50 @@ int RGWGetObj_Decompress::handle_data(bufferlist& bl, off_t bl_ofs, off_t bl_len
   return r;
 }
 
+// the blocks of one call are decompressed at once on the compression
+// threads, if any, before the first of them is passed on
+int RGWGetObj_Decompress::decompress_blocks(const std::vector<bufferlist>& in,
+                                            std::vector<bufferlist>& out)
+{
+  if (!work_queue || in.size() < 2) {
+    std::vector<const bufferlist*> pin;
+    for (auto& bl : in) {
+      pin.push_back(&bl);
+    }
+    return compressor->decompress_batch(pin, out);
+  }
+
+  // shared with the threads, the last of which may still hold the lock
+  // when this returns
+  struct Batch {
+    Mutex lock{"RGWGetObj_Decompress::Batch::lock"};
+    Cond cond;
+    size_t pending;
+    int r = 0;
+  };
+  auto batch = std::make_shared<Batch>();
+  batch->pending = in.size();
+  out.resize(in.size());
+  for (size_t i = 0; i < in.size(); ++i) {
+    work_queue->queue(new FunctionContext(
+      [batch, c = compressor, &in, &out, i](int) {
+        int r = c->decompress(in[i], out[i]);
+        Mutex::Locker l(batch->lock);
+        if (r < 0 && batch->r == 0) {
+          batch->r = r;
+        }
+        if (--batch->pending == 0) {
+          batch->cond.Signal();
+        }
+      }));
+  }
+  Mutex::Locker l(batch->lock);
+  while (batch->pending) {
+    batch->cond.Wait(batch->lock);
+  }
+  return batch->r;
+}
+
 int RGWGetObj_Decompress::fixup_range(off_t& ofs, off_t& end)
 {
   if (partial_content) {
@@ -4,11 +4,17 @@
 #ifndef CEPH_RGW_COMPRESSION_H
 #define CEPH_RGW_COMPRESSION_H
 
+#include <deque>
+#include <memory>
 #include <vector>
 
+#include "common/Cond.h"
+#include "common/Mutex.h"
 #include "compressor/Compressor.h"
 #include "rgw_op.h"
 
+class ContextWQ;
+
 class RGWGetObj_Decompress : public RGWGetObj_Filter
 {
   CephContext* cct;
@@ -19,6 +25,10 @@ class RGWGetObj_Decompress : public RGWGetObj_Filter
   off_t q_ofs, q_len;
   uint64_t cur_ofs;
   bufferlist waiting;
+  ContextWQ *work_queue = nullptr;   ///< null to decompress inline
+
+  int decompress_blocks(const std::vector<bufferlist>& in,
+                        std::vector<bufferlist>& out);
 public:
   RGWGetObj_Decompress(CephContext* cct_, 
                        RGWCompressionInfo* cs_info_, 
@@ -37,11 +47,28 @@ class RGWPutObj_Compress : public RGWPutObj_Filter
   bool compressed{false};
   CompressorRef compressor;
   std::vector<compression_block> blocks;
+
+  // a part handed to the compression threads
+  struct Job {
+    off_t ofs;
+    bufferlist in, out;
+    int r = 0;
+    bool done = false;
+  };
+  ContextWQ *work_queue = nullptr;   ///< null to compress inline
+  const uint64_t max_inflight;
+  Mutex lock{"RGWPutObj_Compress::lock"};
+  Cond cond;
+  std::deque<std::shared_ptr<Job>> jobs;  ///< in the order of the object
+  off_t end_ofs = 0;                 ///< end of the parts handed to us
+
+  void add_block(off_t ofs, size_t len);
+  void queue_compress(bufferlist& bl, off_t ofs);
+  int collect(bool wait_all, bufferlist *out);
 public:
   RGWPutObj_Compress(CephContext* cct_, CompressorRef compressor,
-                     RGWPutObjDataProcessor* next)
-    : RGWPutObj_Filter(next), cct(cct_), compressor(compressor) {}
-  ~RGWPutObj_Compress() override{}
+                     RGWPutObjDataProcessor* next);
+  ~RGWPutObj_Compress() override;
   int handle_data(bufferlist& bl, off_t ofs, void **phandle, rgw_raw_obj *pobj, bool *again) override;
 
   bool is_compressed() { return compressed; }
@@ -0,0 +1,358 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "common/ceph_argparse.h"
+#include "common/ceph_time.h"
+#include "common/Formatter.h"
+#include "common/strtol.h"
+#include "compressor/Compressor.h"
+#include "global/global_context.h"
+#include "global/global_init.h"
+#include "include/str_list.h"
+
+// heap allocations through operator new made by the current thread; this
+// does not see what the compression libraries malloc() on their own
+static thread_local uint64_t allocs = 0;
+
+void *operator new(size_t size)
+{
+  ++allocs;
+  void *p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+static void usage()
+{
+  cout << "usage: ceph_bench_compressor [flags]\n"
+    "	 --algorithms <alg>[,<alg>...]\n"
+    "	       compressors to run (default: all available)\n"
+    "	 --level <n>\n"
+    "	       compression level (default: the default of the algorithm)\n"
+    "	 --corpus <random|zeros|text|path>[,...]\n"
+    "	       data to compress, a path is repeated as needed (default: random,text)\n"
+    "	 --sizes <bytes>[,...]\n"
+    "	       blob sizes (default: 4K,64K,1M,4M)\n"
+    "	 --fragments <bytes>[,...]\n"
+    "	       size of the buffers the input is split into, 0 for a\n"
+    "	       contiguous buffer (default: 0,4K)\n"
+    "	 --threads <n>[,...]\n"
+    "	       threads sharing one compressor (default: 1)\n"
+    "	 --seconds <n>\n"
+    "	       time spent compressing and decompressing each case (default: 1)\n"
+    "	 --format <json|json-pretty>\n"
+    "	       output format (default: json-pretty)\n" << std::endl;
+  generic_client_usage();
+}
+
+// distinct blobs of each case, so that a loop does not hit the same data
+static constexpr unsigned num_inputs = 8;
+
+static bufferlist make_corpus(const std::string& name, size_t len)
+{
+  bufferlist bl;
+  if (name == "zeros") {
+    bl.append_zero(len);
+    return bl;
+  }
+  std::mt19937_64 rng(len);
+  if (name == "random") {
+    bufferptr p = buffer::create_page_aligned(len);
+    for (size_t i = 0; i < len; ++i) {
+      p[i] = rng();
+    }
+    bl.append(std::move(p));
+    return bl;
+  }
+  if (name == "text") {
+    static const char *words[] = {
+      "object", "placement", "group", "pool", "osd", "monitor", "map",
+      "epoch", "write", "read", "the", "of", "a", "to", "and", "is",
+      "replica", "peering", "scrub", "recovery", "backfill", "blob"
+    };
+    std::string s;
+    s.reserve(len + 16);
+    while (s.size() < len) {
+      s += words[rng() % (sizeof(words) / sizeof(words[0]))];
+      s += (rng() % 12) ? ' ' : '\n';
+    }
+    bl.append(s.data(), len);
+    return bl;
+  }
+  bufferlist file;
+  std::string err;
+  if (file.read_file(name.c_str(), &err) < 0 || file.length() == 0) {
+    cerr << "can't read corpus " << name << ": " << err << std::endl;
+    return bl;
+  }
+  while (bl.length() < len) {
+    bl.append(file);
+  }
+  bl.splice(len, bl.length() - len);
+  return bl;
+}
+
+// copy len bytes at off of src into buffers of frag bytes each
+static bufferlist fragment(const bufferlist& src, size_t off, size_t len,
+			   size_t frag)
+{
+  bufferlist bl;
+  if (!frag) {
+    frag = len;
+  }
+  for (size_t pos = 0; pos < len; pos += frag) {
+    size_t l = std::min(frag, len - pos);
+    bufferptr p = buffer::create(l);
+    src.copy(off + pos, l, p.c_str());
+    bl.append(std::move(p));
+  }
+  return bl;
+}
+
+struct Stats {
+  uint64_t bytes = 0;
+  uint64_t allocs = 0;
+  std::vector<uint64_t> lat;	///< per op, in ns
+  double elapsed = 0;
+  int r = 0;
+
+  void merge(const Stats& o) {
+    bytes += o.bytes;
+    allocs += o.allocs;
+    lat.insert(lat.end(), o.lat.begin(), o.lat.end());
+    if (!r)
+      r = o.r;
+  }
+
+  double percentile(double p) const {
+    if (lat.empty())
+      return 0;
+    return lat[std::min<size_t>(lat.size() * p, lat.size() - 1)];
+  }
+
+  void dump(Formatter *f) {
+    std::sort(lat.begin(), lat.end());
+    f->dump_unsigned("ops", lat.size());
+    f->dump_float("mb_per_sec", elapsed ? bytes / elapsed / (1 << 20) : 0);
+    f->dump_float("p50_us", percentile(.5) / 1000);
+    f->dump_float("p99_us", percentile(.99) / 1000);
+    f->dump_float("allocs_per_op",
+		  lat.empty() ? 0 : (double)allocs / lat.size());
+    if (r)
+      f->dump_int("error", r);
+  }
+};
+
+// run op on each of threads until seconds elapsed, op returns the
+// (uncompressed) bytes it processed or a negative error
+template<typename Op>
+static Stats run(unsigned threads, double seconds, Op&& op)
+{
+  std::vector<Stats> stats(threads);
+  std::vector<std::thread> workers;
+  auto start = mono_clock::now();
+  auto end = start + make_timespan(seconds);
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      auto& s = stats[t];
+      for (unsigned n = t; n == t || mono_clock::now() < end; ++n) {
+	uint64_t a = allocs;
+	auto op_start = mono_clock::now();
+	int r = op(n % num_inputs);
+	auto lat = mono_clock::now() - op_start;
+	s.allocs += allocs - a;
+	if (r < 0) {
+	  s.r = r;
+	  break;
+	}
+	s.bytes += r;
+	s.lat.push_back(
+	  std::chrono::duration_cast<std::chrono::nanoseconds>(lat).count());
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  Stats total;
+  total.elapsed = std::chrono::duration<double>(mono_clock::now() - start).count();
+  for (auto& s : stats) {
+    total.merge(s);
+  }
+  return total;
+}
+
+static bool parse_sizes(const std::string& val, std::vector<size_t> *sizes)
+{
+  sizes->clear();
+  for (auto& s : get_str_list(val, ",")) {
+    std::string err;
+    long long v = strict_iecstrtoll(s.c_str(), &err);
+    if (!err.empty() || v < 0) {
+      cerr << "error parsing size " << s << ": " << err << std::endl;
+      return false;
+    }
+    sizes->push_back(v);
+  }
+  return !sizes->empty();
+}
+
+int main(int argc, const char *argv[])
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  if (ceph_argparse_need_usage(args)) {
+    usage();
+    exit(0);
+  }
+
+  auto cct = global_init(nullptr, args, CEPH_ENTITY_TYPE_CLIENT,
+			 CODE_ENVIRONMENT_UTILITY,
+			 CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+
+  std::list<std::string> algorithms;
+  for (auto& a : Compressor::compression_algorithms) {
+    if (a.second != Compressor::COMP_ALG_NONE)
+      algorithms.push_back(a.first);
+  }
+  boost::optional<int> level;
+  std::list<std::string> corpora = {"random", "text"};
+  std::vector<size_t> sizes = {4096, 65536, 1 << 20, 4 << 20};
+  std::vector<size_t> fragments = {0, 4096};
+  std::vector<size_t> threads = {1};
+  double seconds = 1;
+  std::string format = "json-pretty";
+
+  std::string val;
+  for (auto i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &val, "--algorithms", (char*)nullptr)) {
+      algorithms = get_str_list(val, ",");
+    } else if (ceph_argparse_witharg(args, i, &val, "--level", (char*)nullptr)) {
+      level = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--corpus", (char*)nullptr)) {
+      corpora = get_str_list(val, ",");
+    } else if (ceph_argparse_witharg(args, i, &val, "--sizes", (char*)nullptr)) {
+      if (!parse_sizes(val, &sizes))
+	exit(1);
+    } else if (ceph_argparse_witharg(args, i, &val, "--fragments", (char*)nullptr)) {
+      if (!parse_sizes(val, &fragments))
+	exit(1);
+    } else if (ceph_argparse_witharg(args, i, &val, "--threads", (char*)nullptr)) {
+      if (!parse_sizes(val, &threads))
+	exit(1);
+    } else if (ceph_argparse_witharg(args, i, &val, "--seconds", (char*)nullptr)) {
+      seconds = atof(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--format", (char*)nullptr)) {
+      format = val;
+    } else {
+      cerr << "unknown argument: " << *i << std::endl;
+      exit(1);
+    }
+  }
+  common_init_finish(g_ceph_context);
+
+  size_t max_size = *std::max_element(sizes.begin(), sizes.end());
+  std::map<std::string, bufferlist> corpus;
+  for (auto& name : corpora) {
+    corpus[name] = make_corpus(name, max_size * num_inputs);
+    if (corpus[name].length() == 0)
+      exit(1);
+  }
+
+  std::unique_ptr<Formatter> f(Formatter::create(format, "json-pretty"));
+  f->open_array_section("results");
+  for (auto& alg : algorithms) {
+    CompressorRef c = Compressor::create(g_ceph_context, alg, level);
+    if (!c) {
+      cerr << "compressor " << alg << " is not available" << std::endl;
+      continue;
+    }
+    for (auto& name : corpora) {
+      for (auto size : sizes) {
+	for (auto frag : fragments) {
+	  // inputs, and their compressed form split the same way
+	  std::vector<bufferlist> in, cin;
+	  uint64_t clen = 0;
+	  int r = 0;
+	  for (unsigned i = 0; i < num_inputs && !r; ++i) {
+	    in.push_back(fragment(corpus[name], i * size, size, frag));
+	    bufferlist out, check;
+	    r = c->compress(in.back(), out);
+	    if (!r)
+	      r = c->decompress(out, check);
+	    if (!r && !check.contents_equal(in.back()))
+	      r = -EIO;
+	    clen += out.length();
+	    cin.push_back(fragment(out, 0, out.length(), frag));
+	  }
+	  for (auto t : threads) {
+	    f->open_object_section("result");
+	    f->dump_string("algorithm", alg);
+	    if (level)
+	      f->dump_int("level", *level);
+	    f->dump_string("corpus", name);
+	    f->dump_unsigned("size", size);
+	    f->dump_unsigned("fragment", frag);
+	    f->dump_unsigned("threads", t);
+	    if (r) {
+	      f->dump_int("error", r);
+	      f->close_section();
+	      continue;
+	    }
+	    f->dump_float("ratio", (double)clen / (size * num_inputs));
+
+	    Stats cs = run(t, seconds, [&](unsigned i) {
+	      bufferlist out;
+	      int r = c->compress(in[i], out);
+	      return r < 0 ? r : (int)in[i].length();
+	    });
+	    f->open_object_section("compress");
+	    cs.dump(f.get());
+	    f->close_section();
+
+	    Stats ds = run(t, seconds, [&](unsigned i) {
+	      bufferlist out;
+	      int r = c->decompress(cin[i], out);
+	      return r < 0 ? r : (int)out.length();
+	    });
+	    f->open_object_section("decompress");
+	    ds.dump(f.get());
+	    f->close_section();
+
+	    f->close_section();
+	    f->flush(cout);
+	  }
+	}
+      }
+    }
+  }
+  f->close_section();
+  f->flush(cout);
+  cout << std::endl;
+  return 0;
+}
@@ -27,7 +27,8 @@ public:
   {}
 
   int factory(CompressorRef *cs,
-		      ostream *ss) override
+		      ostream *ss,
+		      boost::optional<int> level) override
   {
     if (compressor == 0) {
       CompressorExample *interface = new CompressorExample();
@@ -17,11 +17,14 @@
 #include <errno.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <thread>
 #include "gtest/gtest.h"
 #include "common/ceph_context.h"
 #include "common/config.h"
+#include "compressor/CompressedWrite.h"
 #include "compressor/Compressor.h"
 #include "compressor/CompressionPlugin.h"
+#include "include/stringify.h"
 #include "global/global_context.h"
 
 class CompressorTest : public ::testing::Test,
@@ -237,6 +240,400 @@ TEST_P(CompressorTest, sharded_input_decompress)
   EXPECT_EQ(res, 0);
 }
 
+TEST_P(CompressorTest, fragmented_input_round_trip)
+{
+  bufferlist orig;
+  for (unsigned i = 0; i < 16384; ++i)
+    orig.append(stringify(i * 2654435761u % 100000) + " ");
+  // several input buffers, so that lz4 compresses several chunks
+  bufferlist in;
+  for (unsigned off = 0; off < orig.length(); off += 20000) {
+    bufferlist tmp;
+    tmp.substr_of(orig, off, std::min<unsigned>(20000, orig.length() - off));
+    in.append(buffer::copy(tmp.c_str(), tmp.length()));
+  }
+  bufferlist out;
+  EXPECT_EQ(0, compressor->compress(in, out));
+
+  // odd sized shards, so that chunks and headers straddle buffers
+  for (size_t shard : {1, 7, 1000, 4096}) {
+    bufferlist sharded;
+    for (size_t off = 0; off < out.length(); off += shard) {
+      size_t l = std::min(shard, out.length() - off);
+      sharded.append(buffer::copy(out.c_str() + off, l));
+    }
+    // trailing data is not part of the compressed blob
+    sharded.append("trailer");
+    bufferlist after;
+    auto p = std::cbegin(sharded);
+    EXPECT_EQ(0, compressor->decompress(p, out.length(), after));
+    EXPECT_TRUE(orig.contents_equal(after)) << "shard " << shard;
+  }
+}
+
+TEST_P(CompressorTest, decompress_into)
+{
+  bufferlist orig;
+  for (unsigned i = 0; i < 8192; ++i)
+    orig.append(stringify(i * 2654435761u % 100000) + " ");
+  bufferlist out;
+  EXPECT_EQ(0, compressor->compress(orig, out));
+
+  // room to spare
+  std::unique_ptr<char[]> dst(new char[orig.length() + 100]);
+  auto p = std::cbegin(out);
+  EXPECT_EQ((int)orig.length(),
+	    compressor->decompress_into(p, out.length(), dst.get(),
+					orig.length() + 100));
+  bufferlist after;
+  after.append(dst.get(), orig.length());
+  EXPECT_TRUE(orig.contents_equal(after));
+
+  // too small
+  p = std::cbegin(out);
+  EXPECT_EQ(-ENOSPC,
+	    compressor->decompress_into(p, out.length(), dst.get(),
+					orig.length() / 2));
+}
+
+TEST_P(CompressorTest, dictionary_round_trip)
+{
+  // small records sharing their structure, like rgw index entries
+  auto record = [](unsigned i) {
+    bufferlist bl;
+    for (unsigned j = 0; j < 32; ++j) {
+      bl.append("{\"bucket\": \"photos\", \"key\": \"2018/" +
+		stringify((i * 31 + j) % 997) + ".jpg\", \"size\": " +
+		stringify((i * 7919 + j * 104729) % 1000000) +
+		", \"etag\": \"" + stringify(i * 2654435761u + j) + "\"}\n");
+    }
+    return bl;
+  };
+  std::vector<bufferlist> samples;
+  for (unsigned i = 0; i < 500; ++i) {
+    samples.push_back(record(i));
+  }
+  bufferlist dict;
+  int r = compressor->train_dictionary(samples, 16384, &dict);
+  if (r == -EOPNOTSUPP) {
+    EXPECT_FALSE(compressor->with_dictionary(dict));
+    return;
+  }
+  ASSERT_EQ(0, r);
+  ASSERT_GT(dict.length(), 0u);
+  CompressorRef dc = compressor->with_dictionary(dict);
+  ASSERT_TRUE(dc);
+  EXPECT_EQ(compressor->get_type(), dc->get_type());
+
+  bufferlist orig = record(1000);
+  bufferlist plain, with_dict;
+  EXPECT_EQ(0, compressor->compress(orig, plain));
+  EXPECT_EQ(0, dc->compress(orig, with_dict));
+  EXPECT_LT(with_dict.length(), plain.length());
+
+  bufferlist after;
+  EXPECT_EQ(0, dc->decompress(with_dict, after));
+  EXPECT_TRUE(orig.contents_equal(after));
+  // it takes the dictionary to decompress it
+  after.clear();
+  EXPECT_NE(0, compressor->decompress(with_dict, after));
+}
+
+TEST_P(CompressorTest, concurrent_round_trip)
+{
+  // compressors are shared by all users of a plugin, so calls from
+  // several threads have to be independent of each other
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < 8; ++t) {
+    threads.emplace_back([this, t] {
+      for (unsigned i = 0; i < 50; ++i) {
+	bufferlist orig;
+	unsigned len = 4096 << ((t + i) % 5);
+	while (orig.length() < len) {
+	  orig.append(stringify(t * 1000 + i) + " is a short string. ");
+	}
+	bufferlist compressed;
+	EXPECT_EQ(0, compressor->compress(orig, compressed));
+	bufferlist decompressed;
+	EXPECT_EQ(0, compressor->decompress(compressed, decompressed));
+	EXPECT_TRUE(decompressed.contents_equal(orig));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+TEST_P(CompressorTest, context_reuse)
+{
+  PerfCounters *logger = compressor->get_perf_counters();
+  ASSERT_TRUE(logger);
+  bufferlist orig;
+  orig.append("This is a short string.  There are many strings like it but this one is mine.");
+  // the first round may create contexts, the following ones run on the
+  // same thread and must not need any new one
+  uint64_t misses = 0;
+  for (unsigned i = 0; i < 4; ++i) {
+    bufferlist compressed, decompressed;
+    ASSERT_EQ(0, compressor->compress(orig, compressed));
+    ASSERT_EQ(0, compressor->decompress(compressed, decompressed));
+    ASSERT_TRUE(decompressed.contents_equal(orig));
+    if (i == 0) {
+      misses = logger->get(l_compressor_ctx_miss);
+    }
+  }
+  EXPECT_EQ(misses, logger->get(l_compressor_ctx_miss));
+}
+
+TEST_P(CompressorTest, batch_round_trip)
+{
+  std::vector<bufferlist> orig(5);
+  std::vector<const bufferlist*> in;
+  for (unsigned i = 0; i < orig.size(); ++i) {
+    while (orig[i].length() < (4096u << i)) {
+      orig[i].append(stringify(i) + " is a short string. ");
+    }
+    in.push_back(&orig[i]);
+  }
+  std::vector<bufferlist> compressed;
+  ASSERT_EQ(0, compressor->compress_batch(in, compressed));
+  ASSERT_EQ(orig.size(), compressed.size());
+
+  in.clear();
+  for (auto& bl : compressed) {
+    in.push_back(&bl);
+  }
+  std::vector<bufferlist> decompressed;
+  ASSERT_EQ(0, compressor->decompress_batch(in, decompressed));
+  ASSERT_EQ(orig.size(), decompressed.size());
+  for (unsigned i = 0; i < orig.size(); ++i) {
+    EXPECT_TRUE(decompressed[i].contents_equal(orig[i]));
+  }
+}
+
+TEST_P(CompressorTest, compressed_write_round_trip)
+{
+  // compressible, then random, starting off a segment boundary
+  const uint64_t segment_size = 16384;
+  const uint64_t offset = segment_size + 100;
+  bufferlist orig;
+  while (orig.length() < segment_size * 2) {
+    orig.append("This is a short string.  There are many strings like it but this one is mine.");
+  }
+  bufferptr random(segment_size * 2);
+  for (unsigned i = 0; i < random.length(); ++i) {
+    random.c_str()[i] = rand();
+  }
+  orig.append(random);
+
+  compressed_write_t cw;
+  unsigned n = cw.compress(compressor.get(), offset, orig, segment_size, .875);
+  ASSERT_TRUE(cw.is_valid());
+  ASSERT_EQ(orig.length(), cw.get_length());
+  ASSERT_EQ(5u, cw.segments.size());
+  uint64_t pos = offset;
+  for (auto& s : cw.segments) {
+    pos += s.length;
+    if (&s != &cw.segments.back()) {
+      EXPECT_EQ(0u, pos % segment_size);
+    }
+  }
+  EXPECT_LT(0u, n);
+  EXPECT_GT(cw.segments.size(), n);
+  EXPECT_EQ(Compressor::COMP_ALG_NONE, cw.segments.back().alg);
+  EXPECT_GT(orig.length(), cw.data.length());
+
+  bufferlist bl;
+  encode(cw, bl);
+  compressed_write_t decoded;
+  auto p = bl.cbegin();
+  decode(decoded, p);
+  bufferlist decompressed;
+  ASSERT_EQ(0, decoded.decompress(g_ceph_context, &decompressed));
+  EXPECT_TRUE(decompressed.contents_equal(orig));
+
+  // a segment decompresses to no more than the length it claims
+  for (auto& s : decoded.segments) {
+    if (s.alg != Compressor::COMP_ALG_NONE) {
+      s.length /= 2;
+      break;
+    }
+  }
+  decompressed.clear();
+  EXPECT_GT(0, decoded.decompress(g_ceph_context, &decompressed));
+}
+
+TEST_P(CompressorTest, compressed_write_payload)
+{
+  const uint64_t segment_size = 16384;
+  bufferlist orig;
+  while (orig.length() < segment_size * 4) {
+    orig.append("This is a short string.  There are many strings like it but this one is mine.");
+  }
+  orig.splice(segment_size * 4, orig.length() - segment_size * 4);
+  compressed_write_t cw;
+  ASSERT_LT(0u, cw.compress(compressor.get(), 0, orig, segment_size, .875));
+  auto payload = [](const compressed_write_t& cw) {
+    bufferlist bl;
+    encode(cw, bl);
+    return bl;
+  };
+
+  compressed_write_t decoded;
+  bufferlist out;
+  ASSERT_EQ(0, decoded.decode_payload(g_ceph_context, payload(cw),
+				      orig.length(), 0, &out));
+  EXPECT_TRUE(out.contents_equal(orig));
+  out.clear();
+  ASSERT_EQ(0, decoded.decode_payload(g_ceph_context, payload(cw),
+				      orig.length(), orig.length(), &out));
+  EXPECT_TRUE(out.contents_equal(orig));
+
+  // longer than a write may be
+  out.clear();
+  EXPECT_EQ(-E2BIG, decoded.decode_payload(g_ceph_context, payload(cw),
+					   orig.length(), orig.length() - 1,
+					   &out));
+  // not what the op writes
+  EXPECT_EQ(-EINVAL, decoded.decode_payload(g_ceph_context, payload(cw),
+					    orig.length() + 1, 0, &out));
+  // not a compressed_write_t at all
+  {
+    bufferlist bl;
+    bl.substr_of(payload(cw), 0, 10);
+    EXPECT_EQ(-EINVAL, decoded.decode_payload(g_ceph_context, bl,
+					      orig.length(), 0, &out));
+    EXPECT_EQ(-EINVAL, decoded.decode_payload(g_ceph_context, orig,
+					      orig.length(), 0, &out));
+  }
+  // an algorithm nobody knows
+  {
+    compressed_write_t bad = cw;
+    bad.segments.front().alg = Compressor::COMP_ALG_LAST;
+    EXPECT_EQ(-EINVAL, decoded.decode_payload(g_ceph_context, payload(bad),
+					      orig.length(), 0, &out));
+  }
+  // a segment which decompresses to less than it claims, and one which
+  // would decompress to more
+  for (int factor : {2, -2}) {
+    compressed_write_t bad = cw;
+    for (auto& s : bad.segments) {
+      if (s.alg != Compressor::COMP_ALG_NONE) {
+	s.length = factor > 0 ? s.length * factor : s.length / -factor;
+	break;
+      }
+    }
+    out.clear();
+    EXPECT_EQ(-EINVAL, decoded.decode_payload(g_ceph_context, payload(bad),
+					      bad.get_length(), 0, &out));
+    EXPECT_EQ(0u, out.length());
+  }
+  // an algorithm this host has no plugin for, if there is one
+  for (int alg = Compressor::COMP_ALG_NONE + 1;
+       alg < Compressor::COMP_ALG_LAST; ++alg) {
+    if (Compressor::create(g_ceph_context, alg)) {
+      continue;
+    }
+    compressed_write_t bad = cw;
+    bad.segments.front().alg = alg;
+    EXPECT_EQ(-EOPNOTSUPP, decoded.decode_payload(g_ceph_context,
+						  payload(bad),
+						  orig.length(), 0, &out));
+    break;
+  }
+}
+
+TEST_P(CompressorTest, level_round_trip)
+{
+  EXPECT_FALSE(compressor->get_level());
+  bufferlist orig;
+  while (orig.length() < 65536) {
+    orig.append("This is a short string.  There are many strings like it but this one is mine.");
+  }
+  for (int level : {1, 3, 9}) {
+    CompressorRef c = Compressor::create(g_ceph_context, plugin, level);
+    ASSERT_TRUE(c);
+    EXPECT_EQ(level, c->get_level());
+    EXPECT_EQ(c, Compressor::create(g_ceph_context, plugin, level));
+    EXPECT_NE(compressor, c);
+    bufferlist compressed, decompressed;
+    ASSERT_EQ(0, c->compress(orig, compressed));
+    // the level only matters when compressing
+    ASSERT_EQ(0, compressor->decompress(compressed, decompressed));
+    EXPECT_TRUE(decompressed.contents_equal(orig));
+  }
+
+  // levels beyond those of the algorithm are brought within them
+  int min, max;
+  auto alg = Compressor::get_comp_alg_type(plugin);
+  if (alg && Compressor::get_level_range(*alg, &min, &max)) {
+    CompressorRef c = Compressor::create(g_ceph_context, plugin, max + 1);
+    ASSERT_TRUE(c);
+    EXPECT_EQ(max, c->get_level());
+    bufferlist compressed, decompressed;
+    ASSERT_EQ(0, c->compress(orig, compressed));
+    ASSERT_EQ(0, compressor->decompress(compressed, decompressed));
+    EXPECT_TRUE(decompressed.contents_equal(orig));
+  }
+}
+
+TEST_P(CompressorTest, stream_round_trip)
+{
+  CompressionStreamRef cs = compressor->begin_compress();
+  if (!cs) {
+    EXPECT_FALSE(compressor->begin_decompress());
+    return;
+  }
+  // an object arriving in chunks which repeat earlier ones
+  std::vector<bufferlist> chunks(64);
+  bufferlist orig;
+  for (unsigned i = 0; i < chunks.size(); ++i) {
+    while (chunks[i].length() < 4096) {
+      chunks[i].append(stringify(i % 8) + " is a short string. ");
+    }
+    orig.append(chunks[i]);
+  }
+  bufferlist streamed;
+  size_t separate = 0, flushed_len = 0;
+  for (unsigned i = 0; i < chunks.size(); ++i) {
+    ASSERT_EQ(0, cs->feed(chunks[i], streamed));
+    if (i == 15) {
+      ASSERT_EQ(0, cs->flush(streamed));
+      flushed_len = streamed.length();
+    }
+    bufferlist compressed;
+    ASSERT_EQ(0, compressor->compress(chunks[i], compressed));
+    separate += compressed.length();
+  }
+  ASSERT_EQ(0, cs->finish(streamed));
+  EXPECT_NE(0, cs->feed(chunks[0], streamed));
+  // later chunks refer back to earlier ones
+  EXPECT_LT(streamed.length(), separate);
+
+  // whatever is cut from the stream
+  DecompressionStreamRef ds = compressor->begin_decompress();
+  ASSERT_TRUE(ds);
+  EXPECT_EQ(-EIO, ds->finish());
+  bufferlist decompressed;
+  for (unsigned off = 0; off < streamed.length(); off += 7) {
+    bufferlist piece;
+    piece.substr_of(streamed, off, std::min(7u, streamed.length() - off));
+    ASSERT_EQ(0, ds->feed(piece, decompressed));
+  }
+  EXPECT_EQ(0, ds->finish());
+  EXPECT_TRUE(decompressed.contents_equal(orig));
+
+  // a flush makes all that was fed before it decompressible
+  ds = compressor->begin_decompress();
+  bufferlist flushed, head, expected;
+  flushed.substr_of(streamed, 0, flushed_len);
+  ASSERT_EQ(0, ds->feed(flushed, head));
+  EXPECT_EQ(-EIO, ds->finish());
+  expected.substr_of(orig, 0, 16 * 4096);
+  EXPECT_TRUE(head.contents_equal(expected));
+}
+
 void test_compress(CompressorRef compressor, size_t size)
 {
   char* data = (char*) malloc(size);
@@ -399,7 +796,7 @@ TEST(CompressionPlugin, all)
   factory = dynamic_cast<CompressionPlugin*>(reg->get_with_load("compressor", "example"));
   ASSERT_TRUE(factory);
   stringstream ss;
-  EXPECT_EQ(0, factory->factory(&compressor, &ss));
+  EXPECT_EQ(0, factory->factory(&compressor, &ss, boost::none));
   EXPECT_TRUE(compressor.get());
   {
     Mutex::Locker l(reg->lock);
@@ -409,6 +806,23 @@ TEST(CompressionPlugin, all)
   }
 }
 
+TEST(Compressor, estimate_ratio)
+{
+  bufferlist random, text, empty;
+  random.append(buffer::create(65536));
+  char *p = random.c_str();
+  for (unsigned i = 0; i < random.length(); ++i)
+    p[i] = rand();
+  for (unsigned i = 0; i < 2048; ++i)
+    text.append("the quick brown fox jumps over the lazy dog ");
+
+  EXPECT_GT(Compressor::estimate_ratio(random, 4096), .95);
+  EXPECT_LT(Compressor::estimate_ratio(text, 4096), .7);
+  // the sample may exceed the data
+  EXPECT_LT(Compressor::estimate_ratio(text, 1 << 20), .7);
+  EXPECT_EQ(1.0, Compressor::estimate_ratio(empty, 4096));
+}
+
 #ifdef __x86_64__
 
 TEST(ZlibCompressor, isal_compress_zlib_decompress_random)
@@ -415,6 +415,50 @@ TEST_F(LibRadosIoPP, WriteFullRoundTripPP2)
   ASSERT_EQ(0, memcmp(bl.c_str(), "ceph", 4));
 }
 
+TEST_F(LibRadosIoPP, CompressRoundTripPP)
+{
+  // compressible, and large enough for the client to compress it
+  bufferlist bl;
+  while (bl.length() < 256 * 1024) {
+    bl.append("ceph compresses this line, " + std::to_string(bl.length() % 100) +
+	      " times over\n");
+  }
+  ObjectWriteOperation write_full;
+  write_full.write_full(bl);
+  write_full.set_op_flags2(LIBRADOS_OP_FLAG_COMPRESS);
+  ASSERT_EQ(0, ioctx.operate("foo", &write_full));
+
+  // and over part of it, off any segment boundary
+  bufferlist part;
+  part.substr_of(bl, 1000, 100 * 1024);
+  ObjectWriteOperation write;
+  write.write(12345, part);
+  write.set_op_flags2(LIBRADOS_OP_FLAG_COMPRESS);
+  ASSERT_EQ(0, ioctx.operate("foo", &write));
+
+  bufferlist expected;
+  expected.substr_of(bl, 0, 12345);
+  expected.append(part);
+  bufferlist tail;
+  tail.substr_of(bl, 12345 + part.length(),
+		 bl.length() - 12345 - part.length());
+  expected.append(tail);
+  bufferlist out;
+  ASSERT_EQ((int)bl.length(), ioctx.read("foo", out, bl.length() * 2, 0));
+  ASSERT_TRUE(expected.contents_equal(out));
+
+  // too small to compress goes as it is
+  bufferlist small;
+  small.append("ceph");
+  ObjectWriteOperation write_small;
+  write_small.write(0, small);
+  write_small.set_op_flags2(LIBRADOS_OP_FLAG_COMPRESS);
+  ASSERT_EQ(0, ioctx.operate("foo", &write_small));
+  out.clear();
+  ASSERT_EQ(4, ioctx.read("foo", out, 4, 0));
+  ASSERT_EQ(0, memcmp(out.c_str(), "ceph", 4));
+}
+
 TEST_F(LibRadosIo, AppendRoundTrip) {
   char buf[64];
   char buf2[64];
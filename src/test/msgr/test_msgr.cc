@@ -1251,6 +1251,42 @@ TEST_P(MessengerTest, SyntheticStressTest1) {
 }
 
 
+TEST_P(MessengerTest, SyntheticCompressTest) {
+  // the payloads are mostly zeros, most of them go compressed
+  g_ceph_context->_conf.set_val("ms_compress_mode", "all");
+  g_ceph_context->_conf.set_val("ms_compress_algorithm", "zlib");
+  g_ceph_context->_conf.set_val("ms_inject_socket_failures", "30");
+  SyntheticWorkload test_msg(8, 32, GetParam(), 100,
+                             Messenger::Policy::stateful_server(0),
+                             Messenger::Policy::lossless_client(0));
+  for (int i = 0; i < 100; ++i) {
+    if (!(i % 10)) lderr(g_ceph_context) << "seeding connection " << i << dendl;
+    test_msg.generate_connection();
+  }
+  gen_type rng(time(NULL));
+  for (int i = 0; i < 1000; ++i) {
+    if (!(i % 10)) {
+      lderr(g_ceph_context) << "Op " << i << ": " << dendl;
+      test_msg.print_internal_state();
+    }
+    boost::uniform_int<> true_false(0, 99);
+    int val = true_false(rng);
+    if (val > 90) {
+      test_msg.generate_connection();
+    } else if (val > 80) {
+      test_msg.drop_connection();
+    } else if (val > 10) {
+      test_msg.send_message();
+    } else {
+      usleep(rand() % 500 + 100);
+    }
+  }
+  test_msg.wait_for_done();
+  g_ceph_context->_conf.set_val("ms_inject_socket_failures", "0");
+  g_ceph_context->_conf.set_val("ms_compress_algorithm", "snappy");
+  g_ceph_context->_conf.set_val("ms_compress_mode", "none");
+}
+
 TEST_P(MessengerTest, SyntheticInjectTest) {
   uint64_t dispatch_throttle_bytes = g_ceph_context->_conf->ms_dispatch_throttle_bytes;
   g_ceph_context->_conf.set_val("ms_inject_socket_failures", "30");
@@ -34,6 +34,7 @@
 #include "global/global_init.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/ceph_json.h"
 #include "common/errno.h"
 #include "include/stringify.h"
 #include "include/coredumpctl.h"
@@ -1094,6 +1095,73 @@ TEST_P(StoreTest, CompressionTest) {
   SetVal(g_conf(), "bluestore_compression_mode", "aggressive");
   g_ceph_context->_conf.apply_changes(nullptr);
   doCompressionTest();
+
+  // blobs of a write compressed, and those of a read decompressed, in
+  // parallel
+  SetVal(g_conf(), "bluestore_compression_threads", "2");
+  g_ceph_context->_conf.apply_changes(nullptr);
+  doCompressionTest();
+  SetVal(g_conf(), "bluestore_compression_threads", "0");
+  g_ceph_context->_conf.apply_changes(nullptr);
+
+  SetVal(g_conf(), "bluestore_compression_mode", "adaptive");
+  g_ceph_context->_conf.apply_changes(nullptr);
+  doCompressionTest();
+
+  // blobs compressed in chunks, reads decompress only what they need
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  SetVal(g_conf(), "bluestore_compression_chunk_size", "16384");
+  g_ceph_context->_conf.apply_changes(nullptr);
+  doCompressionTest();
+
+  // cache hits decompressed from blobs cached in compressed form
+  SetVal(g_conf(), "bluestore_cache_compressed", "true");
+  g_ceph_context->_conf.apply_changes(nullptr);
+  {
+    coll_t cid;
+    ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+    auto ch = store->create_new_collection(cid);
+    bufferlist data;
+    while (data.length() < 131072) {
+      data.append("line " + stringify(data.length() % 1000) + "\n");
+    }
+    {
+      ObjectStore::Transaction t;
+      t.create_collection(cid, 0);
+      t.write(cid, hoid, 0, data.length(), data);
+      int r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+    // nothing cached after a remount; the first read caches it compressed
+    ch.reset();
+    ASSERT_EQ(0, store->umount());
+    ASSERT_EQ(0, store->mount());
+    ch = store->open_collection(cid);
+    const PerfCounters* logger = store->get_perf_counters();
+    bufferlist bl;
+    ASSERT_EQ((int)data.length(), store->read(ch, hoid, 0, data.length(), bl));
+    ASSERT_TRUE(bl_eq(data, bl));
+    uint64_t hits = logger->get(l_bluestore_buffer_compressed_hit_bytes);
+    uint64_t misses = logger->get(l_bluestore_buffer_miss_bytes);
+    bl.clear();
+    ASSERT_EQ((int)data.length(), store->read(ch, hoid, 0, data.length(), bl));
+    ASSERT_TRUE(bl_eq(data, bl));
+    ASSERT_LT(hits, logger->get(l_bluestore_buffer_compressed_hit_bytes));
+    ASSERT_EQ(misses, logger->get(l_bluestore_buffer_miss_bytes));
+    {
+      ObjectStore::Transaction t;
+      t.remove(cid, hoid);
+      t.remove_collection(cid);
+      int r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  }
+  doCompressionTest();
+  SetVal(g_conf(), "bluestore_compression_chunk_size", "0");
+  g_ceph_context->_conf.apply_changes(nullptr);
+  doCompressionTest();
+  SetVal(g_conf(), "bluestore_cache_compressed", "false");
+  g_ceph_context->_conf.apply_changes(nullptr);
 }
 
 TEST_P(StoreTest, SimpleObjectTest) {
@@ -6977,6 +7045,648 @@ TEST_P(StoreTestSpecificAUSize, garbageCollection) {
   }
 }
 
+TEST_P(StoreTestSpecificAUSize, CompressionDictTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  StartDeferred(4096);
+  SetVal(g_conf(), "bluestore_compression_algorithm", "zstd");
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  // not the level dictionaries are loaded with
+  SetVal(g_conf(), "bluestore_compression_level", "5");
+  g_conf().apply_changes(nullptr);
+
+  BlueStore* bstore = dynamic_cast<BlueStore*>(store.get());
+  ASSERT_TRUE(bstore);
+  const PerfCounters* logger = store->get_perf_counters();
+  int r;
+  int64_t poolid = 7;
+  coll_t cid(spg_t(pg_t(0, poolid), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto oid = [&](unsigned i) {
+    return ghobject_t(hobject_t(object_t("obj" + stringify(i)), "",
+				CEPH_NOSNAP, i, poolid, ""));
+  };
+  auto record = [](unsigned i) {
+    bufferlist bl;
+    for (unsigned j = 0; j < 128; ++j) {
+      bl.append("{\"key\": \"" + stringify((i * 31 + j) % 997) +
+		".jpg\", \"size\": " + stringify((i * 7919 + j) % 100000) +
+		", \"etag\": \"" + stringify(i * 2654435761u + j) + "\"}\n");
+    }
+    return bl;
+  };
+  unsigned num = 200;
+  for (unsigned i = 0; i < num; ++i) {
+    ObjectStore::Transaction t;
+    bufferlist bl = record(i);
+    t.write(cid, oid(i), 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  uint32_t id = 0;
+  ASSERT_EQ(0, bstore->train_compression_dict(poolid, "zstd", num, 16384,
+					      16384, &id));
+  ASSERT_EQ(1u, id);
+  // pools without objects have nothing to train on
+  uint32_t other;
+  ASSERT_EQ(-ENOENT, bstore->train_compression_dict(poolid + 1, "zstd", num,
+						    16384, 16384, &other));
+
+  // written with the dictionary
+  bufferlist expected = record(num);
+  uint64_t dict_count = logger->get(l_bluestore_compress_dict_count);
+  ASSERT_EQ(0u, dict_count);
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, oid(num), 0, expected.length(), expected);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_LT(dict_count, logger->get(l_bluestore_compress_dict_count));
+  {
+    bufferlist bl;
+    r = store->read(ch, oid(num), 0, expected.length(), bl);
+    ASSERT_EQ(r, (int)expected.length());
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+  // dictionaries are loaded again on mount
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+  {
+    bufferlist bl;
+    r = store->read(ch, oid(num), 0, expected.length(), bl);
+    ASSERT_EQ(r, (int)expected.length());
+    ASSERT_TRUE(bl_eq(expected, bl));
+    bl.clear();
+    bufferlist first = record(0);
+    r = store->read(ch, oid(0), 0, first.length(), bl);
+    ASSERT_EQ(r, (int)first.length());
+    ASSERT_TRUE(bl_eq(first, bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    for (unsigned i = 0; i <= num; ++i) {
+      t.remove(cid, oid(i));
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, RecompressionTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  StartDeferred(4096);
+  SetVal(g_conf(), "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  SetVal(g_conf(), "bluestore_recompression_bytes_per_sec", "0");
+  g_conf().apply_changes(nullptr);
+
+  BlueStore* bstore = dynamic_cast<BlueStore*>(store.get());
+  ASSERT_TRUE(bstore);
+  const PerfCounters* logger = store->get_perf_counters();
+  int r;
+  int64_t poolid = 9;
+  coll_t cid(spg_t(pg_t(0, poolid), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto oid = [&](unsigned i) {
+    return ghobject_t(hobject_t(object_t("obj" + stringify(i)), "",
+				CEPH_NOSNAP, i, poolid, ""));
+  };
+  auto data = [](unsigned i) {
+    bufferlist bl;
+    while (bl.length() < 128 * 1024) {
+      bl.append("object " + stringify(i) + " line " +
+		stringify(bl.length() % 1000) + "\n");
+    }
+    bl.splice(128 * 1024, bl.length() - 128 * 1024);
+    return bl;
+  };
+  unsigned num = 4;
+  for (unsigned i = 0; i < num; ++i) {
+    ObjectStore::Transaction t;
+    bufferlist bl = data(i);
+    t.write(cid, oid(i), 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  struct store_statfs_t before;
+  ASSERT_EQ(0, store->statfs(&before));
+
+  // nothing is cold until the onode cache is emptied
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+  {
+    // keep one object hot
+    bufferlist bl;
+    r = store->read(ch, oid(0), 0, 4096, bl);
+    ASSERT_EQ(r, 4096);
+  }
+
+  uint64_t rewritten = logger->get(l_bluestore_recompress_rewritten);
+  bstore->recompress_cold_data();
+  ASSERT_EQ(rewritten, logger->get(l_bluestore_recompress_rewritten));
+
+  SetVal(g_conf(), "bluestore_recompression_algorithm", "zlib");
+  g_conf().apply_changes(nullptr);
+  bstore->recompress_cold_data();
+  ASSERT_EQ(rewritten + num - 1,
+	    logger->get(l_bluestore_recompress_rewritten));
+
+  // already recompressed, and the hot object is skipped even when the
+  // others are cold again
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+  {
+    bufferlist bl;
+    r = store->read(ch, oid(0), 0, 4096, bl);
+    ASSERT_EQ(r, 4096);
+  }
+  uint64_t checked = logger->get(l_bluestore_recompress_objects);
+  bstore->recompress_cold_data();
+  ASSERT_EQ(checked + num - 1, logger->get(l_bluestore_recompress_objects));
+  ASSERT_EQ(rewritten + num - 1,
+	    logger->get(l_bluestore_recompress_rewritten));
+  // a pass does not leave the onodes it loaded cached, where they would
+  // look hot to the next one
+  bstore->recompress_cold_data();
+  ASSERT_EQ(checked + 2 * (num - 1),
+	    logger->get(l_bluestore_recompress_objects));
+  ASSERT_EQ(rewritten + num - 1,
+	    logger->get(l_bluestore_recompress_rewritten));
+
+  // until it cools down
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+  bstore->recompress_cold_data();
+  ASSERT_EQ(rewritten + num, logger->get(l_bluestore_recompress_rewritten));
+
+  for (unsigned i = 0; i < num; ++i) {
+    bufferlist expected = data(i);
+    bufferlist bl;
+    r = store->read(ch, oid(i), 0, expected.length(), bl);
+    ASSERT_EQ(r, (int)expected.length());
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+  struct store_statfs_t after;
+  ASSERT_EQ(0, store->statfs(&after));
+  ASSERT_EQ(before.data_stored, after.data_stored);
+  ASSERT_EQ(before.data_compressed_original,
+	    after.data_compressed_original);
+  ASSERT_GT(after.data_compressed, 0u);
+
+  {
+    ObjectStore::Transaction t;
+    for (unsigned i = 0; i < num; ++i) {
+      t.remove(cid, oid(i));
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, CompressionPerfCountersTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  StartDeferred(4096);
+  SetVal(g_conf(), "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  g_conf().apply_changes(nullptr);
+
+  // values of a compression logger, empty if it does not exist
+  auto counters = [](const string& logger) {
+    map<string,uint64_t> m;
+    JSONFormatter f;
+    g_ceph_context->get_perfcounters_collection()->dump_formatted(&f, false,
+								   logger);
+    stringstream ss;
+    f.flush(ss);
+    JSONParser parser;
+    if (!parser.parse(ss.str().c_str(), ss.str().length())) {
+      return m;
+    }
+    JSONObj *o = parser.find_obj(logger);
+    if (!o) {
+      return m;
+    }
+    for (auto name : { "compress_bytes_in", "compress_bytes_out",
+		       "compress_success_count", "decompress_bytes_out" }) {
+      JSONObj *v = o->find_obj(name);
+      if (v) {
+	m[name] = std::stoull(v->get_data());
+      }
+    }
+    return m;
+  };
+
+  int r;
+  int64_t poolid = 11;
+  string pool_logger = "bluestore-compression-pool-" + stringify(poolid);
+  coll_t cid(spg_t(pg_t(0, poolid), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto before = counters("bluestore-compression-snappy");
+
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP), "", 0,
+			    poolid, ""));
+  bufferlist data;
+  data.append(string(128 * 1024, 'a'));
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, data.length(), data);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // read from disk rather than the cache
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+  {
+    bufferlist bl;
+    r = store->read(ch, hoid, 0, data.length(), bl);
+    ASSERT_EQ(r, (int)data.length());
+    ASSERT_TRUE(bl_eq(data, bl));
+  }
+
+  auto pool = counters(pool_logger);
+  ASSERT_EQ(data.length(), pool["compress_bytes_in"]);
+  ASSERT_GT(pool["compress_bytes_out"], 0u);
+  ASSERT_LT(pool["compress_bytes_out"], data.length());
+  ASSERT_GT(pool["compress_success_count"], 0u);
+  ASSERT_GE(pool["decompress_bytes_out"], data.length());
+  auto alg = counters("bluestore-compression-snappy");
+  ASSERT_EQ(before["compress_bytes_in"] + data.length(),
+	    alg["compress_bytes_in"]);
+
+  // the pool's counters go with its last collection
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_TRUE(counters(pool_logger).empty());
+}
+
+TEST_P(StoreTestSpecificAUSize, CompressedReadaheadTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  StartDeferred(4096);
+  SetVal(g_conf(), "bluestore_compression_algorithm", "zlib");
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  SetVal(g_conf(), "bluestore_compression_max_blob_size", "65536");
+  SetVal(g_conf(), "bluestore_compression_readahead_blobs", "4");
+  SetVal(g_conf(), "bluestore_compression_readahead_trigger", "2");
+  g_conf().apply_changes(nullptr);
+
+  int r;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  bufferlist data;
+  while (data.length() < 1024 * 1024) {
+    data.append(stringify(data.length()) + " is compressible. ");
+  }
+  data.splice(1024 * 1024, data.length() - 1024 * 1024);
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, data.length(), data);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // read from disk rather than the cache
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t ops = logger->get(l_bluestore_readahead_ops);
+  uint64_t hits = logger->get(l_bluestore_readahead_hit_bytes);
+  uint64_t bytes = logger->get(l_bluestore_readahead_bytes);
+  const unsigned len = 16 * 1024;
+  for (unsigned off = 0; off < data.length(); off += len) {
+    bufferlist bl, expected;
+    r = store->read(ch, hoid, off, len, bl);
+    ASSERT_EQ(r, (int)len);
+    expected.substr_of(data, off, len);
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+  EXPECT_GT(logger->get(l_bluestore_readahead_ops), ops);
+  EXPECT_GT(logger->get(l_bluestore_readahead_hit_bytes), hits);
+  // it is done in the background
+  for (unsigned i = 0; i < 100 &&
+	 logger->get(l_bluestore_readahead_bytes) == bytes; ++i) {
+    usleep(10000);
+  }
+  EXPECT_GT(logger->get(l_bluestore_readahead_bytes), bytes);
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, WriteCompressedTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  StartDeferred(4096);
+  SetVal(g_conf(), "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  SetVal(g_conf(), "bluestore_compression_max_blob_size", "65536");
+  g_conf().apply_changes(nullptr);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  int r;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("Object 2", CEPH_NOSNAP)));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // unaligned at both ends, so that the head and tail stay raw
+  uint64_t offset = 1000;
+  bufferlist data;
+  while (data.length() < 200000) {
+    data.append("line " + stringify(data.length() % 1000) + "\n");
+  }
+  compressed_write_t cw;
+  int num = store->compress_write(ch, hoid, offset, data, &cw);
+  ASSERT_GT(num, 0);
+  ASSERT_TRUE(cw.is_valid());
+  ASSERT_EQ(data.length(), cw.get_length());
+  ASSERT_LT(cw.data.length(), data.length());
+  {
+    bufferlist bl;
+    ASSERT_EQ(0, cw.decompress(g_ceph_context, &bl));
+    ASSERT_TRUE(bl_eq(data, bl));
+  }
+
+  uint64_t kept = logger->get(l_bluestore_compress_precompressed_count);
+  uint64_t rejected =
+    logger->get(l_bluestore_compress_precompressed_rejected_count);
+  {
+    ObjectStore::Transaction t;
+    t.write_compressed(cid, hoid, offset, data.length(), cw);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(kept + num,
+	    logger->get(l_bluestore_compress_precompressed_count));
+  ASSERT_EQ(rejected,
+	    logger->get(l_bluestore_compress_precompressed_rejected_count));
+
+  // a store that doesn't compress writes it raw
+  SetVal(g_conf(), "bluestore_compression_mode", "none");
+  g_conf().apply_changes(nullptr);
+  {
+    ObjectStore::Transaction t;
+    t.write_compressed(cid, hoid2, offset, data.length(), cw);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_LT(rejected,
+	    logger->get(l_bluestore_compress_precompressed_rejected_count));
+
+  // data which does not decompress fails the transaction, like any
+  // other write the store can't apply
+  ghobject_t hoid3(hobject_t(sobject_t("Object 3", CEPH_NOSNAP)));
+  for (auto& s : cw.segments) {
+    if (s.alg != Compressor::COMP_ALG_NONE) {
+      s.alg = Compressor::COMP_ALG_ZLIB;
+    }
+  }
+  {
+    ObjectStore::Transaction t;
+    t.write_compressed(cid, hoid3, offset, data.length(), cw);
+    PrCtl unset_dumpable;
+    EXPECT_DEATH(queue_transaction(store, ch, std::move(t)), "");
+  }
+  {
+    struct stat st;
+    ASSERT_EQ(-ENOENT, store->stat(ch, hoid3, &st));
+  }
+  ASSERT_EQ(-EOPNOTSUPP, store->compress_write(ch, hoid, offset, data, &cw));
+
+  for (auto& o : {hoid, hoid2}) {
+    struct stat st;
+    r = store->stat(ch, o, &st);
+    ASSERT_EQ(r, 0);
+    ASSERT_EQ(offset + data.length(), (uint64_t)st.st_size);
+    bufferlist bl;
+    r = store->read(ch, o, offset, data.length(), bl);
+    ASSERT_EQ(r, (int)data.length());
+    ASSERT_TRUE(bl_eq(data, bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, CompressAdaptiveSkipTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  StartDeferred(4096);
+  SetVal(g_conf(), "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf(), "bluestore_compression_mode", "adaptive");
+  SetVal(g_conf(), "bluestore_compression_max_blob_size", "65536");
+  SetVal(g_conf(), "bluestore_compression_adaptive_max_rejects", "4");
+  g_conf().apply_changes(nullptr);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  int r;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // random bytes do not compress; once the object failed the ratio often
+  // enough, its blobs are no longer tried
+  uint64_t skipped = logger->get(l_bluestore_compress_skipped_count);
+  uint64_t rejected = logger->get(l_bluestore_compress_rejected_count);
+  const unsigned blobs = 12;
+  bufferlist data;
+  for (unsigned i = 0; i < blobs; ++i) {
+    bufferptr bp(65536);
+    for (unsigned j = 0; j < bp.length(); ++j) {
+      bp[j] = (char)rand();
+    }
+    bufferlist bl;
+    bl.append(bp);
+    data.append(bp);
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, i * bl.length(), bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  uint64_t now_skipped = logger->get(l_bluestore_compress_skipped_count);
+  uint64_t now_rejected = logger->get(l_bluestore_compress_rejected_count);
+  ASSERT_LT(skipped, now_skipped);
+  ASSERT_EQ(blobs, (now_skipped - skipped) + (now_rejected - rejected));
+  {
+    bufferlist bl;
+    r = store->read(ch, hoid, 0, data.length(), bl);
+    ASSERT_EQ(r, (int)data.length());
+    ASSERT_TRUE(bl_eq(data, bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, ReadCompressedTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  StartDeferred(4096);
+  SetVal(g_conf(), "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  SetVal(g_conf(), "bluestore_compression_max_blob_size", "65536");
+  g_conf().apply_changes(nullptr);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  int r;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("Object 2", CEPH_NOSNAP)));
+  ghobject_t hoid3(hobject_t(sobject_t("Object 3", CEPH_NOSNAP)));
+  uint64_t offset = 1000;
+  bufferlist data;
+  while (data.length() < 200000) {
+    data.append("line " + stringify(data.length() % 1000) + "\n");
+  }
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, hoid, offset, data.length(), data);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // the head before the first blob boundary comes back raw
+  uint64_t size = offset + data.length();
+  compressed_write_t cw;
+  int num = store->read_compressed(ch, hoid, 0, size, &cw);
+  ASSERT_GT(num, 0);
+  ASSERT_TRUE(cw.is_valid());
+  ASSERT_EQ(size, cw.get_length());
+  ASSERT_LT(cw.data.length(), data.length());
+  ASSERT_EQ(Compressor::COMP_ALG_NONE, cw.segments.front().alg);
+  bufferlist expected;
+  expected.append_zero(offset);
+  expected.append(data);
+  {
+    bufferlist bl;
+    ASSERT_EQ(0, cw.decompress(g_ceph_context, &bl));
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+
+  // another store keeps the blobs as they come
+  uint64_t kept = logger->get(l_bluestore_compress_precompressed_count);
+  {
+    ObjectStore::Transaction t;
+    t.write_compressed(cid, hoid2, 0, size, cw);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(kept + num,
+	    logger->get(l_bluestore_compress_precompressed_count));
+  {
+    bufferlist bl;
+    r = store->read(ch, hoid2, 0, size, bl);
+    ASSERT_EQ(r, (int)size);
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+
+  // nothing to hand on from raw objects, or from within a blob
+  SetVal(g_conf(), "bluestore_compression_mode", "none");
+  g_conf().apply_changes(nullptr);
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid3, offset, data.length(), data);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  compressed_write_t cw2;
+  ASSERT_EQ(0, store->read_compressed(ch, hoid3, 0, size, &cw2));
+  ASSERT_TRUE(cw2.segments.empty());
+  ASSERT_EQ(0, store->read_compressed(ch, hoid, 65536 + 4096, 4096, &cw2));
+  ASSERT_TRUE(cw2.segments.empty());
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove(cid, hoid3);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTestSpecificAUSize, fsckOnUnalignedDevice) {
   if (string(GetParam()) != "bluestore")
     return;
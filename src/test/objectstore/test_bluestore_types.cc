@@ -865,6 +865,39 @@ TEST(bluestore_blob_t, can_split_at)
   ASSERT_FALSE(a.can_split_at(0x2800));
 }
 
+TEST(bluestore_blob_t, compressed_chunks)
+{
+  bluestore_blob_t a;
+  a.allocated_test(bluestore_pextent_t(0x40000, 0x10000));
+  a.set_compressed(0x40000, 0x9000);
+  ASSERT_FALSE(a.has_compressed_chunks());
+  a.set_compressed_chunks(Compressor::COMP_ALG_SNAPPY, 0x10000,
+			  {0, 0x2000, 0x5000, 0x7000, 0x9000});
+  ASSERT_TRUE(a.has_compressed_chunks());
+  ASSERT_FALSE(a.can_split());
+  ASSERT_EQ(0u, a.get_compressed_chunk(0));
+  ASSERT_EQ(0u, a.get_compressed_chunk(0xffff));
+  ASSERT_EQ(3u, a.get_compressed_chunk(0x3ffff));
+  ASSERT_EQ(0x5000u, a.get_compressed_chunk_offset(2));
+  ASSERT_EQ(0x2000u, a.get_compressed_chunk_length(2));
+
+  size_t bound = 0;
+  a.bound_encode(bound, 2);
+  bufferlist bl;
+  {
+    auto app = bl.get_contiguous_appender(bound);
+    a.encode(app, 2);
+  }
+  auto p = bl.front().begin_deep();
+  bluestore_blob_t b;
+  b.decode(p, 2);
+  ASSERT_TRUE(b.has_compressed_chunks());
+  ASSERT_EQ(a.get_logical_length(), b.get_logical_length());
+  ASSERT_EQ(a.comp_type, b.comp_type);
+  ASSERT_EQ(a.comp_chunk_length, b.comp_chunk_length);
+  ASSERT_EQ(a.comp_chunk_offsets, b.comp_chunk_offsets);
+}
+
 TEST(bluestore_blob_t, prune_tail)
 {
   bluestore_blob_t a;
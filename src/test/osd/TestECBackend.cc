@@ -58,3 +58,57 @@ TEST(ECUtil, stripe_info_t)
             make_pair((uint64_t)0, 2*swidth));
 }
 
+
+TEST(ECUtil, HashInfo_compressed)
+{
+  ECUtil::HashInfo hinfo(3);
+  ASSERT_FALSE(hinfo.is_compressed());
+
+  {
+    // uncompressed objects keep the encoding older OSDs understand
+    bufferlist bl;
+    encode(hinfo, bl);
+    ASSERT_EQ(1, bl[0]);
+  }
+
+  hinfo.set_compressed();
+  hinfo.append_compressed(ECUtil::compressed_extent_t(0, 1000, 0, 100, 1));
+  hinfo.append_compressed(
+    ECUtil::compressed_extent_t(1000, 1000, 100, 1000, 0));
+  // a hole at 2000~1000
+  hinfo.append_compressed(
+    ECUtil::compressed_extent_t(3000, 1000, 1100, 300, 1));
+
+  vector<ECUtil::compressed_extent_t> found;
+  hinfo.map_compressed(500, 1000, &found);
+  ASSERT_EQ(2u, found.size());
+  ASSERT_EQ(0u, found[0].logical_offset);
+  ASSERT_EQ(1000u, found[1].logical_offset);
+
+  found.clear();
+  hinfo.map_compressed(2000, 1000, &found);
+  ASSERT_TRUE(found.empty());
+
+  found.clear();
+  hinfo.map_compressed(2500, 10000, &found);
+  ASSERT_EQ(1u, found.size());
+  ASSERT_EQ(1100u, found[0].offset);
+
+  bufferlist bl;
+  encode(hinfo, bl);
+  ECUtil::HashInfo decoded;
+  auto p = bl.cbegin();
+  decode(decoded, p);
+  ASSERT_TRUE(decoded.is_compressed());
+  ASSERT_EQ(3u, decoded.get_compressed_extents().size());
+  ASSERT_EQ(300u, decoded.get_compressed_extents().back().length);
+
+  hinfo.truncate_compressed(1500);
+  ASSERT_EQ(2u, hinfo.get_compressed_extents().size());
+  ASSERT_EQ(500u, hinfo.get_compressed_extents().back().logical_length);
+  ASSERT_EQ(1000u, hinfo.get_compressed_extents().back().length);
+
+  hinfo.clear();
+  ASSERT_FALSE(hinfo.is_compressed());
+  ASSERT_TRUE(hinfo.get_compressed_extents().empty());
+}
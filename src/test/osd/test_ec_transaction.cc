@@ -122,3 +122,73 @@ TEST(ectransaction, many_writes)
   ASSERT_EQ(0u, plan.to_read.size());
   ASSERT_EQ(1u, plan.will_write.size());
 }
+
+// "compresses" buffers of zeros to a tenth of their length
+class ZeroCompressor : public Compressor {
+public:
+  ZeroCompressor() : Compressor(COMP_ALG_SNAPPY, "snappy") {}
+  int compress(const bufferlist &in, bufferlist &out) override {
+    if (!in.is_zero()) {
+      return -EINVAL;
+    }
+    out.append_zero(in.length() / 10);
+    return 0;
+  }
+  int decompress(const bufferlist &in, bufferlist &out) override {
+    return -EOPNOTSUPP;
+  }
+  int decompress(bufferlist::const_iterator &p, size_t compressed_len,
+		 bufferlist &out) override {
+    return -EOPNOTSUPP;
+  }
+};
+
+TEST(ectransaction, compressed_appends)
+{
+  hobject_t h;
+  PGTransactionUPtr t(new PGTransaction);
+  bufferlist a, b;
+  a.append_zero(100000);
+  b.append(string(5000, 'x'));
+  t->create(h);
+  t->write(h, 0, a.length(), a, 0);
+  t->write(h, 100000, b.length(), b, 0);
+
+  ECTransaction::CompressionOpts copts;
+  copts.compressor = std::make_shared<ZeroCompressor>();
+  copts.extent_size = 65536;
+  copts.required_ratio = .875;
+
+  ECUtil::stripe_info_t sinfo(2, 8192);
+  ECUtil::HashInfoRef hinfo(new ECUtil::HashInfo(1));
+  auto plan = ECTransaction::get_write_plan(
+    sinfo,
+    std::move(t),
+    [&](const hobject_t &i) {
+      return hinfo;
+    },
+    &dpp,
+    &copts);
+  generic_derr << "will_write " << plan.will_write << dendl;
+
+  ASSERT_TRUE(hinfo->is_projected_compressed());
+  ASSERT_EQ(1u, plan.compressed.size());
+  auto &extents = plan.compressed[h].extents;
+  ASSERT_EQ(3u, extents.size());
+  // 65536 and 34464 zeros, then 5000 bytes kept as they are
+  ASSERT_EQ(0u, extents[0].logical_offset);
+  ASSERT_EQ(6553u, extents[0].length);
+  ASSERT_EQ(65536u, extents[1].logical_offset);
+  ASSERT_EQ(6553u, extents[1].offset);
+  ASSERT_EQ(3446u, extents[1].length);
+  ASSERT_EQ(100000u, extents[2].logical_offset);
+  ASSERT_EQ(16384u, extents[2].offset);
+  ASSERT_EQ(5000u, extents[2].length);
+  ASSERT_EQ(Compressor::COMP_ALG_NONE, extents[2].alg);
+
+  // both writes went to the stripes compressed, one after the other
+  ASSERT_EQ(0u, plan.to_read.size());
+  ASSERT_EQ(1u, plan.will_write.size());
+  ASSERT_EQ(24576u, plan.will_write[h].range_end());
+  ASSERT_EQ(24576u, hinfo->get_projected_total_logical_size(sinfo));
+}
@@ -3,6 +3,7 @@
 #include "gtest/gtest.h"
 
 #include "rgw/rgw_compression.h"
+#include "include/stringify.h"
 
 class ut_get_sink : public RGWGetObj_Filter {
   bufferlist sink;
@@ -12,16 +13,9 @@ public:
 
   int handle_data(bufferlist& bl, off_t bl_ofs, off_t bl_len) override
   {
-    auto bl_buffers = bl.buffers();
-    auto i = bl_buffers.begin();
-    while (bl_len > 0)
-    {
-      ceph_assert(i != bl_buffers.end());
-      off_t len = std::min<off_t>(bl_len, i->length());
-      sink.append(*i, 0, len);
-      bl_len -= len;
-      i++;
-    }
+    bufferlist part;
+    part.substr_of(bl, bl_ofs, bl_len);
+    sink.claim_append(part);
     return 0;
   }
   bufferlist& get_sink()
@@ -52,12 +46,22 @@ class ut_put_sink: public RGWPutObjDataProcessor
 {
   bufferlist sink;
 public:
+  // like a processor which writes what it gets in more than one go, and
+  // asks to be called again with no data for the rest
+  bool set_again = false;
+  unsigned again_calls = 0;
+
   ut_put_sink(){}
   virtual ~ut_put_sink(){}
   int handle_data(bufferlist& bl, off_t ofs, void **phandle, rgw_raw_obj *pobj, bool *again) override
   {
+    if (*again) {
+      ++again_calls;
+      *again = false;
+      return 0;
+    }
     sink.append(bl);
-    *again = false;
+    *again = set_again && bl.length() > 0;
     return 0;
   }
   int throttle_data(void *handle, const rgw_raw_obj& obj, uint64_t size, bool need_to_wait) override
@@ -199,3 +203,99 @@ TEST(Compress, BillionZeros)
 
   ASSERT_EQ(d_sink.get_sink().length() , size*1000);
 }
+
+TEST(Compress, Pipelined)
+{
+  CompressorRef plugin;
+  plugin = Compressor::create(g_ceph_context, Compressor::COMP_ALG_ZLIB);
+  ASSERT_NE(plugin.get(), nullptr);
+
+  // parts which differ, so that one passed on out of order would show
+  constexpr size_t size = 256 * 1024;
+  constexpr unsigned parts = 20;
+  std::vector<bufferlist> in(parts);
+  bufferlist orig;
+  for (unsigned i = 0; i < parts; ++i) {
+    while (in[i].length() < size) {
+      in[i].append(stringify(i) + " is a part of the object. ");
+    }
+    orig.append(in[i]);
+  }
+
+  auto upload = [&](ut_put_sink& c_sink, std::vector<compression_block>& blocks) {
+    RGWPutObj_Compress compressor(g_ceph_context, plugin, &c_sink);
+    // each part as put_data_and_throttle() hands it on: again, with the
+    // buffer the compressor emptied, for as long as the sink asks
+    auto put = [&](bufferlist& bl, off_t ofs) {
+      void* handle;
+      rgw_raw_obj obj;
+      bool again = false;
+      do {
+        int r = compressor.handle_data(bl, ofs, &handle, &obj, &again);
+        if (r < 0) {
+          return r;
+        }
+      } while (again);
+      return 0;
+    };
+    for (unsigned i = 0; i < parts; ++i) {
+      bufferlist bl = in[i];
+      ASSERT_EQ(0, put(bl, size*i));
+    }
+    bufferlist empty;
+    ASSERT_EQ(0, put(empty, size*parts));
+    ASSERT_TRUE(compressor.is_compressed());
+    blocks = move(compressor.get_compression_blocks());
+  };
+
+  ut_put_sink inline_sink, pipelined_sink, again_sink;
+  std::vector<compression_block> inline_blocks, pipelined_blocks, again_blocks;
+  upload(inline_sink, inline_blocks);
+  g_conf().set_val("rgw_compression_threads", "4");
+  g_conf().set_val("rgw_compression_max_inflight", "3");
+  upload(pipelined_sink, pipelined_blocks);
+  again_sink.set_again = true;
+  upload(again_sink, again_blocks);
+  ASSERT_LT(0u, again_sink.again_calls);
+
+  // the same object either way
+  ASSERT_TRUE(inline_sink.get_sink().contents_equal(pipelined_sink.get_sink()));
+  ASSERT_TRUE(inline_sink.get_sink().contents_equal(again_sink.get_sink()));
+  ASSERT_EQ(parts, pipelined_blocks.size());
+  ASSERT_EQ(parts, again_blocks.size());
+  for (unsigned i = 0; i < parts; ++i) {
+    EXPECT_EQ(inline_blocks[i].old_ofs, pipelined_blocks[i].old_ofs);
+    EXPECT_EQ(inline_blocks[i].new_ofs, pipelined_blocks[i].new_ofs);
+    EXPECT_EQ(inline_blocks[i].len, pipelined_blocks[i].len);
+    EXPECT_EQ(inline_blocks[i].old_ofs, again_blocks[i].old_ofs);
+    EXPECT_EQ(inline_blocks[i].new_ofs, again_blocks[i].new_ofs);
+    EXPECT_EQ(inline_blocks[i].len, again_blocks[i].len);
+  }
+
+  RGWCompressionInfo cs_info;
+  cs_info.compression_type = plugin->get_type_name();
+  cs_info.orig_size = size*parts;
+  cs_info.blocks = move(pipelined_blocks);
+
+  // the compressed object arrives in pieces which cut blocks, and the
+  // whole blocks of each are decompressed by the threads
+  bufferlist& compressed = pipelined_sink.get_sink();
+  for (auto range : {range_t(0, size*parts - 1), range_t(size/2, size*7 + 13)}) {
+    ut_get_sink d_sink;
+    RGWGetObj_Decompress decompress(g_ceph_context, &cs_info, true, &d_sink);
+    off_t f_begin = range.first;
+    off_t f_end = range.second;
+    decompress.fixup_range(f_begin, f_end);
+    for (off_t ofs = f_begin; ofs <= f_end; ofs += 300000) {
+      bufferlist piece;
+      piece.substr_of(compressed, ofs, std::min<off_t>(300000, f_end + 1 - ofs));
+      ASSERT_EQ(0, decompress.handle_data(piece, 0, piece.length()));
+    }
+    bufferlist empty, expected;
+    ASSERT_EQ(0, decompress.handle_data(empty, 0, 0));
+    expected.substr_of(orig, range.first, range.second + 1 - range.first);
+    ASSERT_TRUE(d_sink.get_sink().contents_equal(expected));
+  }
+  g_conf().set_val("rgw_compression_threads", "0");
+  g_conf().set_val("rgw_compression_max_inflight", "4");
+}